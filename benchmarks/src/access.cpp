@@ -0,0 +1,130 @@
+#include "benchmark/benchmark.h"
+
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <iostream>
+
+#include "tatami/tatami.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/describe_layered_sparse.hpp"
+
+#include "common.h"
+
+enum class Selection { FULL, BLOCK, INDEX };
+
+template<bool sparse_>
+void time_access(benchmark::State& state, const tatami::NumericMatrix& mat, const bool row, const Selection selection, const std::vector<int>& order, const double bytes_per_nonzero) {
+    const int otherdim = (row ? mat.ncol() : mat.nrow());
+
+    // Block covers the middle half, indices cover every third element.
+    const int block_start = otherdim / 4, block_length = otherdim / 2;
+    auto indices = std::make_shared<std::vector<int> >();
+    for (int i = 0; i < otherdim; i += 3) {
+        indices->push_back(i);
+    }
+    const std::size_t extracted = (selection == Selection::FULL ? otherdim : (selection == Selection::BLOCK ? block_length : indices->size()));
+
+    std::vector<double> vbuffer(extracted);
+    std::vector<int> ibuffer(extracted);
+    tatami::Options opt;
+
+    for (auto _ : state) {
+        auto ext = [&]() {
+            if (selection == Selection::FULL) {
+                return tatami::new_extractor<sparse_, false>(mat, row, false, opt);
+            } else if (selection == Selection::BLOCK) {
+                return tatami::new_extractor<sparse_, false>(mat, row, false, block_start, block_length, opt);
+            } else {
+                return tatami::new_extractor<sparse_, false>(mat, row, false, indices, opt);
+            }
+        }();
+
+        double total = 0;
+        for (auto i : order) {
+            if constexpr(sparse_) {
+                auto range = ext->fetch(i, vbuffer.data(), ibuffer.data());
+                total = std::accumulate(range.value, range.value + range.number, total);
+            } else {
+                auto ptr = ext->fetch(i, vbuffer.data());
+                total = std::accumulate(ptr, ptr + extracted, total);
+            }
+        }
+        benchmark::DoNotOptimize(total);
+    }
+
+    state.SetItemsProcessed(state.iterations() * order.size());
+    state.counters["bytes_per_nonzero"] = bytes_per_nonzero;
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    const auto config = parse_config(argc, argv);
+
+    const auto triplets = mock_triplets(config);
+    const std::size_t nnz = triplets.vals.size();
+    auto csr = create_csr(config, triplets);
+    auto csc = create_csc(config, triplets);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = config.chunk_size;
+    copt.outliers = (config.mock.outlier_rows > 0);
+    std::shared_ptr<const tatami_layered::LayeredSparseMatrix<double, int, std::uint16_t> > layered = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(*csr, copt);
+
+    std::cout << "Matrix: " << config.nrow << " x " << config.ncol << " with " << nnz << " non-zeros" << std::endl;
+    const double denom = std::max(nnz, static_cast<std::size_t>(1));
+
+    struct Candidate {
+        std::string name;
+        std::shared_ptr<const tatami::NumericMatrix> matrix;
+        double bytes_per_nonzero;
+    };
+    std::vector<Candidate> candidates {
+        { "layered", layered, tatami_layered::describe_layered_sparse(*layered).memory_usage() / denom },
+        { "csr", csr, compressed_sparse_bytes(nnz, config.nrow) / denom },
+        { "csc", csc, compressed_sparse_bytes(nnz, config.ncol) / denom }
+    };
+
+    // Sequential and random orders of access along each dimension.
+    std::mt19937_64 rng(config.mock.seed);
+    auto create_orders = [&](int extent) -> std::vector<std::vector<int> > {
+        std::vector<int> sequential(extent);
+        std::iota(sequential.begin(), sequential.end(), 0);
+        auto random = sequential;
+        std::shuffle(random.begin(), random.end(), rng);
+        return { std::move(sequential), std::move(random) };
+    };
+    const auto row_orders = create_orders(config.nrow);
+    const auto col_orders = create_orders(config.ncol);
+
+    const std::vector<std::pair<Selection, std::string> > selections { { Selection::FULL, "full" }, { Selection::BLOCK, "block" }, { Selection::INDEX, "indexed" } };
+    const char* order_names[] = { "sequential", "random" };
+
+    for (const auto& cand : candidates) {
+        for (bool row : { true, false }) {
+            const auto& orders = (row ? row_orders : col_orders);
+            for (bool sparse : { false, true }) {
+                for (const auto& sel : selections) {
+                    for (int o = 0; o < 2; ++o) {
+                        const std::string name = cand.name + "/" + (row ? "row" : "column") + "/" + (sparse ? "sparse" : "dense") + "/" + sel.second + "/" + order_names[o];
+                        const auto* mat = cand.matrix.get();
+                        const auto* order = &(orders[o]);
+                        const auto selection = sel.first;
+                        const double bpn = cand.bytes_per_nonzero;
+                        benchmark::RegisterBenchmark(name.c_str(), [=](benchmark::State& state) -> void {
+                            if (sparse) {
+                                time_access<true>(state, *mat, row, selection, *order, bpn);
+                            } else {
+                                time_access<false>(state, *mat, row, selection, *order, bpn);
+                            }
+                        })->Unit(benchmark::kMillisecond);
+                    }
+                }
+            }
+        }
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
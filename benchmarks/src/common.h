@@ -0,0 +1,199 @@
+#ifndef TATAMI_LAYERED_BENCHMARKS_COMMON_H
+#define TATAMI_LAYERED_BENCHMARKS_COMMON_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+
+#include "tatami/tatami.hpp"
+#include "tatami_layered/LayeredSparseMatrix.hpp"
+
+#include "mock_data.h"
+
+// Shape and contents of the simulated matrix, which can be changed on the command line, e.g., '--nrow=20000 --density=0.1'.
+struct BenchmarkConfig {
+    std::size_t nrow = 10000;
+    std::size_t ncol = 10000;
+    std::size_t chunk_size = 65536;
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    MockLayeredSparseParameters mock;
+};
+
+// Parses our own flags, which should be done after benchmark::Initialize() has removed its flags.
+inline BenchmarkConfig parse_config(int argc, char** argv) {
+    BenchmarkConfig config;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            throw std::runtime_error("unrecognized argument '" + arg + "'");
+        }
+
+        const auto name = arg.substr(2, eq - 2);
+        const auto value = arg.substr(eq + 1);
+        if (name == "nrow") {
+            config.nrow = std::stoull(value);
+        } else if (name == "ncol") {
+            config.ncol = std::stoull(value);
+        } else if (name == "chunk_size") {
+            config.chunk_size = std::stoull(value);
+        } else if (name == "max_threads") {
+            config.max_threads = std::stoi(value);
+        } else if (name == "density") {
+            config.mock.density = std::stod(value);
+        } else if (name == "weight8") {
+            config.mock.weight8 = std::stod(value);
+        } else if (name == "weight16") {
+            config.mock.weight16 = std::stod(value);
+        } else if (name == "weight32") {
+            config.mock.weight32 = std::stod(value);
+        } else if (name == "weight64") {
+            config.mock.weight64 = std::stod(value);
+        } else if (name == "weight_negative") {
+            config.mock.weight_negative = std::stod(value);
+        } else if (name == "weight_fractional") {
+            config.mock.weight_fractional = std::stod(value);
+        } else if (name == "outlier_rows") {
+            config.mock.outlier_rows = std::stod(value);
+        } else if (name == "outlier_rate") {
+            config.mock.outlier_rate = std::stod(value);
+        } else if (name == "seed") {
+            config.mock.seed = std::stoull(value);
+        } else {
+            throw std::runtime_error("unrecognized argument '" + arg + "'");
+        }
+    }
+    return config;
+}
+
+// Triplets in row-major order, as produced by mock_layered_sparse_data().
+struct MockTriplets {
+    std::vector<std::size_t> rows, cols;
+    std::vector<double> vals;
+};
+
+inline MockTriplets mock_triplets(const BenchmarkConfig& config) {
+    MockTriplets output;
+    mock_layered_sparse_data(config.nrow, config.ncol, config.mock, output.rows, output.cols, output.vals);
+    return output;
+}
+
+// Compressed sparse matrices can be created with double-precision or integer values, to exercise the different paths for each type in the first pass.
+template<typename Value_ = double>
+std::shared_ptr<tatami::Matrix<Value_, int> > create_csr(const BenchmarkConfig& config, const MockTriplets& triplets) {
+    std::vector<Value_> values(triplets.vals.begin(), triplets.vals.end());
+    std::vector<int> indices(triplets.cols.begin(), triplets.cols.end());
+    std::vector<std::size_t> pointers(config.nrow + 1);
+    for (auto r : triplets.rows) {
+        ++pointers[r + 1];
+    }
+    for (std::size_t r = 0; r < config.nrow; ++r) {
+        pointers[r + 1] += pointers[r];
+    }
+    return std::make_shared<tatami::CompressedSparseRowMatrix<Value_, int, std::vector<Value_>, std::vector<int>, std::vector<std::size_t> > >(
+        config.nrow, config.ncol, std::move(values), std::move(indices), std::move(pointers)
+    );
+}
+
+template<typename Value_ = double>
+std::shared_ptr<tatami::Matrix<Value_, int> > create_csc(const BenchmarkConfig& config, const MockTriplets& triplets) {
+    std::vector<std::size_t> pointers(config.ncol + 1);
+    for (auto c : triplets.cols) {
+        ++pointers[c + 1];
+    }
+    for (std::size_t c = 0; c < config.ncol; ++c) {
+        pointers[c + 1] += pointers[c];
+    }
+
+    // Triplets are row-major, so filling by column yields sorted row indices.
+    std::vector<Value_> values(triplets.vals.size());
+    std::vector<int> indices(triplets.vals.size());
+    auto cursors = pointers;
+    for (std::size_t i = 0, n = triplets.vals.size(); i < n; ++i) {
+        auto& cursor = cursors[triplets.cols[i]];
+        values[cursor] = triplets.vals[i];
+        indices[cursor] = triplets.rows[i];
+        ++cursor;
+    }
+
+    return std::make_shared<tatami::CompressedSparseColumnMatrix<Value_, int, std::vector<Value_>, std::vector<int>, std::vector<std::size_t> > >(
+        config.nrow, config.ncol, std::move(values), std::move(indices), std::move(pointers)
+    );
+}
+
+// Unused path in the temporary directory, for writing input files.
+inline std::string temp_file_path(const std::string& prefix) {
+    auto path = std::filesystem::temp_directory_path() / prefix;
+    std::random_device rd;
+    std::mt19937_64 rng(rd());
+    std::filesystem::path full;
+    do {
+        full = path;
+        full += std::to_string(rng());
+    } while (std::filesystem::exists(full));
+    return full.string();
+}
+
+// Bytes used by a compressed sparse matrix with 'Value_' values, integer indices and size_t pointers.
+template<typename Value_ = double>
+std::size_t compressed_sparse_bytes(std::size_t nnz, std::size_t primary) {
+    return nnz * (sizeof(Value_) + sizeof(int)) + (primary + 1) * sizeof(std::size_t);
+}
+
+// Thread counts to test, i.e., powers of 2 up to and including 'max_threads'.
+inline std::vector<std::int64_t> thread_counts(const BenchmarkConfig& config) {
+    std::vector<std::int64_t> output;
+    for (int t = 1; t < config.max_threads; t *= 2) {
+        output.push_back(t);
+    }
+    output.push_back(config.max_threads);
+    return output;
+}
+
+#if defined(__linux__)
+inline std::size_t read_status_bytes(const std::string& field) {
+    std::ifstream handle("/proc/self/status");
+    std::string line;
+    while (std::getline(handle, line)) {
+        if (line.rfind(field, 0) == 0) {
+            return std::stoull(line.substr(field.size())) * 1024; // reported in kB.
+        }
+    }
+    return 0;
+}
+#endif
+
+// Resets the peak resident set size of this process, and returns the current resident set size as a baseline.
+// The baseline includes the inputs and any other allocations held by main(), which should not be attributed to the benchmark.
+// This is only supported on Linux; elsewhere, zero is returned.
+inline std::size_t reset_peak_rss() {
+#if defined(__linux__)
+    {
+        std::ofstream handle("/proc/self/clear_refs");
+        handle << "5";
+    }
+    return read_status_bytes("VmRSS:");
+#else
+    return 0;
+#endif
+}
+
+// Increase in the peak resident set size since reset_peak_rss() returned 'baseline'.
+inline std::size_t peak_rss_increase_bytes(std::size_t baseline) {
+#if defined(__linux__)
+    const auto peak = read_status_bytes("VmHWM:");
+    return (peak > baseline ? peak - baseline : 0);
+#else
+    return 0;
+#endif
+}
+
+#endif
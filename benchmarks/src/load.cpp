@@ -0,0 +1,192 @@
+#include "benchmark/benchmark.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <numeric>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstdio>
+
+#include "zlib.h"
+
+#include "tatami/tatami.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/read_layered_sparse_from_matrix_market.hpp"
+
+#include "common.h"
+
+// Formats the triplets as a Matrix Market file, in row-major or column-major order.
+static std::string format_matrix_market(const BenchmarkConfig& config, const MockTriplets& triplets, bool by_row) {
+    const std::size_t nnz = triplets.vals.size();
+    std::vector<std::size_t> order(nnz);
+    std::iota(order.begin(), order.end(), 0);
+    if (!by_row) {
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t l, std::size_t r) -> bool { return triplets.cols[l] < triplets.cols[r]; });
+    }
+
+    // Integers are written exactly, while non-integers are written with enough digits to round-trip.
+    const bool integer = config.mock.integer();
+    std::string output = std::string("%%MatrixMarket matrix coordinate ") + (integer ? "integer" : "real") + " general\n";
+    output += std::to_string(config.nrow) + " " + std::to_string(config.ncol) + " " + std::to_string(nnz) + "\n";
+    char buffer[32];
+    for (auto i : order) {
+        const double val = triplets.vals[i];
+        if (integer) {
+            std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(val));
+        } else {
+            std::snprintf(buffer, sizeof(buffer), "%.17g", val);
+        }
+        output += std::to_string(triplets.rows[i] + 1) + " " + std::to_string(triplets.cols[i] + 1) + " " + buffer + "\n";
+    }
+    return output;
+}
+
+struct MatrixMarketFile {
+    std::string name;
+    std::string path;
+    bool gzipped;
+    std::size_t bytes; // on disk
+};
+
+static MatrixMarketFile write_matrix_market(const std::string& contents, const std::string& name, bool gzipped) {
+    MatrixMarketFile output;
+    output.name = name;
+    output.gzipped = gzipped;
+    output.path = temp_file_path("tatami-layered-bench-");
+    if (gzipped) {
+        output.path += ".mtx.gz";
+        gzFile handle = gzopen(output.path.c_str(), "wb6");
+        gzwrite(handle, contents.data(), contents.size());
+        gzclose(handle);
+    } else {
+        output.path += ".mtx";
+        std::ofstream handle(output.path, std::ios::binary);
+        handle.write(contents.data(), contents.size());
+    }
+    output.bytes = std::filesystem::file_size(output.path);
+    return output;
+}
+
+static void report(benchmark::State& state, std::size_t bytes, std::size_t nnz, std::size_t baseline_rss, const tatami_layered::Instrumentation& instr) {
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.SetItemsProcessed(state.iterations() * nnz); // i.e., non-zeros per second.
+    state.counters["peak_rss_MB"] = peak_rss_increase_bytes(baseline_rss) / 1048576.0; // excluding the inputs held by main().
+
+    // Per-phase timings, averaged across iterations.
+    const double iterations = state.iterations();
+    state.counters["scan_ms"] = instr.scan_seconds * 1000 / iterations;
+    state.counters["allocate_ms"] = instr.allocate_seconds * 1000 / iterations;
+    state.counters["fill_ms"] = instr.fill_seconds * 1000 / iterations;
+    state.counters["sort_ms"] = instr.sort_seconds * 1000 / iterations;
+    state.counters["consolidate_ms"] = instr.consolidate_seconds * 1000 / iterations;
+    state.counters["encode_ms"] = instr.encode_seconds * 1000 / iterations;
+    state.counters["transient_MB"] = instr.transient_bytes / 1048576.0;
+}
+
+// Registers benchmarks for conversion from matrices with 'Value_' values.
+// The inputs are held by the benchmarks, where the dense matrices are only created if they are requested.
+template<typename Value_>
+void register_convert(const std::string& type, const BenchmarkConfig& config, const MockTriplets& triplets, const std::vector<std::int64_t>& threads, const std::vector<std::int64_t>& chunk_sizes) {
+    typedef tatami::Matrix<Value_, int> InputMatrix;
+    std::shared_ptr<const InputMatrix> csr = create_csr<Value_>(config, triplets);
+    std::shared_ptr<const InputMatrix> csc = create_csc<Value_>(config, triplets);
+    auto dense_row = std::make_shared<std::shared_ptr<const InputMatrix> >();
+    auto dense_column = std::make_shared<std::shared_ptr<const InputMatrix> >();
+    auto get_dense = [=, &triplets](bool row) -> const InputMatrix& {
+        auto& store = (row ? *dense_row : *dense_column);
+        if (!store) {
+            std::vector<Value_> contents(config.nrow * config.ncol);
+            for (std::size_t i = 0, nnz = triplets.vals.size(); i < nnz; ++i) {
+                const auto pos = (row ? triplets.rows[i] * config.ncol + triplets.cols[i] : triplets.cols[i] * config.nrow + triplets.rows[i]);
+                contents[pos] = triplets.vals[i];
+            }
+            store.reset(new tatami::DenseMatrix<Value_, int, std::vector<Value_> >(config.nrow, config.ncol, std::move(contents), row));
+        }
+        return *store;
+    };
+
+    const std::size_t nnz = triplets.vals.size();
+    const std::size_t sparse_bytes = compressed_sparse_bytes<Value_>(nnz, config.nrow);
+    const std::size_t dense_bytes = config.nrow * config.ncol * sizeof(Value_);
+
+    const std::vector<std::string> inputs { "sparse_row", "sparse_column", "dense_row", "dense_column" };
+    for (const auto& input : inputs) {
+        benchmark::RegisterBenchmark(("convert/" + type + "/" + input).c_str(), [=](benchmark::State& state) -> void {
+            const bool sparse = (input.rfind("sparse", 0) == 0);
+            const bool row = (input.find("_row") != std::string::npos);
+            const auto& mat = (sparse ? (row ? *csr : *csc) : get_dense(row));
+
+            tatami_layered::ConvertToLayeredSparseOptions copt;
+            copt.num_threads = state.range(0);
+            copt.chunk_size = state.range(1);
+            copt.outliers = (config.mock.outlier_rows > 0);
+            tatami_layered::Instrumentation instr;
+            copt.instrumentation = &instr;
+            const auto baseline_rss = reset_peak_rss();
+            for (auto _ : state) {
+                auto out = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(mat, copt);
+                benchmark::DoNotOptimize(out);
+            }
+            report(state, (sparse ? sparse_bytes : dense_bytes), nnz, baseline_rss, instr);
+        })->ArgNames({ "threads", "chunk_size" })->ArgsProduct({ threads, chunk_sizes })->Unit(benchmark::kMillisecond)->UseRealTime();
+    }
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    const auto config = parse_config(argc, argv);
+
+    const auto triplets = mock_triplets(config);
+    const std::size_t nnz = triplets.vals.size();
+    std::cout << "Matrix: " << config.nrow << " x " << config.ncol << " with " << nnz << " non-zeros" << std::endl;
+
+    const auto threads = thread_counts(config);
+    const std::vector<std::int64_t> chunk_sizes { 256, 4096, 65536 };
+
+    // Conversion from double-precision and from unsigned integer inputs, as the first pass has a separate path for each.
+    // Both types yield the same layered matrix, so the integer inputs are only used if all mock values fit into them.
+    register_convert<double>("double", config, triplets, threads, chunk_sizes);
+    if (config.mock.unsigned32()) {
+        register_convert<std::uint32_t>("integer", config, triplets, threads, chunk_sizes);
+    }
+
+    // Matrix Market files in all combinations of sorting and compression.
+    std::vector<MatrixMarketFile> files;
+    for (bool by_row : { true, false }) {
+        const auto contents = format_matrix_market(config, triplets, by_row);
+        const std::string order = (by_row ? "row_sorted" : "column_sorted");
+        files.push_back(write_matrix_market(contents, "text/" + order, false));
+        files.push_back(write_matrix_market(contents, "gzip/" + order, true));
+    }
+
+    const std::vector<std::int64_t> buffer_sizes { 65536, 1048576 };
+    for (const auto& file : files) {
+        benchmark::RegisterBenchmark(("read_matrix_market/" + file.name).c_str(), [=](benchmark::State& state) -> void {
+            tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+            ropt.num_threads = state.range(0);
+            ropt.chunk_size = state.range(1);
+            ropt.buffer_size = state.range(2);
+            ropt.outliers = (config.mock.outlier_rows > 0);
+            tatami_layered::Instrumentation instr;
+            ropt.instrumentation = &instr;
+            const auto baseline_rss = reset_peak_rss();
+            for (auto _ : state) {
+                auto out = (file.gzipped ?
+                    tatami_layered::read_layered_sparse_from_matrix_market_gzip_file(file.path.c_str(), ropt) :
+                    tatami_layered::read_layered_sparse_from_matrix_market_text_file(file.path.c_str(), ropt));
+                benchmark::DoNotOptimize(out);
+            }
+            report(state, file.bytes, nnz, baseline_rss, instr);
+        })->ArgNames({ "threads", "chunk_size", "buffer_size" })->ArgsProduct({ threads, chunk_sizes, buffer_sizes })->Unit(benchmark::kMillisecond)->UseRealTime();
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    for (const auto& file : files) {
+        std::filesystem::remove(file.path);
+    }
+    return 0;
+}
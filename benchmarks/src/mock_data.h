@@ -0,0 +1,103 @@
+#ifndef TATAMI_LAYERED_BENCHMARKS_MOCK_DATA_H
+#define TATAMI_LAYERED_BENCHMARKS_MOCK_DATA_H
+
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+// Simulated non-zero values for large matrices, where the proportion of values in each layer can be configured.
+struct MockLayeredSparseParameters {
+    // Expected proportion of non-zero elements.
+    double density = 0.05;
+
+    // Relative frequencies of non-zero values that require 8, 16, 32 or 64 bits.
+    // 64-bit values are no greater than 2^53 so that they are exactly representable as doubles.
+    double weight8 = 0.9, weight16 = 0.09, weight32 = 0.01, weight64 = 0;
+
+    // Relative frequencies of negative integers, for the signed layers; and of non-integers, for the floating-point layers.
+    double weight_negative = 0, weight_fractional = 0;
+
+    // Proportion of rows that contain 8-bit values with a few outliers, for the escaped layer.
+    // In each such row, each value is replaced by a 16- or 32-bit value with probability 'outlier_rate'.
+    // All other rows draw their values according to the weights above.
+    double outlier_rows = 0, outlier_rate = 0.01;
+
+    std::uint64_t seed = 42;
+
+    // Whether all values are non-negative integers that fit into a 32-bit unsigned integer.
+    bool unsigned32() const {
+        return weight64 == 0 && weight_negative == 0 && weight_fractional == 0;
+    }
+
+    // Whether all values are integers.
+    bool integer() const {
+        return weight_fractional == 0;
+    }
+};
+
+inline void mock_layered_sparse_data(std::size_t NR, std::size_t NC, const MockLayeredSparseParameters& params, std::vector<std::size_t>& rows, std::vector<std::size_t>& cols, std::vector<double>& vals) {
+    std::mt19937_64 rng(params.seed);
+    std::discrete_distribution<int> tier({ params.weight8, params.weight16, params.weight32, params.weight64, params.weight_negative, params.weight_fractional });
+    std::uniform_int_distribution<std::uint32_t> draw8(1, 255), draw16(256, 65535), draw32(65536, 100000000);
+    std::uniform_int_distribution<std::uint64_t> draw64(4294967296ull, 9007199254740992ull);
+    std::uniform_int_distribution<std::int32_t> draw_negative(-32768, -1);
+    std::uniform_real_distribution<double> draw_fractional(0, 1000);
+    std::bernoulli_distribution outlier_row(std::min(std::max(params.outlier_rows, 0.0), 1.0)), outlier(std::min(std::max(params.outlier_rate, 0.0), 1.0));
+
+    // Skipping over the zeros with a geometric distribution, so that the cost is proportional to the number of non-zeros.
+    std::geometric_distribution<std::size_t> skip(std::min(std::max(params.density, 1e-8), 1.0));
+
+    for (std::size_t r = 0; r < NR; ++r) {
+        const bool has_outliers = (params.outlier_rows > 0 && outlier_row(rng)); // no extra draws by default, so that the default data are unchanged.
+        std::size_t c = skip(rng);
+        while (c < NC) {
+            rows.push_back(r);
+            cols.push_back(c);
+
+            if (has_outliers) {
+                if (!outlier(rng)) {
+                    vals.push_back(draw8(rng));
+                } else if (rng() % 2) {
+                    vals.push_back(draw16(rng));
+                } else {
+                    vals.push_back(draw32(rng));
+                }
+
+            } else {
+                switch (tier(rng)) {
+                    case 0:
+                        vals.push_back(draw8(rng));
+                        break;
+                    case 1:
+                        vals.push_back(draw16(rng));
+                        break;
+                    case 2:
+                        vals.push_back(draw32(rng));
+                        break;
+                    case 3:
+                        vals.push_back(draw64(rng));
+                        break;
+                    case 4:
+                        vals.push_back(draw_negative(rng));
+                        break;
+                    default:
+                        {
+                            // Avoiding zeros, which would be dropped from the sparse matrices.
+                            double x = 0;
+                            do {
+                                x = draw_fractional(rng);
+                            } while (x == 0);
+                            vals.push_back(x);
+                        }
+                        break;
+                }
+            }
+
+            c += skip(rng) + 1;
+        }
+    }
+}
+
+#endif
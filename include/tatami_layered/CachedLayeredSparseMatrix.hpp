@@ -0,0 +1,324 @@
+#ifndef TATAMI_LAYERED_CACHED_LAYERED_SPARSE_MATRIX_HPP
+#define TATAMI_LAYERED_CACHED_LAYERED_SPARSE_MATRIX_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <stdexcept>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file CachedLayeredSparseMatrix.hpp
+ * @brief Layered sparse matrix with chunks that are created on demand.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Layered sparse matrix with chunks that are created on demand.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices within each chunk.
+ * @tparam Loader_ Function object that creates a chunk from its index.
+ *
+ * This is the base class for layered sparse matrices where the chunks are not all held in memory, e.g., `OutOfCoreLayeredSparseMatrix`.
+ * Each chunk is created when it is first needed and stored in a least-recently-used cache that is shared by all extractors and is safe to use from multiple threads.
+ * If multiple threads request the same chunk while it is being created, they wait for the same result rather than creating it again.
+ * As chunks contain contiguous columns, workflows that iterate over columns (or blocks of columns) only need to hold a few chunks in memory at any time.
+ * Extraction of a full row requires all chunks, so row access is only efficient if the cache is large enough to hold the entire matrix;
+ * `prefer_rows()` will return false otherwise.
+ *
+ * Each extractor holds a reference to the chunk that it is currently using, which remains in memory even if it is evicted from the cache.
+ * Thus, the actual memory usage may exceed the cache size by up to one chunk per extractor.
+ *
+ * If an oracle is supplied for column extraction, each extractor looks ahead in the predictions for the next chunk and loads it in a background thread,
+ * so that the cost of loading each chunk is overlapped with the extraction of columns from the current chunk.
+ * This holds at most one additional chunk per extractor.
+ * Each such extractor starts its own thread on its first prefetch, which is reused for all of its later prefetches and joined when the extractor is destroyed.
+ * Applications that create many oracular column extractors at once (e.g., one per task in a thread pool) should account for the extra threads,
+ * and destroying an extractor will wait for any load that is already in progress.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, class Loader_>
+class CachedLayeredSparseMatrix : public tatami::Matrix<Value_, Index_> {
+protected:
+    /**
+     * @cond
+     */
+    CachedLayeredSparseMatrix(const Index_ nrow, const Index_ ncol, const Index_ chunk_size, std::shared_ptr<ChunkCache<Index_, ColumnIndex_, Loader_> > cache) :
+        my_nrow(nrow),
+        my_ncol(ncol),
+        my_chunk_size(chunk_size),
+        my_cache(std::move(cache))
+    {
+        if (my_chunk_size <= 0) {
+            throw std::runtime_error("chunk size should be positive");
+        }
+        my_num_chunks = sanisizer::max(1, my_ncol / my_chunk_size + (my_ncol % my_chunk_size != 0));
+        my_fits_in_cache = my_cache->fits();
+    }
+    /**
+     * @endcond
+     */
+
+private:
+    Index_ my_nrow, my_ncol, my_chunk_size, my_num_chunks;
+    bool my_fits_in_cache;
+    std::shared_ptr<ChunkCache<Index_, ColumnIndex_, Loader_> > my_cache;
+
+    typedef CachedChunks<Index_, ColumnIndex_, ChunkCache<Index_, ColumnIndex_, Loader_> > Source;
+
+public:
+    Index_ nrow() const {
+        return my_nrow;
+    }
+
+    Index_ ncol() const {
+        return my_ncol;
+    }
+
+    bool is_sparse() const {
+        return true;
+    }
+
+    double is_sparse_proportion() const {
+        return 1;
+    }
+
+    bool prefer_rows() const {
+        return my_fits_in_cache;
+    }
+
+    double prefer_rows_proportion() const {
+        return my_fits_in_cache;
+    }
+
+    bool uses_oracle(const bool row) const {
+        return !row; // for loading the next chunk in the background.
+    }
+
+public:
+    /**
+     * @return Number of columns in each chunk, except for the last chunk which may be smaller.
+     */
+    Index_ get_chunk_size() const {
+        return my_chunk_size;
+    }
+
+    /**
+     * @return Number of chunks.
+     */
+    Index_ num_chunks() const {
+        return my_num_chunks;
+    }
+
+    /**
+     * @param c Index of the chunk.
+     * @return Number of columns in chunk `c`.
+     */
+    Index_ chunk_extent(const Index_ c) const {
+        const Index_ start = c * my_chunk_size;
+        return std::min(my_chunk_size, static_cast<Index_>(my_ncol - start));
+    }
+
+    /**
+     * @return Total size of the layer arrays of the chunks in the cache, in bytes.
+     */
+    std::size_t cached_bytes() const {
+        return my_cache->cached_bytes();
+    }
+
+protected:
+    /**
+     * @cond
+     */
+    const Loader_& loader() const {
+        return my_cache->loader();
+    }
+    /**
+     * @endcond
+     */
+
+    /*****************************
+     *** Extractor construction ***
+     *****************************/
+private:
+    template<bool oracle_>
+    std::unique_ptr<tatami::DenseExtractor<oracle_, Value_, Index_> > dense_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        const Index_ block_start,
+        const Index_ block_length)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimaryDense<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), Source(my_cache.get()), my_chunk_size, block_start, block_length
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondaryDense<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), Source(my_cache.get()), my_chunk_size, LayeredSparseMatrix_internal::consecutive_rows(block_start, block_length)
+            );
+        }
+    }
+
+    template<bool oracle_>
+    std::unique_ptr<tatami::DenseExtractor<oracle_, Value_, Index_> > dense_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        tatami::VectorPtr<Index_> indices_ptr)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimaryDense<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), Source(my_cache.get()), my_chunk_size, std::move(indices_ptr)
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondaryDense<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), Source(my_cache.get()), my_chunk_size, *indices_ptr
+            );
+        }
+    }
+
+    template<bool oracle_>
+    std::unique_ptr<tatami::SparseExtractor<oracle_, Value_, Index_> > sparse_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        const Index_ block_start,
+        const Index_ block_length,
+        const tatami::Options& opt)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimarySparse<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), opt, Source(my_cache.get()), my_chunk_size, block_start, block_length
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondarySparse<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), opt, Source(my_cache.get()), my_chunk_size, LayeredSparseMatrix_internal::consecutive_rows(block_start, block_length)
+            );
+        }
+    }
+
+    template<bool oracle_>
+    std::unique_ptr<tatami::SparseExtractor<oracle_, Value_, Index_> > sparse_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        tatami::VectorPtr<Index_> indices_ptr,
+        const tatami::Options& opt)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimarySparse<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), opt, Source(my_cache.get()), my_chunk_size, std::move(indices_ptr)
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondarySparse<oracle_, Value_, Index_, ColumnIndex_, Source> >(
+                nullptr, std::move(oracle), opt, Source(my_cache.get()), my_chunk_size, *indices_ptr
+            );
+        }
+    }
+
+    Index_ full_extent(const bool row) const {
+        return (row ? my_ncol : my_nrow);
+    }
+
+    /********************
+     *** Myopic dense ***
+     ********************/
+public:
+    std::unique_ptr<tatami::MyopicDenseExtractor<Value_, Index_> > dense(const bool row, const tatami::Options&) const {
+        return dense_internal<false>(row, false, static_cast<Index_>(0), full_extent(row));
+    }
+
+    std::unique_ptr<tatami::MyopicDenseExtractor<Value_, Index_> > dense(const bool row, const Index_ block_start, const Index_ block_length, const tatami::Options&) const {
+        return dense_internal<false>(row, false, block_start, block_length);
+    }
+
+    std::unique_ptr<tatami::MyopicDenseExtractor<Value_, Index_> > dense(const bool row, tatami::VectorPtr<Index_> indices_ptr, const tatami::Options&) const {
+        return dense_internal<false>(row, false, std::move(indices_ptr));
+    }
+
+    /*********************
+     *** Myopic sparse ***
+     *********************/
+public:
+    std::unique_ptr<tatami::MyopicSparseExtractor<Value_, Index_> > sparse(const bool row, const tatami::Options& opt) const {
+        return sparse_internal<false>(row, false, static_cast<Index_>(0), full_extent(row), opt);
+    }
+
+    std::unique_ptr<tatami::MyopicSparseExtractor<Value_, Index_> > sparse(const bool row, const Index_ block_start, const Index_ block_length, const tatami::Options& opt) const {
+        return sparse_internal<false>(row, false, block_start, block_length, opt);
+    }
+
+    std::unique_ptr<tatami::MyopicSparseExtractor<Value_, Index_> > sparse(const bool row, tatami::VectorPtr<Index_> indices_ptr, const tatami::Options& opt) const {
+        return sparse_internal<false>(row, false, std::move(indices_ptr), opt);
+    }
+
+    /**********************
+     *** Oracular dense ***
+     **********************/
+public:
+    std::unique_ptr<tatami::OracularDenseExtractor<Value_, Index_> > dense(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const tatami::Options&)
+    const {
+        return dense_internal<true>(row, std::move(oracle), static_cast<Index_>(0), full_extent(row));
+    }
+
+    std::unique_ptr<tatami::OracularDenseExtractor<Value_, Index_> > dense(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const Index_ block_start,
+        const Index_ block_length,
+        const tatami::Options&)
+    const {
+        return dense_internal<true>(row, std::move(oracle), block_start, block_length);
+    }
+
+    std::unique_ptr<tatami::OracularDenseExtractor<Value_, Index_> > dense(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        tatami::VectorPtr<Index_> indices_ptr,
+        const tatami::Options&)
+    const {
+        return dense_internal<true>(row, std::move(oracle), std::move(indices_ptr));
+    }
+
+    /***********************
+     *** Oracular sparse ***
+     ***********************/
+public:
+    std::unique_ptr<tatami::OracularSparseExtractor<Value_, Index_> > sparse(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const tatami::Options& opt)
+    const {
+        return sparse_internal<true>(row, std::move(oracle), static_cast<Index_>(0), full_extent(row), opt);
+    }
+
+    std::unique_ptr<tatami::OracularSparseExtractor<Value_, Index_> > sparse(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const Index_ block_start,
+        const Index_ block_length,
+        const tatami::Options& opt)
+    const {
+        return sparse_internal<true>(row, std::move(oracle), block_start, block_length, opt);
+    }
+
+    std::unique_ptr<tatami::OracularSparseExtractor<Value_, Index_> > sparse(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        tatami::VectorPtr<Index_> indices_ptr,
+        const tatami::Options& opt)
+    const {
+        return sparse_internal<true>(row, std::move(oracle), std::move(indices_ptr), opt);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef TATAMI_LAYERED_COMPRESSED_LAYERED_SPARSE_MATRIX_HPP
+#define TATAMI_LAYERED_COMPRESSED_LAYERED_SPARSE_MATRIX_HPP
+
+#if __has_include("zlib.h")
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+#include "zlib.h"
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+#include "CachedLayeredSparseMatrix.hpp"
+
+/**
+ * @file CompressedLayeredSparseMatrix.hpp
+ * @brief Layered sparse matrix with Zlib-compressed chunks.
+ *
+ * This file is only available if Zlib is available, i.e., `zlib.h` can be found by the compiler.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @cond
+ */
+namespace CompressedLayeredSparseMatrix_internal {
+
+struct CompressedChunk {
+    std::vector<unsigned char> data;
+    std::array<std::size_t, num_categories> num_rows{};
+    LayerOffsets offsets;
+    std::shared_ptr<const std::vector<RowCode> > codes;
+};
+
+template<typename Index_, typename ColumnIndex_>
+class ZlibLoader {
+public:
+    ZlibLoader(std::vector<CompressedChunk> chunks) : my_chunks(std::make_shared<const std::vector<CompressedChunk> >(std::move(chunks))) {}
+
+public:
+    std::vector<std::size_t> chunk_bytes() const {
+        std::vector<std::size_t> output;
+        output.reserve(my_chunks->size());
+        for (const auto& chunk : *my_chunks) {
+            output.push_back(chunk.offsets.total);
+        }
+        return output;
+    }
+
+    std::size_t compressed_bytes() const {
+        std::size_t output = 0;
+        for (const auto& chunk : *my_chunks) {
+            output += chunk.data.size();
+        }
+        return output;
+    }
+
+    LayeredChunk<Index_, ColumnIndex_> operator()(const std::size_t c) const {
+        const auto& current = (*my_chunks)[c];
+        auto arena = std::make_shared<const LayerArena>(current.offsets.total, false);
+
+        uLongf decompressed = current.offsets.total;
+        const auto status = uncompress(arena->data(), &decompressed, current.data.data(), current.data.size());
+        if (status != Z_OK || decompressed != current.offsets.total) {
+            throw std::runtime_error("failed to decompress a chunk of a layered matrix");
+        }
+
+        LayeredChunk<Index_, ColumnIndex_> output;
+        for_each_layer(output, [&](const Category cat, auto& layer) -> void {
+            layer.num_rows = current.num_rows[static_cast<std::size_t>(cat)];
+        });
+        attach_layers(output, current.offsets, arena->data());
+        output.codes = current.codes;
+        output.storage = std::move(arena);
+        return output;
+    }
+
+private:
+    std::shared_ptr<const std::vector<CompressedChunk> > my_chunks;
+};
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @brief Layered sparse matrix with Zlib-compressed chunks.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices within each chunk.
+ *
+ * The layer arrays of each chunk are stored in memory as a single Zlib-compressed buffer.
+ * Each chunk is decompressed when it is first needed and stored in the cache described in `CachedLayeredSparseMatrix`,
+ * so access patterns that stay within a chunk (e.g., iterating over consecutive columns or extracting a block of columns from each row) only decompress each chunk once.
+ * This trades some CPU time for lower memory usage, which is useful for data that is rarely accessed.
+ *
+ * Users should not need to construct this class directly, as it is created by `compress_layered_sparse()`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_ = std::uint16_t>
+class CompressedLayeredSparseMatrix final : public CachedLayeredSparseMatrix<Value_, Index_, ColumnIndex_, CompressedLayeredSparseMatrix_internal::ZlibLoader<Index_, ColumnIndex_> > {
+private:
+    typedef CompressedLayeredSparseMatrix_internal::ZlibLoader<Index_, ColumnIndex_> Loader;
+    typedef CachedLayeredSparseMatrix<Value_, Index_, ColumnIndex_, Loader> Base;
+
+public:
+    /**
+     * @cond
+     */
+    CompressedLayeredSparseMatrix(const Index_ nrow, const Index_ ncol, const Index_ chunk_size, const Loader& loader, const std::size_t cache_size) :
+        Base(nrow, ncol, chunk_size, std::make_shared<ChunkCache<Index_, ColumnIndex_, Loader> >(loader, loader.chunk_bytes(), cache_size))
+    {}
+    /**
+     * @endcond
+     */
+
+    /**
+     * @return Total size of the compressed chunks, in bytes.
+     */
+    std::size_t compressed_bytes() const {
+        return this->loader().compressed_bytes();
+    }
+};
+
+/**
+ * @brief Options for `compress_layered_sparse()`.
+ */
+struct CompressLayeredSparseOptions {
+    /**
+     * Zlib compression level, from 0 (no compression) to 9 (maximum compression).
+     * The default of -1 uses Zlib's default level.
+     */
+    int compression_level = -1;
+
+    /**
+     * Maximum size of the cache of decompressed chunks, in bytes.
+     * At least one chunk is always cached, regardless of this value.
+     */
+    std::size_t cache_size = 104857600;
+
+    /**
+     * Number of threads to use for compression.
+     */
+    int num_threads = 1;
+};
+
+/**
+ * Compress the chunks of a layered sparse matrix.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * This should not have a fused transformation.
+ * @param options Further options.
+ *
+ * @return Pointer to a `CompressedLayeredSparseMatrix` with the same contents as `mat`.
+ * The row codes are shared with `mat`, but the layer arrays are not, so `mat` can be safely destroyed.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_>
+std::shared_ptr<CompressedLayeredSparseMatrix<Value_, Index_, ColumnIndex_> > compress_layered_sparse(
+    const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat,
+    const CompressLayeredSparseOptions& options)
+{
+    if (mat.get_fused_transform()) {
+        throw std::runtime_error("cannot compress a layered matrix with a fused transformation");
+    }
+
+    const auto& chunks = mat.get_chunks();
+    const Index_ nchunks = chunks.size();
+    auto compressed = sanisizer::create<std::vector<CompressedLayeredSparseMatrix_internal::CompressedChunk> >(nchunks);
+
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        std::vector<unsigned char> buffer;
+        for (Index_ c = start, end = start + length; c < end; ++c) {
+            const auto& chunk = chunks[c];
+            auto& current = compressed[c];
+            current.num_rows = layer_num_rows(chunk);
+            current.codes = chunk.codes;
+            current.offsets = define_layer_offsets<ColumnIndex_>(chunk);
+
+            // Copying into a zeroed buffer so that the padding is deterministic.
+            buffer.clear();
+            buffer.resize(current.offsets.total);
+            const auto& offsets = current.offsets;
+            for_each_layer(chunk, [&](const Category cat, const auto& layer) -> void {
+                const auto i = static_cast<std::size_t>(cat);
+                const auto nnz = layer.num_nonzero();
+                std::copy_n(layer.ptr, layer.num_rows + 1, reinterpret_cast<std::size_t*>(buffer.data() + offsets.ptr[i]));
+                std::copy_n(layer.index, nnz, reinterpret_cast<ColumnIndex_*>(buffer.data() + offsets.index[i]));
+                std::copy_n(layer.value, nnz, reinterpret_cast<I<decltype(*layer.value)>*>(buffer.data() + offsets.value[i]));
+            });
+            const auto& dict = chunk.stored8;
+            std::copy_n(dict.table_ptr, dict.num_rows + 1, reinterpret_cast<std::size_t*>(buffer.data() + offsets.table_ptr));
+            std::copy_n(dict.table, dict.num_entries(), reinterpret_cast<double*>(buffer.data() + offsets.table));
+            const auto& esc = chunk.storee8;
+            std::copy_n(esc.escape_ptr, esc.num_rows + 1, reinterpret_cast<std::size_t*>(buffer.data() + offsets.escape_ptr));
+            std::copy_n(esc.escape_index, esc.num_escapes(), reinterpret_cast<ColumnIndex_*>(buffer.data() + offsets.escape_index));
+            std::copy_n(esc.escape_value, esc.num_escapes(), reinterpret_cast<std::uint64_t*>(buffer.data() + offsets.escape_value));
+
+            uLongf destlen = compressBound(sanisizer::cast<uLong>(buffer.size()));
+            current.data.resize(destlen);
+            const auto status = compress2(current.data.data(), &destlen, buffer.data(), buffer.size(), options.compression_level);
+            if (status != Z_OK) {
+                throw std::runtime_error("failed to compress a chunk of a layered matrix");
+            }
+            current.data.resize(destlen);
+            current.data.shrink_to_fit();
+        }
+    }, nchunks, options.num_threads);
+
+    return std::make_shared<CompressedLayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(
+        mat.nrow(),
+        mat.ncol(),
+        mat.get_chunk_size(),
+        CompressedLayeredSparseMatrix_internal::ZlibLoader<Index_, ColumnIndex_>(std::move(compressed)),
+        options.cache_size
+    );
+}
+
+}
+
+#endif
+
+#endif
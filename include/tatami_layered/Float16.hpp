@@ -0,0 +1,125 @@
+#ifndef TATAMI_LAYERED_FLOAT16_HPP
+#define TATAMI_LAYERED_FLOAT16_HPP
+
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @file Float16.hpp
+ * @brief Half-precision floating-point values.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @cond
+ */
+namespace Float16_internal {
+
+inline std::uint16_t from_float(const float x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    const std::uint32_t sign = (bits >> 16) & 0x8000u;
+    bits &= 0x7fffffffu;
+
+    if (bits >= 0x7f800000u) { // infinity or NaN, where the latter is always converted to a quiet NaN.
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (bits > 0x7f800000u ? 0x200u : 0u));
+    }
+
+    if (bits >= 0x477ff000u) { // halfway between the largest finite half (65504) and 65536, rounding to infinity.
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+
+    if (bits < 0x38800000u) { // below the smallest normal half (2^-14).
+        if (bits <= 0x33000000u) { // no larger than half of the smallest subnormal (2^-25), rounding to zero.
+            return static_cast<std::uint16_t>(sign);
+        }
+        const std::uint32_t exponent = bits >> 23;
+        const std::uint32_t mantissa = (bits & 0x7fffffu) | 0x800000u;
+        const std::uint32_t shift = 126 - exponent;
+        std::uint32_t half = mantissa >> shift;
+        const std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u))) { // round to nearest, ties to even.
+            ++half;
+        }
+        return static_cast<std::uint16_t>(sign | half);
+    }
+
+    // Re-biasing the exponent from 127 to 15, where any carry from rounding the mantissa propagates into the exponent.
+    std::uint32_t half = (bits - 0x38000000u) >> 13;
+    const std::uint32_t remainder = bits & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) {
+        ++half;
+    }
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+inline float to_float(const std::uint16_t half) {
+    const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+    const std::uint32_t exponent = (half >> 10) & 0x1fu;
+    std::uint32_t mantissa = half & 0x3ffu;
+
+    std::uint32_t bits;
+    if (exponent == 0x1fu) {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    } else if (exponent) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal halves are normal floats, so the mantissa is shifted until the implicit leading bit is set.
+        std::uint32_t normalized = 113;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            --normalized;
+        }
+        bits = sign | (normalized << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+
+    float output;
+    std::memcpy(&output, &bits, sizeof(output));
+    return output;
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @brief IEEE 754 half-precision floating-point value.
+ *
+ * This is the value type of the 16-bit floating-point layer of a `LayeredSparseMatrix`, see `convert_to_layered_sparse()` for details.
+ * Conversions to and from `float` are performed in software so that no compiler or hardware support for half-precision arithmetic is required.
+ * Arithmetic is performed after implicit conversion to `float`.
+ */
+struct Float16 {
+    /**
+     * Default constructor, leaving the value uninitialized.
+     */
+    Float16() = default;
+
+    /**
+     * @param x Value to be stored.
+     * This is rounded to the nearest representable value, with ties rounded to even.
+     * Finite values with magnitude greater than 65504 are converted to infinity.
+     */
+    explicit Float16(const float x) : bits(Float16_internal::from_float(x)) {}
+
+    /**
+     * @return The stored value as a single-precision float, which is always exact.
+     */
+    operator float() const {
+        return Float16_internal::to_float(bits);
+    }
+
+    /**
+     * Bit pattern of the stored value, i.e., 1 sign bit, 5 exponent bits and 10 mantissa bits.
+     */
+    std::uint16_t bits;
+};
+
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef TATAMI_LAYERED_INSTRUMENTATION_HPP
+#define TATAMI_LAYERED_INSTRUMENTATION_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "utils.hpp"
+
+/**
+ * @file Instrumentation.hpp
+ * @brief Instrumentation for the construction of layered sparse matrices.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Per-phase timings and memory usage during the construction of a layered sparse matrix.
+ *
+ * An instance of this class can be supplied via `ConvertToLayeredSparseOptions::instrumentation` or `ReadLayeredSparseFromMatrixMarketOptions::instrumentation`,
+ * in which case its members are incremented during construction.
+ * This allows users to determine the bottleneck for slow loads in production.
+ * The same instance may be re-used across multiple calls to accumulate statistics, or reset by assigning a default-constructed instance.
+ */
+struct Instrumentation {
+    /**
+     * Wall time (in seconds) spent in the first pass through the input, where the layer of each row is determined in each chunk.
+     * For Matrix Market files, this includes the time spent reading, decompressing and parsing the file.
+     */
+    double scan_seconds = 0;
+
+    /**
+     * Wall time (in seconds) spent allocating the layers for each chunk.
+     */
+    double allocate_seconds = 0;
+
+    /**
+     * Wall time (in seconds) spent in the second pass through the input, where the non-zero values are stored in the layers.
+     * For Matrix Market files, this includes the time spent reading, decompressing and parsing the file again.
+     */
+    double fill_seconds = 0;
+
+    /**
+     * Wall time (in seconds) spent sorting the column indices within each row of each layer.
+     * This is only relevant for Matrix Market files where the entries are not sorted by column.
+     */
+    double sort_seconds = 0;
+
+    /**
+     * Wall time (in seconds) spent choosing and building the dictionary-coded layer for each chunk.
+     * This is only relevant if dictionary coding is enabled, see `ConvertToLayeredSparseOptions::dictionary`.
+     * (Rows with escapes are chosen in the first pass and filled directly, see `ConvertToLayeredSparseOptions::outliers`.)
+     */
+    double encode_seconds = 0;
+
+    /**
+     * Wall time (in seconds) spent consolidating the chunks into a single matrix, including the sharing of row codes between chunks.
+     */
+    double consolidate_seconds = 0;
+
+    /**
+     * Number of bytes read from the source, summed across both passes.
+     * For Matrix Market files, this is the size of the (possibly compressed) file or buffer.
+     * For `tatami::Matrix` inputs, this is not reported.
+     */
+    std::size_t bytes_read = 0;
+
+    /**
+     * Number of non-zero elements stored in the layers.
+     */
+    std::size_t num_nonzero = 0;
+
+    /**
+     * Size (in bytes) of the largest transient allocation used to track the layer and number of non-zero elements for each row in each chunk,
+     * or of the copies of the layers and row codes made while rebuilding chunks for dictionary coding, summed across threads.
+     * This does not include the buffers used by **tatami** or the Matrix Market parser.
+     */
+    std::size_t transient_bytes = 0;
+
+    /**
+     * Size (in bytes) of the layers and row codes of the constructed matrix, before any sharing of row codes between chunks.
+     */
+    std::size_t layer_bytes = 0;
+};
+
+/**
+ * @cond
+ */
+namespace Instrumentation_internal {
+
+// Hooks for construction without instrumentation.
+// Every member is an empty inline function, so the uninstrumented instantiation of each construction function does not contain any instrumentation code.
+struct NoOp {
+    void finish(double Instrumentation::*) {}
+
+    template<class Bytes_>
+    void record_transient(Bytes_) {}
+
+    template<typename Index_, typename ColumnIndex_>
+    void record_layers(const std::vector<LayeredChunk<Index_, ColumnIndex_> >&) {}
+
+    template<class Bytes_>
+    void record_bytes_read(Bytes_) {}
+};
+
+// Hooks that record the wall time since the previous phase and the memory usage in an Instrumentation instance.
+// Sizes are supplied as functions that are only called here, so that they are not computed at all without instrumentation.
+class Recorder {
+public:
+    Recorder(Instrumentation& instrumentation) : my_instrumentation(instrumentation), my_last(std::chrono::steady_clock::now()) {}
+
+    void finish(double Instrumentation::* field) {
+        const auto now = std::chrono::steady_clock::now();
+        my_instrumentation.*field += std::chrono::duration<double>(now - my_last).count();
+        my_last = now;
+    }
+
+    template<class Bytes_>
+    void record_transient(Bytes_ bytes) {
+        my_instrumentation.transient_bytes = std::max<std::size_t>(my_instrumentation.transient_bytes, bytes());
+    }
+
+    template<typename Index_, typename ColumnIndex_>
+    void record_layers(const std::vector<LayeredChunk<Index_, ColumnIndex_> >& chunks) {
+        for (const auto& chunk : chunks) {
+            const auto num_nonzero = layer_num_nonzero(chunk);
+            const auto offsets = define_layer_offsets<ColumnIndex_>(layer_num_rows(chunk), num_nonzero, layer_num_entries(chunk), layer_num_escapes(chunk));
+            my_instrumentation.layer_bytes += offsets.total + chunk.codes->size() * sizeof(RowCode);
+            for (auto n : num_nonzero) {
+                my_instrumentation.num_nonzero += n;
+            }
+        }
+    }
+
+    template<class Bytes_>
+    void record_bytes_read(Bytes_ bytes) {
+        my_instrumentation.bytes_read += bytes();
+    }
+
+private:
+    Instrumentation& my_instrumentation;
+    std::chrono::steady_clock::time_point my_last;
+};
+
+// Calls 'fun(hooks)' with a Recorder if 'instrumentation' is not NULL, and with a NoOp otherwise.
+// The choice is made once per construction, so that the uninstrumented instantiation of 'fun' is free of any checks.
+template<class Function_>
+auto dispatch(Instrumentation* instrumentation, Function_ fun) {
+    if (instrumentation) {
+        Recorder hooks(*instrumentation);
+        return fun(hooks);
+    } else {
+        NoOp hooks;
+        return fun(hooks);
+    }
+}
+
+}
+/**
+ * @endcond
+ */
+
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef TATAMI_LAYERED_LAYER_COMPOSITION_HPP
+#define TATAMI_LAYERED_LAYER_COMPOSITION_HPP
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+
+/**
+ * @file LayerComposition.hpp
+ * @brief Composition and memory usage of the layers of a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Composition and memory usage of the layers in a single chunk.
+ *
+ * Arrays of per-layer statistics are indexed by the integer value of each `Category`, e.g., `num_rows[static_cast<int>(Category::U16)]`.
+ */
+struct ChunkComposition {
+    /**
+     * Number of rows assigned to each layer.
+     */
+    std::array<std::size_t, num_categories> num_rows{};
+
+    /**
+     * Number of non-zero elements stored in each layer.
+     */
+    std::array<std::size_t, num_categories> num_nonzero{};
+
+    /**
+     * Number of distinct values in the tables of the dictionary-coded layer, i.e., `Category::D8`.
+     */
+    std::size_t num_entries = 0;
+
+    /**
+     * Number of outliers that are stored as escapes in the escaped layer, i.e., `Category::E8`.
+     */
+    std::size_t num_escapes = 0;
+
+    /**
+     * Size (in bytes) of the values across all layers, including the tables of the dictionary-coded layer and the values of the escapes.
+     */
+    std::size_t value_bytes = 0;
+
+    /**
+     * Size (in bytes) of the column indices across all layers, including the column indices of the escapes.
+     */
+    std::size_t index_bytes = 0;
+
+    /**
+     * Size (in bytes) of the row pointers across all layers, including the pointers to the tables of the dictionary-coded layer and to the escapes of the escaped layer.
+     */
+    std::size_t pointer_bytes = 0;
+
+    /**
+     * Size (in bytes) of the row codes, i.e., the mapping from each row to its layer and its position within that layer.
+     * This is zero if the codes are shared with an earlier chunk.
+     */
+    std::size_t code_bytes = 0;
+
+    /**
+     * Size (in bytes) of the padding used to align each array in the chunk's allocation.
+     */
+    std::size_t padding_bytes = 0;
+
+    /**
+     * @return Total memory usage of this chunk, in bytes.
+     */
+    std::size_t memory_usage() const {
+        return value_bytes + index_bytes + pointer_bytes + code_bytes + padding_bytes;
+    }
+};
+
+/**
+ * @brief Composition and memory usage of the layers of a layered sparse matrix.
+ *
+ * This can be obtained from an existing matrix with `describe_layered_sparse()`, or predicted from a first pass through the input with `scan_layered_sparse()`.
+ * It can be used to choose the chunk size and column index type for a dataset, or to detect datasets with unexpectedly large values.
+ */
+struct LayerComposition {
+    /**
+     * Composition of each chunk.
+     */
+    std::vector<ChunkComposition> chunks;
+
+    /**
+     * Number of rows assigned to each layer, summed across chunks.
+     */
+    std::array<std::size_t, num_categories> num_rows{};
+
+    /**
+     * Number of non-zero elements stored in each layer, summed across chunks.
+     */
+    std::array<std::size_t, num_categories> num_nonzero{};
+
+    /**
+     * Number of distinct values in the tables of the dictionary-coded layer, summed across chunks.
+     */
+    std::size_t num_entries = 0;
+
+    /**
+     * Number of escapes in the escaped layer, summed across chunks.
+     */
+    std::size_t num_escapes = 0;
+
+    /**
+     * Size (in bytes) of the values, summed across chunks.
+     */
+    std::size_t value_bytes = 0;
+
+    /**
+     * Size (in bytes) of the column indices, summed across chunks.
+     */
+    std::size_t index_bytes = 0;
+
+    /**
+     * Size (in bytes) of the row pointers, summed across chunks.
+     */
+    std::size_t pointer_bytes = 0;
+
+    /**
+     * Size (in bytes) of the row codes, summed across chunks.
+     */
+    std::size_t code_bytes = 0;
+
+    /**
+     * Size (in bytes) of the alignment padding, summed across chunks.
+     */
+    std::size_t padding_bytes = 0;
+
+    /**
+     * Size (in bytes) of the same matrix in a plain compressed sparse row format,
+     * i.e., a `tatami::CompressedSparseRowMatrix` with the value and index types of the `tatami::Matrix` interface and `std::size_t` row pointers.
+     */
+    std::size_t csr_bytes = 0;
+
+    /**
+     * @return Total memory usage of the layered matrix, in bytes.
+     */
+    std::size_t memory_usage() const {
+        return value_bytes + index_bytes + pointer_bytes + code_bytes + padding_bytes;
+    }
+};
+
+/**
+ * @cond
+ */
+template<typename ColumnIndex_>
+ChunkComposition compose_chunk(
+    const std::array<std::size_t, num_categories>& num_rows,
+    const std::array<std::size_t, num_categories>& num_nonzero,
+    const std::size_t num_entries,
+    const std::size_t num_escapes,
+    const std::size_t code_bytes)
+{
+    ChunkComposition output;
+    output.num_rows = num_rows;
+    output.num_nonzero = num_nonzero;
+    output.num_entries = num_entries;
+    output.num_escapes = num_escapes;
+    output.code_bytes = code_bytes;
+
+    for (std::size_t i = 0; i < num_categories; ++i) {
+        output.value_bytes += num_nonzero[i] * category_value_sizes[i];
+        output.index_bytes += num_nonzero[i] * sizeof(ColumnIndex_);
+        output.pointer_bytes += (num_rows[i] + 1) * sizeof(std::size_t);
+    }
+    output.value_bytes += num_entries * sizeof(double);
+    output.pointer_bytes += (num_rows[static_cast<std::size_t>(Category::D8)] + 1) * sizeof(std::size_t);
+    output.value_bytes += num_escapes * sizeof(std::uint64_t);
+    output.index_bytes += num_escapes * sizeof(ColumnIndex_);
+    output.pointer_bytes += (num_rows[static_cast<std::size_t>(Category::E8)] + 1) * sizeof(std::size_t);
+
+    const auto offsets = define_layer_offsets<ColumnIndex_>(num_rows, num_nonzero, num_entries, num_escapes);
+    output.padding_bytes = offsets.total - output.value_bytes - output.index_bytes - output.pointer_bytes;
+    return output;
+}
+
+inline void add_chunk(LayerComposition& composition, ChunkComposition chunk) {
+    for (std::size_t i = 0; i < num_categories; ++i) {
+        composition.num_rows[i] += chunk.num_rows[i];
+        composition.num_nonzero[i] += chunk.num_nonzero[i];
+    }
+    composition.num_entries += chunk.num_entries;
+    composition.num_escapes += chunk.num_escapes;
+    composition.value_bytes += chunk.value_bytes;
+    composition.index_bytes += chunk.index_bytes;
+    composition.pointer_bytes += chunk.pointer_bytes;
+    composition.code_bytes += chunk.code_bytes;
+    composition.padding_bytes += chunk.padding_bytes;
+    composition.chunks.push_back(std::move(chunk));
+}
+
+template<typename Value_, typename Index_>
+std::size_t compute_csr_bytes(const std::size_t nnz, const std::size_t nrow) {
+    return sanisizer::sum<std::size_t>(
+        sanisizer::product<std::size_t>(nnz, sizeof(Value_) + sizeof(Index_)),
+        sanisizer::product<std::size_t>(sanisizer::sum<std::size_t>(nrow, 1), sizeof(std::size_t))
+    );
+}
+
+// Predicts the composition from the per-chunk results of the first pass, assuming that no row codes are shared between chunks.
+template<typename Value_, typename Index_, typename ColumnIndex_, typename Count_>
+LayerComposition compose_first_pass(const FirstPass<Count_>& pass, const std::size_t nrow) {
+    LayerComposition output;
+    output.chunks.reserve(pass.summary_per_chunk.size());
+    std::size_t total_nnz = 0;
+
+    for (I<decltype(pass.summary_per_chunk.size())> chunk = 0, nchunks = pass.summary_per_chunk.size(); chunk < nchunks; ++chunk) {
+        std::array<std::size_t, num_categories> num_rows{}, num_nonzero{};
+        std::size_t num_escapes = 0;
+        const auto& current_summary = pass.summary_per_chunk[chunk];
+        const auto& current_num = pass.num_per_chunk[chunk];
+        for (std::size_t r = 0; r < nrow; ++r) {
+            const auto cat = choose_category<ColumnIndex_>(current_summary, r, current_num[r]);
+            const auto i = static_cast<std::size_t>(cat);
+            ++num_rows[i];
+            num_nonzero[i] += current_num[r];
+            if (cat == Category::E8) {
+                num_escapes += current_summary.num_outliers(r);
+            }
+        }
+
+        for (auto n : num_nonzero) {
+            total_nnz += n;
+        }
+        add_chunk(output, compose_chunk<ColumnIndex_>(num_rows, num_nonzero, 0, num_escapes, sanisizer::product<std::size_t>(nrow, sizeof(RowCode))));
+    }
+
+    output.csr_bytes = compute_csr_bytes<Value_, Index_>(total_nnz, nrow);
+    return output;
+}
+/**
+ * @endcond
+ */
+
+}
+
+#endif
@@ -0,0 +1,1064 @@
+#ifndef TATAMI_LAYERED_LAYERED_SPARSE_MATRIX_HPP
+#define TATAMI_LAYERED_LAYERED_SPARSE_MATRIX_HPP
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+
+/**
+ * @file LayeredSparseMatrix.hpp
+ * @brief Layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Element-wise transformation that is fused into the extractors of a `LayeredSparseMatrix`.
+ *
+ * Each stored value \f$x_{rc}\f$ in row \f$r\f$ and column \f$c\f$ is transformed by:
+ *
+ * 1. Multiplying by `row_factors[r]`, if `row_factors` is not empty.
+ * 2. Multiplying by `column_factors[c]`, if `column_factors` is not empty.
+ * 3. Computing \f$\log(1 + x)\f$, if `log1p = true`.
+ * 4. Clamping to the interval defined by `lower` and `upper`.
+ *
+ * For example, the usual log-normalized expression values are obtained by setting `column_factors` to the reciprocal of each cell's size factor and `log1p = true`.
+ *
+ * The transformation is applied to each value as it is decoded from its layer, avoiding a separate pass over the extracted buffer.
+ * Steps 1-3 always map zero to zero, so sparsity is preserved unless the clamping interval excludes zero.
+ */
+struct FusedTransform {
+    /**
+     * Scaling factor for each row.
+     * This should either be empty or have length equal to the number of rows.
+     */
+    std::vector<double> row_factors;
+
+    /**
+     * Scaling factor for each column.
+     * This should either be empty or have length equal to the number of columns.
+     */
+    std::vector<double> column_factors;
+
+    /**
+     * Whether to apply a log-transformation after scaling.
+     */
+    bool log1p = false;
+
+    /**
+     * Lower bound for clamping.
+     */
+    double lower = -std::numeric_limits<double>::infinity();
+
+    /**
+     * Upper bound for clamping.
+     */
+    double upper = std::numeric_limits<double>::infinity();
+
+    /**
+     * @return Whether the transformation maps zero to zero.
+     */
+    bool preserves_zero() const {
+        return lower <= 0 && upper >= 0;
+    }
+
+    /**
+     * @return The transformed value of a structural zero.
+     */
+    double zero_value() const {
+        return std::min(std::max(0.0, lower), upper);
+    }
+
+    /**
+     * @param row Row index.
+     * @param column Column index.
+     * @param x Stored value at `row` and `column`.
+     * @return The transformed value.
+     */
+    template<typename Index_>
+    double apply(const Index_ row, const Index_ column, double x) const {
+        if (!row_factors.empty()) {
+            x *= row_factors[row];
+        }
+        if (!column_factors.empty()) {
+            x *= column_factors[column];
+        }
+        if (log1p) {
+            x = std::log1p(x);
+        }
+        return std::min(std::max(x, lower), upper);
+    }
+};
+
+/**
+ * @cond
+ */
+namespace LayeredSparseMatrix_internal {
+
+template<typename Index_>
+struct ChunkBounds {
+    ChunkBounds() = default;
+    ChunkBounds(Index_ chunk, Index_ start, Index_ end) : chunk(chunk), start(start), end(end) {}
+    Index_ chunk = 0;
+    Index_ start = 0; // local column within the chunk.
+    Index_ end = 0;
+};
+
+template<typename Index_>
+std::vector<ChunkBounds<Index_> > define_block_bounds(const Index_ chunk_size, const Index_ block_start, const Index_ block_length) {
+    std::vector<ChunkBounds<Index_> > output;
+    if (block_length == 0) {
+        return output;
+    }
+
+    const Index_ block_end = block_start + block_length;
+    const Index_ first = block_start / chunk_size;
+    const Index_ last = (block_end - 1) / chunk_size;
+    output.reserve(last - first + 1);
+
+    for (Index_ c = first; c <= last; ++c) {
+        const Index_ chunk_start = c * chunk_size;
+        const Index_ start = (c == first ? block_start - chunk_start : 0);
+        const Index_ end = (c == last ? block_end - chunk_start : chunk_size);
+        output.emplace_back(c, start, end);
+    }
+
+    return output;
+}
+
+template<typename Index_>
+std::vector<ChunkBounds<Index_> > define_index_bounds(const Index_ chunk_size, const std::vector<Index_>& indices) {
+    std::vector<ChunkBounds<Index_> > output;
+    for (auto i : indices) {
+        const Index_ chunk = i / chunk_size;
+        const Index_ local = i % chunk_size;
+        if (output.empty() || output.back().chunk != chunk) {
+            output.emplace_back(chunk, local, local + 1);
+        } else {
+            output.back().end = local + 1;
+        }
+    }
+    return output;
+}
+
+// Calls 'fun' on each non-zero element of 'row' in 'chunk' with a local column index in [start, end).
+template<typename Index_, typename ColumnIndex_, class Function_>
+void scan_row(const LayeredChunk<Index_, ColumnIndex_>& chunk, const Index_ row, const Index_ start, const Index_ end, Function_ fun) {
+    visit_row_segment(chunk, row, start, end, [&](const ColumnIndex_* indices, const auto values, const std::size_t number) -> void {
+        for (std::size_t i = 0; i < number; ++i) {
+            fun(static_cast<Index_>(indices[i]), values[i]);
+        }
+    });
+}
+
+// Source of chunks for the extractors, where all chunks are held in memory.
+// Other sources should provide the same get() method, where the returned reference is valid until the next call;
+// a peek() method that returns a pointer to the chunk if it is immediately available (and NULL otherwise) without changing the current chunk;
+// and a prefetch() method that is called with the next chunk that an oracle predicts will be requested.
+template<typename Index_, typename ColumnIndex_>
+class InMemoryChunks {
+public:
+    InMemoryChunks(const std::vector<LayeredChunk<Index_, ColumnIndex_> >& chunks) : my_chunks(chunks) {}
+
+    const LayeredChunk<Index_, ColumnIndex_>& get(const Index_ c) {
+        return my_chunks[c];
+    }
+
+    const LayeredChunk<Index_, ColumnIndex_>* peek(const Index_ c) const {
+        return &(my_chunks[c]);
+    }
+
+    void prefetch(const Index_) {}
+
+private:
+    const std::vector<LayeredChunk<Index_, ColumnIndex_> >& my_chunks;
+};
+
+// Tracks the position in the oracle's predictions, if an oracle is available.
+template<bool oracle_, typename Index_>
+class Predictions {
+public:
+    Predictions(tatami::MaybeOracle<oracle_, Index_> oracle) : my_oracle(std::move(oracle)) {
+        if constexpr(oracle_) {
+            my_total = my_oracle->total();
+        }
+    }
+
+    Index_ next(const Index_ i) {
+        if constexpr(oracle_) {
+            return my_oracle->get(my_used++);
+        } else {
+            return i;
+        }
+    }
+
+    // Number of predictions after the one that was most recently returned by next().
+    tatami::PredictionIndex remaining() const {
+        return my_total - my_used;
+    }
+
+    // Prediction that is 'offset' positions after the one that was most recently returned by next().
+    Index_ ahead(const tatami::PredictionIndex offset) const {
+        return my_oracle->get(my_used + offset - 1);
+    }
+
+    tatami::PredictionIndex used() const {
+        return my_used;
+    }
+
+    tatami::PredictionIndex total() const {
+        return my_total;
+    }
+
+    Index_ get(const tatami::PredictionIndex i) const {
+        return my_oracle->get(i);
+    }
+
+private:
+    tatami::MaybeOracle<oracle_, Index_> my_oracle;
+    tatami::PredictionIndex my_used = 0;
+    tatami::PredictionIndex my_total = 0;
+};
+
+template<typename Value_, typename Index_, typename ColumnIndex_, class Source_ = InMemoryChunks<Index_, ColumnIndex_> >
+class PrimaryCore {
+public:
+    PrimaryCore(Source_ chunks, const Index_ chunk_size, const Index_ block_start, const Index_ block_length) :
+        my_chunks(std::move(chunks)),
+        my_chunk_size(chunk_size),
+        my_bounds(define_block_bounds(chunk_size, block_start, block_length)),
+        my_first(block_start),
+        my_extent(block_length)
+    {}
+
+    PrimaryCore(Source_ chunks, const Index_ chunk_size, tatami::VectorPtr<Index_> indices_ptr) :
+        my_chunks(std::move(chunks)),
+        my_chunk_size(chunk_size),
+        my_bounds(define_index_bounds(chunk_size, *indices_ptr)),
+        my_extent(indices_ptr->size()),
+        my_indices(std::move(indices_ptr))
+    {
+        const auto& indices = *my_indices;
+        if (!indices.empty()) {
+            my_first = indices.front();
+            tatami::resize_container_to_Index_size(my_remap, indices.back() - my_first + 1);
+            for (Index_ i = 0; i < my_extent; ++i) {
+                my_remap[indices[i] - my_first] = i + 1;
+            }
+        }
+    }
+
+public:
+    Index_ extent() const {
+        return my_extent;
+    }
+
+    Index_ column(const Index_ pos) const {
+        if (my_indices) {
+            return (*my_indices)[pos];
+        } else {
+            return my_first + pos;
+        }
+    }
+
+    // Calls 'fun' with the position in the output and the full column index of each non-zero element.
+    template<class Function_>
+    void fetch(const Index_ row, Function_ fun) {
+        if (my_remap.empty()) {
+            for (const auto& b : my_bounds) {
+                const Index_ chunk_start = b.chunk * my_chunk_size;
+                scan_row(my_chunks.get(b.chunk), row, b.start, b.end, [&](const Index_ col, const auto val) -> void {
+                    const Index_ full = chunk_start + col;
+                    fun(full - my_first, full, val);
+                });
+            }
+
+        } else {
+            for (const auto& b : my_bounds) {
+                const Index_ chunk_start = b.chunk * my_chunk_size;
+                scan_row(my_chunks.get(b.chunk), row, b.start, b.end, [&](const Index_ col, const auto val) -> void {
+                    const Index_ full = chunk_start + col;
+                    const Index_ pos = my_remap[full - my_first];
+                    if (pos) {
+                        fun(pos - 1, full, val);
+                    }
+                });
+            }
+        }
+    }
+
+    // Software prefetching of the upcoming rows, pipelined so that each row's memory accesses are issued over the three preceding calls.
+    // Each stage depends on data that should have been brought into the cache by the previous stage.
+    template<class Predictions_>
+    void prefetch(const Predictions_& predictions) {
+        const auto remaining = predictions.remaining();
+        if (remaining >= 3) {
+            prefetch_row(predictions.ahead(3), 0);
+        }
+        if (remaining >= 2) {
+            prefetch_row(predictions.ahead(2), 1);
+        }
+        if (remaining >= 1) {
+            prefetch_row(predictions.ahead(1), 2);
+        }
+    }
+
+private:
+    // Stage 0 fetches the row code, stage 1 fetches the row pointers in the row's layer, and stage 2 fetches the start of its indices and values.
+    void prefetch_row(const Index_ row, const int stage) {
+        for (const auto& b : my_bounds) {
+            const auto chunk = my_chunks.peek(b.chunk);
+            if (chunk == NULL) {
+                continue;
+            }
+
+            const auto& codes = *(chunk->codes);
+            if (stage == 0) {
+                prefetch_address(codes.data() + row);
+                continue;
+            }
+
+            const auto code = codes[row];
+            const auto pos = row_code_position(code);
+            dispatch_layer(*chunk, row_code_category(code), [&](const auto& layer) -> void {
+                if (stage == 1) {
+                    prefetch_address(layer.ptr + pos);
+                } else {
+                    const auto start = layer.ptr[pos];
+                    prefetch_address(layer.index + start);
+                    prefetch_address(layer.value + start);
+                }
+            });
+        }
+    }
+
+private:
+    Source_ my_chunks;
+    Index_ my_chunk_size;
+    std::vector<ChunkBounds<Index_> > my_bounds;
+    Index_ my_first = 0;
+    Index_ my_extent;
+    std::vector<Index_> my_remap;
+    tatami::VectorPtr<Index_> my_indices;
+};
+
+template<bool oracle_, typename Value_, typename Index_, typename ColumnIndex_, class Source_ = InMemoryChunks<Index_, ColumnIndex_> >
+class PrimaryDense final : public tatami::DenseExtractor<oracle_, Value_, Index_> {
+public:
+    template<typename ... Args_>
+    PrimaryDense(const FusedTransform* transform, tatami::MaybeOracle<oracle_, Index_> oracle, Args_&& ... args) :
+        my_core(std::forward<Args_>(args)...),
+        my_transform(transform),
+        my_predictions(std::move(oracle))
+    {}
+
+    const Value_* fetch(Index_ i, Value_* const buffer) {
+        i = my_predictions.next(i);
+        if constexpr(oracle_) {
+            my_core.prefetch(my_predictions);
+        }
+
+        if (!my_transform) {
+            std::fill_n(buffer, my_core.extent(), static_cast<Value_>(0));
+            my_core.fetch(i, [&](const Index_ pos, const Index_, const auto val) -> void {
+                buffer[pos] = val;
+            });
+        } else {
+            std::fill_n(buffer, my_core.extent(), static_cast<Value_>(my_transform->zero_value()));
+            my_core.fetch(i, [&](const Index_ pos, const Index_ full, const auto val) -> void {
+                buffer[pos] = my_transform->apply(i, full, val);
+            });
+        }
+        return buffer;
+    }
+
+private:
+    PrimaryCore<Value_, Index_, ColumnIndex_, Source_> my_core;
+    const FusedTransform* my_transform;
+    Predictions<oracle_, Index_> my_predictions;
+};
+
+template<bool oracle_, typename Value_, typename Index_, typename ColumnIndex_, class Source_ = InMemoryChunks<Index_, ColumnIndex_> >
+class PrimarySparse final : public tatami::SparseExtractor<oracle_, Value_, Index_> {
+public:
+    template<typename ... Args_>
+    PrimarySparse(const FusedTransform* transform, tatami::MaybeOracle<oracle_, Index_> oracle, const tatami::Options& opt, Args_&& ... args) :
+        my_core(std::forward<Args_>(args)...),
+        my_transform(transform),
+        my_predictions(std::move(oracle)),
+        my_needs_value(opt.sparse_extract_value),
+        my_needs_index(opt.sparse_extract_index)
+    {}
+
+    tatami::SparseRange<Value_, Index_> fetch(Index_ i, Value_* const vbuffer, Index_* const ibuffer) {
+        i = my_predictions.next(i);
+        if constexpr(oracle_) {
+            my_core.prefetch(my_predictions);
+        }
+
+        if (my_transform && !my_transform->preserves_zero()) {
+            return fetch_dense(i, vbuffer, ibuffer);
+        }
+
+        Index_ count = 0;
+        my_core.fetch(i, [&](const Index_, const Index_ full, const auto val) -> void {
+            if (my_needs_value) {
+                vbuffer[count] = (my_transform ? my_transform->apply(i, full, val) : val);
+            }
+            if (my_needs_index) {
+                ibuffer[count] = full;
+            }
+            ++count;
+        });
+        return tatami::SparseRange<Value_, Index_>(count, (my_needs_value ? vbuffer : NULL), (my_needs_index ? ibuffer : NULL));
+    }
+
+private:
+    // Every element is non-zero after the transformation, so we report all of them.
+    tatami::SparseRange<Value_, Index_> fetch_dense(const Index_ i, Value_* const vbuffer, Index_* const ibuffer) {
+        const Index_ extent = my_core.extent();
+        if (my_needs_value) {
+            std::fill_n(vbuffer, extent, static_cast<Value_>(my_transform->zero_value()));
+            my_core.fetch(i, [&](const Index_ pos, const Index_ full, const auto val) -> void {
+                vbuffer[pos] = my_transform->apply(i, full, val);
+            });
+        }
+        if (my_needs_index) {
+            for (Index_ pos = 0; pos < extent; ++pos) {
+                ibuffer[pos] = my_core.column(pos);
+            }
+        }
+        return tatami::SparseRange<Value_, Index_>(extent, (my_needs_value ? vbuffer : NULL), (my_needs_index ? ibuffer : NULL));
+    }
+
+private:
+    PrimaryCore<Value_, Index_, ColumnIndex_, Source_> my_core;
+    const FusedTransform* my_transform;
+    Predictions<oracle_, Index_> my_predictions;
+    bool my_needs_value, my_needs_index;
+};
+
+template<typename Value_, typename Index_, typename ColumnIndex_, class Source_ = InMemoryChunks<Index_, ColumnIndex_> >
+class SecondaryCore {
+public:
+    SecondaryCore(Source_ chunks, const Index_ chunk_size, std::vector<Index_> rows) :
+        my_chunks(std::move(chunks)),
+        my_chunk_size(chunk_size),
+        my_rows(std::move(rows))
+    {
+        const Index_ num = my_rows.size();
+        tatami::resize_container_to_Index_size(my_start, num);
+        tatami::resize_container_to_Index_size(my_current, num);
+        tatami::resize_container_to_Index_size(my_end, num);
+        tatami::resize_container_to_Index_size(my_category, num);
+        tatami::resize_container_to_Index_size(my_position, num);
+    }
+
+public:
+    Index_ extent() const {
+        return my_rows.size();
+    }
+
+    Index_ row(const Index_ k) const {
+        return my_rows[k];
+    }
+
+    // Calls 'fun' with the position of each requested row that has a non-zero element in column 'col'.
+    template<class Function_>
+    void fetch(const Index_ col, Function_ fun) {
+        const Index_ chunk = col / my_chunk_size;
+        const ColumnIndex_ local = col % my_chunk_size;
+
+        bool rewind = false;
+        if (!my_initialized || chunk != my_last_chunk) {
+            reset(chunk);
+        } else if (local < my_last_local) {
+            rewind = true;
+        }
+        my_last_local = local;
+
+        const auto& current_chunk = my_chunks.get(chunk);
+        const Index_ num = my_rows.size();
+        for (Index_ k = 0; k < num; ++k) {
+            auto& cur = my_current[k];
+            if (rewind) {
+                cur = my_start[k];
+            }
+
+            const auto end = my_end[k];
+            if (cur == end) {
+                continue;
+            }
+
+            if (*cur < local) {
+                cur = std::lower_bound(cur + 1, end, local);
+                if (cur == end) {
+                    continue;
+                }
+            }
+
+            if (*cur == local) {
+                dispatch_layer(current_chunk, my_category[k], [&](const auto& layer) -> void {
+                    fun(k, layer_values(layer, my_position[k])[cur - layer.index]);
+                });
+            }
+        }
+    }
+
+    // Looks ahead in the predictions for the next chunk that differs from that of 'col', so that the source can start loading it in advance.
+    // The lookahead position only moves forward, so the total cost of scanning is linear in the number of predictions.
+    template<class Predictions_>
+    void prefetch(const Predictions_& predictions, const Index_ col) {
+        const Index_ chunk = col / my_chunk_size;
+        my_lookahead = std::max(my_lookahead, predictions.used());
+        const auto total = predictions.total();
+
+        while (my_lookahead < total) {
+            const Index_ upcoming = predictions.get(my_lookahead) / my_chunk_size;
+            if (upcoming != chunk) {
+                if (!my_requested || upcoming != my_last_requested) {
+                    my_chunks.prefetch(upcoming);
+                    my_requested = true;
+                    my_last_requested = upcoming;
+                }
+                break;
+            }
+            ++my_lookahead;
+        }
+    }
+
+private:
+    void reset(const Index_ chunk) {
+        const auto& current_chunk = my_chunks.get(chunk);
+        const auto& codes = *(current_chunk.codes);
+        const Index_ num = my_rows.size();
+
+        for (Index_ k = 0; k < num; ++k) {
+            const auto code = codes[my_rows[k]];
+            const auto pos = row_code_position(code);
+            const auto cat = row_code_category(code);
+            dispatch_layer(current_chunk, cat, [&](const auto& layer) -> void {
+                my_start[k] = layer.index + layer.ptr[pos];
+                my_end[k] = layer.index + layer.ptr[pos + 1];
+            });
+            my_current[k] = my_start[k];
+            my_category[k] = cat;
+            my_position[k] = pos;
+        }
+
+        my_initialized = true;
+        my_last_chunk = chunk;
+    }
+
+private:
+    Source_ my_chunks;
+    Index_ my_chunk_size;
+    std::vector<Index_> my_rows;
+
+    bool my_initialized = false;
+    Index_ my_last_chunk = 0;
+    ColumnIndex_ my_last_local = 0;
+
+    std::vector<const ColumnIndex_*> my_start, my_current, my_end;
+    std::vector<Category> my_category;
+    std::vector<std::size_t> my_position;
+
+    tatami::PredictionIndex my_lookahead = 0;
+    bool my_requested = false;
+    Index_ my_last_requested = 0;
+};
+
+template<bool oracle_, typename Value_, typename Index_, typename ColumnIndex_, class Source_ = InMemoryChunks<Index_, ColumnIndex_> >
+class SecondaryDense final : public tatami::DenseExtractor<oracle_, Value_, Index_> {
+public:
+    template<typename ... Args_>
+    SecondaryDense(const FusedTransform* transform, tatami::MaybeOracle<oracle_, Index_> oracle, Args_&& ... args) :
+        my_core(std::forward<Args_>(args)...),
+        my_transform(transform),
+        my_predictions(std::move(oracle))
+    {}
+
+    const Value_* fetch(Index_ i, Value_* const buffer) {
+        i = my_predictions.next(i);
+        if constexpr(oracle_) {
+            my_core.prefetch(my_predictions, i);
+        }
+
+        if (!my_transform) {
+            std::fill_n(buffer, my_core.extent(), static_cast<Value_>(0));
+            my_core.fetch(i, [&](const Index_ k, const auto val) -> void {
+                buffer[k] = val;
+            });
+        } else {
+            std::fill_n(buffer, my_core.extent(), static_cast<Value_>(my_transform->zero_value()));
+            my_core.fetch(i, [&](const Index_ k, const auto val) -> void {
+                buffer[k] = my_transform->apply(my_core.row(k), i, val);
+            });
+        }
+        return buffer;
+    }
+
+private:
+    SecondaryCore<Value_, Index_, ColumnIndex_, Source_> my_core;
+    const FusedTransform* my_transform;
+    Predictions<oracle_, Index_> my_predictions;
+};
+
+template<bool oracle_, typename Value_, typename Index_, typename ColumnIndex_, class Source_ = InMemoryChunks<Index_, ColumnIndex_> >
+class SecondarySparse final : public tatami::SparseExtractor<oracle_, Value_, Index_> {
+public:
+    template<typename ... Args_>
+    SecondarySparse(const FusedTransform* transform, tatami::MaybeOracle<oracle_, Index_> oracle, const tatami::Options& opt, Args_&& ... args) :
+        my_core(std::forward<Args_>(args)...),
+        my_transform(transform),
+        my_predictions(std::move(oracle)),
+        my_needs_value(opt.sparse_extract_value),
+        my_needs_index(opt.sparse_extract_index)
+    {}
+
+    tatami::SparseRange<Value_, Index_> fetch(Index_ i, Value_* const vbuffer, Index_* const ibuffer) {
+        i = my_predictions.next(i);
+        if constexpr(oracle_) {
+            my_core.prefetch(my_predictions, i);
+        }
+
+        if (my_transform && !my_transform->preserves_zero()) {
+            return fetch_dense(i, vbuffer, ibuffer);
+        }
+
+        Index_ count = 0;
+        my_core.fetch(i, [&](const Index_ k, const auto val) -> void {
+            if (my_needs_value) {
+                vbuffer[count] = (my_transform ? my_transform->apply(my_core.row(k), i, val) : val);
+            }
+            if (my_needs_index) {
+                ibuffer[count] = my_core.row(k);
+            }
+            ++count;
+        });
+        return tatami::SparseRange<Value_, Index_>(count, (my_needs_value ? vbuffer : NULL), (my_needs_index ? ibuffer : NULL));
+    }
+
+private:
+    tatami::SparseRange<Value_, Index_> fetch_dense(const Index_ i, Value_* const vbuffer, Index_* const ibuffer) {
+        const Index_ extent = my_core.extent();
+        if (my_needs_value) {
+            std::fill_n(vbuffer, extent, static_cast<Value_>(my_transform->zero_value()));
+            my_core.fetch(i, [&](const Index_ k, const auto val) -> void {
+                vbuffer[k] = my_transform->apply(my_core.row(k), i, val);
+            });
+        }
+        if (my_needs_index) {
+            for (Index_ k = 0; k < extent; ++k) {
+                ibuffer[k] = my_core.row(k);
+            }
+        }
+        return tatami::SparseRange<Value_, Index_>(extent, (my_needs_value ? vbuffer : NULL), (my_needs_index ? ibuffer : NULL));
+    }
+
+private:
+    SecondaryCore<Value_, Index_, ColumnIndex_, Source_> my_core;
+    const FusedTransform* my_transform;
+    Predictions<oracle_, Index_> my_predictions;
+    bool my_needs_value, my_needs_index;
+};
+
+template<typename Index_>
+std::vector<Index_> consecutive_rows(const Index_ start, const Index_ length) {
+    auto output = tatami::create_container_of_Index_size<std::vector<Index_> >(length);
+    std::iota(output.begin(), output.end(), start);
+    return output;
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @brief Layered sparse matrix.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices within each chunk.
+ *
+ * The columns of a layered sparse matrix are split into chunks of `chunk_size` contiguous columns, where the last chunk may be smaller.
+ * Within each chunk, each row is assigned to one of several layers depending on its largest value, see `convert_to_layered_sparse()` for details.
+ * Each layer is stored as a compressed sparse row submatrix using the smallest unsigned integer, signed integer or floating-point type that can hold its values.
+ *
+ * Each row's layer and its position within that layer are packed into a single code, so a row in a chunk is found with a single lookup.
+ * Chunks with the same assignment of rows to layers can share the same vector of codes.
+ *
+ * If an oracle is supplied for row extraction, the extractor issues software prefetches for the codes, row pointers and the start of the indices and values of the upcoming rows.
+ * This reduces the latency of row access in an unpredictable order, e.g., when looking up a set of marker genes.
+ *
+ * Users should not need to construct this class directly, as it is created by `convert_to_layered_sparse()` and friends.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_ = std::uint16_t>
+class LayeredSparseMatrix final : public tatami::Matrix<Value_, Index_> {
+public:
+    /**
+     * @cond
+     */
+    LayeredSparseMatrix(const Index_ nrow, const Index_ ncol, const Index_ chunk_size, std::vector<LayeredChunk<Index_, ColumnIndex_> > chunks, const bool check = true) :
+        my_nrow(nrow),
+        my_ncol(ncol),
+        my_chunk_size(chunk_size),
+        my_chunks(std::move(chunks))
+    {
+        if (check) {
+            if (my_chunk_size <= 0) {
+                throw std::runtime_error("chunk size should be positive");
+            }
+
+            const Index_ expected = sanisizer::max(1, my_ncol / my_chunk_size + (my_ncol % my_chunk_size != 0));
+            if (sanisizer::is_less_than(my_chunks.size(), expected) || sanisizer::is_greater_than(my_chunks.size(), expected)) {
+                throw std::runtime_error("number of chunks is not consistent with the number of columns and the chunk size");
+            }
+
+            for (const auto& chunk : my_chunks) {
+                if (!chunk.codes || sanisizer::is_less_than(chunk.codes->size(), my_nrow) || sanisizer::is_greater_than(chunk.codes->size(), my_nrow)) {
+                    throw std::runtime_error("length of the row codes in each chunk should be equal to the number of rows");
+                }
+            }
+        }
+    }
+    /**
+     * @endcond
+     */
+
+private:
+    Index_ my_nrow, my_ncol, my_chunk_size;
+    std::vector<LayeredChunk<Index_, ColumnIndex_> > my_chunks;
+    std::shared_ptr<const FusedTransform> my_transform;
+
+public:
+    Index_ nrow() const {
+        return my_nrow;
+    }
+
+    Index_ ncol() const {
+        return my_ncol;
+    }
+
+    bool is_sparse() const {
+        return !my_transform || my_transform->preserves_zero();
+    }
+
+    double is_sparse_proportion() const {
+        return is_sparse();
+    }
+
+    bool prefer_rows() const {
+        return true;
+    }
+
+    double prefer_rows_proportion() const {
+        return 1;
+    }
+
+    bool uses_oracle(const bool row) const {
+        return row; // for software prefetching of the upcoming rows.
+    }
+
+public:
+    /**
+     * @return Number of columns in each chunk, except for the last chunk which may be smaller.
+     */
+    Index_ get_chunk_size() const {
+        return my_chunk_size;
+    }
+
+    /**
+     * @return Number of chunks.
+     */
+    Index_ num_chunks() const {
+        return my_chunks.size();
+    }
+
+    /**
+     * @param c Index of the chunk.
+     * @return Number of columns in chunk `c`.
+     */
+    Index_ chunk_extent(const Index_ c) const {
+        const Index_ start = c * my_chunk_size;
+        return std::min(my_chunk_size, static_cast<Index_>(my_ncol - start));
+    }
+
+    /**
+     * @cond
+     */
+    const std::vector<LayeredChunk<Index_, ColumnIndex_> >& get_chunks() const {
+        return my_chunks;
+    }
+    /**
+     * @endcond
+     */
+
+    /**
+     * @return Pointer to the fused transformation, or `NULL` if no transformation is applied.
+     */
+    const FusedTransform* get_fused_transform() const {
+        return my_transform.get();
+    }
+
+    /**
+     * Create a new matrix that applies a transformation to each value during extraction.
+     * The new matrix shares the layers of this matrix, so no copies of the data are made.
+     *
+     * @param transform Transformation to apply.
+     * This should not be combined with any existing transformation, i.e., `get_fused_transform()` should be `NULL`.
+     * @return Pointer to a new `LayeredSparseMatrix` with the fused transformation.
+     */
+    std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > fuse_transform(FusedTransform transform) const {
+        if (my_transform) {
+            throw std::runtime_error("layered matrix already has a fused transformation");
+        }
+        if (!transform.row_factors.empty() && !sanisizer::is_equal(transform.row_factors.size(), my_nrow)) {
+            throw std::runtime_error("length of 'row_factors' should be equal to the number of rows");
+        }
+        if (!transform.column_factors.empty() && !sanisizer::is_equal(transform.column_factors.size(), my_ncol)) {
+            throw std::runtime_error("length of 'column_factors' should be equal to the number of columns");
+        }
+
+        auto output = std::make_shared<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(my_nrow, my_ncol, my_chunk_size, my_chunks, false);
+        output->my_transform = std::make_shared<const FusedTransform>(std::move(transform));
+        return output;
+    }
+
+    /*****************************
+     *** Extractor construction ***
+     *****************************/
+private:
+    template<bool oracle_>
+    std::unique_ptr<tatami::DenseExtractor<oracle_, Value_, Index_> > dense_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        const Index_ block_start,
+        const Index_ block_length)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimaryDense<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), my_chunks, my_chunk_size, block_start, block_length
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondaryDense<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), my_chunks, my_chunk_size, LayeredSparseMatrix_internal::consecutive_rows(block_start, block_length)
+            );
+        }
+    }
+
+    template<bool oracle_>
+    std::unique_ptr<tatami::DenseExtractor<oracle_, Value_, Index_> > dense_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        tatami::VectorPtr<Index_> indices_ptr)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimaryDense<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), my_chunks, my_chunk_size, std::move(indices_ptr)
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondaryDense<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), my_chunks, my_chunk_size, *indices_ptr
+            );
+        }
+    }
+
+    template<bool oracle_>
+    std::unique_ptr<tatami::SparseExtractor<oracle_, Value_, Index_> > sparse_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        const Index_ block_start,
+        const Index_ block_length,
+        const tatami::Options& opt)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimarySparse<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), opt, my_chunks, my_chunk_size, block_start, block_length
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondarySparse<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), opt, my_chunks, my_chunk_size, LayeredSparseMatrix_internal::consecutive_rows(block_start, block_length)
+            );
+        }
+    }
+
+    template<bool oracle_>
+    std::unique_ptr<tatami::SparseExtractor<oracle_, Value_, Index_> > sparse_internal(
+        const bool row,
+        tatami::MaybeOracle<oracle_, Index_> oracle,
+        tatami::VectorPtr<Index_> indices_ptr,
+        const tatami::Options& opt)
+    const {
+        if (row) {
+            return std::make_unique<LayeredSparseMatrix_internal::PrimarySparse<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), opt, my_chunks, my_chunk_size, std::move(indices_ptr)
+            );
+        } else {
+            return std::make_unique<LayeredSparseMatrix_internal::SecondarySparse<oracle_, Value_, Index_, ColumnIndex_> >(
+                my_transform.get(), std::move(oracle), opt, my_chunks, my_chunk_size, *indices_ptr
+            );
+        }
+    }
+
+    Index_ full_extent(const bool row) const {
+        return (row ? my_ncol : my_nrow);
+    }
+
+    /********************
+     *** Myopic dense ***
+     ********************/
+public:
+    std::unique_ptr<tatami::MyopicDenseExtractor<Value_, Index_> > dense(const bool row, const tatami::Options&) const {
+        return dense_internal<false>(row, false, static_cast<Index_>(0), full_extent(row));
+    }
+
+    std::unique_ptr<tatami::MyopicDenseExtractor<Value_, Index_> > dense(const bool row, const Index_ block_start, const Index_ block_length, const tatami::Options&) const {
+        return dense_internal<false>(row, false, block_start, block_length);
+    }
+
+    std::unique_ptr<tatami::MyopicDenseExtractor<Value_, Index_> > dense(const bool row, tatami::VectorPtr<Index_> indices_ptr, const tatami::Options&) const {
+        return dense_internal<false>(row, false, std::move(indices_ptr));
+    }
+
+    /*********************
+     *** Myopic sparse ***
+     *********************/
+public:
+    std::unique_ptr<tatami::MyopicSparseExtractor<Value_, Index_> > sparse(const bool row, const tatami::Options& opt) const {
+        return sparse_internal<false>(row, false, static_cast<Index_>(0), full_extent(row), opt);
+    }
+
+    std::unique_ptr<tatami::MyopicSparseExtractor<Value_, Index_> > sparse(const bool row, const Index_ block_start, const Index_ block_length, const tatami::Options& opt) const {
+        return sparse_internal<false>(row, false, block_start, block_length, opt);
+    }
+
+    std::unique_ptr<tatami::MyopicSparseExtractor<Value_, Index_> > sparse(const bool row, tatami::VectorPtr<Index_> indices_ptr, const tatami::Options& opt) const {
+        return sparse_internal<false>(row, false, std::move(indices_ptr), opt);
+    }
+
+    /**********************
+     *** Oracular dense ***
+     **********************/
+public:
+    std::unique_ptr<tatami::OracularDenseExtractor<Value_, Index_> > dense(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const tatami::Options&)
+    const {
+        return dense_internal<true>(row, std::move(oracle), static_cast<Index_>(0), full_extent(row));
+    }
+
+    std::unique_ptr<tatami::OracularDenseExtractor<Value_, Index_> > dense(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const Index_ block_start,
+        const Index_ block_length,
+        const tatami::Options&)
+    const {
+        return dense_internal<true>(row, std::move(oracle), block_start, block_length);
+    }
+
+    std::unique_ptr<tatami::OracularDenseExtractor<Value_, Index_> > dense(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        tatami::VectorPtr<Index_> indices_ptr,
+        const tatami::Options&)
+    const {
+        return dense_internal<true>(row, std::move(oracle), std::move(indices_ptr));
+    }
+
+    /***********************
+     *** Oracular sparse ***
+     ***********************/
+public:
+    std::unique_ptr<tatami::OracularSparseExtractor<Value_, Index_> > sparse(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const tatami::Options& opt)
+    const {
+        return sparse_internal<true>(row, std::move(oracle), static_cast<Index_>(0), full_extent(row), opt);
+    }
+
+    std::unique_ptr<tatami::OracularSparseExtractor<Value_, Index_> > sparse(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        const Index_ block_start,
+        const Index_ block_length,
+        const tatami::Options& opt)
+    const {
+        return sparse_internal<true>(row, std::move(oracle), block_start, block_length, opt);
+    }
+
+    std::unique_ptr<tatami::OracularSparseExtractor<Value_, Index_> > sparse(
+        const bool row,
+        std::shared_ptr<const tatami::Oracle<Index_> > oracle,
+        tatami::VectorPtr<Index_> indices_ptr,
+        const tatami::Options& opt)
+    const {
+        return sparse_internal<true>(row, std::move(oracle), std::move(indices_ptr), opt);
+    }
+};
+
+/**
+ * @cond
+ */
+inline std::size_t hash_row_codes(const std::vector<RowCode>& codes) {
+    // FNV-1a, only used to find candidates for sharing.
+    std::size_t hash = 14695981039346656037ull;
+    for (auto c : codes) {
+        hash ^= static_cast<std::size_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Chunks with the same category assignment have the same positions, so they can share the same codes.
+template<typename Index_, typename ColIndex_>
+void share_row_codes(std::vector<LayeredChunk<Index_, ColIndex_> >& chunks) {
+    std::vector<std::pair<std::size_t, std::shared_ptr<const std::vector<RowCode> > > > unique_codes;
+    for (auto& chunk : chunks) {
+        const auto hash = hash_row_codes(*(chunk.codes));
+        bool shared = false;
+        for (const auto& candidate : unique_codes) {
+            if (candidate.first == hash && *(candidate.second) == *(chunk.codes)) {
+                chunk.codes = candidate.second;
+                shared = true;
+                break;
+            }
+        }
+        if (!shared) {
+            unique_codes.emplace_back(hash, chunk.codes);
+        }
+    }
+}
+
+template<typename ValueOut_, typename IndexOut_, typename ColIndex_>
+std::shared_ptr<LayeredSparseMatrix<ValueOut_, IndexOut_, ColIndex_> > consolidate_matrices(
+    std::vector<LayeredChunk<IndexOut_, ColIndex_> > chunks,
+    const IndexOut_ NR,
+    const IndexOut_ NC,
+    const IndexOut_ chunk_size)
+{
+    share_row_codes(chunks);
+    return std::make_shared<LayeredSparseMatrix<ValueOut_, IndexOut_, ColIndex_> >(NR, NC, chunk_size, std::move(chunks), false);
+}
+/**
+ * @endcond
+ */
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef TATAMI_LAYERED_MEMORY_ESTIMATE_HPP
+#define TATAMI_LAYERED_MEMORY_ESTIMATE_HPP
+
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayerComposition.hpp"
+
+/**
+ * @file MemoryEstimate.hpp
+ * @brief Memory required to construct a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Memory required to construct a layered sparse matrix.
+ *
+ * This is returned by `estimate_convert_to_layered_sparse()` and `estimate_read_layered_sparse_from_matrix_market()`,
+ * so that the memory requirements of a load can be checked before committing to it.
+ */
+struct MemoryEstimate {
+    /**
+     * Size (in bytes) of the layers and row codes of the constructed matrix, before any sharing of row codes between chunks.
+     * This accounts for any rounding of each chunk's allocation to a multiple of the huge page size.
+     */
+    std::size_t final_bytes = 0;
+
+    /**
+     * Size (in bytes) of the largest set of transient allocations that coexist with the layers during construction,
+     * i.e., the per-row statistics from the first pass, the buffers used in the fill pass (including those of the Matrix Market reader and parser),
+     * or the copies of the chunks that are rebuilt for dictionary coding.
+     * This does not include the internal buffers of the **tatami** extractors.
+     */
+    std::size_t transient_bytes = 0;
+
+    /**
+     * Peak memory usage (in bytes) during construction, i.e., the sum of `final_bytes` and `transient_bytes`.
+     */
+    std::size_t peak_bytes = 0;
+};
+
+/**
+ * @cond
+ */
+inline std::size_t composition_num_rows(const LayerComposition& composition) {
+    std::size_t NR = 0;
+    if (!composition.chunks.empty()) {
+        for (auto n : composition.chunks.front().num_rows) {
+            NR += n;
+        }
+    }
+    return NR;
+}
+
+// Size of the first pass's summaries and counts, see FirstPass.
+// Each chunk only holds the RowExtras if any of its rows were assigned to a signed or floating-point layer,
+// in which case 'extras_copies' accounts for any per-worker copies of the extras, see RowRangeSummaries.
+// If 'outliers = true', the outlier counts are treated in the same manner, and are assumed to be present in any chunk with rows that can hold values above 254.
+template<typename Count_>
+std::size_t estimate_first_pass(const LayerComposition& composition, const std::size_t extras_copies, const bool outliers) {
+    const std::size_t NR = composition_num_rows(composition);
+    std::size_t output = 0;
+    for (const auto& chunk : composition.chunks) {
+        std::size_t per_row = sizeof(std::uint8_t) + sizeof(Count_);
+        for (std::size_t i = 0; i < num_categories; ++i) {
+            const auto cat = static_cast<Category>(i);
+            if (chunk.num_rows[i] && (is_signed_category(cat) || is_floating_category(cat))) {
+                per_row += sizeof(RowExtras) * extras_copies;
+                break;
+            }
+        }
+        if (outliers) {
+            for (std::size_t i = 0; i < num_categories; ++i) {
+                const auto cat = static_cast<Category>(i);
+                if (chunk.num_rows[i] && cat != Category::U8 && cat != Category::I8) {
+                    per_row += sizeof(OutlierCount) * extras_copies;
+                    break;
+                }
+            }
+        }
+        output = sanisizer::sum<std::size_t>(output, sanisizer::product<std::size_t>(NR, per_row));
+    }
+    return output;
+}
+
+inline std::size_t estimate_layer_bytes(const ChunkComposition& chunk) {
+    return chunk.value_bytes + chunk.index_bytes + chunk.pointer_bytes + chunk.padding_bytes;
+}
+
+// Size of the copies made by encode_dictionaries(), where each thread rebuilds one chunk at a time.
+// Rows are only re-encoded if this saves memory, so a rebuilt chunk is no larger than the original, apart from the padding of the newly non-empty arrays of the dictionary-coded layer.
+// Each thread also holds the new category and table offset for each row,
+// along with the tables of the re-encoded rows and the sorted values of the current row, each of which holds at most one double for each value in a candidate layer.
+inline std::size_t estimate_dictionary_pass(const LayerComposition& composition, const bool huge_pages, const int nthreads) {
+    const std::size_t NR = composition_num_rows(composition);
+    std::size_t largest = 0;
+    for (const auto& chunk : composition.chunks) {
+        std::size_t candidates = 0;
+        for (std::size_t i = 0; i < num_categories; ++i) {
+            if (category_value_sizes[i] > 1 && static_cast<Category>(i) != Category::U64) {
+                candidates += chunk.num_nonzero[i];
+            }
+        }
+        const std::size_t layers = sanisizer::sum<std::size_t>(estimate_layer_bytes(chunk), 4 * LayerArena::default_alignment);
+        largest = std::max(largest, sanisizer::sum<std::size_t>(
+            LayerArena::allocated_size(layers, huge_pages),
+            sanisizer::product<std::size_t>(NR, sizeof(RowCode)),
+            sanisizer::product<std::size_t>(candidates, 2 * sizeof(double))
+        ));
+    }
+
+    const std::size_t per_thread = sanisizer::sum<std::size_t>(largest, sanisizer::product<std::size_t>(NR, sizeof(Category) + sizeof(std::size_t)));
+    return sanisizer::product<std::size_t>(std::min(static_cast<std::size_t>(std::max(nthreads, 1)), composition.chunks.size()), per_thread);
+}
+
+inline MemoryEstimate estimate_memory(const LayerComposition& composition, const bool huge_pages, const std::size_t first_pass_bytes, const std::size_t fill_pass_bytes, const std::size_t dictionary_pass_bytes) {
+    MemoryEstimate output;
+    for (const auto& chunk : composition.chunks) {
+        output.final_bytes = sanisizer::sum<std::size_t>(output.final_bytes, LayerArena::allocated_size(estimate_layer_bytes(chunk), huge_pages), chunk.code_bytes);
+    }
+
+    // Each pass's transient allocations are freed before those of the next pass are allocated, so only the largest of them is relevant.
+    output.transient_bytes = std::max({ first_pass_bytes, fill_pass_bytes, dictionary_pass_bytes });
+    output.peak_bytes = sanisizer::sum<std::size_t>(output.final_bytes, output.transient_bytes);
+    return output;
+}
+
+inline void check_memory_budget(const MemoryEstimate& estimate, const std::size_t max_memory) {
+    if (estimate.peak_bytes > max_memory) {
+        throw std::runtime_error(
+            "estimated peak memory usage of " + std::to_string(estimate.peak_bytes) +
+            " bytes exceeds 'max_memory' of " + std::to_string(max_memory) + " bytes"
+        );
+    }
+}
+
+inline bool has_memory_budget(const std::size_t max_memory) {
+    return max_memory != std::numeric_limits<std::size_t>::max();
+}
+/**
+ * @endcond
+ */
+
+}
+
+#endif
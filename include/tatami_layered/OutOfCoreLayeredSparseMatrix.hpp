@@ -0,0 +1,234 @@
+#ifndef TATAMI_LAYERED_OUT_OF_CORE_LAYERED_SPARSE_MATRIX_HPP
+#define TATAMI_LAYERED_OUT_OF_CORE_LAYERED_SPARSE_MATRIX_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+#include "CachedLayeredSparseMatrix.hpp"
+#include "load_layered_sparse.hpp"
+
+/**
+ * @file OutOfCoreLayeredSparseMatrix.hpp
+ * @brief Layered sparse matrix that loads chunks from disk on demand.
+ */
+
+namespace tatami_layered {
+
+/**
+ * Expected pattern of access to the file, passed to the operating system as a hint where supported.
+ */
+enum class AccessPattern : char { NORMAL, SEQUENTIAL, RANDOM };
+
+/**
+ * @brief Options for the `OutOfCoreLayeredSparseMatrix` constructor.
+ */
+struct OutOfCoreLayeredSparseMatrixOptions {
+    /**
+     * Maximum size of the chunk cache, in bytes.
+     * Larger values reduce the number of reads from disk at the cost of increased memory usage.
+     * At least one chunk is always cached, regardless of this value.
+     */
+    std::size_t cache_size = 1073741824;
+
+    /**
+     * Expected pattern of access to the chunks.
+     * This should be `AccessPattern::SEQUENTIAL` if the chunks are mostly accessed in order, e.g., when iterating over consecutive columns;
+     * or `AccessPattern::RANDOM` if the chunks are accessed in an unpredictable order, in which case the operating system should not read ahead.
+     */
+    AccessPattern access_pattern = AccessPattern::NORMAL;
+
+    /**
+     * Whether to check the contents of the layer arrays of each chunk when it is read from disk, see `LoadLayeredSparseOptions::validate` for details.
+     */
+    bool validate = true;
+};
+
+/**
+ * @cond
+ */
+namespace OutOfCoreLayeredSparseMatrix_internal {
+
+class ChunkFile {
+public:
+    ChunkFile(std::string path, const AccessPattern pattern) : my_path(std::move(path)) {
+#ifdef TATAMI_LAYERED_HAS_MMAP
+        my_fd = ::open(my_path.c_str(), O_RDONLY);
+        if (my_fd < 0) {
+            throw std::runtime_error("failed to open '" + my_path + "' for reading");
+        }
+
+        struct stat info;
+        if (::fstat(my_fd, &info) != 0) {
+            ::close(my_fd);
+            throw std::runtime_error("failed to determine the size of '" + my_path + "'");
+        }
+        my_size = info.st_size;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (pattern == AccessPattern::SEQUENTIAL) {
+            ::posix_fadvise(my_fd, 0, 0, POSIX_FADV_SEQUENTIAL); // advisory only, so failures are ignored.
+        } else if (pattern == AccessPattern::RANDOM) {
+            ::posix_fadvise(my_fd, 0, 0, POSIX_FADV_RANDOM);
+        }
+#else
+        (void)pattern;
+#endif
+
+#else
+        (void)pattern;
+        std::ifstream stream(my_path, std::ios::binary | std::ios::ate);
+        if (!stream) {
+            throw std::runtime_error("failed to open '" + my_path + "' for reading");
+        }
+        my_size = sanisizer::cast<std::size_t>(static_cast<std::streamoff>(stream.tellg()));
+#endif
+    }
+
+    ~ChunkFile() {
+#ifdef TATAMI_LAYERED_HAS_MMAP
+        ::close(my_fd);
+#endif
+    }
+
+    ChunkFile(const ChunkFile&) = delete;
+    ChunkFile& operator=(const ChunkFile&) = delete;
+
+public:
+    std::size_t size() const {
+        return my_size;
+    }
+
+    // Safe to call from multiple threads.
+    void read(std::size_t offset, std::size_t bytes, unsigned char* output) const {
+        if (offset > my_size || bytes > my_size - offset) {
+            throw std::runtime_error("layered matrix file is truncated");
+        }
+
+#ifdef TATAMI_LAYERED_HAS_MMAP
+        while (bytes) {
+            const auto got = ::pread(my_fd, output, bytes, offset);
+            if (got <= 0) {
+                throw std::runtime_error("failed to read from '" + my_path + "'");
+            }
+            output += got;
+            offset += got;
+            bytes -= got;
+        }
+#else
+        std::ifstream stream(my_path, std::ios::binary);
+        stream.seekg(offset);
+        stream.read(reinterpret_cast<char*>(output), bytes);
+        if (!stream) {
+            throw std::runtime_error("failed to read from '" + my_path + "'");
+        }
+#endif
+    }
+
+private:
+    std::string my_path;
+    std::size_t my_size = 0;
+#ifdef TATAMI_LAYERED_HAS_MMAP
+    int my_fd = -1;
+#endif
+};
+
+template<typename Index_, typename ColumnIndex_>
+class FileLoader {
+public:
+    FileLoader(std::string path, const AccessPattern pattern, const bool validate) :
+        my_file(std::make_shared<const ChunkFile>(std::move(path), pattern)),
+        my_validate(validate)
+    {
+        my_summary = std::make_shared<const load_layered_sparse_internal::FileSummary>(
+            load_layered_sparse_internal::read_summary<ColumnIndex_>([&](const std::size_t offset, const std::size_t bytes, void* output) -> void {
+                my_file->read(offset, bytes, static_cast<unsigned char*>(output));
+            }, my_file->size())
+        );
+    }
+
+public:
+    const load_layered_sparse_internal::FileSummary& summary() const {
+        return *my_summary;
+    }
+
+    std::vector<std::size_t> chunk_bytes() const {
+        const std::size_t nchunks = my_summary->num_chunks();
+        auto output = sanisizer::create<std::vector<std::size_t> >(nchunks);
+        for (std::size_t c = 0; c < nchunks; ++c) {
+            output[c] = my_summary->data_size(c);
+        }
+        return output;
+    }
+
+    LayeredChunk<Index_, ColumnIndex_> operator()(const std::size_t c) const {
+        const auto size = my_summary->data_size(c);
+        auto arena = std::make_shared<const LayerArena>(size, false);
+        my_file->read(my_summary->data_offset(c), size, arena->data());
+        const auto data = arena->data();
+        return load_layered_sparse_internal::attach_chunk<Index_, ColumnIndex_>(*my_summary, c, data, std::move(arena), my_validate);
+    }
+
+private:
+    std::shared_ptr<const ChunkFile> my_file;
+    std::shared_ptr<const load_layered_sparse_internal::FileSummary> my_summary;
+    bool my_validate;
+};
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @brief Layered sparse matrix that loads chunks from disk on demand.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices within each chunk.
+ * This should be the same as that used to save the file.
+ *
+ * This class provides access to a layered sparse matrix in a file created by `save_layered_sparse()`, without loading the entire matrix into memory.
+ * Each chunk's data section is read from disk when it is first needed and stored in the cache described in `CachedLayeredSparseMatrix`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_ = std::uint16_t>
+class OutOfCoreLayeredSparseMatrix final : public CachedLayeredSparseMatrix<Value_, Index_, ColumnIndex_, OutOfCoreLayeredSparseMatrix_internal::FileLoader<Index_, ColumnIndex_> > {
+private:
+    typedef OutOfCoreLayeredSparseMatrix_internal::FileLoader<Index_, ColumnIndex_> Loader;
+    typedef CachedLayeredSparseMatrix<Value_, Index_, ColumnIndex_, Loader> Base;
+
+    OutOfCoreLayeredSparseMatrix(const Loader& loader, const std::size_t cache_size) :
+        Base(
+            sanisizer::cast<Index_>(loader.summary().nrow),
+            sanisizer::cast<Index_>(loader.summary().ncol),
+            sanisizer::cast<Index_>(loader.summary().chunk_size),
+            std::make_shared<ChunkCache<Index_, ColumnIndex_, Loader> >(loader, loader.chunk_bytes(), cache_size)
+        )
+    {
+        if (!sanisizer::is_equal(loader.summary().num_chunks(), this->num_chunks())) {
+            throw std::runtime_error("number of chunks is not consistent with the number of columns and the chunk size");
+        }
+    }
+
+public:
+    /**
+     * @param path Path to a file created by `save_layered_sparse()`.
+     * @param options Further options.
+     */
+    OutOfCoreLayeredSparseMatrix(std::string path, const OutOfCoreLayeredSparseMatrixOptions& options) :
+        OutOfCoreLayeredSparseMatrix(Loader(std::move(path), options.access_pattern, options.validate), options.cache_size)
+    {}
+};
+
+}
+
+#endif
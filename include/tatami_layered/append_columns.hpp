@@ -0,0 +1,240 @@
+#ifndef TATAMI_LAYERED_APPEND_COLUMNS_HPP
+#define TATAMI_LAYERED_APPEND_COLUMNS_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file append_columns.hpp
+ * @brief Append columns to a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `append_columns()`.
+ */
+struct AppendColumnsOptions {
+    /**
+     * Number of threads to use.
+     * This should be a positive integer.
+     */
+    int num_threads = 1;
+
+    /**
+     * Maximum relative error for non-integer values in the new batch, see `ConvertToLayeredSparseOptions::tolerance` for details.
+     * Values that are already stored in the last chunk of the matrix are always kept exactly.
+     */
+    double tolerance = 0;
+
+    /**
+     * Whether to request transparent huge pages for the storage of each new chunk's layers,
+     * see `ConvertToLayeredSparseOptions::huge_pages` for details.
+     */
+    bool huge_pages = false;
+
+    /**
+     * Whether to store rows of the new chunks in the dictionary-coded layer, see `ConvertToLayeredSparseOptions::dictionary`.
+     * This should generally be the same as the option used to create `mat`,
+     * as any dictionary-coded rows in the last chunk of `mat` are otherwise decoded into the other layers when that chunk is combined with the new batch.
+     */
+    bool dictionary = false;
+
+    /**
+     * Whether to store rows of the new chunks in the escaped layer, see `ConvertToLayeredSparseOptions::outliers`.
+     * As with `dictionary`, this should generally be the same as the option used to create `mat`.
+     */
+    bool outliers = false;
+};
+
+/**
+ * @cond
+ */
+namespace append_columns_internal {
+
+// Calls 'fun' on each non-zero element of 'row' in the trailing columns, i.e., the leftover columns of the last chunk of 'mat' followed by the columns of 'batch'.
+// Column indices are relative to the start of the trailing columns, and the last argument of 'fun' is true for values from the leftover columns.
+template<typename Index_, typename ColumnIndex_, typename ValueIn_, typename IndexIn_, class Function_>
+void scan_trailing_row(
+    const LayeredChunk<Index_, ColumnIndex_>* leftover,
+    const Index_ num_leftover,
+    const Index_ row,
+    const bool sparse,
+    tatami::MyopicDenseExtractor<ValueIn_, IndexIn_>* dext,
+    tatami::MyopicSparseExtractor<ValueIn_, IndexIn_>* sext,
+    const IndexIn_ batch_ncol,
+    std::vector<ValueIn_>& vbuffer,
+    std::vector<IndexIn_>& ibuffer,
+    Function_ fun)
+{
+    if (leftover) {
+        visit_row_segment(*leftover, row, [&](const ColumnIndex_* indices, const auto values, const std::size_t number) -> void {
+            for (std::size_t i = 0; i < number; ++i) {
+                fun(static_cast<Index_>(indices[i]), values[i], true);
+            }
+        });
+    }
+
+    if (sparse) {
+        const auto range = sext->fetch(row, vbuffer.data(), ibuffer.data());
+        for (IndexIn_ i = 0; i < range.number; ++i) {
+            if (range.value[i]) {
+                fun(static_cast<Index_>(num_leftover + range.index[i]), range.value[i], false);
+            }
+        }
+    } else {
+        const auto ptr = dext->fetch(row, vbuffer.data());
+        for (IndexIn_ c = 0; c < batch_ncol; ++c) {
+            if (ptr[c]) {
+                fun(static_cast<Index_>(num_leftover + c), ptr[c], false);
+            }
+        }
+    }
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Append new columns to a layered sparse matrix, e.g., when a new batch of cells is available.
+ * The new columns are first used to fill the last chunk of `mat` up to its chunk size, after which new chunks are created as described in `convert_to_layered_sparse()`.
+ * All other chunks of `mat` are shared with the output matrix without any copying, so the cost of this function is proportional to the size of the new batch and the last chunk.
+ *
+ * The new columns are extracted by row from `batch`, so it is most efficient if `batch` is row-major.
+ * An error is thrown if `mat` has a fused transformation, see `LayeredSparseMatrix::fuse_transform()`.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam ValueIn_ Type of data value for the new batch.
+ * @tparam IndexIn_ Integer type for the row/column indices of the new batch.
+ *
+ * @param mat A layered sparse matrix.
+ * @param batch A `tatami::Matrix` with the same number of rows as `mat`.
+ * @param options Further options.
+ *
+ * @return A new `LayeredSparseMatrix` containing the columns of `mat` followed by the columns of `batch`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, typename ValueIn_, typename IndexIn_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > append_columns(
+    const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat,
+    const tatami::Matrix<ValueIn_, IndexIn_>& batch,
+    const AppendColumnsOptions& options)
+{
+    if (mat.get_fused_transform()) {
+        throw std::runtime_error("cannot append columns to a layered matrix with a fused transformation");
+    }
+    const Index_ NR = mat.nrow();
+    if (!sanisizer::is_equal(batch.nrow(), NR)) {
+        throw std::runtime_error("number of rows in the new batch should be equal to that of the layered matrix");
+    }
+
+    const Index_ old_NC = mat.ncol();
+    const IndexIn_ batch_NC = batch.ncol();
+    const Index_ new_NC = sanisizer::sum<Index_>(old_NC, batch_NC);
+    const Index_ chunk_size = mat.get_chunk_size();
+    const auto& old_chunks = mat.get_chunks();
+    if (batch_NC == 0) {
+        return std::make_shared<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(NR, old_NC, chunk_size, old_chunks, false);
+    }
+
+    // Full chunks are re-used as-is, while the leftover columns of the last chunk are combined with the new batch.
+    const Index_ num_full = old_NC / chunk_size;
+    const Index_ num_leftover = old_NC % chunk_size;
+    const LayeredChunk<Index_, ColumnIndex_>* leftover = (num_leftover ? &(old_chunks[num_full]) : NULL);
+    const Index_ num_trailing = sanisizer::sum<Index_>(num_leftover, batch_NC);
+    const Index_ num_new_chunks = num_trailing / chunk_size + (num_trailing % chunk_size != 0);
+    auto new_chunks = tatami::create_container_of_Index_size<std::vector<LayeredChunk<Index_, ColumnIndex_> > >(num_new_chunks);
+
+    const bool sparse = batch.is_sparse();
+    auto process_rows = [&](const Index_ start, const Index_ length, const bool ordered, auto fun) -> void {
+        std::unique_ptr<tatami::MyopicDenseExtractor<ValueIn_, IndexIn_> > dext;
+        std::unique_ptr<tatami::MyopicSparseExtractor<ValueIn_, IndexIn_> > sext;
+        auto vbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(batch_NC);
+        std::vector<IndexIn_> ibuffer;
+        if (sparse) {
+            tatami::Options opt;
+            opt.sparse_ordered_index = ordered;
+            sext = batch.sparse(true, opt);
+            tatami::resize_container_to_Index_size(ibuffer, batch_NC);
+        } else {
+            dext = batch.dense(true, tatami::Options());
+        }
+
+        for (Index_ r = start, end = start + length; r < end; ++r) {
+            append_columns_internal::scan_trailing_row(leftover, num_leftover, r, sparse, dext.get(), sext.get(), batch_NC, vbuffer, ibuffer, [&](const Index_ col, const auto val, const bool existing) -> void {
+                fun(r, col, val, existing);
+            });
+        }
+    };
+
+    // First pass to define the allocations.
+    {
+        auto pass = create_first_pass<Index_>(num_new_chunks, NR, options.outliers);
+        auto& num_per_chunk = pass.num_per_chunk;
+        std::mutex lock;
+
+        tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+            RowRangeSummaries summaries(pass.summary_per_chunk, start, length);
+            process_rows(start, length, false, [&](const Index_ r, const Index_ col, const auto val, const bool existing) -> void {
+                const auto chunk = col / chunk_size;
+                summaries.add(chunk, r, val, existing ? 0.0 : options.tolerance); // existing values must not be downgraded to a lossier layer.
+                ++num_per_chunk[chunk][r];
+            });
+            summaries.finish(lock);
+        }, NR, options.num_threads);
+
+        allocate_rows(pass.summary_per_chunk, num_per_chunk, new_chunks, options.huge_pages);
+    }
+
+    // Second pass to actually fill the vectors.
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        auto output_positions = tatami::create_container_of_Index_size<std::vector<std::size_t> >(num_new_chunks);
+        Index_ last_row = start;
+        for (Index_ chunk = 0; chunk < num_new_chunks; ++chunk) {
+            output_positions[chunk] = get_sparse_ptr(new_chunks, chunk, start);
+        }
+
+        process_rows(start, length, true, [&](const Index_ r, const Index_ col, const auto val, const bool) -> void {
+            if (r != last_row) {
+                for (Index_ chunk = 0; chunk < num_new_chunks; ++chunk) {
+                    output_positions[chunk] = get_sparse_ptr(new_chunks, chunk, r);
+                }
+                last_row = r;
+            }
+            const Index_ chunk = col / chunk_size;
+            fill_sparse_value(new_chunks, chunk, r, col % chunk_size, val, output_positions[chunk]++);
+        });
+    }, NR, options.num_threads);
+
+    if (options.dictionary) {
+        encode_dictionaries(new_chunks, options.huge_pages, options.num_threads);
+    }
+
+    share_row_codes(new_chunks);
+
+    std::vector<LayeredChunk<Index_, ColumnIndex_> > chunks;
+    chunks.reserve(sanisizer::sum<std::size_t>(num_full, num_new_chunks));
+    chunks.insert(chunks.end(), old_chunks.begin(), old_chunks.begin() + num_full);
+    for (auto& chunk : new_chunks) {
+        chunks.push_back(std::move(chunk));
+    }
+
+    return std::make_shared<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(NR, new_NC, chunk_size, std::move(chunks), false);
+}
+
+}
+
+#endif
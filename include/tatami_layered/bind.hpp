@@ -0,0 +1,397 @@
+#ifndef TATAMI_LAYERED_BIND_HPP
+#define TATAMI_LAYERED_BIND_HPP
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file bind.hpp
+ * @brief Combine layered sparse matrices by row or column.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `cbind()` and `rbind()`.
+ */
+struct BindOptions {
+    /**
+     * Number of threads to use.
+     * This should be a positive integer.
+     */
+    int num_threads = 1;
+
+    /**
+     * Whether to request transparent huge pages for the storage of each new chunk's layers,
+     * see `ConvertToLayeredSparseOptions::huge_pages` for details.
+     */
+    bool huge_pages = false;
+
+    /**
+     * Whether to store rows of the assembled chunks in the dictionary-coded layer, see `ConvertToLayeredSparseOptions::dictionary`.
+     * This should generally be the same as the option used to create the input matrices, as their dictionary-coded rows are otherwise decoded into the other layers.
+     */
+    bool dictionary = false;
+
+    /**
+     * Whether to store rows of the assembled chunks in the escaped layer, see `ConvertToLayeredSparseOptions::outliers`.
+     * As with `dictionary`, this should generally be the same as the option used to create the input matrices.
+     */
+    bool outliers = false;
+};
+
+/**
+ * @cond
+ */
+namespace bind_internal {
+
+template<typename Value_, typename Index_, typename ColumnIndex_>
+void check_inputs(const std::vector<std::shared_ptr<const LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > >& mats) {
+    if (mats.empty()) {
+        throw std::runtime_error("at least one layered matrix should be supplied for binding");
+    }
+    for (const auto& m : mats) {
+        if (m->get_fused_transform()) {
+            throw std::runtime_error("cannot bind layered matrices with a fused transformation");
+        }
+    }
+}
+
+// Columns [start, end) of input chunk 'chunk' of matrix 'matrix', to be stored at local columns [offset, offset + end - start) of an output chunk.
+template<typename Index_>
+struct Segment {
+    std::size_t matrix;
+    Index_ chunk;
+    Index_ start;
+    Index_ end;
+    Index_ offset;
+};
+
+// Combines the columns of all 'mats' into chunks of 'chunk_size' columns.
+// Input chunks that map exactly onto an output chunk are re-used if the column index types are the same, otherwise they are assembled from the relevant segments.
+template<typename OutColumnIndex_, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<LayeredChunk<Index_, OutColumnIndex_> > combine_columns(
+    const std::vector<const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>*>& mats,
+    const Index_ NR,
+    const Index_ NC,
+    const Index_ chunk_size,
+    const int num_threads,
+    const bool huge_pages,
+    const bool dictionary,
+    const bool outliers)
+{
+    // Splitting each input chunk at the output chunk boundaries.
+    const Index_ num_chunks = sanisizer::max(1, NC / chunk_size + (NC % chunk_size != 0)); // a matrix always has at least one chunk, even if it is empty.
+    auto segments = tatami::create_container_of_Index_size<std::vector<std::vector<Segment<Index_> > > >(num_chunks);
+    Index_ global_start = 0;
+    for (std::size_t m = 0, nmats = mats.size(); m < nmats; ++m) {
+        const auto& current = *(mats[m]);
+        const Index_ in_chunk_size = current.get_chunk_size();
+        const Index_ in_num_chunks = current.num_chunks();
+        for (Index_ ic = 0; ic < in_num_chunks; ++ic) {
+            const Index_ chunk_start = global_start + ic * in_chunk_size;
+            const Index_ chunk_end = chunk_start + current.chunk_extent(ic);
+            Index_ pos = chunk_start;
+            while (pos < chunk_end) {
+                const Index_ oc = pos / chunk_size;
+                const Index_ oc_start = oc * chunk_size;
+                const Index_ seg_end = oc_start + std::min(chunk_size, chunk_end - oc_start);
+                segments[oc].push_back({ m, ic, static_cast<Index_>(pos - chunk_start), static_cast<Index_>(seg_end - chunk_start), static_cast<Index_>(pos - oc_start) });
+                pos = seg_end;
+            }
+        }
+        global_start += current.ncol();
+    }
+
+    // Output chunks that correspond exactly to an input chunk are re-used; all others need to be assembled.
+    std::vector<LayeredChunk<Index_, OutColumnIndex_> > chunks;
+    chunks.reserve(num_chunks);
+    std::vector<Index_> rebuild;
+    for (Index_ oc = 0; oc < num_chunks; ++oc) {
+        const auto& segs = segments[oc];
+        const Index_ extent = std::min(chunk_size, NC - oc * chunk_size);
+        if constexpr(std::is_same<ColumnIndex_, OutColumnIndex_>::value) {
+            if (segs.size() == 1) {
+                const auto& s = segs.front();
+                const auto& input = *(mats[s.matrix]);
+                if (s.start == 0 && s.end == extent && input.chunk_extent(s.chunk) == extent) {
+                    chunks.push_back(input.get_chunks()[s.chunk]);
+                    continue;
+                }
+            }
+        }
+        chunks.emplace_back();
+        rebuild.push_back(oc);
+    }
+
+    const Index_ num_rebuild = rebuild.size();
+    if (num_rebuild) {
+        auto new_chunks = tatami::create_container_of_Index_size<std::vector<LayeredChunk<Index_, OutColumnIndex_> > >(num_rebuild);
+
+        auto visit_segments = [&](const Index_ k, const Index_ r, auto fun) -> void {
+            for (const auto& s : segments[rebuild[k]]) {
+                const auto& input = *(mats[s.matrix]);
+                const auto& chunk = input.get_chunks()[s.chunk];
+                const Index_ extent = input.chunk_extent(s.chunk);
+                const auto category = row_code_category((*(chunk.codes))[r]);
+                const bool whole = (s.start == 0 && s.end == extent);
+                visit_row_segment(chunk, r, s.start, s.end, [&](const auto* indices, const auto values, const std::size_t number) -> void {
+                    fun(s, category, whole, indices, values, number);
+                });
+            }
+        };
+
+        // First pass to define the allocations.
+        {
+            auto pass = create_first_pass<std::size_t>(num_rebuild, NR, outliers);
+            auto& num_per_chunk = pass.num_per_chunk;
+            std::mutex lock;
+
+            tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+                RowRangeSummaries summaries(pass.summary_per_chunk, start, length);
+                for (Index_ k = 0; k < num_rebuild; ++k) {
+                    auto& current_num = num_per_chunk[k];
+                    for (Index_ r = start, end = start + length; r < end; ++r) {
+                        visit_segments(k, r, [&](const auto&, const Category category, const bool whole, const auto*, const auto values, const std::size_t number) -> void {
+                            if (number) {
+                                // Whole segments in the floating-point layers can re-use their category, as any integers must already be exactly representable in that layer.
+                                // All other segments are rescanned, which only involves the range of the values for integer layers.
+                                if (whole && is_floating_category(category)) {
+                                    add_floating_to_extras(summaries.get_extras(k, r), category);
+                                } else {
+                                    for (std::size_t i = 0; i < number; ++i) {
+                                        summaries.add(k, r, values[i]);
+                                    }
+                                }
+                                current_num[r] += number;
+                            }
+                        });
+                    }
+                }
+                summaries.finish(lock);
+            }, NR, num_threads);
+
+            allocate_rows(pass.summary_per_chunk, num_per_chunk, new_chunks, huge_pages);
+        }
+
+        // Second pass to actually fill the vectors.
+        tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+            for (Index_ k = 0; k < num_rebuild; ++k) {
+                for (Index_ r = start, end = start + length; r < end; ++r) {
+                    auto position = get_sparse_ptr(new_chunks, k, r);
+                    visit_segments(k, r, [&](const auto& s, const Category, const bool, const auto* indices, const auto values, const std::size_t number) -> void {
+                        for (std::size_t i = 0; i < number; ++i) {
+                            fill_sparse_value(new_chunks, k, r, static_cast<Index_>(s.offset + (indices[i] - s.start)), values[i], position++);
+                        }
+                    });
+                }
+            }
+        }, NR, num_threads);
+
+        if (dictionary) {
+            encode_dictionaries(new_chunks, huge_pages, num_threads);
+        }
+
+        for (Index_ k = 0; k < num_rebuild; ++k) {
+            chunks[rebuild[k]] = std::move(new_chunks[k]);
+        }
+        share_row_codes(chunks);
+    }
+
+    return chunks;
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Combine layered sparse matrices by column, i.e., the columns of `mats[1]` are placed after those of `mats[0]`, and so on.
+ * The output matrix uses the chunk size of `mats[0]`.
+ * Chunks of the input matrices are shared with the output matrix without any copying if their boundaries line up with those of the output chunks,
+ * e.g., if all matrices have the same chunk size and all but the last matrix have a number of columns that is a multiple of the chunk size.
+ * Other output chunks are assembled from the relevant segments of the input chunks,
+ * where the layer of each row is chosen again as described in `convert_to_layered_sparse()`, subject to `BindOptions::dictionary` and `BindOptions::outliers`.
+ *
+ * An error is thrown if any matrix has a fused transformation, see `LayeredSparseMatrix::fuse_transform()`.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mats Vector of pointers to layered sparse matrices with the same number of rows.
+ * This should contain at least one matrix.
+ * @param options Further options.
+ *
+ * @return A new `LayeredSparseMatrix` containing the columns of all matrices in `mats`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > cbind(
+    const std::vector<std::shared_ptr<const LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > >& mats,
+    const BindOptions& options)
+{
+    bind_internal::check_inputs(mats);
+    const Index_ NR = mats.front()->nrow();
+    const Index_ chunk_size = mats.front()->get_chunk_size();
+    Index_ NC = 0;
+    for (const auto& m : mats) {
+        if (m->nrow() != NR) {
+            throw std::runtime_error("all layered matrices should have the same number of rows for 'cbind'");
+        }
+        NC = sanisizer::sum<Index_>(NC, m->ncol());
+    }
+
+    std::vector<const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>*> ptrs;
+    ptrs.reserve(mats.size());
+    for (const auto& m : mats) {
+        ptrs.push_back(m.get());
+    }
+    auto chunks = bind_internal::combine_columns<ColumnIndex_>(ptrs, NR, NC, chunk_size, options.num_threads, options.huge_pages, options.dictionary, options.outliers);
+
+    return std::make_shared<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(NR, NC, chunk_size, std::move(chunks), false);
+}
+
+/**
+ * Combine layered sparse matrices by row, i.e., the rows of `mats[1]` are placed after those of `mats[0]`, and so on.
+ * For each chunk, the rows of each layer of the input matrices are concatenated to form the corresponding layer of the output chunk,
+ * and the in-layer positions of each row are shifted accordingly.
+ * This does not require any decoding or re-categorization of the individual values.
+ *
+ * All matrices should have the same chunk size so that their chunks cover the same columns, see `rechunk()` to change the chunk size of a matrix if this is not the case.
+ * An error is thrown if any matrix has a fused transformation, see `LayeredSparseMatrix::fuse_transform()`.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mats Vector of pointers to layered sparse matrices with the same number of columns and chunk size.
+ * This should contain at least one matrix.
+ * @param options Further options.
+ *
+ * @return A new `LayeredSparseMatrix` containing the rows of all matrices in `mats`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > rbind(
+    const std::vector<std::shared_ptr<const LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > >& mats,
+    const BindOptions& options)
+{
+    bind_internal::check_inputs(mats);
+    const Index_ NC = mats.front()->ncol();
+    const Index_ chunk_size = mats.front()->get_chunk_size();
+    Index_ NR = 0;
+    for (const auto& m : mats) {
+        if (m->ncol() != NC) {
+            throw std::runtime_error("all layered matrices should have the same number of columns for 'rbind'");
+        }
+        if (m->get_chunk_size() != chunk_size) {
+            throw std::runtime_error("all layered matrices should have the same chunk size for 'rbind'");
+        }
+        NR = sanisizer::sum<Index_>(NR, m->nrow());
+    }
+    if (sanisizer::is_greater_than(NR, max_row_code_rows)) {
+        throw std::runtime_error("number of rows is too large for a layered matrix");
+    }
+
+    const Index_ num_chunks = mats.front()->num_chunks();
+    auto chunks = tatami::create_container_of_Index_size<std::vector<LayeredChunk<Index_, ColumnIndex_> > >(num_chunks);
+
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        for (Index_ c = start, end = start + length; c < end; ++c) {
+            auto& output = chunks[c];
+            std::array<std::size_t, num_categories> num_rows{}, num_nonzero{};
+            std::size_t num_entries = 0, num_escapes = 0;
+            for (const auto& m : mats) {
+                const auto& input = m->get_chunks()[c];
+                for_each_layer(input, [&](const Category cat, const auto& layer) -> void {
+                    const auto i = static_cast<std::size_t>(cat);
+                    num_rows[i] += layer.num_rows;
+                    num_nonzero[i] = sanisizer::sum<std::size_t>(num_nonzero[i], layer.num_nonzero());
+                });
+                num_entries = sanisizer::sum<std::size_t>(num_entries, layer_num_entries(input));
+                num_escapes = sanisizer::sum<std::size_t>(num_escapes, layer_num_escapes(input));
+            }
+
+            const auto offsets = define_layer_offsets<ColumnIndex_>(num_rows, num_nonzero, num_entries, num_escapes);
+            auto arena = std::make_shared<const LayerArena>(offsets.total, options.huge_pages);
+            attach_layers(output, offsets, arena->data());
+            output.storage = std::move(arena);
+            for_each_layer(output, [&](const Category, auto& layer) -> void {
+                layer.num_rows = 0;
+                writable_array(layer.ptr)[0] = 0;
+            });
+            writable_array(output.stored8.table_ptr)[0] = 0;
+            writable_array(output.storee8.escape_ptr)[0] = 0;
+
+            auto codes = tatami::create_container_of_Index_size<std::vector<RowCode> >(NR);
+            auto cIt = codes.begin();
+
+            for (const auto& m : mats) {
+                const auto& input = m->get_chunks()[c];
+
+                // Shifting each row's position by the number of rows already in its layer.
+                const auto shift = layer_num_rows(output);
+                for (auto code : *(input.codes)) {
+                    const auto cat = row_code_category(code);
+                    *cIt = pack_row_code(cat, row_code_position(code) + shift[static_cast<int>(cat)]);
+                    ++cIt;
+                }
+
+                auto append = [&](auto& out, const auto& in) -> void {
+                    if constexpr(I<decltype(in)>::dictionary) {
+                        const auto table_base = out.num_entries();
+                        const auto table_ptr = writable_array(out.table_ptr) + out.num_rows;
+                        for (std::size_t i = 0; i < in.num_rows; ++i) {
+                            table_ptr[i + 1] = table_base + in.table_ptr[i + 1];
+                        }
+                        std::copy_n(in.table, in.num_entries(), writable_array(out.table) + table_base);
+                    }
+                    if constexpr(I<decltype(in)>::escaped) {
+                        const auto escape_base = out.num_escapes();
+                        const auto escape_ptr = writable_array(out.escape_ptr) + out.num_rows;
+                        for (std::size_t i = 0; i < in.num_rows; ++i) {
+                            escape_ptr[i + 1] = escape_base + in.escape_ptr[i + 1];
+                        }
+                        std::copy_n(in.escape_index, in.num_escapes(), writable_array(out.escape_index) + escape_base);
+                        std::copy_n(in.escape_value, in.num_escapes(), writable_array(out.escape_value) + escape_base);
+                    }
+
+                    const auto base = out.num_nonzero();
+                    const auto ptr = writable_array(out.ptr) + out.num_rows;
+                    for (std::size_t i = 0; i < in.num_rows; ++i) {
+                        ptr[i + 1] = base + in.ptr[i + 1];
+                    }
+                    const auto nnz = in.num_nonzero();
+                    if (nnz) {
+                        std::memcpy(writable_array(out.index) + base, in.index, nnz * sizeof(ColumnIndex_));
+                        std::memcpy(writable_array(out.value) + base, in.value, nnz * sizeof(*(in.value)));
+                    }
+                    out.num_rows += in.num_rows;
+                };
+                for_each_layer_pair(output, input, append);
+            }
+
+            output.codes = std::make_shared<const std::vector<RowCode> >(std::move(codes));
+        }
+    }, num_chunks, options.num_threads);
+
+    share_row_codes(chunks);
+    return std::make_shared<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(NR, NC, chunk_size, std::move(chunks), false);
+}
+
+}
+
+#endif
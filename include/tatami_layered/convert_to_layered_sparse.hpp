@@ -6,15 +6,20 @@
 #include <memory>
 #include <limits>
 #include <algorithm>
+#include <mutex>
 
 #include "tatami/tatami.hpp"
 #include "sanisizer/sanisizer.hpp"
 
 #include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+#include "Instrumentation.hpp"
+#include "LayerComposition.hpp"
+#include "MemoryEstimate.hpp"
 
 /**
  * @file convert_to_layered_sparse.hpp
- * @brief Create a layered sparse matrix for non-negative integers.
+ * @brief Create a layered sparse matrix.
  */
 
 namespace tatami_layered {
@@ -22,91 +27,196 @@ namespace tatami_layered {
 /**
  * @cond
  */
-template<typename ColIndex_, typename ValueOut_ = double, typename IndexOut_ = int, typename ValueIn_, typename IndexIn_>
-std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_row(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const IndexIn_ chunk_size, const int nthreads) {
+// First pass to determine the layer and number of non-zero elements for each row in each chunk.
+template<typename ValueIn_, typename IndexIn_>
+FirstPass<IndexIn_> scan_by_row(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const IndexIn_ chunk_size, const IndexIn_ nchunks, const int nthreads, const double tolerance, const bool outliers) {
     const auto NR = mat.nrow(), NC = mat.ncol();
-    const IndexIn_ leftovers = NC % chunk_size;
-    const IndexIn_ nchunks = sanisizer::max(1, NC / chunk_size + (leftovers != 0));
+    auto output = create_first_pass<IndexIn_>(nchunks, NR, outliers);
+    auto& num_per_chunk = output.num_per_chunk;
+    std::mutex lock;
 
-    auto store8  = tatami::create_container_of_Index_size<std::vector<Holder< std::uint8_t, IndexOut_, ColIndex_> > >(nchunks);
-    auto store16 = tatami::create_container_of_Index_size<std::vector<Holder<std::uint16_t, IndexOut_, ColIndex_> > >(nchunks);
-    auto store32 = tatami::create_container_of_Index_size<std::vector<Holder<std::uint32_t, IndexOut_, ColIndex_> > >(nchunks);
+    if (mat.sparse()) {
+        tatami::parallelize([&](const int, const IndexIn_ start, const IndexIn_ length) -> void {
+            auto ext = tatami::consecutive_extractor<true>(mat, true, start, length, [&]{
+                tatami::Options opt;
+                opt.sparse_ordered_index = false;
+                return opt;
+            }());
+            auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NC);
+            auto ibuffer = tatami::create_container_of_Index_size<std::vector<IndexIn_> >(NC);
+            RowRangeSummaries summaries(output.summary_per_chunk, start, length);
+
+            for (IndexIn_ r = start, end = start + length; r < end; ++r) {
+                const auto range = ext->fetch(r, dbuffer.data(), ibuffer.data());
+                if (nchunks == 1) {
+                    // All values belong to the same chunk, so we can skip the chunk lookup for each value.
+                    num_per_chunk[0][r] += summaries.add_run(0, r, range.value, range.number, tolerance);
+                    continue;
+                }
+                for (IndexIn_ i = 0; i < range.number; ++i) {
+                    if (range.value[i]) {
+                        const auto chunk = range.index[i] / chunk_size;
+                        summaries.add(chunk, r, range.value[i], tolerance);
+                        ++num_per_chunk[chunk][r];
+                    }
+                }
+            }
 
-    auto identities8  = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
-    auto identities16 = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
-    auto identities32 = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
+            summaries.finish(lock);
+        }, NR, nthreads);
 
-    auto assigned_position = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
-    auto assigned_category = tatami::create_container_of_Index_size<std::vector<std::vector<Category> > >(nchunks);
+    } else {
+        tatami::parallelize([&](const int, const IndexIn_ start, const IndexIn_ length) -> void {
+            auto ext = tatami::consecutive_extractor<false>(mat, true, start, length);
+            auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NC);
+            RowRangeSummaries summaries(output.summary_per_chunk, start, length);
+
+            for (IndexIn_ r = start, end = start + length; r < end; ++r) {
+                auto ptr = ext->fetch(r, dbuffer.data());
+                for (IndexIn_ chunk = 0; chunk < nchunks; ++chunk) {
+                    const IndexIn_ first = chunk * chunk_size;
+                    const IndexIn_ number = std::min(chunk_size, static_cast<IndexIn_>(NC - first));
+                    num_per_chunk[chunk][r] += summaries.add_run(chunk, r, ptr + first, number, tolerance);
+                }
+            }
 
-    // First pass to define the allocations.
-    {
-        auto max_per_chunk = tatami::create_container_of_Index_size<std::vector<std::vector<Category> > >(nchunks);
-        for (auto& x : max_per_chunk) {
-            tatami::resize_container_to_Index_size(x, NR);
-        }
+            summaries.finish(lock);
+        }, NR, nthreads);
+    }
 
-        auto num_per_chunk = tatami::create_container_of_Index_size<std::vector<std::vector<IndexIn_> > >(nchunks);
-        for (auto& x : num_per_chunk) {
-            tatami::resize_container_to_Index_size(x, NR);
-        }
+    return output;
+}
 
-        if (mat.sparse()) {
-            tatami::parallelize([&](const int, const IndexIn_ start, const IndexIn_ length) -> void {
-                auto ext = tatami::consecutive_extractor<true>(mat, true, start, length, [&]{
-                    tatami::Options opt;
-                    opt.sparse_ordered_index = false;
-                    return opt;
-                }());
-                auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NC);
-                auto ibuffer = tatami::create_container_of_Index_size<std::vector<IndexIn_> >(NC);
+template<typename ValueIn_, typename IndexIn_>
+FirstPass<IndexIn_> scan_by_column(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const IndexIn_ chunk_size, const IndexIn_ nchunks, const int nthreads, const double tolerance, const bool outliers) {
+    const auto NR = mat.nrow(), NC = mat.ncol();
 
-                for (IndexIn_ r = start, end = start + length; r < end; ++r) {
-                    const auto range = ext->fetch(r, dbuffer.data(), ibuffer.data());
-                    for (IndexIn_ i = 0; i < range.number; ++i) {
-                        if (range.value[i]) {
-                            const auto chunk = range.index[i] / chunk_size;
-                            const auto cat = categorize(range.value[i]);
-                            max_per_chunk[chunk][r] = std::max(max_per_chunk[chunk][r], cat);
-                            ++num_per_chunk[chunk][r];
-                        }
+    // Each thread holds its own copy of the first pass, as the same row is visited by multiple threads.
+    auto threaded = sanisizer::create<std::vector<FirstPass<IndexIn_> > >(nthreads);
+    for (auto& x : threaded) {
+        x = create_first_pass<IndexIn_>(nchunks, NR, outliers);
+    }
+
+    if (mat.sparse()) {
+        tatami::parallelize([&](const int t, const IndexIn_ start, const IndexIn_ length) -> void {
+            auto ext = tatami::consecutive_extractor<true>(mat, false, start, length, [&]{
+                tatami::Options opt;
+                opt.sparse_ordered_index = false;
+                return opt;
+            }());
+            auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NR);
+            auto ibuffer = tatami::create_container_of_Index_size<std::vector<IndexIn_> >(NR);
+            auto& current = threaded[t];
+
+            for (IndexIn_ c = start, end = start + length; c < end; ++c) {
+                const auto range = ext->fetch(c, dbuffer.data(), ibuffer.data());
+                const auto chunk = c / chunk_size;
+                auto& summary = current.summary_per_chunk[chunk];
+                auto& num_vec = current.num_per_chunk[chunk];
+
+                for (IndexIn_ i = 0; i < range.number; ++i) {
+                    if (range.value[i]) {
+                        const auto r = range.index[i];
+                        summary.add(r, range.value[i], tolerance);
+                        ++num_vec[r];
                     }
                 }
-            }, NR, nthreads);
+            }
+        }, NC, nthreads);
 
-        } else {
-            tatami::parallelize([&](const int, const IndexIn_ start, const IndexIn_ length) -> void {
-                auto ext = tatami::consecutive_extractor<false>(mat, true, start, length);
-                auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NC);
+    } else {
+        tatami::parallelize([&](const int t, const IndexIn_ start, const IndexIn_ length) -> void {
+            auto ext = tatami::consecutive_extractor<false>(mat, false, start, length);
+            auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NR);
+            auto& current = threaded[t];
 
-                for (IndexIn_ r = start, end = start + length; r < end; ++r) {
-                    auto ptr = ext->fetch(r, dbuffer.data());
-                    for (IndexIn_ c = 0; c < NC; ++c) {
-                        if (ptr[c]) {
-                            const auto chunk = c / chunk_size;
-                            const auto cat = categorize(ptr[c]);
-                            max_per_chunk[chunk][r] = std::max(max_per_chunk[chunk][r], cat);
-                            ++num_per_chunk[chunk][r];
-                        }
+            for (IndexIn_ c = start, end = start + length; c < end; ++c) {
+                const auto ptr = ext->fetch(c, dbuffer.data());
+                const auto chunk = c / chunk_size;
+                auto& summary = current.summary_per_chunk[chunk];
+                auto& num_vec = current.num_per_chunk[chunk];
+
+                for (IndexIn_ r = 0; r < NR; ++r) {
+                    if (ptr[r]) {
+                        summary.add(r, ptr[r], tolerance);
+                        ++num_vec[r];
                     }
                 }
-            }, NR, nthreads);
+            }
+        }, NC, nthreads);
+    }
+
+    // Assume we have at least one thread!
+    auto output = std::move(threaded[0]);
+    for (I<decltype(nchunks)> chunk = 0; chunk < nchunks; ++chunk) {
+        for (int t = 1; t < nthreads; ++t) {
+            output.summary_per_chunk[chunk].merge(threaded[t].summary_per_chunk[chunk]);
+            auto& num_vec = output.num_per_chunk[chunk];
+            const auto& other_num = threaded[t].num_per_chunk[chunk];
+            for (IndexIn_ r = 0; r < NR; ++r) {
+                num_vec[r] += other_num[r];
+            }
         }
+    }
+
+    return output;
+}
+
+template<typename ValueIn_, typename IndexIn_>
+MemoryEstimate estimate_conversion(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const LayerComposition& composition, const int nthreads, const bool huge_pages, const bool dictionary, const bool outliers) {
+    const std::size_t NR = mat.nrow(), NC = mat.ncol();
+    const std::size_t nchunks = composition.chunks.size();
+    const std::size_t element = sizeof(ValueIn_) + (mat.is_sparse() ? sizeof(IndexIn_) : 0);
 
-        allocate_rows(
-            max_per_chunk, 
-            num_per_chunk, 
-            identities8, 
-            identities16, 
-            identities32, 
-            store8, 
-            store16, 
-            store32, 
-            assigned_category, 
-            assigned_position
+    std::size_t first_pass, fill_pass;
+    if (mat.prefer_rows()) {
+        // Each thread holds a buffer for a full row.
+        // The extras of the first pass are also collected by each thread before they are copied to the shared statistics.
+        const std::size_t buffers = sanisizer::product<std::size_t>(sanisizer::product<std::size_t>(nthreads, NC), element);
+        first_pass = sanisizer::sum<std::size_t>(estimate_first_pass<IndexIn_>(composition, 2, outliers), buffers);
+        fill_pass = sanisizer::sum<std::size_t>(sanisizer::product<std::size_t>(sanisizer::product<std::size_t>(nthreads, nchunks), sizeof(std::size_t)), buffers);
+    } else {
+        // Each thread holds its own copy of the statistics and a buffer for a full column in the first pass,
+        // while the output positions and buffers in the fill pass are split across threads by row.
+        first_pass = sanisizer::sum<std::size_t>(
+            sanisizer::product<std::size_t>(nthreads, estimate_first_pass<IndexIn_>(composition, 1, outliers)),
+            sanisizer::product<std::size_t>(sanisizer::product<std::size_t>(nthreads, NR), element)
+        );
+        fill_pass = sanisizer::sum<std::size_t>(
+            sanisizer::product<std::size_t>(sanisizer::product<std::size_t>(nchunks, NR), sizeof(std::size_t)),
+            sanisizer::product<std::size_t>(NR, element)
         );
     }
 
+    const std::size_t dictionary_pass = (dictionary ? estimate_dictionary_pass(composition, huge_pages, nthreads) : 0);
+    return estimate_memory(composition, huge_pages, first_pass, fill_pass, dictionary_pass);
+}
+
+template<typename ColIndex_, typename ValueOut_, typename IndexOut_, typename ValueIn_, typename IndexIn_>
+void check_conversion_budget(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const FirstPass<IndexIn_>& scanned, const int nthreads, const bool huge_pages, const bool dictionary, const bool outliers, const std::size_t max_memory) {
+    if (has_memory_budget(max_memory)) {
+        const auto composition = compose_first_pass<ValueOut_, IndexOut_, ColIndex_>(scanned, mat.nrow());
+        check_memory_budget(estimate_conversion(mat, composition, nthreads, huge_pages, dictionary, outliers), max_memory);
+    }
+}
+
+template<typename ColIndex_, typename ValueOut_ = double, typename IndexOut_ = int, typename ValueIn_, typename IndexIn_, class Hooks_>
+std::shared_ptr<LayeredSparseMatrix<ValueOut_, IndexOut_, ColIndex_> > convert_by_row(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const IndexIn_ chunk_size, const int nthreads, const double tolerance, const bool huge_pages, const bool dictionary, const bool outliers, const std::size_t max_memory, Hooks_& hooks) {
+    const auto NR = mat.nrow(), NC = mat.ncol();
+    const IndexIn_ leftovers = NC % chunk_size;
+    const IndexIn_ nchunks = sanisizer::max(1, NC / chunk_size + (leftovers != 0));
+
+    auto chunks = tatami::create_container_of_Index_size<std::vector<LayeredChunk<IndexOut_, ColIndex_> > >(nchunks);
+    // First pass to define the allocations.
+    {
+        auto scanned = scan_by_row(mat, chunk_size, nchunks, nthreads, tolerance, outliers);
+        hooks.record_transient([&]() -> std::size_t { return scanned.bytes(); });
+        hooks.finish(&Instrumentation::scan_seconds);
+        check_conversion_budget<ColIndex_, ValueOut_, IndexOut_>(mat, scanned, nthreads, huge_pages, dictionary, outliers, max_memory);
+        allocate_rows(scanned.summary_per_chunk, scanned.num_per_chunk, chunks, huge_pages);
+        hooks.finish(&Instrumentation::allocate_seconds);
+    }
+
     // Second pass to actually fill the vectors.
     {
         tatami::parallelize([&](const int, const IndexIn_ start, const IndexIn_ length) -> void {
@@ -119,7 +229,7 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_row(const tata
 
                 for (IndexIn_ r = start, end = start + length; r < end; ++r) {
                     for (I<decltype(nchunks)> chunk = 0; chunk < nchunks; ++chunk) {
-                        output_positions[chunk] = get_sparse_ptr(store8, store16, store32, assigned_category, assigned_position, chunk, r);
+                        output_positions[chunk] = get_sparse_ptr(chunks, chunk, r);
                     }
 
                     auto range = ext->fetch(r, dbuffer.data(), ibuffer.data());
@@ -127,7 +237,7 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_row(const tata
                         if (range.value[i]) {
                             const IndexIn_ chunk = range.index[i] / chunk_size;
                             const IndexIn_ col = range.index[i] % chunk_size;
-                            fill_sparse_value(store8, store16, store32, assigned_category[chunk][r], chunk, col, range.value[i], output_positions[chunk]++);
+                            fill_sparse_value(chunks, chunk, r, col, range.value[i], output_positions[chunk]++);
                         }
                     }
                 }
@@ -137,7 +247,7 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_row(const tata
 
                 for (IndexIn_ r = start, end = start + length; r < end; ++r) {
                     for (I<decltype(nchunks)> chunk = 0; chunk < nchunks; ++chunk) {
-                        output_positions[chunk] = get_sparse_ptr(store8, store16, store32, assigned_category, assigned_position, chunk, r);
+                        output_positions[chunk] = get_sparse_ptr(chunks, chunk, r);
                     }
 
                     auto ptr = ext->fetch(r, dbuffer.data());
@@ -145,7 +255,7 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_row(const tata
                         if (ptr[c]) {
                             const IndexIn_ chunk = c / chunk_size;
                             const IndexIn_ col = c % chunk_size;
-                            fill_sparse_value(store8, store16, store32, assigned_category[chunk][r], chunk, col, ptr[c], output_positions[chunk]++);
+                            fill_sparse_value(chunks, chunk, r, col, ptr[c], output_positions[chunk]++);
                         }
                     }
                 }
@@ -154,137 +264,33 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_row(const tata
         }, NR, nthreads);
     }
 
-    return consolidate_matrices<ValueOut_, IndexOut_>(
-        identities8, 
-        identities16, 
-        identities32, 
-        std::move(store8), 
-        std::move(store16), 
-        std::move(store32),
-        NR,
-        chunk_size,
-        leftovers
-    );
+    hooks.finish(&Instrumentation::fill_seconds);
+    if (dictionary) {
+        const auto copies = encode_dictionaries(chunks, huge_pages, nthreads);
+        hooks.record_transient([&]() -> std::size_t { return copies; });
+        hooks.finish(&Instrumentation::encode_seconds);
+    }
+    hooks.record_layers(chunks);
+    auto output = consolidate_matrices<ValueOut_, IndexOut_>(std::move(chunks), NR, NC, chunk_size);
+    hooks.finish(&Instrumentation::consolidate_seconds);
+    return output;
 }
 
-template<typename ColIndex_, typename ValueOut_ = double, typename IndexOut_ = int, typename ValueIn_, typename IndexIn_>
-std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_column(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const IndexIn_ chunk_size, const int nthreads) {
+template<typename ColIndex_, typename ValueOut_ = double, typename IndexOut_ = int, typename ValueIn_, typename IndexIn_, class Hooks_>
+std::shared_ptr<LayeredSparseMatrix<ValueOut_, IndexOut_, ColIndex_> > convert_by_column(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const IndexIn_ chunk_size, const int nthreads, const double tolerance, const bool huge_pages, const bool dictionary, const bool outliers, const std::size_t max_memory, Hooks_& hooks) {
     const auto NR = mat.nrow(), NC = mat.ncol();
     const IndexIn_ leftovers = NC % chunk_size;
     const IndexIn_ nchunks = sanisizer::max(1, NC / chunk_size + (leftovers != 0));
 
-    auto store8  = tatami::create_container_of_Index_size<std::vector<Holder< std::uint8_t, IndexOut_, ColIndex_> > >(nchunks);
-    auto store16 = tatami::create_container_of_Index_size<std::vector<Holder<std::uint16_t, IndexOut_, ColIndex_> > >(nchunks);
-    auto store32 = tatami::create_container_of_Index_size<std::vector<Holder<std::uint32_t, IndexOut_, ColIndex_> > >(nchunks);
-
-    auto identities8  = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
-    auto identities16 = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
-    auto identities32 = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
-
-    auto assigned_position = tatami::create_container_of_Index_size<std::vector<std::vector<IndexOut_> > >(nchunks);
-    auto assigned_category = tatami::create_container_of_Index_size<std::vector<std::vector<Category> > >(nchunks);
-
+    auto chunks = tatami::create_container_of_Index_size<std::vector<LayeredChunk<IndexOut_, ColIndex_> > >(nchunks);
     // First pass to define the allocations.
     {
-        auto max_per_chunk_threaded = sanisizer::create<std::vector<std::vector<std::vector<Category> > > >(nthreads);
-        for (auto& max_per_chunk : max_per_chunk_threaded) { 
-            tatami::resize_container_to_Index_size<std::vector<std::vector<Category> > >(max_per_chunk, nchunks);
-            for (auto& x : max_per_chunk) {
-                tatami::resize_container_to_Index_size(x, NR);
-            }
-        }
-
-        auto num_per_chunk_threaded = sanisizer::create<std::vector<std::vector<std::vector<IndexIn_> > > >(nthreads);
-        for (auto& num_per_chunk : num_per_chunk_threaded) { 
-            tatami::resize_container_to_Index_size<std::vector<std::vector<IndexIn_> > >(num_per_chunk, nchunks);
-            for (auto& x : num_per_chunk) {
-                tatami::resize_container_to_Index_size(x, NR);
-            }
-        }
-
-        if (mat.sparse()) {
-            tatami::parallelize([&](const int t, const IndexIn_ start, const IndexIn_ length) -> void {
-                auto ext = tatami::consecutive_extractor<true>(mat, false, start, length, [&]{
-                    tatami::Options opt;
-                    opt.sparse_ordered_index = false;
-                    return opt;
-                }());
-                auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NR);
-                auto ibuffer = tatami::create_container_of_Index_size<std::vector<IndexIn_> >(NR);
-
-                auto& max_per_chunk = max_per_chunk_threaded[t];
-                auto& num_per_chunk = num_per_chunk_threaded[t];
-
-                for (IndexIn_ c = start, end = start + length; c < end; ++c) {
-                    const auto range = ext->fetch(c, dbuffer.data(), ibuffer.data());
-                    const auto chunk = c / chunk_size;
-                    auto& max_vec = max_per_chunk[chunk];
-                    auto& num_vec = num_per_chunk[chunk];
-
-                    for (IndexIn_ i = 0; i < range.number; ++i) {
-                        if (range.value[i]) {
-                            const auto cat = categorize(range.value[i]);
-                            const auto r = range.index[i];
-                            max_vec[r] = std::max(max_vec[r], cat);
-                            ++num_vec[r];
-                        }
-                    }
-                }
-            }, NC, nthreads);
-
-        } else {
-            tatami::parallelize([&](const int t, const IndexIn_ start, const IndexIn_ length) -> void {
-                auto ext = tatami::consecutive_extractor<false>(mat, false, start, length);
-                auto dbuffer = tatami::create_container_of_Index_size<std::vector<ValueIn_> >(NR);
-
-                auto& max_per_chunk = max_per_chunk_threaded[t];
-                auto& num_per_chunk = num_per_chunk_threaded[t];
-
-                for (IndexIn_ c = start, end = start + length; c < end; ++c) {
-                    const auto ptr = ext->fetch(c, dbuffer.data());
-                    const auto chunk = c / chunk_size;
-                    auto& max_vec = max_per_chunk[chunk];
-                    auto& num_vec = num_per_chunk[chunk];
-
-                    for (IndexIn_ r = 0; r < NR; ++r) {
-                        if (ptr[r]) {
-                            auto cat = categorize(ptr[r]);
-                            max_vec[r] = std::max(max_vec[r], cat);
-                            ++num_vec[r];
-                        }
-                    }
-                }
-            }, NC, nthreads);
-        }
-
-        auto max_per_chunk = tatami::create_container_of_Index_size<std::vector<std::vector<Category> > >(nchunks);
-        auto num_per_chunk = tatami::create_container_of_Index_size<std::vector<std::vector<IndexIn_> > >(nchunks);
-
-        for (I<decltype(nchunks)> chunk = 0; chunk < nchunks; ++chunk) {
-            // Assume we have at least one thread!
-            max_per_chunk[chunk].swap(max_per_chunk_threaded[0][chunk]);
-            num_per_chunk[chunk].swap(num_per_chunk_threaded[0][chunk]);
-
-            for (int t = 1; t < nthreads; ++t) {
-                for (IndexIn_ r = 0; r < NR; ++r) {
-                    max_per_chunk[chunk][r] = std::max(max_per_chunk[chunk][r], max_per_chunk_threaded[t][chunk][r]);
-                    num_per_chunk[chunk][r] += num_per_chunk_threaded[t][chunk][r];
-                }
-            }
-        }
-
-        allocate_rows(
-            max_per_chunk, 
-            num_per_chunk, 
-            identities8, 
-            identities16, 
-            identities32, 
-            store8, 
-            store16, 
-            store32, 
-            assigned_category, 
-            assigned_position
-        );
+        auto scanned = scan_by_column(mat, chunk_size, nchunks, nthreads, tolerance, outliers);
+        hooks.record_transient([&]() -> std::size_t { return sanisizer::product<std::size_t>(scanned.bytes(), nthreads); });
+        hooks.finish(&Instrumentation::scan_seconds);
+        check_conversion_budget<ColIndex_, ValueOut_, IndexOut_>(mat, scanned, nthreads, huge_pages, dictionary, outliers, max_memory);
+        allocate_rows(scanned.summary_per_chunk, scanned.num_per_chunk, chunks, huge_pages);
+        hooks.finish(&Instrumentation::allocate_seconds);
     }
 
     // Second pass to actually fill the vectors.
@@ -294,7 +300,7 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_column(const t
             for (I<decltype(nchunks)> chunk = 0; chunk < nchunks; ++chunk) {
                 tatami::resize_container_to_Index_size(output_positions[chunk], length);
                 for (IndexIn_ r = 0; r < length; ++r) {
-                    output_positions[chunk][r] = get_sparse_ptr(store8, store16, store32, assigned_category, assigned_position, chunk, r + start);
+                    output_positions[chunk][r] = get_sparse_ptr(chunks, chunk, r + start);
                 }
             }
 
@@ -313,7 +319,7 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_column(const t
                     for (IndexIn_ i = 0; i < range.number; ++i) {
                         if (range.value[i]) {
                             const auto r = range.index[i];
-                            fill_sparse_value(store8, store16, store32, assigned_category[chunk][r], chunk, col, range.value[i], outpos[r - start]++);
+                            fill_sparse_value(chunks, chunk, r, col, range.value[i], outpos[r - start]++);
                         }
                     }
                 }
@@ -327,9 +333,9 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_column(const t
                     const IndexIn_ col = c % chunk_size;
                     auto& outpos = output_positions[chunk];
 
-                    for (IndexIn_ r = 0; r < NR; ++r) {
+                    for (IndexIn_ r = 0; r < length; ++r) {
                         if (ptr[r]) {
-                            fill_sparse_value(store8, store16, store32, assigned_category[chunk][r], chunk, col, ptr[r], outpos[r - start]++);
+                            fill_sparse_value(chunks, chunk, r + start, col, ptr[r], outpos[r]++);
                         }
                     }
                 }
@@ -338,17 +344,16 @@ std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_by_column(const t
         }, NR, nthreads);
     }
 
-    return consolidate_matrices<ValueOut_, IndexOut_>(
-        identities8, 
-        identities16, 
-        identities32, 
-        std::move(store8), 
-        std::move(store16), 
-        std::move(store32),
-        NR,
-        chunk_size,
-        leftovers
-    );
+    hooks.finish(&Instrumentation::fill_seconds);
+    if (dictionary) {
+        const auto copies = encode_dictionaries(chunks, huge_pages, nthreads);
+        hooks.record_transient([&]() -> std::size_t { return copies; });
+        hooks.finish(&Instrumentation::encode_seconds);
+    }
+    hooks.record_layers(chunks);
+    auto output = consolidate_matrices<ValueOut_, IndexOut_>(std::move(chunks), NR, NC, chunk_size);
+    hooks.finish(&Instrumentation::consolidate_seconds);
+    return output;
 }
 /**
  * @endcond
@@ -369,13 +374,66 @@ struct ConvertToLayeredSparseOptions {
      * This should be a positive integer.
      */
     int num_threads = 1;
+
+    /**
+     * Maximum relative error for values that are stored in the floating-point layers.
+     * Each non-integer value \f$x\f$ is only stored in a narrower floating-point type if the stored value \f$y\f$ satisfies \f$|y - x| \le \tau|x|\f$, where \f$\tau\f$ is the tolerance.
+     * By default, all values are stored exactly.
+     * Larger values (e.g., 0.001 for half precision, \f$10^{-7}\f$ for single precision) allow more rows to be stored in narrower types.
+     * Integer values are always stored exactly, unless a row mixes integers that are too large for the signed layers with negative values.
+     */
+    double tolerance = 0;
+
+    /**
+     * Whether to request transparent huge pages for the storage of each chunk's layers.
+     * This may reduce TLB misses during extraction from large matrices.
+     * Only used on Linux, where it is passed to `madvise()` as a hint; ignored on other platforms.
+     */
+    bool huge_pages = false;
+
+    /**
+     * Whether to store rows with no more than 256 distinct values in the dictionary-coded layer (`Category::D8`), i.e., as 8-bit codes into a per-row table of values.
+     * A row is only re-encoded if this uses less memory than its original layer.
+     * This requires an extra pass over each chunk after it is filled, and each access to a dictionary-coded value involves an extra lookup into its row's table.
+     * Unlike the other layers, this is not chosen in the first pass, as counting the distinct values would require holding up to 256 values for each row of each chunk;
+     * instead, each chunk is rebuilt after it is filled, holding one extra chunk per thread.
+     */
+    bool dictionary = false;
+
+    /**
+     * Whether to store rows of non-negative integers in the escaped layer (`Category::E8`) when only a few of their values do not fit into an 8-bit unsigned integer.
+     * Each row of each chunk that would be stored in the 16-, 32- or 64-bit unsigned integer layers is considered for storage as 8-bit unsigned integers,
+     * where the outliers (i.e., values above 254) are replaced by 255 and stored in a per-row list of escapes containing their column indices and their values as 64-bit unsigned integers.
+     * A row is only stored with escapes if this uses less memory than its original layer, i.e., if the number of outliers is below a threshold that depends on the number of non-zero elements in the row and the size of its original type.
+     *
+     * The number of outliers in each row of each chunk is counted in the first pass, so that the escaped rows are chosen along with all other layers and filled directly.
+     * This costs an extra 2 bytes per row in each chunk that has any outliers during the first pass, but no extra pass over or copy of the data;
+     * the memory estimates from `estimate_convert_to_layered_sparse()` also account for the escapes.
+     * Escaped values are patched in during extraction by walking through the row's escapes alongside its non-zero elements.
+     * If `dictionary = true`, dictionary coding is only considered for rows that are not stored with escapes.
+     */
+    bool outliers = false;
+
+    /**
+     * Pointer to an `Instrumentation` instance to be filled with per-phase timings and memory usage.
+     * If `NULL`, no instrumentation is performed.
+     */
+    Instrumentation* instrumentation = NULL;
+
+    /**
+     * Maximum memory usage (in bytes) for the conversion.
+     * If the estimated peak memory usage exceeds this value, an error is thrown after the first pass and before any layers are allocated.
+     * See `estimate_convert_to_layered_sparse()` for details on the estimate.
+     * By default, no limit is imposed.
+     */
+    std::size_t max_memory = std::numeric_limits<std::size_t>::max();
 };
 
 /**
- * @param mat A `tatami::Matrix` object containing non-negative integers.
+ * @param mat A `tatami::Matrix` object, typically containing integers.
  * @param options Further options.
  *
- * @return A `tatami::Matrix` object containing a layered sparse matrix.
+ * @return A `LayeredSparseMatrix` object.
  *
  * @tparam ValueOut_ Type of data value for the output `tatami::Matrix` interface.
  * @tparam IndexOut_ Integer type for the row/column indices of the output.
@@ -383,31 +441,109 @@ struct ConvertToLayeredSparseOptions {
  * @tparam ValueIn_ Type of data value for the input.
  * @tparam IndexIn_ Integer type for the row/column indices of the input.
  *
- * This function converts an existing sparse matrix of non-negative integers into a layered sparse matrix.
- * The aim is to reduce memory usage by storing each row's data in the smallest unsigned integer type that can hold them.
+ * This function converts an existing sparse matrix into a layered sparse matrix.
+ * The aim is to reduce memory usage by storing each row's data in the smallest type that can hold them.
  * To create a layered sparse matrix:
  *
  * 1. We split the input matrix into chunks of `options.chunk_size` contiguous columns.
- * 2. Within each chunk, we identify the maximum integer for each row.
- * 3. Data for each row are stored in one of three sparse matrices using 8, 16, or 32-bit unsigned integers as the data type, depending on the row's maximum value.
- * 4. The three sparse matrices are combined together with `tatami::DelayedBind`, with some use of `tatami::DelayedSubset` to restore the original order of rows.
- * 5. Each chunk is then combined together with `tatami::DelayedBind`.
+ * 2. Within each chunk, we identify the minimum and maximum integer for each row.
+ * 3. Data for each row are stored in one of four sparse layers using 8, 16, 32 or 64-bit unsigned integers as the data type, depending on the row's maximum value.
+ *    Rows containing negative integers are instead stored in one of three layers using 8, 16 or 32-bit signed integers, depending on the row's minimum and maximum values.
+ *    (Rows with integers outside of the 32-bit signed range and negative values are stored as double-precision values.)
+ *    Rows containing non-integer values are stored in one of three layers using half-precision (see `Float16`), single-precision or double-precision floating-point values,
+ *    depending on the narrowest type that can store all of the row's values within `options.tolerance`.
+ *    An integer row that is combined with a floating-point row (e.g., by `cbind()`) is stored in the floating-point layer that can hold the integers exactly.
+ * 4. If `options.dictionary = true`, rows with few distinct values are moved into a dictionary-coded layer when this is smaller.
+ *    If `options.outliers = true`, rows where only a few values exceed 254 are moved into an 8-bit layer with escapes for those values when this is smaller.
+ * 5. Each row's layer and position within that layer is recorded, so that the original order of rows can be restored during extraction.
+ * 6. All chunks are then combined into a single `LayeredSparseMatrix`.
  *
  * We improve the chances of being able to use small types by splitting the matrix columns into chunks.
  * This ensures that a few large values in a particular row only cause promotion to a larger integer type for the chunks in which they occur.
+ * Within a chunk, such promotion can also be avoided by escaping the large values, see `ConvertToLayeredSparseOptions::outliers`.
  *
  * Setting `ColumnIndex_` to the smallest type that can hold `options.chunk_size - 1` can be used to further reduce memory usage.
  * If `ColumnIndex_` is not able to hold `options.chunk_size - 1`, the chunk size is automatically set to the largest value that can be represented by `ColumnIndex_` plus 1.
  * For example, if `ColumnIndex_` was set to an unsigned 8-bit integer, `chunk_size` would be automatically reduced to 256.
  */
 template<typename ValueOut_ = double, typename IndexOut_ = int, typename ColumnIndex_ = std::uint16_t, typename ValueIn_, typename IndexIn_>
-std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > convert_to_layered_sparse(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const ConvertToLayeredSparseOptions& options) {
+std::shared_ptr<LayeredSparseMatrix<ValueOut_, IndexOut_, ColumnIndex_> > convert_to_layered_sparse(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const ConvertToLayeredSparseOptions& options) {
     const IndexIn_ chunk_size = check_chunk_size<IndexIn_, ColumnIndex_>(options.chunk_size);
-    if (mat.prefer_rows()) {
-        return convert_by_row<ColumnIndex_, ValueOut_, IndexOut_>(mat, chunk_size, options.num_threads);
-    } else {
-        return convert_by_column<ColumnIndex_, ValueOut_, IndexOut_>(mat, chunk_size, options.num_threads);
-    }
+    return Instrumentation_internal::dispatch(options.instrumentation, [&](auto& hooks) -> std::shared_ptr<LayeredSparseMatrix<ValueOut_, IndexOut_, ColumnIndex_> > {
+        if (mat.prefer_rows()) {
+            return convert_by_row<ColumnIndex_, ValueOut_, IndexOut_>(mat, chunk_size, options.num_threads, options.tolerance, options.huge_pages, options.dictionary, options.outliers, options.max_memory, hooks);
+        } else {
+            return convert_by_column<ColumnIndex_, ValueOut_, IndexOut_>(mat, chunk_size, options.num_threads, options.tolerance, options.huge_pages, options.dictionary, options.outliers, options.max_memory, hooks);
+        }
+    });
+}
+
+/**
+ * Predict the composition of the layered sparse matrix that would be created by `convert_to_layered_sparse()`, without actually creating it.
+ * This only performs the first pass through `mat`, so it is cheaper than the conversion itself.
+ * As row codes are not created, the reported `LayerComposition::code_bytes` assumes that no codes are shared between chunks.
+ *
+ * @param mat A `tatami::Matrix` object, typically containing integers.
+ * @param options Further options, as used in `convert_to_layered_sparse()`.
+ *
+ * @return Composition of the layers of the converted matrix.
+ *
+ * @tparam ValueOut_ Type of data value for the output `tatami::Matrix` interface, used to compute `LayerComposition::csr_bytes`.
+ * @tparam IndexOut_ Integer type for the row/column indices of the output, used to compute `LayerComposition::csr_bytes`.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam ValueIn_ Type of data value for the input.
+ * @tparam IndexIn_ Integer type for the row/column indices of the input.
+ */
+template<typename ValueOut_ = double, typename IndexOut_ = int, typename ColumnIndex_ = std::uint16_t, typename ValueIn_, typename IndexIn_>
+LayerComposition scan_layered_sparse(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const ConvertToLayeredSparseOptions& options) {
+    const IndexIn_ chunk_size = check_chunk_size<IndexIn_, ColumnIndex_>(options.chunk_size);
+    const auto NR = mat.nrow(), NC = mat.ncol();
+    const IndexIn_ nchunks = sanisizer::max(1, NC / chunk_size + (NC % chunk_size != 0));
+    const auto scanned = (mat.prefer_rows() ?
+        scan_by_row(mat, chunk_size, nchunks, options.num_threads, options.tolerance, options.outliers) :
+        scan_by_column(mat, chunk_size, nchunks, options.num_threads, options.tolerance, options.outliers));
+    return compose_first_pass<ValueOut_, IndexOut_, ColumnIndex_>(scanned, NR);
+}
+
+/**
+ * Estimate the memory required by `convert_to_layered_sparse()`, given the results of a previous scan.
+ * This allows users to check whether a conversion will fit into memory before committing to it.
+ * The scan can be persisted and re-used for different `options.num_threads`, `options.huge_pages` and `options.dictionary`, but not for a different `options.chunk_size` or `ColumnIndex_`.
+ * If `options.dictionary = true`, the estimate assumes that no rows are dictionary-coded, so it is an upper bound on the final and peak memory usage.
+ *
+ * @param mat A `tatami::Matrix` object, typically containing integers.
+ * @param composition Composition of the layers, as returned by `scan_layered_sparse()` with the same `options`.
+ * @param options Further options, as used in `convert_to_layered_sparse()`.
+ *
+ * @return Estimated memory usage of the conversion.
+ *
+ * @tparam ValueIn_ Type of data value for the input.
+ * @tparam IndexIn_ Integer type for the row/column indices of the input.
+ */
+template<typename ValueIn_, typename IndexIn_>
+MemoryEstimate estimate_convert_to_layered_sparse(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const LayerComposition& composition, const ConvertToLayeredSparseOptions& options) {
+    return estimate_conversion(mat, composition, options.num_threads, options.huge_pages, options.dictionary, options.outliers);
+}
+
+/**
+ * Overload of `estimate_convert_to_layered_sparse()` that performs the scan with `scan_layered_sparse()`.
+ * This only performs the first pass through `mat`, so it is cheaper than the conversion itself.
+ *
+ * @param mat A `tatami::Matrix` object, typically containing integers.
+ * @param options Further options, as used in `convert_to_layered_sparse()`.
+ *
+ * @return Estimated memory usage of the conversion.
+ *
+ * @tparam ValueOut_ Type of data value for the output `tatami::Matrix` interface.
+ * @tparam IndexOut_ Integer type for the row/column indices of the output.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam ValueIn_ Type of data value for the input.
+ * @tparam IndexIn_ Integer type for the row/column indices of the input.
+ */
+template<typename ValueOut_ = double, typename IndexOut_ = int, typename ColumnIndex_ = std::uint16_t, typename ValueIn_, typename IndexIn_>
+MemoryEstimate estimate_convert_to_layered_sparse(const tatami::Matrix<ValueIn_, IndexIn_>& mat, const ConvertToLayeredSparseOptions& options) {
+    const auto composition = scan_layered_sparse<ValueOut_, IndexOut_, ColumnIndex_>(mat, options);
+    return estimate_conversion(mat, composition, options.num_threads, options.huge_pages, options.dictionary, options.outliers);
 }
 
 /**
@@ -0,0 +1,57 @@
+#ifndef TATAMI_LAYERED_DESCRIBE_LAYERED_SPARSE_HPP
+#define TATAMI_LAYERED_DESCRIBE_LAYERED_SPARSE_HPP
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <unordered_set>
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+#include "LayerComposition.hpp"
+
+/**
+ * @file describe_layered_sparse.hpp
+ * @brief Describe the layers of a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * Report the number of rows and non-zero elements in each layer of each chunk, along with the memory used by each component of the layers.
+ * Row codes that are shared between chunks are only counted once, in the first chunk that uses them.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ *
+ * @return Composition of the layers of `mat`.
+ * The total memory usage of `mat` is available from `LayerComposition::memory_usage()`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_>
+LayerComposition describe_layered_sparse(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat) {
+    LayerComposition output;
+    const auto& chunks = mat.get_chunks();
+    output.chunks.reserve(chunks.size());
+
+    std::unordered_set<const void*> seen;
+    std::size_t total_nnz = 0;
+    for (const auto& chunk : chunks) {
+        const auto num_nonzero = layer_num_nonzero(chunk);
+        for (auto n : num_nonzero) {
+            total_nnz += n;
+        }
+
+        const std::size_t code_bytes = (seen.insert(chunk.codes.get()).second ? chunk.codes->size() * sizeof(RowCode) : 0);
+        add_chunk(output, compose_chunk<ColumnIndex_>(layer_num_rows(chunk), num_nonzero, layer_num_entries(chunk), layer_num_escapes(chunk), code_bytes));
+    }
+
+    output.csr_bytes = compute_csr_bytes<Value_, Index_>(total_nnz, mat.nrow());
+    return output;
+}
+
+}
+
+#endif
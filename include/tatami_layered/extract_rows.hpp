@@ -0,0 +1,251 @@
+#ifndef TATAMI_LAYERED_EXTRACT_ROWS_HPP
+#define TATAMI_LAYERED_EXTRACT_ROWS_HPP
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file extract_rows.hpp
+ * @brief Extract a batch of rows from a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `extract_dense_rows()` and `extract_sparse_rows()`.
+ */
+struct ExtractRowsOptions {
+    /**
+     * Number of threads to use.
+     * This should be a positive integer.
+     */
+    int num_threads = 1;
+};
+
+/**
+ * @brief Batch of rows in compressed sparse row form.
+ *
+ * @tparam Output_ Numeric type of the output values.
+ * @tparam Index_ Integer type for the column indices.
+ */
+template<typename Output_, typename Index_>
+struct ExtractedSparseRows {
+    /**
+     * Row pointers, of length equal to the number of extracted rows plus 1.
+     * The non-zero elements of the `i`-th extracted row are stored in `[pointers[i], pointers[i + 1])` of `values` and `indices`.
+     */
+    std::vector<std::size_t> pointers;
+
+    /**
+     * Values of the non-zero elements.
+     */
+    std::vector<Output_> values;
+
+    /**
+     * Column indices of the non-zero elements, sorted in increasing order within each row.
+     */
+    std::vector<Index_> indices;
+};
+
+/**
+ * @cond
+ */
+namespace extract_rows_internal {
+
+template<typename Value_, typename Index_, typename ColumnIndex_>
+void check_rows(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const std::vector<Index_>& rows, const Index_ column_start, const Index_ column_length) {
+    const Index_ NR = mat.nrow();
+    for (auto r : rows) {
+        if (is_negative(r) || r >= NR) {
+            throw std::runtime_error("requested rows should be non-negative and less than the number of rows");
+        }
+    }
+    if (is_negative(column_start) || is_negative(column_length) || column_start > mat.ncol() || column_length > mat.ncol() - column_start) {
+        throw std::runtime_error("requested columns should be a subinterval of the columns of the matrix");
+    }
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Extract a batch of rows from a layered sparse matrix into a dense row-major array.
+ * This avoids a virtual call for each row and visits each chunk once per batch, which is faster than using a `tatami::MyopicDenseExtractor` for many rows.
+ * Rows are split across threads, and each thread iterates over the chunks in the outer loop so that each chunk's layers are only traversed once.
+ * Any fused transformation in `mat` is applied to the extracted values, see `LayeredSparseMatrix::fuse_transform()`.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam Output_ Numeric type of the output values.
+ *
+ * @param mat A layered sparse matrix.
+ * @param rows Indices of the rows to extract.
+ * These may be in any order and may contain duplicates.
+ * @param column_start Index of the first column to extract.
+ * @param column_length Number of consecutive columns to extract.
+ * @param[out] output Pointer to a row-major array with number of rows equal to `rows.size()` and number of columns equal to `column_length`.
+ * On output, the `i`-th row of this array is filled with the values of row `rows[i]` of `mat` in the requested columns.
+ * @param options Further options.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, typename Output_>
+void extract_dense_rows(
+    const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat,
+    const std::vector<Index_>& rows,
+    const Index_ column_start,
+    const Index_ column_length,
+    Output_* output,
+    const ExtractRowsOptions& options)
+{
+    extract_rows_internal::check_rows(mat, rows, column_start, column_length);
+    const Index_ chunk_size = mat.get_chunk_size();
+    const auto& chunks = mat.get_chunks();
+    const auto bounds = LayeredSparseMatrix_internal::define_block_bounds(chunk_size, column_start, column_length);
+    const auto transform = mat.get_fused_transform();
+    const std::size_t width = column_length;
+    const Output_ fill = (transform ? transform->zero_value() : 0);
+
+    tatami::parallelize([&](const int, const std::size_t start, const std::size_t length) -> void {
+        std::fill_n(output + start * width, length * width, fill);
+
+        for (const auto& b : bounds) {
+            const auto& chunk = chunks[b.chunk];
+            const Index_ chunk_start = b.chunk * chunk_size;
+            const std::size_t offset = chunk_start + b.start - column_start; // position of the first local column 'b.start' in each output row.
+
+            for (std::size_t k = start, end = start + length; k < end; ++k) {
+                const Index_ r = rows[k];
+                const auto optr = output + k * width + offset;
+                visit_row_segment(chunk, r, b.start, b.end, [&](const auto* indices, const auto values, const std::size_t number) -> void {
+                    if (transform) {
+                        for (std::size_t i = 0; i < number; ++i) {
+                            const Index_ col = indices[i];
+                            optr[col - b.start] = transform->apply(r, chunk_start + col, values[i]);
+                        }
+                    } else {
+                        for (std::size_t i = 0; i < number; ++i) {
+                            optr[indices[i] - b.start] = values[i];
+                        }
+                    }
+                });
+            }
+        }
+    }, rows.size(), options.num_threads);
+}
+
+/**
+ * Extract a batch of rows from a layered sparse matrix into compressed sparse row form.
+ * This is the sparse counterpart to `extract_dense_rows()`, where the non-zero elements are counted in a first pass so that the output can be filled in place.
+ * If `mat` has a fused transformation that does not preserve zeros, all elements of the requested columns are reported for each row.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam Output_ Numeric type of the output values.
+ *
+ * @param mat A layered sparse matrix.
+ * @param rows Indices of the rows to extract.
+ * These may be in any order and may contain duplicates.
+ * @param column_start Index of the first column to extract.
+ * @param column_length Number of consecutive columns to extract.
+ * @param[out] output Batch of extracted rows, where the `i`-th row contains the non-zero elements of row `rows[i]` of `mat` in the requested columns.
+ * The vectors in this object are resized as necessary, so it can be re-used across batches to avoid reallocations.
+ * @param options Further options.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, typename Output_>
+void extract_sparse_rows(
+    const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat,
+    const std::vector<Index_>& rows,
+    const Index_ column_start,
+    const Index_ column_length,
+    ExtractedSparseRows<Output_, Index_>& output,
+    const ExtractRowsOptions& options)
+{
+    extract_rows_internal::check_rows(mat, rows, column_start, column_length);
+    const Index_ chunk_size = mat.get_chunk_size();
+    const auto& chunks = mat.get_chunks();
+    const auto bounds = LayeredSparseMatrix_internal::define_block_bounds(chunk_size, column_start, column_length);
+    const auto transform = mat.get_fused_transform();
+    const std::size_t nrows = rows.size();
+    auto& pointers = output.pointers;
+    pointers.clear();
+    pointers.resize(sanisizer::sum<std::size_t>(nrows, 1));
+
+    if (transform && !transform->preserves_zero()) {
+        // Every element is non-zero after the transformation, so we fill in the dense rows and then the indices.
+        const std::size_t width = column_length;
+        const auto total = sanisizer::product<std::size_t>(nrows, width);
+        sanisizer::resize(output.values, total);
+        sanisizer::resize(output.indices, total);
+        for (std::size_t k = 0; k < nrows; ++k) {
+            pointers[k + 1] = pointers[k] + width;
+        }
+        extract_dense_rows(mat, rows, column_start, column_length, output.values.data(), options);
+
+        tatami::parallelize([&](const int, const std::size_t start, const std::size_t length) -> void {
+            for (std::size_t k = start, end = start + length; k < end; ++k) {
+                const auto iptr = output.indices.data() + k * width;
+                for (std::size_t i = 0; i < width; ++i) {
+                    iptr[i] = column_start + i;
+                }
+            }
+        }, nrows, options.num_threads);
+        return;
+    }
+
+    tatami::parallelize([&](const int, const std::size_t start, const std::size_t length) -> void {
+        for (const auto& b : bounds) {
+            const auto& chunk = chunks[b.chunk];
+            for (std::size_t k = start, end = start + length; k < end; ++k) {
+                visit_row_segment(chunk, rows[k], b.start, b.end, [&](const auto*, const auto, const std::size_t number) -> void {
+                    pointers[k + 1] += number;
+                });
+            }
+        }
+    }, nrows, options.num_threads);
+
+    for (std::size_t k = 0; k < nrows; ++k) {
+        pointers[k + 1] = sanisizer::sum<std::size_t>(pointers[k + 1], pointers[k]);
+    }
+    sanisizer::resize(output.values, pointers.back());
+    sanisizer::resize(output.indices, pointers.back());
+
+    tatami::parallelize([&](const int, const std::size_t start, const std::size_t length) -> void {
+        auto cursors = sanisizer::create<std::vector<std::size_t> >(length);
+        std::copy_n(pointers.begin() + start, length, cursors.begin());
+
+        for (const auto& b : bounds) {
+            const auto& chunk = chunks[b.chunk];
+            const Index_ chunk_start = b.chunk * chunk_size;
+
+            for (std::size_t k = start, end = start + length; k < end; ++k) {
+                const Index_ r = rows[k];
+                auto& cursor = cursors[k - start];
+                visit_row_segment(chunk, r, b.start, b.end, [&](const auto* indices, const auto values, const std::size_t number) -> void {
+                    const auto vptr = output.values.data() + cursor;
+                    const auto iptr = output.indices.data() + cursor;
+                    for (std::size_t i = 0; i < number; ++i) {
+                        const Index_ col = chunk_start + indices[i];
+                        vptr[i] = (transform ? transform->apply(r, col, values[i]) : values[i]);
+                        iptr[i] = col;
+                    }
+                    cursor += number;
+                });
+            }
+        }
+    }, nrows, options.num_threads);
+}
+
+}
+
+#endif
@@ -0,0 +1,423 @@
+#ifndef TATAMI_LAYERED_LOAD_LAYERED_SPARSE_HPP
+#define TATAMI_LAYERED_LOAD_LAYERED_SPARSE_HPP
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define TATAMI_LAYERED_HAS_MMAP
+#endif
+
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file load_layered_sparse.hpp
+ * @brief Load a layered sparse matrix from a binary file.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `load_layered_sparse()`.
+ */
+struct LoadLayeredSparseOptions {
+    /**
+     * Whether to memory-map the file.
+     * If true, the layer arrays are used directly from the mapped file without any copies,
+     * so loading is nearly instant and multiple processes can share the same physical memory through the page cache.
+     * If false or if memory mapping is not supported on this platform, the file is read into memory.
+     */
+    bool memory_map = true;
+
+    /**
+     * Whether to check the contents of the layer arrays, i.e., that the row pointers are non-decreasing,
+     * the column indices are sorted and within each chunk, and the dictionary codes and escapes refer to valid entries.
+     * This requires a pass over all column indices and is the main cost of loading a memory-mapped file.
+     * Setting this to false skips the pass for trusted files, but the extractors may read or write out of bounds if the file is corrupted.
+     * The structure of the file is always checked, regardless of this option.
+     */
+    bool validate = true;
+};
+
+/**
+ * @cond
+ */
+namespace load_layered_sparse_internal {
+
+#ifdef TATAMI_LAYERED_HAS_MMAP
+class MappedFile {
+public:
+    MappedFile(const char* path) {
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open '" + std::string(path) + "' for reading");
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("failed to determine the size of '" + std::string(path) + "'");
+        }
+        my_size = info.st_size;
+
+        if (my_size) {
+            void* mapped = ::mmap(NULL, my_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("failed to memory-map '" + std::string(path) + "'");
+            }
+            my_data = static_cast<unsigned char*>(mapped);
+        }
+
+        ::close(fd); // the mapping remains valid after the descriptor is closed.
+    }
+
+    ~MappedFile() {
+        if (my_data) {
+            ::munmap(my_data, my_size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+    const unsigned char* data() const {
+        return my_data;
+    }
+
+    std::size_t size() const {
+        return my_size;
+    }
+
+private:
+    unsigned char* my_data = NULL;
+    std::size_t my_size = 0;
+};
+#endif
+
+inline std::shared_ptr<const LayerArena> read_file(const char* path) {
+    std::ifstream stream(path, std::ios::binary | std::ios::ate);
+    if (!stream) {
+        throw std::runtime_error("failed to open '" + std::string(path) + "' for reading");
+    }
+
+    const std::size_t size = sanisizer::cast<std::size_t>(static_cast<std::streamoff>(stream.tellg()));
+    auto arena = std::make_shared<const LayerArena>(size, false);
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(arena->data()), size);
+    if (!stream) {
+        throw std::runtime_error("failed to read '" + std::string(path) + "'");
+    }
+    return arena;
+}
+
+// Everything in the file except for the chunks' data sections.
+struct FileSummary {
+    std::uint64_t nrow = 0, ncol = 0, chunk_size = 0;
+    std::vector<std::shared_ptr<const std::vector<RowCode> > > codes;
+    std::vector<std::uint64_t> directory;
+
+    std::size_t num_chunks() const {
+        return directory.size() / file_directory_words;
+    }
+
+    const std::uint64_t* entry(const std::size_t c) const {
+        return directory.data() + c * file_directory_words;
+    }
+
+    // Each entry contains the code vector index, the number of rows in each layer, the number of non-zero elements in each layer,
+    // the number of dictionary table entries, the number of escapes, and the data offset and size.
+    std::size_t code_index(const std::size_t c) const {
+        return entry(c)[0];
+    }
+
+    std::array<std::size_t, num_categories> num_rows(const std::size_t c) const {
+        std::array<std::size_t, num_categories> output;
+        std::copy_n(entry(c) + 1, num_categories, output.begin());
+        return output;
+    }
+
+    std::array<std::size_t, num_categories> num_nonzero(const std::size_t c) const {
+        std::array<std::size_t, num_categories> output;
+        std::copy_n(entry(c) + 1 + num_categories, num_categories, output.begin());
+        return output;
+    }
+
+    std::size_t num_entries(const std::size_t c) const {
+        return entry(c)[1 + 2 * num_categories];
+    }
+
+    std::size_t num_escapes(const std::size_t c) const {
+        return entry(c)[2 + 2 * num_categories];
+    }
+
+    std::size_t data_offset(const std::size_t c) const {
+        return entry(c)[file_directory_words - 2];
+    }
+
+    std::size_t data_size(const std::size_t c) const {
+        return entry(c)[file_directory_words - 1];
+    }
+
+    // Number of columns in chunk 'c', or zero if the chunk lies beyond the last column.
+    std::size_t chunk_extent(const std::size_t c) const {
+        if (chunk_size == 0 || c >= ncol / chunk_size + (ncol % chunk_size != 0)) {
+            return 0;
+        }
+        return std::min<std::uint64_t>(chunk_size, ncol - c * chunk_size);
+    }
+};
+
+// 'read' should be a function that fills an array from the file, given a byte offset, the number of bytes and a pointer to the array.
+// It should throw an error if the file is truncated.
+template<typename ColumnIndex_, class Read_>
+FileSummary read_summary(Read_ read, const std::size_t file_size) {
+    if constexpr(sizeof(std::size_t) != sizeof(std::uint64_t)) {
+        throw std::runtime_error("layered matrix files can only be loaded on platforms with a 64-bit std::size_t");
+    }
+
+    std::uint64_t header[file_header_words];
+    read(static_cast<std::size_t>(0), sizeof(header), header);
+    if (std::memcmp(header, file_magic, sizeof(file_magic)) != 0) {
+        throw std::runtime_error("file does not contain a layered matrix");
+    }
+    if (header[1] != file_version) {
+        throw std::runtime_error("unsupported version of the layered matrix format");
+    }
+    if (header[2] != file_byte_order) {
+        throw std::runtime_error("layered matrix file was saved with a different byte order");
+    }
+    if (header[3] != sizeof(ColumnIndex_)) {
+        throw std::runtime_error("size of the column index type in the layered matrix file is not consistent with 'ColumnIndex_'");
+    }
+    if (header[9] != num_categories || header[10] != row_code_shift) {
+        throw std::runtime_error("layered matrix file has " + std::to_string(header[9]) + " layers with " + std::to_string(header[10]) +
+            "-bit layer codes, expected " + std::to_string(num_categories) + " layers with " + std::to_string(row_code_shift) + "-bit layer codes");
+    }
+
+    FileSummary output;
+    output.nrow = header[4];
+    output.ncol = header[5];
+    output.chunk_size = header[6];
+    const std::size_t NR = sanisizer::cast<std::size_t>(output.nrow);
+    const std::size_t nchunks = sanisizer::cast<std::size_t>(header[7]);
+    const std::size_t ncodes = sanisizer::cast<std::size_t>(header[8]);
+
+    // The code vectors are small relative to the data, so we copy them into vectors for use by LayeredChunk.
+    const std::size_t codes_start = pad_file_offset(sanisizer::product<std::size_t>(file_header_words, sizeof(std::uint64_t)));
+    const std::size_t codes_bytes = sanisizer::product<std::size_t>(sanisizer::product<std::size_t>(ncodes, NR), sizeof(RowCode));
+    if (codes_bytes > file_size) {
+        throw std::runtime_error("layered matrix file is truncated");
+    }
+    output.codes.reserve(ncodes);
+    for (std::size_t i = 0; i < ncodes; ++i) {
+        auto current = sanisizer::create<std::vector<RowCode> >(NR);
+        read(sanisizer::sum<std::size_t>(codes_start, i * NR * sizeof(RowCode)), NR * sizeof(RowCode), current.data());
+        output.codes.push_back(std::make_shared<const std::vector<RowCode> >(std::move(current)));
+    }
+
+    const std::size_t directory_start = pad_file_offset(sanisizer::sum<std::size_t>(codes_start, codes_bytes));
+    const std::size_t directory_words = sanisizer::product<std::size_t>(nchunks, file_directory_words);
+    if (sanisizer::product<std::size_t>(directory_words, sizeof(std::uint64_t)) > file_size) {
+        throw std::runtime_error("layered matrix file is truncated");
+    }
+    output.directory.resize(directory_words);
+    read(directory_start, directory_words * sizeof(std::uint64_t), output.directory.data());
+
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        const auto code_index = output.code_index(c);
+        if (code_index >= ncodes) {
+            throw std::runtime_error("invalid code vector index in the layered matrix file");
+        }
+
+        const auto num_rows = output.num_rows(c);
+        const auto offsets = define_layer_offsets<ColumnIndex_>(num_rows, output.num_nonzero(c), output.num_entries(c), output.num_escapes(c));
+        const std::size_t start = output.data_offset(c);
+        if (start % LayerArena::default_alignment != 0 || output.data_size(c) != offsets.total || start > file_size || offsets.total > file_size - start) {
+            throw std::runtime_error("invalid data section in the layered matrix file");
+        }
+
+        for (const auto code : *(output.codes[code_index])) {
+            const auto cat = static_cast<std::size_t>(row_code_category(code));
+            if (cat >= num_categories || row_code_position(code) >= num_rows[cat]) {
+                throw std::runtime_error("invalid row code in the layered matrix file");
+            }
+        }
+    }
+
+    return output;
+}
+
+// Checks that the arrays of a chunk can be used without reading or writing out of bounds.
+// Row pointers must start at zero and be non-decreasing, as they are already known to end at the number of non-zero elements from the directory.
+// Column indices must be strictly increasing within each row and less than 'extent', the number of columns in the chunk.
+template<typename Index_, typename ColumnIndex_>
+void validate_chunk(const LayeredChunk<Index_, ColumnIndex_>& chunk, const std::size_t extent) {
+    auto check_pointers = [](const std::size_t* ptr, const std::size_t num_rows) -> void {
+        if (ptr[0] != 0) {
+            throw std::runtime_error("invalid row pointers in the layered matrix file");
+        }
+        for (std::size_t r = 0; r < num_rows; ++r) {
+            if (ptr[r + 1] < ptr[r]) {
+                throw std::runtime_error("invalid row pointers in the layered matrix file");
+            }
+        }
+    };
+
+    for_each_layer(chunk, [&](const Category, const auto& layer) -> void {
+        check_pointers(layer.ptr, layer.num_rows);
+        for (std::size_t r = 0; r < layer.num_rows; ++r) {
+            const auto start = layer.ptr[r], end = layer.ptr[r + 1];
+            for (auto i = start; i < end; ++i) {
+                if (!sanisizer::is_less_than(layer.index[i], extent) || (i > start && layer.index[i] <= layer.index[i - 1])) {
+                    throw std::runtime_error("invalid column indices in the layered matrix file");
+                }
+            }
+        }
+    });
+
+    // Each dictionary code must refer to an entry in its row's table.
+    const auto& dict = chunk.stored8;
+    check_pointers(dict.table_ptr, dict.num_rows);
+    for (std::size_t r = 0; r < dict.num_rows; ++r) {
+        const auto num_entries = dict.table_ptr[r + 1] - dict.table_ptr[r];
+        for (auto i = dict.ptr[r], end = dict.ptr[r + 1]; i < end; ++i) {
+            if (dict.value[i] >= num_entries) {
+                throw std::runtime_error("invalid dictionary codes in the layered matrix file");
+            }
+        }
+    }
+
+    // Each escaped value must have an escape with the same column index, as the escapes are found by their column indices.
+    const auto& esc = chunk.storee8;
+    check_pointers(esc.escape_ptr, esc.num_rows);
+    for (std::size_t r = 0; r < esc.num_rows; ++r) {
+        auto e = esc.escape_ptr[r];
+        const auto eend = esc.escape_ptr[r + 1];
+        for (auto i = esc.ptr[r], end = esc.ptr[r + 1]; i < end; ++i) {
+            if (esc.value[i] == escape_code) {
+                if (e == eend || esc.escape_index[e] != esc.index[i]) {
+                    throw std::runtime_error("invalid escapes in the layered matrix file");
+                }
+                ++e;
+            }
+        }
+        if (e != eend) {
+            throw std::runtime_error("invalid escapes in the layered matrix file");
+        }
+    }
+}
+
+// Points the layers of chunk 'c' into 'data', which should contain the chunk's data section.
+template<typename Index_, typename ColumnIndex_>
+LayeredChunk<Index_, ColumnIndex_> attach_chunk(const FileSummary& summary, const std::size_t c, const unsigned char* data, std::shared_ptr<const void> storage, const bool validate) {
+    LayeredChunk<Index_, ColumnIndex_> chunk;
+    chunk.codes = summary.codes[summary.code_index(c)];
+    const auto num_rows = summary.num_rows(c);
+    for_each_layer(chunk, [&](const Category cat, auto& layer) -> void {
+        layer.num_rows = num_rows[static_cast<std::size_t>(cat)];
+    });
+
+    const auto num_nonzero = summary.num_nonzero(c);
+    const auto num_entries = summary.num_entries(c);
+    const auto num_escapes = summary.num_escapes(c);
+    const auto offsets = define_layer_offsets<ColumnIndex_>(num_rows, num_nonzero, num_entries, num_escapes);
+    attach_layers(chunk, offsets, data);
+    if (layer_num_nonzero(chunk) != num_nonzero) {
+        throw std::runtime_error("inconsistent number of non-zero elements in the layered matrix file");
+    }
+    if (layer_num_entries(chunk) != num_entries) {
+        throw std::runtime_error("inconsistent number of dictionary entries in the layered matrix file");
+    }
+    if (layer_num_escapes(chunk) != num_escapes) {
+        throw std::runtime_error("inconsistent number of escapes in the layered matrix file");
+    }
+    if (validate) {
+        validate_chunk(chunk, summary.chunk_extent(c));
+    }
+
+    chunk.storage = std::move(storage);
+    return chunk;
+}
+
+template<typename Value_, typename Index_, typename ColumnIndex_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > parse(std::shared_ptr<const void> storage, const unsigned char* data, const std::size_t file_size, const bool validate) {
+    auto summary = read_summary<ColumnIndex_>([&](const std::size_t offset, const std::size_t bytes, void* output) -> void {
+        if (offset > file_size || bytes > file_size - offset) {
+            throw std::runtime_error("layered matrix file is truncated");
+        }
+        if (bytes) { // 'output' may be null for empty arrays.
+            std::memcpy(output, data + offset, bytes);
+        }
+    }, file_size);
+
+    const std::size_t nchunks = summary.num_chunks();
+    auto chunks = sanisizer::create<std::vector<LayeredChunk<Index_, ColumnIndex_> > >(nchunks);
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        chunks[c] = attach_chunk<Index_, ColumnIndex_>(summary, c, data + summary.data_offset(c), storage, validate);
+    }
+
+    return std::make_shared<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(
+        sanisizer::cast<Index_>(summary.nrow),
+        sanisizer::cast<Index_>(summary.ncol),
+        sanisizer::cast<Index_>(summary.chunk_size),
+        std::move(chunks)
+    );
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Load a layered sparse matrix from a file created by `save_layered_sparse()`.
+ * The structure of the file is always checked, and the contents of the layer arrays are also checked if `LoadLayeredSparseOptions::validate = true`.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * This should be the same as that used to save the file.
+ *
+ * @param path Path to the file.
+ * @param options Further options.
+ *
+ * @return Pointer to a `LayeredSparseMatrix`.
+ * If memory mapping is used, the file is unmapped when this matrix and all matrices sharing its layers are destroyed.
+ */
+template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > load_layered_sparse(const char* path, const LoadLayeredSparseOptions& options) {
+#ifdef TATAMI_LAYERED_HAS_MMAP
+    if (options.memory_map) {
+        auto mapped = std::make_shared<const load_layered_sparse_internal::MappedFile>(path);
+        const auto data = mapped->data();
+        const auto size = mapped->size();
+        return load_layered_sparse_internal::parse<Value_, Index_, ColumnIndex_>(std::move(mapped), data, size, options.validate);
+    }
+#endif
+
+    auto contents = load_layered_sparse_internal::read_file(path);
+    const auto data = contents->data();
+    const auto size = contents->size();
+    return load_layered_sparse_internal::parse<Value_, Index_, ColumnIndex_>(std::move(contents), data, size, options.validate);
+}
+
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef TATAMI_LAYERED_MULTIPLY_HPP
+#define TATAMI_LAYERED_MULTIPLY_HPP
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file multiply.hpp
+ * @brief Multiply a layered sparse matrix by a dense matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `multiply()` and `multiply_transposed()`.
+ */
+struct MultiplyOptions {
+    /**
+     * Number of threads to use.
+     * This should be a positive integer.
+     */
+    int num_threads = 1;
+};
+
+/**
+ * @cond
+ */
+namespace multiply_internal {
+
+// Adds the product of a row segment of one layer with the corresponding rows of 'right' into 'output'.
+// 'values' may be a pointer, a DictionaryValues or an EscapedValues.
+template<class Values_, typename ColumnIndex_, typename Right_, typename Output_>
+void multiply_segment(
+    const ColumnIndex_* indices,
+    const Values_ values,
+    const std::size_t number,
+    const Right_* right,
+    const std::size_t num_right_columns,
+    Output_* output)
+{
+    if (num_right_columns == 1) {
+        Output_ total = 0;
+        for (std::size_t i = 0; i < number; ++i) {
+            total += static_cast<Output_>(values[i]) * static_cast<Output_>(right[indices[i]]);
+        }
+        output[0] += total;
+        return;
+    }
+
+    for (std::size_t i = 0; i < number; ++i) {
+        const Output_ val = values[i];
+        const auto src = right + static_cast<std::size_t>(indices[i]) * num_right_columns;
+        for (std::size_t j = 0; j < num_right_columns; ++j) {
+            output[j] += val * static_cast<Output_>(src[j]);
+        }
+    }
+}
+
+// Scatters the product of a row segment of one layer with a single row of 'right' into 'output'.
+template<class Values_, typename ColumnIndex_, typename Right_, typename Output_>
+void multiply_segment_transposed(
+    const ColumnIndex_* indices,
+    const Values_ values,
+    const std::size_t number,
+    const Right_* right,
+    const std::size_t num_right_columns,
+    Output_* output)
+{
+    if (num_right_columns == 1) {
+        const Output_ mult = right[0];
+        for (std::size_t i = 0; i < number; ++i) {
+            output[indices[i]] += static_cast<Output_>(values[i]) * mult;
+        }
+        return;
+    }
+
+    for (std::size_t i = 0; i < number; ++i) {
+        const Output_ val = values[i];
+        const auto dest = output + static_cast<std::size_t>(indices[i]) * num_right_columns;
+        for (std::size_t j = 0; j < num_right_columns; ++j) {
+            dest[j] += val * static_cast<Output_>(right[j]);
+        }
+    }
+}
+
+template<typename Value_, typename Index_, typename ColumnIndex_>
+void check_untransformed(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat) {
+    if (mat.get_fused_transform()) {
+        throw std::runtime_error("multiplication cannot be performed directly on a layered matrix with a fused transformation");
+    }
+}
+
+// Computes the transposed product for rows [start, start + length) and a single chunk, where 'output' points to the chunk's first output row.
+template<typename Index_, typename ColumnIndex_, typename Right_, typename Output_>
+void multiply_chunk_transposed(
+    const LayeredChunk<Index_, ColumnIndex_>& chunk,
+    const Index_ start,
+    const Index_ length,
+    const Right_* right,
+    const std::size_t num_right_columns,
+    Output_* output)
+{
+    for (Index_ r = start, end = start + length; r < end; ++r) {
+        const auto rptr = right + static_cast<std::size_t>(r) * num_right_columns;
+        visit_row_segment(chunk, r, [&](const auto* indices, const auto values, const std::size_t number) -> void {
+            multiply_segment_transposed(indices, values, number, rptr, num_right_columns, output);
+        });
+    }
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Compute the product of a layered sparse matrix \f$A\f$ and a dense matrix \f$X\f$, i.e., \f$AX\f$.
+ * This operates directly on each layer's arrays rather than extracting rows through the `tatami::Matrix` interface.
+ * Rows of \f$A\f$ are split across threads, and each thread iterates over the chunks in the outer loop,
+ * so that the rows of \f$X\f$ corresponding to the current chunk are re-used across all of its rows of \f$A\f$.
+ * An error is thrown if `mat` has a fused transformation, see `LayeredSparseMatrix::fuse_transform()`.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam Right_ Numeric type of the values of \f$X\f$.
+ * @tparam Output_ Numeric type of the output values.
+ *
+ * @param mat A layered sparse matrix \f$A\f$.
+ * @param[in] right Pointer to a row-major array containing \f$X\f$, with number of rows equal to the number of columns of `mat`.
+ * @param num_right_columns Number of columns of \f$X\f$.
+ * @param[out] output Pointer to a row-major array with number of rows equal to the number of rows of `mat` and number of columns equal to `num_right_columns`.
+ * On output, this is filled with \f$AX\f$.
+ * @param options Further options.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, typename Right_, typename Output_>
+void multiply(
+    const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat,
+    const Right_* right,
+    const std::size_t num_right_columns,
+    Output_* output,
+    const MultiplyOptions& options)
+{
+    multiply_internal::check_untransformed(mat);
+    const Index_ NR = mat.nrow();
+    const auto& chunks = mat.get_chunks();
+    const Index_ chunk_size = mat.get_chunk_size();
+    const Index_ nchunks = chunks.size();
+
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        const auto ostart = output + static_cast<std::size_t>(start) * num_right_columns;
+        std::fill_n(ostart, static_cast<std::size_t>(length) * num_right_columns, static_cast<Output_>(0));
+
+        for (Index_ c = 0; c < nchunks; ++c) {
+            const auto& chunk = chunks[c];
+            const auto rptr = right + static_cast<std::size_t>(c) * static_cast<std::size_t>(chunk_size) * num_right_columns;
+            for (Index_ r = start, end = start + length; r < end; ++r) {
+                const auto optr = output + static_cast<std::size_t>(r) * num_right_columns;
+                visit_row_segment(chunk, r, [&](const auto* indices, const auto values, const std::size_t number) -> void {
+                    multiply_internal::multiply_segment(indices, values, number, rptr, num_right_columns, optr);
+                });
+            }
+        }
+    }, NR, options.num_threads);
+}
+
+/**
+ * Compute the product of the transpose of a layered sparse matrix \f$A\f$ and a dense matrix \f$X\f$, i.e., \f$A^TX\f$.
+ * This operates directly on each layer's arrays rather than extracting columns through the `tatami::Matrix` interface.
+ *
+ * If there are at least as many chunks as threads, each thread is assigned a disjoint set of chunks and only writes to the corresponding rows of the output.
+ * Otherwise, the rows of \f$A\f$ are split across threads, each of which accumulates into its own buffer before the buffers are summed.
+ * An error is thrown if `mat` has a fused transformation.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam Right_ Numeric type of the values of \f$X\f$.
+ * @tparam Output_ Numeric type of the output values.
+ *
+ * @param mat A layered sparse matrix \f$A\f$.
+ * @param[in] right Pointer to a row-major array containing \f$X\f$, with number of rows equal to the number of rows of `mat`.
+ * @param num_right_columns Number of columns of \f$X\f$.
+ * @param[out] output Pointer to a row-major array with number of rows equal to the number of columns of `mat` and number of columns equal to `num_right_columns`.
+ * On output, this is filled with \f$A^TX\f$.
+ * @param options Further options.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, typename Right_, typename Output_>
+void multiply_transposed(
+    const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat,
+    const Right_* right,
+    const std::size_t num_right_columns,
+    Output_* output,
+    const MultiplyOptions& options)
+{
+    multiply_internal::check_untransformed(mat);
+    const Index_ NR = mat.nrow();
+    const Index_ NC = mat.ncol();
+    const auto& chunks = mat.get_chunks();
+    const Index_ chunk_size = mat.get_chunk_size();
+    const Index_ nchunks = chunks.size();
+    const std::size_t output_size = sanisizer::product<std::size_t>(NC, num_right_columns);
+
+    if (sanisizer::is_less_than_or_equal(options.num_threads, nchunks)) {
+        tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+            for (Index_ c = start, end = start + length; c < end; ++c) {
+                const auto optr = output + static_cast<std::size_t>(c) * static_cast<std::size_t>(chunk_size) * num_right_columns;
+                std::fill_n(optr, static_cast<std::size_t>(mat.chunk_extent(c)) * num_right_columns, static_cast<Output_>(0));
+                multiply_internal::multiply_chunk_transposed(chunks[c], static_cast<Index_>(0), NR, right, num_right_columns, optr);
+            }
+        }, nchunks, options.num_threads);
+        return;
+    }
+
+    auto buffers = sanisizer::create<std::vector<std::vector<Output_> > >(options.num_threads);
+    tatami::parallelize([&](const int t, const Index_ start, const Index_ length) -> void {
+        auto& buffer = buffers[t];
+        buffer.resize(output_size);
+        for (Index_ c = 0; c < nchunks; ++c) {
+            const auto optr = buffer.data() + static_cast<std::size_t>(c) * static_cast<std::size_t>(chunk_size) * num_right_columns;
+            multiply_internal::multiply_chunk_transposed(chunks[c], start, length, right, num_right_columns, optr);
+        }
+    }, NR, options.num_threads);
+
+    std::fill_n(output, output_size, static_cast<Output_>(0));
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        const std::size_t first = static_cast<std::size_t>(start) * num_right_columns;
+        const std::size_t last = static_cast<std::size_t>(start + length) * num_right_columns;
+        for (const auto& buffer : buffers) {
+            if (buffer.empty()) { // thread was not used.
+                continue;
+            }
+            for (std::size_t i = first; i < last; ++i) {
+                output[i] += buffer[i];
+            }
+        }
+    }, NC, options.num_threads);
+}
+
+}
+
+#endif
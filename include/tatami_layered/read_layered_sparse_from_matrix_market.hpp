@@ -4,6 +4,12 @@
 #include <vector>
 #include <algorithm>
 #include <cstddef>
+#include <fstream>
+#include <limits>
+#include <utility>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
 
 #include "byteme/byteme.hpp"
 #include "eminem/eminem.hpp"
@@ -11,6 +17,10 @@
 #include "sanisizer/sanisizer.hpp"
 
 #include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+#include "Instrumentation.hpp"
+#include "LayerComposition.hpp"
+#include "MemoryEstimate.hpp"
 
 /**
  * @file read_layered_sparse_from_matrix_market.hpp
@@ -22,84 +32,337 @@ namespace tatami_layered {
 /**
  * @cond
  */
-template<typename Value_, typename Index_, typename ColumnIndex_, class Creator_>
-std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix_market(Creator_ create, const Index_ chunk_size, const int num_threads) {
-    Index_ NR, NC, nchunks, leftovers;
+template<typename Index_>
+struct MatrixMarketScan {
+    Index_ NR, NC, nchunks;
+    FirstPass<Index_> pass;
+    bool rescanned = false; // whether the integers were re-read by scan_signed_integer_lines().
+};
 
-    std::vector<Holder< std::uint8_t, Index_, ColumnIndex_> > store8;
-    std::vector<Holder<std::uint16_t, Index_, ColumnIndex_> > store16;
-    std::vector<Holder<std::uint32_t, Index_, ColumnIndex_> > store32;
+// Parses the data lines of an integer Matrix Market file on a single thread, reading 'input' from the start of the file.
+// Each value's magnitude is parsed as a 64-bit unsigned integer and its sign is handled separately, so that the U64 layer can hold any non-negative value.
+// 'store(r, c, val)' is called with 1-based indices and a std::uint64_t for non-negative values, a std::int64_t for negative values that fit, or a double otherwise.
+template<typename Index_, class Input_, class Store_>
+void scan_signed_integer_lines(Input_& input, const bool array, const Index_ NR, const Index_ NC, const std::size_t nlines, Store_ store) {
+    std::size_t line = 0; // number of newlines consumed so far.
+    auto fail = [&](const std::string& msg) -> void {
+        throw std::runtime_error(msg + " on line " + std::to_string(line + 1) + " of the Matrix Market file");
+    };
 
-    std::vector<std::vector<Index_> > identities8, identities16, identities32;
-    std::vector<std::vector<Index_> > assigned_position;
-    std::vector<std::vector<Category> > assigned_category;
+    auto is_digit = [](const char x) -> bool {
+        return x >= '0' && x <= '9';
+    };
 
-    eminem::ParserOptions eopt;
-    eopt.num_threads = num_threads;
+    auto skip_blanks = [&]() -> void {
+        while (input.valid()) {
+            const char x = input.get();
+            if (x != ' ' && x != '\t' && x != '\r') {
+                break;
+            }
+            input.advance();
+        }
+    };
 
-    // First pass, scanning for the max and number.
-    {
-        auto reader = create();
-        byteme::PerByteSerial<char, byteme::Reader*> pb(&reader);
-        eminem::Parser<I<decltype(&pb)>, Index_> parser(&pb, eopt);
+    auto skip_line = [&]() -> void {
+        while (input.valid()) {
+            const char x = input.get();
+            input.advance();
+            if (x == '\n') {
+                ++line;
+                break;
+            }
+        }
+    };
 
-        parser.scan_preamble();
-        NR = parser.get_nrows();
-        NC = parser.get_ncols();
-        leftovers = NC % chunk_size;
-        nchunks = sanisizer::max(1, NC / chunk_size + (leftovers != 0));
-
-        tatami::resize_container_to_Index_size(store8, nchunks);
-        tatami::resize_container_to_Index_size(store16, nchunks);
-        tatami::resize_container_to_Index_size(store32, nchunks);
-        tatami::resize_container_to_Index_size(identities8, nchunks);
-        tatami::resize_container_to_Index_size(identities16, nchunks);
-        tatami::resize_container_to_Index_size(identities32, nchunks);
-        tatami::resize_container_to_Index_size(assigned_position, nchunks);
-        tatami::resize_container_to_Index_size(assigned_category, nchunks);
-
-        auto max_per_chunk = tatami::create_container_of_Index_size<std::vector<std::vector<Category> > >(nchunks);
-        for (auto& x : max_per_chunk) {
-            tatami::resize_container_to_Index_size(x, NR);
+    // Moves to the first character of the next line that is neither empty nor a comment, returning false at the end of the file.
+    auto next_line = [&]() -> bool {
+        while (input.valid()) {
+            const char x = input.get();
+            if (x == '%') {
+                skip_line();
+            } else if (x == '\n') {
+                ++line;
+                input.advance();
+            } else if (x == ' ' || x == '\t' || x == '\r') {
+                input.advance();
+            } else {
+                return true;
+            }
         }
+        return false;
+    };
 
-        auto num_per_chunk = tatami::create_container_of_Index_size<std::vector<std::vector<Index_> > >(nchunks);
-        for (auto& x : num_per_chunk) {
-            tatami::resize_container_to_Index_size(x, NR);
+    auto parse_magnitude = [&]() -> std::uint64_t {
+        if (!input.valid() || !is_digit(input.get())) {
+            fail("expected a non-negative integer");
         }
+        constexpr std::uint64_t limit = std::numeric_limits<std::uint64_t>::max();
+        std::uint64_t output = 0;
+        do {
+            const std::uint64_t digit = input.get() - '0';
+            if (output > (limit - digit) / 10) {
+                fail("integer does not fit in 64 bits");
+            }
+            output = output * 10 + digit;
+            input.advance();
+        } while (input.valid() && is_digit(input.get()));
+        return output;
+    };
 
-        auto handler = [&](const Index_ r, const Index_ c, const Category cat) -> void {
-            const auto chunk = (c - 1) / chunk_size;
-            auto& maxcat = max_per_chunk[chunk][r - 1];
-            maxcat = std::max(maxcat, cat);
-            ++num_per_chunk[chunk][r - 1];
-        };
+    auto parse_index = [&](const Index_ bound, const char* dimension) -> Index_ {
+        skip_blanks();
+        const auto x = parse_magnitude();
+        if (x == 0 || sanisizer::is_greater_than(x, bound)) {
+            fail(std::string(dimension) + " index out of range");
+        }
+        return x;
+    };
+
+    // Skipping the banner, any comments and the size line, which were already parsed by eminem.
+    if (next_line()) {
+        skip_line();
+    }
 
-        const auto& banner = parser.get_banner();
-        if (banner.field == eminem::Field::INTEGER) {
-            parser.template scan_integer<std::uint32_t>([&](const Index_ r, const Index_ c, const std::uint32_t val) -> void {
-                handler(r, c, categorize(val));
-            });
-        } else if (banner.field == eminem::Field::DOUBLE || banner.field == eminem::Field::REAL) {
-            parser.scan_real([&](const Index_ r, const Index_ c, const double val) -> void {
-                handler(r, c, categorize(val));
-            });
+    constexpr std::uint64_t max_negative = static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) + 1;
+    std::size_t count = 0;
+
+    while (next_line()) {
+        if (count == nlines) {
+            fail("more lines present than specified in the header");
+        }
+
+        Index_ r, c;
+        if (array) {
+            // Array files are stored in column-major order without any indices.
+            r = count % NR + 1;
+            c = count / NR + 1;
         } else {
-            throw std::runtime_error("expected a numeric field in the Matrix Market file");
+            r = parse_index(NR, "row");
+            c = parse_index(NC, "column");
+            skip_blanks();
         }
 
-        allocate_rows(
-            max_per_chunk, 
-            num_per_chunk, 
-            identities8, 
-            identities16, 
-            identities32, 
-            store8, 
-            store16, 
-            store32, 
-            assigned_category, 
-            assigned_position
-        );
+        bool negative = false;
+        if (input.valid() && (input.get() == '-' || input.get() == '+')) {
+            negative = (input.get() == '-');
+            input.advance();
+        }
+        const auto magnitude = parse_magnitude();
+
+        skip_blanks();
+        if (input.valid() && input.get() != '\n') {
+            fail("expected a newline after the value");
+        }
+
+        if (!negative) {
+            store(r, c, magnitude);
+        } else if (magnitude <= max_negative) {
+            store(r, c, magnitude == max_negative ? std::numeric_limits<std::int64_t>::min() : -static_cast<std::int64_t>(magnitude));
+        } else {
+            store(r, c, -static_cast<double>(magnitude));
+        }
+        ++count;
+    }
+
+    if (count < nlines) {
+        fail("fewer lines present than specified in the header");
+    }
+}
+
+// Calls 'store(r, c, val)' for each data line of a Matrix Market file, after 'parser' has scanned the preamble.
+// Integer values are parsed by eminem as std::uint64_t, which keeps the common case of non-negative counts on eminem's parallel parser.
+// However, eminem negates a negative value within the unsigned type, so it wraps around to 2^63 or above and cannot be told apart from a genuine value above 2^63 - 1.
+// In that case, we stop storing values and return false so that the caller can re-read the file with scan_signed_integer_lines().
+template<typename Index_, class Parser_, class Store_>
+bool scan_matrix_market_lines(Parser_& parser, Store_ store) {
+    const auto& banner = parser.get_banner();
+    if (banner.field == eminem::Field::INTEGER) {
+        constexpr std::uint64_t limit = std::numeric_limits<std::int64_t>::max();
+        bool ambiguous = false;
+        parser.template scan_integer<std::uint64_t>([&](const Index_ r, const Index_ c, const std::uint64_t val) -> void {
+            if (ambiguous) {
+                return;
+            }
+            if (val > limit) {
+                ambiguous = true;
+                return;
+            }
+            store(r, c, val);
+        });
+        return !ambiguous;
+
+    } else if (banner.field == eminem::Field::DOUBLE || banner.field == eminem::Field::REAL) {
+        parser.scan_real([&](const Index_ r, const Index_ c, const double val) -> void {
+            store(r, c, val);
+        });
+        return true;
+
+    } else {
+        throw std::runtime_error("expected a numeric field in the Matrix Market file");
+    }
+}
+
+// Whether any data line of a Matrix Market file has a sign, reading 'input' from the start of the file.
+// This is only used after eminem fails to parse an integer file, to decide whether it failed on a signed value or the file is malformed.
+template<class Input_>
+bool has_signed_lines(Input_& input) {
+    bool line_start = true, comment = false, size_line = true;
+    while (input.valid()) {
+        const char x = input.get();
+        if (x == '\n') {
+            if (!line_start && !comment) {
+                size_line = false;
+            }
+            line_start = true;
+            comment = false;
+        } else if (line_start && x == '%') {
+            comment = true;
+            line_start = false;
+        } else {
+            if (!comment && !size_line && (x == '-' || x == '+')) {
+                return true;
+            }
+            if (x != ' ' && x != '\t' && x != '\r') {
+                line_start = false;
+            }
+        }
+        input.advance();
+    }
+    return false;
+}
+
+// Re-reads an integer Matrix Market file with scan_signed_integer_lines(), after scan_matrix_market_lines() returned false for 'parser'.
+template<typename Index_, class Parser_, class Creator_, class Store_>
+void rescan_matrix_market_lines(Parser_& parser, Creator_& create, Store_ store) {
+    const Index_ NR = parser.get_nrows();
+    const Index_ NC = parser.get_ncols();
+    const bool array = parser.get_banner().format == eminem::Format::ARRAY;
+    const std::size_t nlines = (array ? sanisizer::product<std::size_t>(NR, NC) : static_cast<std::size_t>(parser.get_nlines()));
+
+    auto reader = create();
+    byteme::PerByteSerial<char, byteme::Reader*> pb(&reader);
+    scan_signed_integer_lines<Index_>(pb, array, NR, NC, nlines, store);
+}
+
+// First pass, scanning for the max and number.
+template<typename Index_, class Creator_>
+MatrixMarketScan<Index_> scan_matrix_market(Creator_ create, const Index_ chunk_size, const int num_threads, const double tolerance, const bool outliers) {
+    eminem::ParserOptions eopt;
+    eopt.num_threads = num_threads;
+
+    auto reader = create();
+    byteme::PerByteSerial<char, byteme::Reader*> pb(&reader);
+    eminem::Parser<I<decltype(&pb)>, Index_> parser(&pb, eopt);
+
+    parser.scan_preamble();
+    MatrixMarketScan<Index_> output;
+    const Index_ NR = parser.get_nrows();
+    const Index_ NC = parser.get_ncols();
+    const Index_ nchunks = sanisizer::max(1, NC / chunk_size + (NC % chunk_size != 0));
+    output.NR = NR;
+    output.NC = NC;
+    output.nchunks = nchunks;
+
+    output.pass = create_first_pass<Index_>(nchunks, NR, outliers);
+
+    auto handler = [&](const Index_ r, const Index_ c, const auto val) -> void {
+        const auto chunk = (c - 1) / chunk_size;
+        output.pass.summary_per_chunk[chunk].add(r - 1, val, tolerance);
+        ++output.pass.num_per_chunk[chunk][r - 1];
+    };
+
+    bool parsed;
+    try {
+        parsed = scan_matrix_market_lines<Index_>(parser, handler);
+    } catch (...) {
+        // eminem may also refuse to parse a signed value in an unsigned type, in which case we fall back to our own parser.
+        // Otherwise, the file is malformed (or could not be read) and eminem's error is propagated.
+        if (parser.get_banner().field != eminem::Field::INTEGER) {
+            throw;
+        }
+        auto sreader = create();
+        byteme::PerByteSerial<char, byteme::Reader*> spb(&sreader);
+        if (!has_signed_lines(spb)) {
+            throw;
+        }
+        parsed = false;
+    }
+
+    if (!parsed) {
+        output.pass = create_first_pass<Index_>(nchunks, NR, outliers); // discarding anything that was already added.
+        output.rescanned = true;
+        rescan_matrix_market_lines<Index_>(parser, create, handler);
+    }
+
+    return output;
+}
+
+template<typename Index_, typename ColumnIndex_>
+MemoryEstimate estimate_matrix_market(
+    const LayerComposition& composition,
+    const Index_ chunk_size,
+    const int num_threads,
+    const std::size_t buffer_size,
+    const bool huge_pages,
+    const bool dictionary,
+    const bool outliers)
+{
+    // Both passes hold the reader's buffer, doubled to account for the decompressed buffer of the Gzip readers,
+    // along with a block for each thread if eminem parses in parallel.
+    std::size_t parser = sanisizer::product<std::size_t>(buffer_size, 2);
+    if (num_threads > 1) {
+        parser = sanisizer::sum<std::size_t>(parser, sanisizer::product<std::size_t>(num_threads, eminem::ParserOptions().block_size));
+    }
+
+    const std::size_t NR = composition_num_rows(composition);
+    const std::size_t cells = sanisizer::product<std::size_t>(composition.chunks.size(), NR);
+    const std::size_t first_pass = sanisizer::sum<std::size_t>(estimate_first_pass<Index_>(composition, 1, outliers), parser);
+    const std::size_t fill_pass = sanisizer::sum<std::size_t>(
+        sanisizer::product<std::size_t>(cells, sizeof(std::size_t)), // output positions.
+        sanisizer::product<std::size_t>(chunk_size, sizeof(std::pair<ColumnIndex_, std::uint64_t>)), // buffer for sorting, at most one layer's buffer is in use at any time.
+        parser
+    );
+    const std::size_t dictionary_pass = (dictionary ? estimate_dictionary_pass(composition, huge_pages, num_threads) : 0);
+    return estimate_memory(composition, huge_pages, first_pass, fill_pass, dictionary_pass);
+}
+
+template<typename Value_, typename Index_, typename ColumnIndex_, class Creator_, class SourceBytes_, class Hooks_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market_internal(
+    Creator_ create,
+    const Index_ chunk_size,
+    const int num_threads,
+    const std::size_t buffer_size,
+    const double tolerance,
+    const bool huge_pages,
+    const bool dictionary,
+    const bool outliers,
+    const std::size_t max_memory,
+    SourceBytes_ source_bytes,
+    Hooks_& hooks)
+{
+    Index_ NR, NC, nchunks;
+    bool rescanned;
+
+    std::vector<LayeredChunk<Index_, ColumnIndex_> > chunks;
+
+    // First pass, scanning for the max and number.
+    {
+        auto scanned = scan_matrix_market(create, chunk_size, num_threads, tolerance, outliers);
+        NR = scanned.NR;
+        NC = scanned.NC;
+        nchunks = scanned.nchunks;
+        rescanned = scanned.rescanned;
+        hooks.finish(&Instrumentation::scan_seconds);
+
+        hooks.record_transient([&]() -> std::size_t { return scanned.pass.bytes(); });
+        if (has_memory_budget(max_memory)) {
+            const auto composition = compose_first_pass<Value_, Index_, ColumnIndex_>(scanned.pass, NR);
+            check_memory_budget(estimate_matrix_market<Index_, ColumnIndex_>(composition, chunk_size, num_threads, buffer_size, huge_pages, dictionary, outliers), max_memory);
+        }
+
+        tatami::resize_container_to_Index_size(chunks, nchunks);
+        allocate_rows(scanned.pass.summary_per_chunk, scanned.pass.num_per_chunk, chunks, huge_pages);
+        hooks.finish(&Instrumentation::allocate_seconds);
     }
 
     // Now allocating.
@@ -108,10 +371,12 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
         for (I<decltype(nchunks)> chunk = 0; chunk < nchunks; ++chunk) {
             tatami::resize_container_to_Index_size(output_positions[chunk], NR);
             for (I<decltype(NR)> r = 0; r < NR; ++r) {
-                output_positions[chunk][r] = get_sparse_ptr(store8, store16, store32, assigned_category, assigned_position, chunk, r);
+                output_positions[chunk][r] = get_sparse_ptr(chunks, chunk, r);
             }
         }
 
+        eminem::ParserOptions eopt;
+        eopt.num_threads = num_threads;
         auto reader = create();
         byteme::PerByteSerial<char, byteme::Reader*> pb(&reader);
         eminem::Parser<I<decltype(&pb)>, Index_> parser(&pb, eopt);
@@ -121,64 +386,119 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
             const Index_ chunk = c / chunk_size;
             const Index_ offset = c % chunk_size;
             --r;
-            fill_sparse_value(store8, store16, store32, assigned_category[chunk][r], chunk, offset, val, output_positions[chunk][r]++);
+            fill_sparse_value(chunks, chunk, r, offset, val, output_positions[chunk][r]++);
         };
 
         parser.scan_preamble();
-        const auto& banner = parser.get_banner();
-        if (banner.field == eminem::Field::INTEGER) {
-            parser.template scan_integer<std::uint32_t>([&](const Index_ r, const Index_ c, const std::uint32_t val) -> void {
-                handler(r, c, val);
-            });
-        } else if (banner.field == eminem::Field::DOUBLE || banner.field == eminem::Field::REAL) {
-            parser.scan_real([&](const Index_ r, const Index_ c, const double val) -> void {
-                handler(r, c, val);
-            });
+        if (rescanned) {
+            // Going straight to the single-threaded parser, as the first pass already showed that eminem's results are not usable.
+            rescan_matrix_market_lines<Index_>(parser, create, handler);
+        } else if (!scan_matrix_market_lines<Index_>(parser, handler)) {
+            throw std::runtime_error("Matrix Market file has changed since the first pass");
         }
+        hooks.finish(&Instrumentation::fill_seconds);
 
         // Checking that the column indices are sorted properly.
-        auto sorter = [&](auto& store) -> void {
-            std::vector<std::pair<I<decltype(store[0].index[0])>, I<decltype(store[0].value[0])>> > buffer;
-            buffer.reserve(chunk_size);
-
-            for (auto& st : store) {
-                const auto num_ptr = st.ptr.size();
-                for (I<decltype(num_ptr)> r = 1; r < num_ptr; ++r) {
-                    const auto start = st.ptr[r - 1], end = st.ptr[r];
-
-                    if (!std::is_sorted(st.index.begin() + start, st.index.begin() + end)) {
-                        buffer.clear();
-                        for (auto i = start; i < end; ++i) {
-                            buffer.emplace_back(st.index[i], st.value[i]);
+        // The buffer is specific to each layer's value type so that no precision is lost, but it is only allocated if a row needs sorting.
+        auto sorter = [&](const Category, auto& st) -> void {
+            std::vector<std::pair<ColumnIndex_, I<decltype(*st.value)> > > buffer;
+            for (I<decltype(st.num_rows)> r = 0; r < st.num_rows; ++r) {
+                const auto start = st.ptr[r], end = st.ptr[r + 1];
+
+                if (!std::is_sorted(st.index + start, st.index + end)) {
+                    buffer.clear();
+                    for (auto i = start; i < end; ++i) {
+                        buffer.emplace_back(st.index[i], st.value[i]);
+                    }
+
+                    std::sort(buffer.begin(), buffer.end());
+                    const auto index = writable_array(st.index);
+                    const auto value = writable_array(st.value);
+                    auto bIt = buffer.begin();
+                    for (auto i = start; i < end; ++i, ++bIt) {
+                        index[i] = bIt->first;
+                        value[i] = bIt->second;
+                    }
+
+                    // Escapes were also added in the order of the lines, so they need to be sorted by column index as well.
+                    if constexpr(I<decltype(st)>::escaped) {
+                        const auto estart = st.escape_ptr[r], eend = st.escape_ptr[r + 1];
+                        std::vector<std::pair<ColumnIndex_, std::uint64_t> > escapes;
+                        escapes.reserve(eend - estart);
+                        for (auto e = estart; e < eend; ++e) {
+                            escapes.emplace_back(st.escape_index[e], st.escape_value[e]);
                         }
 
-                        std::sort(buffer.begin(), buffer.end());
-                        auto bIt = buffer.begin();
-                        for (auto i = start; i < end; ++i, ++bIt) {
-                            st.index[i] = bIt->first;
-                            st.value[i] = bIt->second;
+                        std::sort(escapes.begin(), escapes.end());
+                        const auto escape_index = writable_array(st.escape_index);
+                        const auto escape_value = writable_array(st.escape_value);
+                        auto eIt = escapes.begin();
+                        for (auto e = estart; e < eend; ++e, ++eIt) {
+                            escape_index[e] = eIt->first;
+                            escape_value[e] = eIt->second;
                         }
                     }
                 }
             }
         };
 
-        sorter(store8);
-        sorter(store16);
-        sorter(store32);
+        for (auto& chunk : chunks) {
+            for_each_layer(chunk, sorter);
+        }
+        hooks.finish(&Instrumentation::sort_seconds);
     }
 
-    return consolidate_matrices<Value_, Index_>(
-        identities8, 
-        identities16, 
-        identities32, 
-        std::move(store8), 
-        std::move(store16), 
-        std::move(store32),
-        NR,
-        chunk_size,
-        leftovers
-    );
+    if (dictionary) {
+        const auto copies = encode_dictionaries(chunks, huge_pages, num_threads);
+        hooks.record_transient([&]() -> std::size_t { return copies; });
+        hooks.finish(&Instrumentation::encode_seconds);
+    }
+
+    hooks.record_bytes_read([&]() -> std::size_t { return sanisizer::product<std::size_t>(source_bytes(), rescanned ? 3 : 2); }); // once for each pass, plus another read if the integers were rescanned.
+    hooks.record_layers(chunks);
+    auto output = consolidate_matrices<Value_, Index_>(std::move(chunks), NR, NC, chunk_size);
+    hooks.finish(&Instrumentation::consolidate_seconds);
+    return output;
+}
+
+template<typename Value_, typename Index_, typename ColumnIndex_, class Creator_, class SourceBytes_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market(
+    Creator_ create,
+    const Index_ chunk_size,
+    const int num_threads,
+    const std::size_t buffer_size,
+    const double tolerance,
+    const bool huge_pages,
+    const bool dictionary,
+    const bool outliers,
+    const std::size_t max_memory,
+    Instrumentation* instrumentation,
+    SourceBytes_ source_bytes)
+{
+    return Instrumentation_internal::dispatch(instrumentation, [&](auto& hooks) -> std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > {
+        return read_layered_sparse_from_matrix_market_internal<Value_, Index_, ColumnIndex_>(
+            std::move(create),
+            chunk_size,
+            num_threads,
+            buffer_size,
+            tolerance,
+            huge_pages,
+            dictionary,
+            outliers,
+            max_memory,
+            std::move(source_bytes),
+            hooks
+        );
+    });
+}
+
+// Only called if instrumentation was requested, see Instrumentation_internal::Recorder::record_bytes_read().
+inline std::size_t source_file_size(const char* filepath) {
+    std::ifstream handle(filepath, std::ios::binary | std::ios::ate);
+    if (!handle) {
+        return 0;
+    }
+    return handle.tellg();
 }
 /**
  * @endcond
@@ -200,26 +520,62 @@ struct ReadLayeredSparseFromMatrixMarketOptions {
 
     /**
      * Number of threads for Matrix Market parsing.
+     * Integer files with negative values or values above 2^63 - 1 are parsed on a single thread so that they can be read exactly.
+     * Such files are only detected during the first pass, so they are also read once more than other files.
      */
     int num_threads = 1;
+
+    /**
+     * Maximum relative error for non-integer values in real-valued files, see `ConvertToLayeredSparseOptions::tolerance` for details.
+     */
+    double tolerance = 0;
+
+    /**
+     * Whether to request transparent huge pages for the storage of each chunk's layers, see `ConvertToLayeredSparseOptions::huge_pages` for details.
+     */
+    bool huge_pages = false;
+
+    /**
+     * Whether to store rows in the dictionary-coded layer, see `ConvertToLayeredSparseOptions::dictionary`.
+     */
+    bool dictionary = false;
+
+    /**
+     * Whether to store rows with a few large values in the escaped layer, see `ConvertToLayeredSparseOptions::outliers`.
+     */
+    bool outliers = false;
+
+    /**
+     * Pointer to an `Instrumentation` instance in which to record the time spent in each phase of the load, the number of bytes read and the memory usage.
+     * If `NULL`, no instrumentation is performed.
+     * Note that the time spent reading and decompressing the input cannot be separated from parsing, so it is included in `Instrumentation::scan_seconds` and `Instrumentation::fill_seconds`.
+     */
+    Instrumentation* instrumentation = NULL;
+
+    /**
+     * Maximum memory usage (in bytes) for the load.
+     * If the estimated peak memory usage exceeds this value, an error is thrown after the first pass through the file and before any layers are allocated.
+     * See `estimate_read_layered_sparse_from_matrix_market()` for details on the estimate.
+     * By default, no limit is imposed.
+     */
+    std::size_t max_memory = std::numeric_limits<std::size_t>::max();
 };
 
 /**
  * @param filepath Path to an uncompressed Matrix Market text file.
  * @param options Further options.
  * 
- * @return A `tatami::Matrix` object containing a layered sparse matrix.
+ * @return A `LayeredSparseMatrix` object.
  *
  * @tparam Value_ Type of data value for the output `tatami::Matrix` interface.
  * @tparam Index_ Integer type for the row/column indices of the output.
  * @tparam ColumnIndex_ Integer type for the stored column indices.
  *
- * This function loads a layered sparse integer matrix from a Matrix Market file.
- * The aim is to reduce memory usage by storing each gene's counts in the smallest unsigned integer type that can hold them.
- * See `convert_to_layered_sparse()` for more details.
+ * This function loads a layered sparse matrix from a Matrix Market file.
+ * The aim is to reduce memory usage by storing each row of each chunk in the smallest of the layers described in `convert_to_layered_sparse()`.
  */
 template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
-std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix_market_text_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market_text_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
     return read_layered_sparse_from_matrix_market<Value_, Index_, ColumnIndex_>(
         [&]() -> auto {
             return byteme::RawFileReader(filepath, [&]{
@@ -229,7 +585,15 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
             }());
         },
         check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
-        options.num_threads
+        options.num_threads,
+        options.buffer_size,
+        options.tolerance,
+        options.huge_pages,
+        options.dictionary,
+        options.outliers,
+        options.max_memory,
+        options.instrumentation,
+        [&]() -> std::size_t { return source_file_size(filepath); }
     );
 }
 
@@ -256,18 +620,17 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
  * @param filepath Path to a (possibly Gzip-compressed) Matrix Market file.
  * @param options Further options.
  * 
- * @return A `tatami::Matrix` object containing a layered sparse matrix.
+ * @return A `LayeredSparseMatrix` object.
  *
  * @tparam Value_ Type of data value for the output `tatami::Matrix` interface.
  * @tparam Index_ Integer type for the row/column indices of the output.
  * @tparam ColumnIndex_ Integer type for the stored column indices.
  *
- * This function loads a layered sparse integer matrix from a Matrix Market file.
- * The aim is to reduce memory usage by storing each gene's counts in the smallest unsigned integer type that can hold them.
- * See `convert_to_layered_sparse()` for more details.
+ * This function loads a layered sparse matrix from a Matrix Market file.
+ * The aim is to reduce memory usage by storing each row of each chunk in the smallest of the layers described in `convert_to_layered_sparse()`.
  */
 template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
-std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix_market_some_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market_some_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
     return read_layered_sparse_from_matrix_market<Value_, Index_, ColumnIndex_>(
         [&]() -> auto {
             return byteme::SomeFileReader(filepath, [&]{
@@ -277,7 +640,15 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
             }());
         },
         check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
-        options.num_threads
+        options.num_threads,
+        options.buffer_size,
+        options.tolerance,
+        options.huge_pages,
+        options.dictionary,
+        options.outliers,
+        options.max_memory,
+        options.instrumentation,
+        [&]() -> std::size_t { return source_file_size(filepath); }
     );
 }
 
@@ -285,18 +656,17 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
  * @param filepath Path to a Gzip-compressed Matrix Market file.
  * @param options Further options.
  * 
- * @return A `tatami::Matrix` object containing a layered sparse matrix.
+ * @return A `LayeredSparseMatrix` object.
  *
  * @tparam Value_ Type of data value for the output `tatami::Matrix` interface.
  * @tparam Index_ Integer type for the row/column indices of the output.
  * @tparam ColumnIndex_ Integer type for the stored column indices.
  *
- * This function loads a layered sparse integer matrix from a Matrix Market file.
- * The aim is to reduce memory usage by storing each gene's counts in the smallest unsigned integer type that can hold them.
- * See `convert_to_layered_sparse()` for more details.
+ * This function loads a layered sparse matrix from a Matrix Market file.
+ * The aim is to reduce memory usage by storing each row of each chunk in the smallest of the layers described in `convert_to_layered_sparse()`.
  */
 template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
-std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix_market_gzip_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market_gzip_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
     return read_layered_sparse_from_matrix_market<Value_, Index_, ColumnIndex_>(
         [&]() -> auto {
             return byteme::GzipFileReader(filepath, [&]{
@@ -306,7 +676,15 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
             }());
         },
         check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
-        options.num_threads
+        options.num_threads,
+        options.buffer_size,
+        options.tolerance,
+        options.huge_pages,
+        options.dictionary,
+        options.outliers,
+        options.max_memory,
+        options.instrumentation,
+        [&]() -> std::size_t { return source_file_size(filepath); }
     );
 }
 
@@ -345,18 +723,17 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
  * @param length Length of the array.
  * @param options Further options.
  * 
- * @return A `tatami::Matrix` object containing a layered sparse matrix.
+ * @return A `LayeredSparseMatrix` object.
  *
  * @tparam Value_ Type of data value for the output `tatami::Matrix` interface.
  * @tparam Index_ Integer type for the row/column indices of the output.
  * @tparam ColumnIndex_ Integer type for the stored column indices.
  *
- * This function loads a layered sparse integer matrix from a buffer with the contents of a Matrix Market file.
- * The aim is to reduce memory usage by storing each gene's counts in the smallest unsigned integer type that can hold them.
- * See `convert_to_layered_sparse()` for more details.
+ * This function loads a layered sparse matrix from a buffer with the contents of a Matrix Market file.
+ * The aim is to reduce memory usage by storing each row of each chunk in the smallest of the layers described in `convert_to_layered_sparse()`.
  */
 template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
-std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix_market_text_buffer(
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market_text_buffer(
     const unsigned char* contents,
     std::size_t length,
     const ReadLayeredSparseFromMatrixMarketOptions& options)
@@ -366,7 +743,15 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
             return byteme::RawBufferReader(contents, length);
         },
         check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
-        options.num_threads
+        options.num_threads,
+        options.buffer_size,
+        options.tolerance,
+        options.huge_pages,
+        options.dictionary,
+        options.outliers,
+        options.max_memory,
+        options.instrumentation,
+        [&]() -> std::size_t { return length; }
     );
 }
 
@@ -394,18 +779,17 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
  * @param length Length of the array.
  * @param options Further options.
  * 
- * @return A `tatami::Matrix` object containing a layered sparse matrix.
+ * @return A `LayeredSparseMatrix` object.
  *
  * @tparam Value_ Type of data value for the output `tatami::Matrix` interface.
  * @tparam Index_ Integer type for the row/column indices of the output.
  * @tparam ColumnIndex_ Integer type for the stored column indices.
  *
- * This function loads a layered sparse integer matrix from a buffer with the contents of a Matrix Market file.
- * The aim is to reduce memory usage by storing each gene's counts in the smallest unsigned integer type that can hold them.
- * See `convert_to_layered_sparse()` for more details.
+ * This function loads a layered sparse matrix from a buffer with the contents of a Matrix Market file.
+ * The aim is to reduce memory usage by storing each row of each chunk in the smallest of the layers described in `convert_to_layered_sparse()`.
  */
 template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
-std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix_market_some_buffer(
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market_some_buffer(
     const unsigned char* contents,
     std::size_t length,
     const ReadLayeredSparseFromMatrixMarketOptions& options)
@@ -419,7 +803,15 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
             }());
         },
         check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
-        options.num_threads
+        options.num_threads,
+        options.buffer_size,
+        options.tolerance,
+        options.huge_pages,
+        options.dictionary,
+        options.outliers,
+        options.max_memory,
+        options.instrumentation,
+        [&]() -> std::size_t { return length; }
     );
 }
 
@@ -428,18 +820,17 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
  * @param length Length of the array.
  * @param options Further options.
  * 
- * @return A `tatami::Matrix` object containing a layered sparse matrix.
+ * @return A `LayeredSparseMatrix` object.
  *
  * @tparam Value_ Type of data value for the output `tatami::Matrix` interface.
  * @tparam Index_ Integer type for the row/column indices of the output.
  * @tparam ColumnIndex_ Integer type for the stored column indices.
  *
- * This function loads a layered sparse integer matrix from a buffer with the contents of a Matrix Market file.
- * The aim is to reduce memory usage by storing each gene's counts in the smallest unsigned integer type that can hold them.
- * See `convert_to_layered_sparse()` for more details.
+ * This function loads a layered sparse matrix from a buffer with the contents of a Matrix Market file.
+ * The aim is to reduce memory usage by storing each row of each chunk in the smallest of the layers described in `convert_to_layered_sparse()`.
  */
 template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
-std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix_market_zlib_buffer(
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > read_layered_sparse_from_matrix_market_zlib_buffer(
     const unsigned char* contents,
     std::size_t length,
     const ReadLayeredSparseFromMatrixMarketOptions& options)
@@ -453,7 +844,15 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
             }());
         },
         check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
-        options.num_threads
+        options.num_threads,
+        options.buffer_size,
+        options.tolerance,
+        options.huge_pages,
+        options.dictionary,
+        options.outliers,
+        options.max_memory,
+        options.instrumentation,
+        [&]() -> std::size_t { return length; }
     );
 }
 
@@ -497,6 +896,139 @@ std::shared_ptr<tatami::Matrix<Value_, Index_> > read_layered_sparse_from_matrix
 
 #endif
 
+/**
+ * @cond
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, class Creator_>
+LayerComposition scan_layered_sparse_from_matrix_market(Creator_ create, const Index_ chunk_size, const int num_threads, const double tolerance, const bool outliers) {
+    const auto scanned = scan_matrix_market(create, chunk_size, num_threads, tolerance, outliers);
+    return compose_first_pass<Value_, Index_, ColumnIndex_>(scanned.pass, scanned.NR);
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Predict the composition of the layered sparse matrix that would be created by `read_layered_sparse_from_matrix_market_text_file()`, without actually creating it.
+ * This only performs the first pass through the file, see `scan_layered_sparse()` for more details.
+ *
+ * @param filepath Path to an uncompressed Matrix Market text file.
+ * @param options Further options, as used in `read_layered_sparse_from_matrix_market_text_file()`.
+ *
+ * @return Composition of the layers of the loaded matrix.
+ *
+ * @tparam Value_ Type of data value for the output `tatami::Matrix` interface, used to compute `LayerComposition::csr_bytes`.
+ * @tparam Index_ Integer type for the row/column indices of the output.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ */
+template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
+LayerComposition scan_layered_sparse_from_matrix_market_text_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
+    return scan_layered_sparse_from_matrix_market<Value_, Index_, ColumnIndex_>(
+        [&]() -> auto {
+            return byteme::RawFileReader(filepath, [&]{
+                byteme::RawFileReaderOptions opt;
+                opt.buffer_size = options.buffer_size;
+                return opt;
+            }());
+        },
+        check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
+        options.num_threads,
+        options.tolerance,
+        options.outliers
+    );
+}
+
+#if __has_include("zlib.h")
+
+/**
+ * Predict the composition of the layered sparse matrix that would be created by `read_layered_sparse_from_matrix_market_some_file()`, without actually creating it.
+ * This only performs the first pass through the file, see `scan_layered_sparse()` for more details.
+ *
+ * @param filepath Path to a (possibly Gzip-compressed) Matrix Market file.
+ * @param options Further options, as used in `read_layered_sparse_from_matrix_market_some_file()`.
+ *
+ * @return Composition of the layers of the loaded matrix.
+ *
+ * @tparam Value_ Type of data value for the output `tatami::Matrix` interface, used to compute `LayerComposition::csr_bytes`.
+ * @tparam Index_ Integer type for the row/column indices of the output.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ */
+template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
+LayerComposition scan_layered_sparse_from_matrix_market_some_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
+    return scan_layered_sparse_from_matrix_market<Value_, Index_, ColumnIndex_>(
+        [&]() -> auto {
+            return byteme::SomeFileReader(filepath, [&]{
+                byteme::SomeFileReaderOptions opt;
+                opt.buffer_size = options.buffer_size;
+                return opt;
+            }());
+        },
+        check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
+        options.num_threads,
+        options.tolerance,
+        options.outliers
+    );
+}
+
+/**
+ * Predict the composition of the layered sparse matrix that would be created by `read_layered_sparse_from_matrix_market_gzip_file()`, without actually creating it.
+ * This only performs the first pass through the file, see `scan_layered_sparse()` for more details.
+ *
+ * @param filepath Path to a Gzip-compressed Matrix Market file.
+ * @param options Further options, as used in `read_layered_sparse_from_matrix_market_gzip_file()`.
+ *
+ * @return Composition of the layers of the loaded matrix.
+ *
+ * @tparam Value_ Type of data value for the output `tatami::Matrix` interface, used to compute `LayerComposition::csr_bytes`.
+ * @tparam Index_ Integer type for the row/column indices of the output.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ */
+template<typename Value_ = double, typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
+LayerComposition scan_layered_sparse_from_matrix_market_gzip_file(const char* filepath, const ReadLayeredSparseFromMatrixMarketOptions& options) {
+    return scan_layered_sparse_from_matrix_market<Value_, Index_, ColumnIndex_>(
+        [&]() -> auto {
+            return byteme::GzipFileReader(filepath, [&]{
+                byteme::GzipFileReaderOptions opt;
+                opt.buffer_size = options.buffer_size;
+                return opt;
+            }());
+        },
+        check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
+        options.num_threads,
+        options.tolerance,
+        options.outliers
+    );
+}
+
+#endif
+
+/**
+ * Estimate the memory required by `read_layered_sparse_from_matrix_market_text_file()` and friends, given the results of a previous scan.
+ * This allows users to check whether a load will fit into memory before committing to it, e.g., to avoid running out of memory in the middle of the second pass.
+ * The scan can be persisted and re-used for different `options.num_threads`, `options.buffer_size`, `options.huge_pages` and `options.dictionary`, but not for a different `options.chunk_size` or `ColumnIndex_`.
+ * If `options.dictionary = true`, the estimate assumes that no rows are dictionary-coded, so it is an upper bound on the final and peak memory usage.
+ *
+ * @param composition Composition of the layers, as returned by `scan_layered_sparse_from_matrix_market_text_file()` or friends with the same `options`.
+ * @param options Further options, as used in `read_layered_sparse_from_matrix_market_text_file()`.
+ *
+ * @return Estimated memory usage of the load.
+ *
+ * @tparam Index_ Integer type for the row/column indices of the output.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ */
+template<typename Index_ = int, typename ColumnIndex_ = std::uint16_t>
+MemoryEstimate estimate_read_layered_sparse_from_matrix_market(const LayerComposition& composition, const ReadLayeredSparseFromMatrixMarketOptions& options) {
+    return estimate_matrix_market<Index_, ColumnIndex_>(
+        composition,
+        check_chunk_size<Index_, ColumnIndex_>(options.chunk_size),
+        options.num_threads,
+        options.buffer_size,
+        options.huge_pages,
+        options.dictionary,
+        options.outliers
+    );
+}
+
 }
 
 #endif
@@ -0,0 +1,99 @@
+#ifndef TATAMI_LAYERED_RECHUNK_HPP
+#define TATAMI_LAYERED_RECHUNK_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+#include "bind.hpp"
+
+/**
+ * @file rechunk.hpp
+ * @brief Change the chunk size of a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `rechunk()`.
+ */
+struct RechunkOptions {
+    /**
+     * Chunk size to use for partitioning columns in the output matrix.
+     * This should be a positive integer.
+     */
+    std::size_t chunk_size = sanisizer::cap<std::size_t>(65536);
+
+    /**
+     * Number of threads to use.
+     * This should be a positive integer.
+     */
+    int num_threads = 1;
+
+    /**
+     * Whether to request transparent huge pages for the storage of each new chunk's layers,
+     * see `ConvertToLayeredSparseOptions::huge_pages` for details.
+     */
+    bool huge_pages = false;
+
+    /**
+     * Whether to store rows of the assembled chunks in the dictionary-coded layer, see `ConvertToLayeredSparseOptions::dictionary`.
+     * This should generally be the same as the option used to create `mat`, as its dictionary-coded rows are otherwise decoded into the other layers.
+     */
+    bool dictionary = false;
+
+    /**
+     * Whether to store rows of the assembled chunks in the escaped layer, see `ConvertToLayeredSparseOptions::outliers`.
+     * As with `dictionary`, this should generally be the same as the option used to create `mat`.
+     */
+    bool outliers = false;
+};
+
+/**
+ * Change the chunk size and/or the column index type of a layered sparse matrix.
+ * This operates directly on the existing layers, which is much faster than extracting values via the `tatami::Matrix` interface for `convert_to_layered_sparse()`.
+ * Each output chunk is assembled from the segments of the input chunks that it covers.
+ * For rows in the integer layers (including the 8-bit layer) or with escapes, only the range of the native integer values in each segment is computed,
+ * as this is needed to choose a signed layer if the row has negative values in another segment.
+ * For rows in the floating-point layers, the existing category is re-used if the input chunk is fully contained in an output chunk (e.g., when merging chunks);
+ * otherwise, the category is recomputed from the values in the segment.
+ * Dictionary-coded rows and rows with escapes are re-encoded in the assembled chunks according to `RechunkOptions::dictionary` and `RechunkOptions::outliers`.
+ * If `OutColumnIndex_` is the same as `ColumnIndex_`, input chunks that are identical to an output chunk are shared without copying.
+ * Any fused transformation in `mat` is transferred to the output matrix.
+ *
+ * @tparam OutColumnIndex_ Integer type for the stored column indices in the output matrix.
+ * If this is not able to hold `options.chunk_size - 1`, the chunk size is reduced as described in `convert_to_layered_sparse()`.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices in `mat`.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return A new `LayeredSparseMatrix` with the same values as `mat` but a different chunk size and/or column index type.
+ */
+template<typename OutColumnIndex_ = std::uint16_t, typename Value_, typename Index_, typename ColumnIndex_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, OutColumnIndex_> > rechunk(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const RechunkOptions& options) {
+    const Index_ chunk_size = check_chunk_size<Index_, OutColumnIndex_>(options.chunk_size);
+    const Index_ NR = mat.nrow();
+    const Index_ NC = mat.ncol();
+
+    std::vector<const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>*> ptrs{ &mat };
+    auto chunks = bind_internal::combine_columns<OutColumnIndex_>(ptrs, NR, NC, chunk_size, options.num_threads, options.huge_pages, options.dictionary, options.outliers);
+    auto output = std::make_shared<LayeredSparseMatrix<Value_, Index_, OutColumnIndex_> >(NR, NC, chunk_size, std::move(chunks), false);
+
+    const auto transform = mat.get_fused_transform();
+    if (!transform) {
+        return output;
+    }
+    return output->fuse_transform(*transform);
+}
+
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef TATAMI_LAYERED_SAVE_LAYERED_SPARSE_HPP
+#define TATAMI_LAYERED_SAVE_LAYERED_SPARSE_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file save_layered_sparse.hpp
+ * @brief Save a layered sparse matrix to a binary file.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @cond
+ */
+namespace save_layered_sparse_internal {
+
+class Writer {
+public:
+    Writer(const char* path) : my_stream(path, std::ios::binary | std::ios::trunc) {
+        if (!my_stream) {
+            throw std::runtime_error("failed to open '" + std::string(path) + "' for writing");
+        }
+    }
+
+    void write(const void* data, const std::size_t bytes) {
+        if (bytes) {
+            my_stream.write(static_cast<const char*>(data), bytes);
+            if (!my_stream) {
+                throw std::runtime_error("failed to write layered matrix to file");
+            }
+            my_position += bytes;
+        }
+    }
+
+    void pad_to(const std::size_t position) {
+        static const char zeros[LayerArena::default_alignment] = {};
+        while (my_position < position) {
+            write(zeros, std::min(position - my_position, sizeof(zeros)));
+        }
+    }
+
+    std::size_t position() const {
+        return my_position;
+    }
+
+    void finish() {
+        my_stream.close();
+        if (!my_stream) {
+            throw std::runtime_error("failed to write layered matrix to file");
+        }
+    }
+
+private:
+    std::ofstream my_stream;
+    std::size_t my_position = 0;
+};
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Save a layered sparse matrix to a binary file that can be loaded with `load_layered_sparse()`.
+ * Loading is much faster than re-reading a Matrix Market file or re-running `convert_to_layered_sparse()`,
+ * as the layer arrays can be used directly from the file without any processing.
+ *
+ * The file consists of a series of sections, each of which starts at a byte offset that is a multiple of 64.
+ * All integers are stored in the native byte order of the machine, so files are only portable between machines with the same byte order;
+ * this is checked by `load_layered_sparse()`.
+ *
+ * 1. The header consists of 16 unsigned 64-bit integers, containing (in order):
+ *    the magic string `TLAYERED`, the format version (currently 1), the byte order marker `0x0102030405060708`,
+ *    the size of the column index type in bytes, the number of rows, the number of columns, the chunk size,
+ *    the number of chunks, the number of unique code vectors, the number of layers in each chunk (currently 12)
+ *    and the number of bits used for the layer in each row code (currently 4).
+ *    The remaining integers are set to zero.
+ * 2. The code vectors, each containing one unsigned 32-bit integer per row.
+ *    Each integer contains the layer of the row in the lowest bits and the position of the row within that layer (in the remaining bits).
+ *    The layers are numbered from 0 to 11, i.e., the 8-, 16-, 32- and 64-bit unsigned integer layers, the 16-, 32- and 64-bit floating-point layers,
+ *    the 8-, 16- and 32-bit signed integer layers, the dictionary-coded layer and the escaped layer.
+ *    Chunks with the same assignment of rows to layers share the same code vector.
+ * 3. The chunk directory, containing \f$5 + 2L\f$ unsigned 64-bit integers for each chunk where \f$L\f$ is the number of layers in the header:
+ *    the index of the chunk's code vector; the number of rows in each layer;
+ *    the number of non-zero elements in each layer;
+ *    the number of entries in the tables of the dictionary-coded layer; the number of escapes in the escaped layer;
+ *    and the byte offset and size of the chunk's data section.
+ * 4. The data section for each chunk, containing the row pointers (as unsigned 64-bit integers) for each layer in the above order,
+ *    then the column indices for the same layers, and then the values for the same layers.
+ *    Half-precision values are stored as their IEEE 754 bit patterns, see `Float16`, while the dictionary-coded layer stores an 8-bit code for each value
+ *    and the escaped layer stores each value as an 8-bit unsigned integer (or 255 for escaped values).
+ *    The data section then contains the pointers (as unsigned 64-bit integers) into the tables for each row of the dictionary-coded layer, followed by the tables as doubles.
+ *    Finally, the data section contains the pointers (as unsigned 64-bit integers) into the escapes for each row of the escaped layer,
+ *    followed by the column indices and the values (as unsigned 64-bit integers) of the escapes.
+ *    Each array starts at a multiple of 64 bytes from the start of the data section.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * This should not have a fused transformation.
+ * @param path Path to the output file.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_>
+void save_layered_sparse(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const char* path) {
+    if (mat.get_fused_transform()) {
+        throw std::runtime_error("cannot save a layered matrix with a fused transformation");
+    }
+
+    const auto& chunks = mat.get_chunks();
+    const std::size_t nchunks = chunks.size();
+    const std::size_t NR = mat.nrow();
+
+    // Identifying the unique code vectors by their address, as consolidate_matrices() already shares identical vectors.
+    std::vector<const std::vector<RowCode>*> unique_codes;
+    auto code_ids = sanisizer::create<std::vector<std::size_t> >(nchunks);
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        const auto current = chunks[c].codes.get();
+        auto it = std::find(unique_codes.begin(), unique_codes.end(), current);
+        code_ids[c] = it - unique_codes.begin();
+        if (it == unique_codes.end()) {
+            unique_codes.push_back(current);
+        }
+    }
+
+    const std::size_t codes_start = pad_file_offset(sanisizer::product<std::size_t>(file_header_words, sizeof(std::uint64_t)));
+    const std::size_t codes_bytes = sanisizer::product<std::size_t>(sanisizer::product<std::size_t>(unique_codes.size(), NR), sizeof(RowCode));
+    const std::size_t directory_start = pad_file_offset(sanisizer::sum<std::size_t>(codes_start, codes_bytes));
+    const std::size_t directory_bytes = sanisizer::product<std::size_t>(sanisizer::product<std::size_t>(nchunks, file_directory_words), sizeof(std::uint64_t));
+
+    std::vector<std::uint64_t> directory;
+    directory.reserve(nchunks * file_directory_words);
+    std::vector<LayerOffsets> all_offsets;
+    all_offsets.reserve(nchunks);
+    std::size_t data_position = pad_file_offset(sanisizer::sum<std::size_t>(directory_start, directory_bytes));
+
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        const auto& chunk = chunks[c];
+        const auto num_rows = layer_num_rows(chunk);
+        const auto num_nonzero = layer_num_nonzero(chunk);
+        const auto num_entries = layer_num_entries(chunk);
+        const auto num_escapes = layer_num_escapes(chunk);
+        all_offsets.push_back(define_layer_offsets<ColumnIndex_>(num_rows, num_nonzero, num_entries, num_escapes));
+        const auto& offsets = all_offsets.back();
+
+        directory.push_back(code_ids[c]);
+        directory.insert(directory.end(), num_rows.begin(), num_rows.end());
+        directory.insert(directory.end(), num_nonzero.begin(), num_nonzero.end());
+        directory.push_back(num_entries);
+        directory.push_back(num_escapes);
+        directory.push_back(data_position);
+        directory.push_back(offsets.total);
+        data_position = pad_file_offset(sanisizer::sum<std::size_t>(data_position, offsets.total));
+    }
+
+    save_layered_sparse_internal::Writer writer(path);
+
+    std::uint64_t header[file_header_words] = {};
+    std::memcpy(header, file_magic, sizeof(file_magic));
+    header[1] = file_version;
+    header[2] = file_byte_order;
+    header[3] = sizeof(ColumnIndex_);
+    header[4] = NR;
+    header[5] = mat.ncol();
+    header[6] = mat.get_chunk_size();
+    header[7] = nchunks;
+    header[8] = unique_codes.size();
+    header[9] = num_categories;
+    header[10] = row_code_shift;
+    writer.write(header, sizeof(header));
+
+    writer.pad_to(codes_start);
+    for (const auto codes : unique_codes) {
+        static_assert(sizeof(RowCode) == sizeof(std::uint32_t));
+        writer.write(codes->data(), NR * sizeof(RowCode));
+    }
+
+    writer.pad_to(directory_start);
+    writer.write(directory.data(), directory_bytes);
+
+    [[maybe_unused]] std::vector<std::uint64_t> pointer_buffer;
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        const auto& chunk = chunks[c];
+        const auto& offsets = all_offsets[c];
+        const std::size_t base = directory[(c + 1) * file_directory_words - 2];
+
+        // Arrays are written in the order of their offsets, i.e., all pointers, then all indices, then all values, then the dictionary tables and the escapes.
+        // Pointers are written as a single block if they are already 64-bit, which is required for loading anyway.
+        // Otherwise, they are converted into a buffer that is reused across all layers and chunks.
+        auto write_pointers = [&](const std::size_t offset, const std::size_t* ptr, const std::size_t num_rows) -> void {
+            writer.pad_to(base + offset);
+            const std::size_t num_pointers = sanisizer::sum<std::size_t>(num_rows, 1);
+            if constexpr(sizeof(std::size_t) == sizeof(std::uint64_t)) {
+                writer.write(ptr, num_pointers * sizeof(std::uint64_t));
+            } else {
+                pointer_buffer.assign(ptr, ptr + num_pointers);
+                writer.write(pointer_buffer.data(), num_pointers * sizeof(std::uint64_t));
+            }
+        };
+        for_each_layer(chunk, [&](const Category cat, const auto& layer) -> void {
+            write_pointers(offsets.ptr[static_cast<std::size_t>(cat)], layer.ptr, layer.num_rows);
+        });
+
+        auto write_layer_array = [&](const std::size_t offset, const auto* data, const std::size_t number) -> void {
+            writer.pad_to(base + offset);
+            writer.write(data, number * sizeof(*data));
+        };
+        for_each_layer(chunk, [&](const Category cat, const auto& layer) -> void {
+            write_layer_array(offsets.index[static_cast<std::size_t>(cat)], layer.index, layer.num_nonzero());
+        });
+        for_each_layer(chunk, [&](const Category cat, const auto& layer) -> void {
+            write_layer_array(offsets.value[static_cast<std::size_t>(cat)], layer.value, layer.num_nonzero());
+        });
+        const auto& dict = chunk.stored8;
+        write_pointers(offsets.table_ptr, dict.table_ptr, dict.num_rows);
+        write_layer_array(offsets.table, dict.table, dict.num_entries());
+        const auto& esc = chunk.storee8;
+        write_pointers(offsets.escape_ptr, esc.escape_ptr, esc.num_rows);
+        write_layer_array(offsets.escape_index, esc.escape_index, esc.num_escapes());
+        write_layer_array(offsets.escape_value, esc.escape_value, esc.num_escapes());
+        writer.pad_to(base + offsets.total);
+    }
+
+    writer.finish();
+}
+
+}
+
+#endif
@@ -0,0 +1,471 @@
+#ifndef TATAMI_LAYERED_STATISTICS_HPP
+#define TATAMI_LAYERED_STATISTICS_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file statistics.hpp
+ * @brief Compute row and column statistics from a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `row_sums()`, `column_sums()` and friends.
+ */
+struct StatisticsOptions {
+    /**
+     * Number of threads to use.
+     * This should be a positive integer.
+     */
+    int num_threads = 1;
+};
+
+/**
+ * @cond
+ */
+namespace statistics_internal {
+
+// Integer layers are summed exactly in 64 bits, while floating-point layers are summed in double precision.
+template<typename Int_>
+using SumType = std::conditional_t<
+    std::is_integral<Int_>::value,
+    std::conditional_t<std::is_signed<Int_>::value, std::int64_t, std::uint64_t>,
+    double
+>;
+
+// These loops are deliberately simple so that compilers can vectorize them over the narrow integer types.
+// 'values' may also be a DictionaryValues or EscapedValues, in which case the decoded values are summed as doubles or 64-bit unsigned integers, respectively.
+template<class Values_>
+auto sum_values(const Values_ values, const std::size_t number) {
+    typedef SumType<I<decltype(values[0])> > Sum;
+    Sum total = 0;
+    for (std::size_t i = 0; i < number; ++i) {
+        total += static_cast<Sum>(values[i]);
+    }
+    return total;
+}
+
+// Running sum over layers of different types, keeping the integer parts exact.
+struct LayerSum {
+    std::uint64_t integer = 0;
+    std::int64_t signed_integer = 0;
+    double floating = 0;
+
+    template<class Values_>
+    void add(const Values_ values, const std::size_t number) {
+        typedef I<decltype(values[0])> Int;
+        if constexpr(std::is_integral<Int>::value) {
+            if constexpr(std::is_signed<Int>::value) {
+                signed_integer += sum_values(values, number);
+            } else {
+                integer += sum_values(values, number);
+            }
+        } else {
+            floating += sum_values(values, number);
+        }
+    }
+
+    template<typename Int_>
+    void add(const Int_ val) {
+        add(&val, 1);
+    }
+
+    LayerSum& operator+=(const LayerSum& other) {
+        integer += other.integer;
+        signed_integer += other.signed_integer;
+        floating += other.floating;
+        return *this;
+    }
+
+    template<typename Output_>
+    Output_ get() const {
+        return static_cast<Output_>(integer) + static_cast<Output_>(signed_integer) + static_cast<Output_>(floating);
+    }
+};
+
+template<class Values_>
+std::size_t count_nonzero(const Values_ values, const std::size_t number) {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < number; ++i) {
+        total += (values[i] != 0);
+    }
+    return total;
+}
+
+template<class Values_>
+double sum_squared_deviations(const Values_ values, const std::size_t number, const double mean) {
+    double total = 0;
+    for (std::size_t i = 0; i < number; ++i) {
+        const double delta = static_cast<double>(values[i]) - mean;
+        total += delta * delta;
+    }
+    return total;
+}
+
+template<typename Index_, typename ColumnIndex_>
+void row_sums_and_counts(
+    const std::vector<LayeredChunk<Index_, ColumnIndex_> >& chunks,
+    const Index_ row,
+    LayerSum& sum,
+    std::size_t& stored)
+{
+    sum = LayerSum();
+    stored = 0;
+    for (const auto& chunk : chunks) {
+        visit_row_segment(chunk, row, [&](const auto*, const auto values, const std::size_t number) -> void {
+            sum.add(values, number);
+            stored += number;
+        });
+    }
+}
+
+template<typename Value_, typename Index_, typename ColumnIndex_>
+void check_untransformed(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat) {
+    if (mat.get_fused_transform()) {
+        throw std::runtime_error("statistics cannot be computed directly from a layered matrix with a fused transformation");
+    }
+}
+
+template<typename Output_>
+Output_ finalize_variance(const double sum_squares, const double mean, const std::size_t stored, const std::size_t total) {
+    static_assert(std::is_floating_point<Output_>::value, "variances should be returned as floating-point values");
+    if (total < 2) {
+        return std::numeric_limits<Output_>::quiet_NaN();
+    }
+    return (sum_squares + static_cast<double>(total - stored) * mean * mean) / static_cast<double>(total - 1);
+}
+
+// Column statistics are computed in the same manner as multiply_transposed().
+// If there are at least as many chunks as threads, each thread processes a disjoint set of chunks and only writes to the corresponding columns.
+// Otherwise, the rows are split across threads, each of which accumulates into its own vector of column totals.
+template<typename Accumulator_, typename Value_, typename Index_, typename ColumnIndex_, class Function_>
+std::vector<Accumulator_> accumulate_by_column(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const int num_threads, Function_ fun) {
+    check_untransformed(mat);
+    const Index_ NR = mat.nrow();
+    const Index_ NC = mat.ncol();
+    const auto& chunks = mat.get_chunks();
+    const Index_ chunk_size = mat.get_chunk_size();
+    const Index_ nchunks = chunks.size();
+
+    auto accumulate_chunk = [&](std::vector<Accumulator_>& totals, const Index_ c, const Index_ start, const Index_ length) -> void {
+        const auto& chunk = chunks[c];
+        const Index_ offset = c * chunk_size;
+        for (Index_ r = start, end = start + length; r < end; ++r) {
+            visit_row_segment(chunk, r, [&](const auto* indices, const auto values, const std::size_t number) -> void {
+                for (std::size_t i = 0; i < number; ++i) {
+                    const Index_ col = offset + static_cast<Index_>(indices[i]);
+                    fun(totals[col], col, values[i]);
+                }
+            });
+        }
+    };
+
+    if (sanisizer::is_less_than_or_equal(num_threads, nchunks)) {
+        auto output = tatami::create_container_of_Index_size<std::vector<Accumulator_> >(NC);
+        tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+            for (Index_ c = start, end = start + length; c < end; ++c) {
+                accumulate_chunk(output, c, static_cast<Index_>(0), NR);
+            }
+        }, nchunks, num_threads);
+        return output;
+    }
+
+    auto per_thread = sanisizer::create<std::vector<std::vector<Accumulator_> > >(num_threads);
+    tatami::parallelize([&](const int t, const Index_ start, const Index_ length) -> void {
+        auto& totals = per_thread[t];
+        tatami::resize_container_to_Index_size(totals, NC);
+        for (Index_ c = 0; c < nchunks; ++c) {
+            accumulate_chunk(totals, c, start, length);
+        }
+    }, NR, num_threads);
+
+    std::vector<Accumulator_> output;
+    bool first = true;
+    for (auto& totals : per_thread) {
+        if (totals.empty()) { // thread was not used.
+            continue;
+        }
+        if (first) {
+            output.swap(totals);
+            first = false;
+        } else {
+            for (Index_ c = 0; c < NC; ++c) {
+                output[c] += totals[c];
+            }
+        }
+    }
+
+    if (first) {
+        tatami::resize_container_to_Index_size(output, NC);
+    }
+    return output;
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @tparam Output_ Type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of rows, containing the sum of each row.
+ *
+ * This walks through the layers directly, accumulating each row's values as 64-bit integers (or as doubles for the floating-point layers) before converting to `Output_`.
+ * It is typically much faster than calling `tatami_stats::sums::by_row()` on the same matrix.
+ *
+ * All functions in this file operate on the stored values and will throw an error if `mat` has a fused transformation, see `LayeredSparseMatrix::fuse_transform()`.
+ */
+template<typename Output_ = double, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> row_sums(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    statistics_internal::check_untransformed(mat);
+    const Index_ NR = mat.nrow();
+    auto output = tatami::create_container_of_Index_size<std::vector<Output_> >(NR);
+    const auto& chunks = mat.get_chunks();
+
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        for (Index_ r = start, end = start + length; r < end; ++r) {
+            statistics_internal::LayerSum sum;
+            std::size_t stored;
+            statistics_internal::row_sums_and_counts(chunks, r, sum, stored);
+            output[r] = sum.get<Output_>();
+        }
+    }, NR, options.num_threads);
+
+    return output;
+}
+
+/**
+ * @tparam Output_ Type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of rows, containing the mean of each row.
+ * This is NaN for all rows if the matrix has no columns.
+ */
+template<typename Output_ = double, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> row_means(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    auto output = row_sums<Output_>(mat, options);
+    const Output_ denom = mat.ncol();
+    for (auto& o : output) {
+        o /= denom;
+    }
+    return output;
+}
+
+/**
+ * @tparam Output_ Floating-point type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of rows, containing the sample variance of each row.
+ * This is NaN for all rows if the matrix has fewer than two columns.
+ *
+ * The mean is computed from the row sums (exactly, for the integer layers), after which the squared deviations are accumulated over the stored values of each row.
+ */
+template<typename Output_ = double, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> row_variances(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    statistics_internal::check_untransformed(mat);
+    const Index_ NR = mat.nrow();
+    const Index_ NC = mat.ncol();
+    auto output = tatami::create_container_of_Index_size<std::vector<Output_> >(NR);
+    const auto& chunks = mat.get_chunks();
+
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        for (Index_ r = start, end = start + length; r < end; ++r) {
+            statistics_internal::LayerSum sum;
+            std::size_t stored;
+            statistics_internal::row_sums_and_counts(chunks, r, sum, stored);
+            const double mean = sum.get<double>() / static_cast<double>(NC);
+
+            double sum_squares = 0;
+            for (const auto& chunk : chunks) {
+                visit_row_segment(chunk, r, [&](const auto*, const auto values, const std::size_t number) -> void {
+                    sum_squares += statistics_internal::sum_squared_deviations(values, number, mean);
+                });
+            }
+
+            output[r] = statistics_internal::finalize_variance<Output_>(sum_squares, mean, stored, NC);
+        }
+    }, NR, options.num_threads);
+
+    return output;
+}
+
+/**
+ * @tparam Output_ Type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of rows, containing the number of non-zero values in each row.
+ */
+template<typename Output_ = std::size_t, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> row_nnz(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    statistics_internal::check_untransformed(mat);
+    const Index_ NR = mat.nrow();
+    auto output = tatami::create_container_of_Index_size<std::vector<Output_> >(NR);
+    const auto& chunks = mat.get_chunks();
+
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        for (Index_ r = start, end = start + length; r < end; ++r) {
+            std::size_t count = 0;
+            for (const auto& chunk : chunks) {
+                visit_row_segment(chunk, r, [&](const auto*, const auto values, const std::size_t number) -> void {
+                    count += statistics_internal::count_nonzero(values, number);
+                });
+            }
+            output[r] = count;
+        }
+    }, NR, options.num_threads);
+
+    return output;
+}
+
+/**
+ * @tparam Output_ Type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of columns, containing the sum of each column.
+ *
+ * If there are at least as many chunks as threads, each thread is assigned a disjoint set of chunks and computes the totals for their columns.
+ * Otherwise, rows are split across threads, each of which accumulates column totals that are combined at the end.
+ */
+template<typename Output_ = double, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> column_sums(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    auto totals = statistics_internal::accumulate_by_column<statistics_internal::LayerSum>(mat, options.num_threads, [](statistics_internal::LayerSum& total, const Index_, const auto val) -> void {
+        total.add(val);
+    });
+    auto output = tatami::create_container_of_Index_size<std::vector<Output_> >(totals.size());
+    for (std::size_t c = 0, end = totals.size(); c < end; ++c) {
+        output[c] = totals[c].template get<Output_>();
+    }
+    return output;
+}
+
+/**
+ * @tparam Output_ Type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of columns, containing the mean of each column.
+ * This is NaN for all columns if the matrix has no rows.
+ */
+template<typename Output_ = double, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> column_means(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    auto output = column_sums<Output_>(mat, options);
+    const Output_ denom = mat.nrow();
+    for (auto& o : output) {
+        o /= denom;
+    }
+    return output;
+}
+
+/**
+ * @tparam Output_ Floating-point type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of columns, containing the sample variance of each column.
+ * This is NaN for all columns if the matrix has fewer than two rows.
+ */
+template<typename Output_ = double, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> column_variances(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    struct SumCount {
+        statistics_internal::LayerSum sum;
+        std::size_t stored = 0;
+        SumCount& operator+=(const SumCount& other) {
+            sum += other.sum;
+            stored += other.stored;
+            return *this;
+        }
+    };
+
+    auto first = statistics_internal::accumulate_by_column<SumCount>(mat, options.num_threads, [](SumCount& total, const Index_, const auto val) -> void {
+        total.sum.add(val);
+        ++(total.stored);
+    });
+
+    const Index_ NR = mat.nrow();
+    const Index_ NC = mat.ncol();
+    auto means = tatami::create_container_of_Index_size<std::vector<double> >(NC);
+    for (Index_ c = 0; c < NC; ++c) {
+        means[c] = first[c].sum.template get<double>() / static_cast<double>(NR);
+    }
+
+    auto second = statistics_internal::accumulate_by_column<double>(mat, options.num_threads, [&](double& total, const Index_ col, const auto val) -> void {
+        const double delta = static_cast<double>(val) - means[col];
+        total += delta * delta;
+    });
+
+    auto output = tatami::create_container_of_Index_size<std::vector<Output_> >(NC);
+    for (Index_ c = 0; c < NC; ++c) {
+        output[c] = statistics_internal::finalize_variance<Output_>(second[c], means[c], first[c].stored, NR);
+    }
+    return output;
+}
+
+/**
+ * @tparam Output_ Type of the output.
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param options Further options.
+ *
+ * @return Vector of length equal to the number of columns, containing the number of non-zero values in each column.
+ */
+template<typename Output_ = std::size_t, typename Value_, typename Index_, typename ColumnIndex_>
+std::vector<Output_> column_nnz(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const StatisticsOptions& options) {
+    auto totals = statistics_internal::accumulate_by_column<std::size_t>(mat, options.num_threads, [](std::size_t& total, const Index_, const auto val) -> void {
+        total += (val != 0);
+    });
+    return std::vector<Output_>(totals.begin(), totals.end());
+}
+
+}
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef TATAMI_LAYERED_SUBSET_LAYERED_HPP
+#define TATAMI_LAYERED_SUBSET_LAYERED_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <string>
+#include <numeric>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+
+#include "tatami/tatami.hpp"
+#include "sanisizer/sanisizer.hpp"
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file subset_layered.hpp
+ * @brief Subset a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Options for `subset_layered()`.
+ */
+struct SubsetLayeredOptions {
+    /**
+     * Number of threads to use.
+     * This should be a positive integer.
+     */
+    int num_threads = 1;
+
+    /**
+     * Whether to request transparent huge pages for the storage of each chunk's layers,
+     * see `ConvertToLayeredSparseOptions::huge_pages` for details.
+     */
+    bool huge_pages = false;
+
+    /**
+     * Whether to store rows of the output chunks in the dictionary-coded layer, see `ConvertToLayeredSparseOptions::dictionary`.
+     * This should generally be the same as the option used to create `mat`, as its dictionary-coded rows are otherwise decoded into the other layers.
+     */
+    bool dictionary = false;
+
+    /**
+     * Whether to store rows of the output chunks in the escaped layer, see `ConvertToLayeredSparseOptions::outliers`.
+     * As with `dictionary`, this should generally be the same as the option used to create `mat`.
+     */
+    bool outliers = false;
+};
+
+/**
+ * @cond
+ */
+namespace subset_layered_internal {
+
+template<typename Index_>
+void check_subset(const std::vector<Index_>* subset, const Index_ extent, const char* dim) {
+    if (subset) {
+        for (auto i : *subset) {
+            if (is_negative(i) || i >= extent) {
+                throw std::runtime_error(std::string("subset indices should be non-negative and less than the number of ") + dim);
+            }
+        }
+    }
+}
+
+// Sorts the non-zero elements of 'row' in 'chunk' by their column indices, for when the column subset is not sorted.
+template<typename Index_, typename ColumnIndex_>
+void sort_row(const LayeredChunk<Index_, ColumnIndex_>& chunk, const Index_ row, std::vector<std::size_t>& order, std::vector<unsigned char>& buffer) {
+    const auto code = (*(chunk.codes))[row];
+    const auto pos = row_code_position(code);
+    auto sort_layer = [&](const auto& layer) -> void { // the layers were just filled, so they are still writable.
+        const auto start = layer.ptr[pos];
+        const std::size_t number = layer.ptr[pos + 1] - start;
+        const auto iptr = writable_array(layer.index) + start;
+        const auto vptr = writable_array(layer.value) + start;
+        if (std::is_sorted(iptr, iptr + number)) {
+            return;
+        }
+
+        order.resize(number);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](const std::size_t l, const std::size_t r) -> bool { return iptr[l] < iptr[r]; });
+
+        typedef I<decltype(*vptr)> Int;
+        buffer.resize(number * std::max(sizeof(Int), sizeof(ColumnIndex_)));
+        auto ibuffer = reinterpret_cast<ColumnIndex_*>(buffer.data());
+        for (std::size_t i = 0; i < number; ++i) {
+            ibuffer[i] = iptr[order[i]];
+        }
+        std::copy_n(ibuffer, number, iptr);
+        auto vbuffer = reinterpret_cast<Int*>(buffer.data());
+        for (std::size_t i = 0; i < number; ++i) {
+            vbuffer[i] = vptr[order[i]];
+        }
+        std::copy_n(vbuffer, number, vptr);
+
+        // Escapes were added in the same order as the other values, so they need to be sorted by column index as well.
+        if constexpr(I<decltype(layer)>::escaped) {
+            const auto estart = layer.escape_ptr[pos];
+            const std::size_t enumber = layer.escape_ptr[pos + 1] - estart;
+            const auto eiptr = writable_array(layer.escape_index) + estart;
+            const auto evptr = writable_array(layer.escape_value) + estart;
+            std::vector<std::pair<ColumnIndex_, std::uint64_t> > escapes;
+            escapes.reserve(enumber);
+            for (std::size_t e = 0; e < enumber; ++e) {
+                escapes.emplace_back(eiptr[e], evptr[e]);
+            }
+            std::sort(escapes.begin(), escapes.end());
+            for (std::size_t e = 0; e < enumber; ++e) {
+                eiptr[e] = escapes[e].first;
+                evptr[e] = escapes[e].second;
+            }
+        }
+    };
+
+    dispatch_layer(chunk, row_code_category(code), sort_layer);
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Subset the rows and/or columns of a layered sparse matrix, returning a new layered sparse matrix that only contains the retained elements.
+ * This is more efficient than a `tatami::DelayedSubset` for repeated access as there is no indirection during extraction,
+ * and the memory for the full matrix can be released once the subset is created.
+ *
+ * The layer of each row is re-assigned in each chunk of the output matrix, so rows are moved to a smaller integer type if their largest retained value is small enough.
+ * The output matrix has the same chunk size as `mat`.
+ * Any fused transformation in `mat` is also transferred to the output matrix, after subsetting its row and column factors.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ *
+ * @param mat A layered sparse matrix.
+ * @param rows Pointer to a vector of row indices to retain, which may be unsorted and may contain duplicates.
+ * If `NULL`, all rows are retained.
+ * @param columns Pointer to a vector of column indices to retain, which may be unsorted and may contain duplicates.
+ * If `NULL`, all columns are retained.
+ * @param options Further options.
+ *
+ * @return A new `LayeredSparseMatrix` where the `i`-th row and `j`-th column correspond to row `(*rows)[i]` and column `(*columns)[j]` of `mat`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_>
+std::shared_ptr<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> > subset_layered(
+    const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat,
+    const std::vector<Index_>* rows,
+    const std::vector<Index_>* columns,
+    const SubsetLayeredOptions& options)
+{
+    const Index_ in_NR = mat.nrow();
+    const Index_ in_NC = mat.ncol();
+    subset_layered_internal::check_subset(rows, in_NR, "rows");
+    subset_layered_internal::check_subset(columns, in_NC, "columns");
+
+    const Index_ NR = (rows ? sanisizer::cast<Index_>(rows->size()) : in_NR);
+    const Index_ NC = (columns ? sanisizer::cast<Index_>(columns->size()) : in_NC);
+    const Index_ chunk_size = mat.get_chunk_size();
+    const Index_ num_chunks = sanisizer::max(1, NC / chunk_size + (NC % chunk_size != 0));
+    const auto& in_chunks = mat.get_chunks();
+    const Index_ in_num_chunks = in_chunks.size();
+
+    // Mapping each input column to its output columns in compressed form.
+    // We also skip the input chunks that do not contain any retained column.
+    auto map_ptr = sanisizer::create<std::vector<std::size_t> >(sanisizer::sum<std::size_t>(in_NC, 1));
+    std::vector<Index_> map_out;
+    auto needed = sanisizer::create<std::vector<unsigned char> >(in_num_chunks);
+    bool sorted = true;
+    if (columns) {
+        for (auto c : *columns) {
+            ++map_ptr[c + 1];
+        }
+        for (Index_ c = 0; c < in_NC; ++c) {
+            map_ptr[c + 1] += map_ptr[c];
+        }
+        sanisizer::resize(map_out, columns->size());
+        auto cursors = map_ptr;
+        for (Index_ j = 0; j < NC; ++j) {
+            const auto c = (*columns)[j];
+            map_out[cursors[c]++] = j;
+            needed[c / chunk_size] = 1;
+            if (j && c < (*columns)[j - 1]) {
+                sorted = false;
+            }
+        }
+    } else {
+        std::iota(map_ptr.begin(), map_ptr.end(), 0);
+        sanisizer::resize(map_out, in_NC);
+        std::iota(map_out.begin(), map_out.end(), 0);
+        std::fill(needed.begin(), needed.end(), 1);
+    }
+
+    auto process_row = [&](const Index_ i, auto fun) -> void {
+        const Index_ r = (rows ? (*rows)[i] : i);
+        for (Index_ ic = 0; ic < in_num_chunks; ++ic) {
+            if (!needed[ic]) {
+                continue;
+            }
+            const Index_ chunk_start = ic * chunk_size;
+            visit_row_segment(in_chunks[ic], r, [&](const ColumnIndex_* indices, const auto values, const std::size_t number) -> void {
+                for (std::size_t k = 0; k < number; ++k) {
+                    const Index_ c = chunk_start + indices[k];
+                    for (auto m = map_ptr[c], mend = map_ptr[c + 1]; m < mend; ++m) {
+                        fun(map_out[m], values[k]);
+                    }
+                }
+            });
+        }
+    };
+
+    auto chunks = tatami::create_container_of_Index_size<std::vector<LayeredChunk<Index_, ColumnIndex_> > >(num_chunks);
+
+    // First pass to define the allocations.
+    {
+        auto pass = create_first_pass<Index_>(num_chunks, NR, options.outliers);
+        auto& num_per_chunk = pass.num_per_chunk;
+        std::mutex lock;
+
+        tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+            RowRangeSummaries summaries(pass.summary_per_chunk, start, length);
+            for (Index_ i = start, end = start + length; i < end; ++i) {
+                process_row(i, [&](const Index_ j, const auto val) -> void {
+                    const Index_ chunk = j / chunk_size;
+                    summaries.add(chunk, i, val);
+                    ++num_per_chunk[chunk][i];
+                });
+            }
+            summaries.finish(lock);
+        }, NR, options.num_threads);
+
+        allocate_rows(pass.summary_per_chunk, num_per_chunk, chunks, options.huge_pages);
+    }
+
+    // Second pass to actually fill the vectors.
+    tatami::parallelize([&](const int, const Index_ start, const Index_ length) -> void {
+        auto output_positions = tatami::create_container_of_Index_size<std::vector<std::size_t> >(num_chunks);
+        std::vector<std::size_t> order;
+        std::vector<unsigned char> buffer;
+
+        for (Index_ i = start, end = start + length; i < end; ++i) {
+            for (Index_ chunk = 0; chunk < num_chunks; ++chunk) {
+                output_positions[chunk] = get_sparse_ptr(chunks, chunk, i);
+            }
+            process_row(i, [&](const Index_ j, const auto val) -> void {
+                const Index_ chunk = j / chunk_size;
+                fill_sparse_value(chunks, chunk, i, j % chunk_size, val, output_positions[chunk]++);
+            });
+
+            if (!sorted) {
+                for (const auto& chunk : chunks) {
+                    subset_layered_internal::sort_row(chunk, i, order, buffer);
+                }
+            }
+        }
+    }, NR, options.num_threads);
+
+    if (options.dictionary) {
+        encode_dictionaries(chunks, options.huge_pages, options.num_threads);
+    }
+
+    share_row_codes(chunks);
+    auto output = std::make_shared<LayeredSparseMatrix<Value_, Index_, ColumnIndex_> >(NR, NC, chunk_size, std::move(chunks), false);
+
+    const auto transform = mat.get_fused_transform();
+    if (!transform) {
+        return output;
+    }
+
+    FusedTransform copy = *transform;
+    if (rows && !copy.row_factors.empty()) {
+        auto& factors = copy.row_factors;
+        std::vector<double> subsetted;
+        subsetted.reserve(NR);
+        for (auto r : *rows) {
+            subsetted.push_back(factors[r]);
+        }
+        factors.swap(subsetted);
+    }
+    if (columns && !copy.column_factors.empty()) {
+        auto& factors = copy.column_factors;
+        std::vector<double> subsetted;
+        subsetted.reserve(NC);
+        for (auto c : *columns) {
+            subsetted.push_back(factors[c]);
+        }
+        factors.swap(subsetted);
+    }
+    return output->fuse_transform(std::move(copy));
+}
+
+}
+
+#endif
@@ -1,8 +1,27 @@
 #ifndef TATAMI_LAYERED_TATAMI_LAYERED_HPP
 #define TATAMI_LAYERED_TATAMI_LAYERED_HPP
 
+#include "LayeredSparseMatrix.hpp"
+#include "CachedLayeredSparseMatrix.hpp"
+#include "CompressedLayeredSparseMatrix.hpp"
+#include "Float16.hpp"
+#include "OutOfCoreLayeredSparseMatrix.hpp"
+#include "Instrumentation.hpp"
+#include "LayerComposition.hpp"
+#include "MemoryEstimate.hpp"
+#include "append_columns.hpp"
+#include "bind.hpp"
 #include "convert_to_layered_sparse.hpp"
+#include "describe_layered_sparse.hpp"
+#include "extract_rows.hpp"
+#include "load_layered_sparse.hpp"
+#include "multiply.hpp"
 #include "read_layered_sparse_from_matrix_market.hpp"
+#include "rechunk.hpp"
+#include "save_layered_sparse.hpp"
+#include "statistics.hpp"
+#include "subset_layered.hpp"
+#include "visit.hpp"
 
 /**
  * @file tatami_layered.hpp
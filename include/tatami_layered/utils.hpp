@@ -2,33 +2,145 @@
 #define TATAMI_LAYERED_UTILS_HPP
 
 #include <limits>
+#include <array>
 #include <vector>
+#include <algorithm>
 #include <numeric>
 #include <cstdint>
 #include <cstddef>
 #include <type_traits>
+#include <memory>
+#include <new>
+#include <list>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <cmath>
+#include <cstring>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#ifdef MADV_HUGEPAGE
+#define TATAMI_LAYERED_HAS_MADVISE
+#endif
+#endif
 
 #include "tatami/tatami.hpp"
 #include "sanisizer/sanisizer.hpp"
 
+#include "Float16.hpp"
+
 namespace tatami_layered {
 
-enum class Category : unsigned char { U8, U16, U32 };
+enum class Category : unsigned char { U8, U16, U32, U64, F16, F32, F64, I8, I16, I32, D8, E8 };
+
+constexpr std::size_t num_categories = 12;
+
+// Size of the stored values in each layer, indexed by the integer value of each Category.
+constexpr std::array<std::size_t, num_categories> category_value_sizes {
+    sizeof(std::uint8_t),
+    sizeof(std::uint16_t),
+    sizeof(std::uint32_t),
+    sizeof(std::uint64_t),
+    sizeof(Float16),
+    sizeof(float),
+    sizeof(double),
+    sizeof(std::int8_t),
+    sizeof(std::int16_t),
+    sizeof(std::int32_t),
+    sizeof(std::uint8_t), // codes into each row's dictionary, see encode_dictionaries().
+    sizeof(std::uint8_t) // values with escapes for outliers, see choose_category().
+};
+
+inline bool is_unsigned_category(const Category cat) {
+    return cat <= Category::U64;
+}
+
+inline bool is_floating_category(const Category cat) {
+    return cat >= Category::F16 && cat <= Category::F64;
+}
+
+inline bool is_signed_category(const Category cat) {
+    return cat >= Category::I8 && cat <= Category::I32;
+}
+
+// Value of the escaped layer that indicates an outlier, i.e., a value that is stored as an escape.
+constexpr std::uint8_t escape_code = std::numeric_limits<std::uint8_t>::max();
 
+// Whether 'v' would need an escape in the escaped layer.
+// This is only meaningful for non-negative integers, as rows with any other values are never stored in that layer.
 template<typename Value_>
-Category categorize(const Value_ v) {
-    if (v < 0) {
-        throw std::runtime_error("cannot categorize negative value in a layered matrix");
+bool is_outlier(const Value_ v) {
+    if constexpr(std::is_same<Value_, Float16>::value) {
+        return is_outlier(static_cast<float>(v));
+    } else if constexpr(std::is_floating_point<Value_>::value) {
+        return v >= static_cast<Value_>(escape_code);
+    } else {
+        return sanisizer::is_greater_than(v, escape_code - 1);
+    }
+}
+
+// Smallest floating-point category that can store 'v' with a relative error of no more than 'tolerance'.
+// Non-finite values are representable in all floating-point layers.
+inline Category categorize_floating(const double v, const double tolerance) {
+    if (!std::isfinite(v)) {
+        return Category::F16;
     }
 
-    constexpr std::uint32_t max32 = std::numeric_limits<std::uint32_t>::max();
-    if constexpr(std::is_floating_point<Value_>::value) {
-        if (v > static_cast<double>(max32)) {
-            throw std::runtime_error("floating-point value is outside of the range of a 32-bit unsigned integer");
+    // Checking the range first, as converting an out-of-range double to float is undefined.
+    const double magnitude = std::abs(v);
+    if (magnitude <= static_cast<double>(std::numeric_limits<float>::max())) {
+        const double allowed = tolerance * magnitude;
+        const float single = static_cast<float>(v);
+        const double half = static_cast<float>(Float16(single));
+        if (std::isfinite(half) && std::abs(half - v) <= allowed) {
+            return Category::F16;
         }
-        return categorize<std::uint32_t>(v);
+        if (std::abs(static_cast<double>(single) - v) <= allowed) {
+            return Category::F32;
+        }
+    }
+
+    return Category::F64;
+}
+
+// Non-negative integers are stored in the smallest unsigned integer layer that can hold them exactly.
+// Negative integers are stored in the smallest signed integer layer, up to 32 bits.
+// All other values are stored in the smallest floating-point layer that satisfies 'tolerance', see categorize_floating().
+template<typename Value_>
+Category categorize(const Value_ v, const double tolerance = 0) {
+    if constexpr(std::is_same<Value_, Float16>::value) {
+        return categorize(static_cast<float>(v), tolerance);
+
+    } else if constexpr(std::is_floating_point<Value_>::value) {
+        if (std::trunc(v) == v) {
+            // 2^64 is exactly representable, unlike the maximum value of a 64-bit unsigned integer.
+            if (v >= 0 && v < static_cast<Value_>(18446744073709551616.0)) {
+                return categorize<std::uint64_t>(v);
+            }
+            if (v < 0 && v >= static_cast<Value_>(std::numeric_limits<std::int32_t>::min())) {
+                return categorize<std::int32_t>(v);
+            }
+        }
+        return categorize_floating(v, tolerance);
 
     } else {
+        if constexpr(std::is_signed<Value_>::value) {
+            if (v < 0) {
+                if (v >= std::numeric_limits<std::int8_t>::min()) {
+                    return Category::I8;
+                }
+                if (v >= std::numeric_limits<std::int16_t>::min()) {
+                    return Category::I16;
+                }
+                if (v >= std::numeric_limits<std::int32_t>::min()) {
+                    return Category::I32;
+                }
+                return categorize_floating(v, tolerance);
+            }
+        }
+
         constexpr std::uint8_t max8 = std::numeric_limits<std::uint8_t>::max();
         if (sanisizer::is_less_than_or_equal(v, max8)) {
             return Category::U8;
@@ -39,206 +151,1467 @@ Category categorize(const Value_ v) {
             return Category::U16;
         }
 
-        if (sanisizer::is_greater_than(v, max32)) {
-            throw std::runtime_error("integer value is outside of the range of a 32-bit unsigned integer");
+        constexpr std::uint32_t max32 = std::numeric_limits<std::uint32_t>::max();
+        if (sanisizer::is_less_than_or_equal(v, max32)) {
+            return Category::U32;
+        }
+
+        constexpr std::uint64_t max64 = std::numeric_limits<std::uint64_t>::max();
+        if (sanisizer::is_greater_than(v, max64)) {
+            return categorize_floating(v, tolerance);
+        }
+
+        return Category::U64;
+    }
+}
+
+// The first pass only tracks the range of the integer values and the smallest floating-point category for the non-integer values of each row in each chunk;
+// the layer is chosen once all values have been added, so it does not depend on the order in which values or partial summaries are combined.
+// For example, [-5, 200, 0.5] is always stored as F16, regardless of whether 0.5 is seen before or after the integers.
+//
+// The range is stored as levels, i.e., the number of layer boundaries that are exceeded by the largest and smallest values.
+// This keeps the summary of rows with only non-negative integers - by far the most common case - to a single byte.
+inline std::uint8_t max_level(const std::uint64_t x) {
+    return (x > 127u) // I8
+        + (x > 255u) // U8
+        + (x > 2048u) // F16, as all integers up to 2^11 are exactly representable in half precision.
+        + (x > 32767u) // I16
+        + (x > 65535u) // U16
+        + (x > 16777216u) // F32, as all integers up to 2^24 are exactly representable in single precision.
+        + (x > 2147483647u) // I32
+        + (x > 4294967295u); // U32
+}
+
+// Level of a negative integer, where zero is reserved for rows without negative integers.
+inline std::uint8_t min_level(const std::int32_t x) {
+    return 1 + (x < -128) + (x < -2048) + (x < -32768) + (x < -16777216);
+}
+
+constexpr std::uint8_t max_level_I8 = 0, max_level_F16 = 2, max_level_I16 = 3, max_level_F32 = 5, max_level_I32 = 6;
+constexpr std::uint8_t min_level_I8 = 1, min_level_F16 = 2, min_level_I16 = 3, min_level_F32 = 4;
+
+// Remainder of the summary of a row, which is only needed if the row contains a negative or non-integer value.
+struct RowExtras {
+    // Level of the smallest negative integer, or zero if there are none.
+    // Negative integers below the range of a 32-bit signed integer are treated as non-integers, as there is no signed layer to hold them.
+    std::uint8_t min = 0;
+
+    // Smallest floating-point category that satisfies the tolerance for all of the non-integer values,
+    // or U8 if all values are integers (which compares less than all floating-point categories).
+    Category floating = Category::U8;
+};
+
+// Non-negative integers are stored in the smallest unsigned layer that can hold the maximum.
+// Rows that mix non-negative and negative integers use the smallest signed layer that holds both the minimum and maximum, or F64 if no signed layer is large enough.
+// Rows with non-integers use the smallest floating-point layer that can also hold all integers exactly.
+// This is exact except for integers above 2^53, which are rounded to the nearest double.
+inline Category summary_category(const std::uint8_t max, const RowExtras& extras) {
+    if (extras.floating != Category::U8) {
+        Category needed = Category::F64;
+        if (max <= max_level_F16 && extras.min <= min_level_F16) {
+            needed = Category::F16;
+        } else if (max <= max_level_F32 && extras.min <= min_level_F32) {
+            needed = Category::F32;
+        }
+        return std::max(extras.floating, needed);
+    }
+
+    if (extras.min) {
+        if (extras.min <= min_level_I8 && max <= max_level_I8) {
+            return Category::I8;
+        }
+        if (extras.min <= min_level_I16 && max <= max_level_I16) {
+            return Category::I16;
+        }
+        if (max <= max_level_I32) {
+            return Category::I32;
+        }
+        return Category::F64; // there is no 64-bit signed layer.
+    }
+
+    constexpr std::array<Category, 9> unsigned_categories {
+        Category::U8, Category::U8, Category::U16, Category::U16, Category::U16, Category::U32, Category::U32, Category::U32, Category::U64
+    };
+    return unsigned_categories[max];
+}
+
+inline void add_floating_to_extras(RowExtras& extras, const Category floating) {
+    extras.floating = std::max(extras.floating, floating);
+}
+
+// Adds 'v' to the summary of a row, where 'max' is the level of the row's maximum.
+// 'extras' should return a reference to the row's RowExtras, and is only called for negative or non-integer values.
+template<typename Value_, class Extras_>
+void add_to_summary(std::uint8_t& max, const Value_ v, const double tolerance, Extras_ extras) {
+    if constexpr(std::is_same<Value_, Float16>::value) {
+        add_to_summary(max, static_cast<float>(v), tolerance, std::move(extras));
+
+    } else if constexpr(std::is_floating_point<Value_>::value) {
+        // Checking for integers by round-tripping through the integer type, which is cheaper than std::trunc().
+        // 2^64 is exactly representable, unlike the maximum value of a 64-bit unsigned integer.
+        if (v >= 0) {
+            if (v < static_cast<Value_>(18446744073709551616.0)) {
+                const auto x = static_cast<std::uint64_t>(v);
+                if (static_cast<Value_>(x) == v) {
+                    max = std::max(max, max_level(x));
+                    return;
+                }
+            }
+        } else if (v >= static_cast<Value_>(std::numeric_limits<std::int32_t>::min())) {
+            const auto x = static_cast<std::int32_t>(v);
+            if (static_cast<Value_>(x) == v) {
+                auto& current = extras();
+                current.min = std::max(current.min, min_level(x));
+                return;
+            }
+        }
+        add_floating_to_extras(extras(), categorize_floating(v, tolerance));
+
+    } else {
+        if constexpr(std::is_signed<Value_>::value) {
+            if (v < 0) {
+                auto& current = extras();
+                if (v >= std::numeric_limits<std::int32_t>::min()) {
+                    current.min = std::max(current.min, min_level(static_cast<std::int32_t>(v)));
+                } else {
+                    add_floating_to_extras(current, categorize_floating(v, tolerance));
+                }
+                return;
+            }
+        }
+
+        constexpr std::uint64_t max64 = std::numeric_limits<std::uint64_t>::max();
+        if (sanisizer::is_greater_than(v, max64)) {
+            add_floating_to_extras(extras(), categorize_floating(v, tolerance));
+            return;
+        }
+        max = std::max(max, max_level(v));
+    }
+}
+
+// Adds a run of values in the same row and chunk, returning the number of non-zero values.
+// The number of outliers (see is_outlier()) is added to 'outliers'.
+// Unsigned integer inputs only need the maximum of the run, which avoids any branching on each value.
+template<typename Value_, typename Count_, class Extras_>
+Count_ add_run_to_summary(std::uint8_t& max, std::size_t& outliers, const Value_* values, const Count_ number, const double tolerance, Extras_ extras) {
+    Count_ nonzero = 0;
+    if constexpr(std::is_integral<Value_>::value && std::is_unsigned<Value_>::value) {
+        Value_ largest = 0;
+        std::size_t large = 0;
+        for (Count_ i = 0; i < number; ++i) {
+            largest = std::max(largest, values[i]);
+            nonzero += (values[i] != 0);
+            large += is_outlier(values[i]);
+        }
+        max = std::max(max, max_level(largest));
+        outliers += large;
+    } else {
+        auto current = max; // local copy so that the level can stay in a register.
+        for (Count_ i = 0; i < number; ++i) {
+            if (values[i]) {
+                add_to_summary(current, values[i], tolerance, extras);
+                outliers += is_outlier(values[i]);
+                ++nonzero;
+            }
+        }
+        max = current;
+    }
+    return nonzero;
+}
+
+// Summary of the values of a single row.
+struct RowCategory {
+    std::uint8_t max = 0;
+    RowExtras extras;
+
+    Category category() const {
+        return summary_category(max, extras);
+    }
+};
+
+template<typename Value_>
+void add_to_category(RowCategory& row, const Value_ v, const double tolerance = 0) {
+    add_to_summary(row.max, v, tolerance, [&]() -> RowExtras& { return row.extras; });
+}
+
+template<typename Value_>
+RowCategory summarize(const Value_ v, const double tolerance = 0) {
+    RowCategory output;
+    add_to_category(output, v, tolerance);
+    return output;
+}
+
+inline RowExtras merge_extras(const RowExtras& left, const RowExtras& right) {
+    RowExtras output;
+    output.min = std::max(left.min, right.min);
+    output.floating = std::max(left.floating, right.floating);
+    return output;
+}
+
+// Summary of the values of both 'left' and 'right'.
+// This is associative and commutative, so partial summaries can be combined in any order.
+inline RowCategory merge_categories(const RowCategory& left, const RowCategory& right) {
+    RowCategory output;
+    output.max = std::max(left.max, right.max);
+    output.extras = merge_extras(left.extras, right.extras);
+    return output;
+}
+
+// Number of outliers in a row of a chunk, saturating at the maximum.
+// Rows with a saturated count are never stored with escapes, which is no loss as they would be larger than their original layer.
+typedef std::uint16_t OutlierCount;
+
+constexpr OutlierCount max_outlier_count = std::numeric_limits<OutlierCount>::max();
+
+inline void add_outliers(OutlierCount& count, const std::size_t extra) {
+    count = (extra >= static_cast<std::size_t>(max_outlier_count - count) ? max_outlier_count : count + extra);
+}
+
+// Summaries of all rows in a chunk.
+// The RowExtras are only allocated once a negative or non-integer value is added to any row of the chunk,
+// so the first pass only needs a single byte per row and chunk for inputs with non-negative integers.
+// Similarly, if 'count_outliers = true', the number of outliers for each row is only allocated once any row of the chunk has an outlier.
+struct ChunkSummary {
+    std::vector<std::uint8_t> max;
+    std::vector<RowExtras> extras;
+    std::vector<OutlierCount> outliers;
+    bool count_outliers = false;
+
+    void resize(const std::size_t num_rows) {
+        sanisizer::resize(max, num_rows);
+    }
+
+    std::size_t size() const {
+        return max.size();
+    }
+
+    RowExtras& get_extras(const std::size_t r) {
+        if (extras.empty()) {
+            sanisizer::resize(extras, max.size());
+        }
+        return extras[r];
+    }
+
+    void add_outliers(const std::size_t r, const std::size_t number) {
+        if (count_outliers && number) {
+            if (outliers.empty()) {
+                sanisizer::resize(outliers, max.size());
+            }
+            tatami_layered::add_outliers(outliers[r], number);
+        }
+    }
+
+    template<typename Value_>
+    void add(const std::size_t r, const Value_ v, const double tolerance = 0) {
+        add_to_summary(max[r], v, tolerance, [&]() -> RowExtras& { return get_extras(r); });
+        add_outliers(r, is_outlier(v));
+    }
+
+    template<typename Value_, typename Count_>
+    Count_ add_run(const std::size_t r, const Value_* values, const Count_ number, const double tolerance) {
+        std::size_t large = 0;
+        const auto nonzero = add_run_to_summary(max[r], large, values, number, tolerance, [&]() -> RowExtras& { return get_extras(r); });
+        add_outliers(r, large);
+        return nonzero;
+    }
+
+    Category category(const std::size_t r) const {
+        return summary_category(max[r], extras.empty() ? RowExtras() : extras[r]);
+    }
+
+    std::size_t num_outliers(const std::size_t r) const {
+        return (outliers.empty() ? 0 : outliers[r]);
+    }
+
+    void merge(const ChunkSummary& other) {
+        const std::size_t n = max.size();
+        for (std::size_t r = 0; r < n; ++r) {
+            max[r] = std::max(max[r], other.max[r]);
+        }
+        if (!other.extras.empty()) {
+            for (std::size_t r = 0; r < n; ++r) {
+                auto& current = get_extras(r);
+                current = merge_extras(current, other.extras[r]);
+            }
+        }
+        if (!other.outliers.empty()) {
+            for (std::size_t r = 0; r < n; ++r) {
+                add_outliers(r, other.outliers[r]);
+            }
         }
+    }
+
+    std::size_t bytes() const {
+        return max.size() * sizeof(std::uint8_t) + extras.size() * sizeof(RowExtras) + outliers.size() * sizeof(OutlierCount);
+    }
+};
 
-        return Category::U32;
+// Summaries for the rows in [first, first + length) of each chunk, for a worker in a row-parallel first pass.
+// As each row is only visited by one worker, the levels of the maxima are written directly to the shared summaries.
+// Any extras and outlier counts are collected locally as their allocation in the shared summaries would be a race, and are copied over by finish().
+class RowRangeSummaries {
+public:
+    RowRangeSummaries(std::vector<ChunkSummary>& shared, const std::size_t first, const std::size_t length) :
+        my_shared(shared),
+        my_first(first),
+        my_length(length)
+    {
+        sanisizer::resize(my_extras, shared.size());
+        sanisizer::resize(my_outliers, shared.size());
+    }
+
+    RowExtras& get_extras(const std::size_t chunk, const std::size_t r) {
+        auto& current = my_extras[chunk];
+        if (current.empty()) {
+            sanisizer::resize(current, my_length);
+        }
+        return current[r - my_first];
     }
+
+    template<typename Value_>
+    void add(const std::size_t chunk, const std::size_t r, const Value_ v, const double tolerance = 0) {
+        add_to_summary(my_shared[chunk].max[r], v, tolerance, [&]() -> RowExtras& { return get_extras(chunk, r); });
+        add_outliers(chunk, r, is_outlier(v));
+    }
+
+    template<typename Value_, typename Count_>
+    Count_ add_run(const std::size_t chunk, const std::size_t r, const Value_* values, const Count_ number, const double tolerance) {
+        std::size_t large = 0;
+        const auto nonzero = add_run_to_summary(my_shared[chunk].max[r], large, values, number, tolerance, [&]() -> RowExtras& { return get_extras(chunk, r); });
+        add_outliers(chunk, r, large);
+        return nonzero;
+    }
+
+    void finish(std::mutex& lock) {
+        for (std::size_t chunk = 0, nchunks = my_extras.size(); chunk < nchunks; ++chunk) {
+            const auto& current_extras = my_extras[chunk];
+            const auto& current_outliers = my_outliers[chunk];
+            if (current_extras.empty() && current_outliers.empty()) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lck(lock);
+            auto& shared = my_shared[chunk];
+            if (!current_extras.empty()) {
+                if (shared.extras.empty()) {
+                    sanisizer::resize(shared.extras, shared.max.size());
+                }
+                std::copy(current_extras.begin(), current_extras.end(), shared.extras.begin() + my_first);
+            }
+            if (!current_outliers.empty()) {
+                if (shared.outliers.empty()) {
+                    sanisizer::resize(shared.outliers, shared.max.size());
+                }
+                std::copy(current_outliers.begin(), current_outliers.end(), shared.outliers.begin() + my_first);
+            }
+        }
+    }
+
+private:
+    void add_outliers(const std::size_t chunk, const std::size_t r, const std::size_t number) {
+        if (my_shared[chunk].count_outliers && number) {
+            auto& current = my_outliers[chunk];
+            if (current.empty()) {
+                sanisizer::resize(current, my_length);
+            }
+            tatami_layered::add_outliers(current[r - my_first], number);
+        }
+    }
+
+    std::vector<ChunkSummary>& my_shared;
+    std::size_t my_first, my_length;
+    std::vector<std::vector<RowExtras> > my_extras;
+    std::vector<std::vector<OutlierCount> > my_outliers;
+};
+
+// Layer for the row 'r' of a chunk with 'number' non-zero elements.
+// Rows of non-negative integers are stored in the escaped layer if only a few of their values are outliers,
+// such that the 8-bit values plus the escapes (i.e., the column index and value of each outlier) and the escape pointer are smaller than the row's values in its original layer.
+// This is decided here rather than after the layers are filled, so that rows can be filled directly into the escaped layer.
+template<typename ColIndex_>
+Category choose_category(const ChunkSummary& summary, const std::size_t r, const std::size_t number) {
+    const auto cat = summary.category(r);
+    if (cat == Category::U8 || !is_unsigned_category(cat)) {
+        return cat;
+    }
+
+    const std::size_t outliers = summary.num_outliers(r);
+    if (outliers == 0 || outliers == max_outlier_count) {
+        return cat;
+    }
+
+    constexpr std::size_t escape_size = sizeof(ColIndex_) + sizeof(std::uint64_t);
+    if (number + outliers * escape_size + sizeof(std::size_t) >= number * category_value_sizes[static_cast<std::size_t>(cat)]) {
+        return cat;
+    }
+    return Category::E8;
 }
 
+class LayerArena {
+public:
+    LayerArena(std::size_t size, bool huge_pages) : my_size(size) {
+        if (my_size == 0) {
+            return;
+        }
+
+#ifdef TATAMI_LAYERED_HAS_MADVISE
+        if (uses_huge_pages(my_size, huge_pages)) {
+            my_alignment = huge_page_size;
+            my_size = allocated_size(my_size, huge_pages);
+        }
+#endif
+
+        // Deliberately not value-initialized, as every byte is overwritten by the fill pass.
+        my_data = static_cast<unsigned char*>(::operator new(my_size, std::align_val_t(my_alignment)));
+
+#ifdef TATAMI_LAYERED_HAS_MADVISE
+        if (my_alignment == huge_page_size) {
+            madvise(my_data, my_size, MADV_HUGEPAGE); // advisory only, so failures are ignored.
+        }
+#else
+        (void)huge_pages;
+#endif
+    }
+
+    ~LayerArena() {
+        if (my_data) {
+            ::operator delete(my_data, std::align_val_t(my_alignment));
+        }
+    }
+
+    LayerArena(const LayerArena&) = delete;
+    LayerArena& operator=(const LayerArena&) = delete;
+
+public:
+    static constexpr std::size_t default_alignment = 64;
+
+    static constexpr std::size_t huge_page_size = 2097152;
+
+    // Transparent huge pages are only considered for regions that are
+    // aligned to, and at least as large as, a huge page.
+    static bool uses_huge_pages([[maybe_unused]] const std::size_t size, [[maybe_unused]] const bool huge_pages) {
+#ifdef TATAMI_LAYERED_HAS_MADVISE
+        return huge_pages && size >= huge_page_size;
+#else
+        return false;
+#endif
+    }
+
+    // Number of bytes that are actually allocated for a request of 'size' bytes.
+    static std::size_t allocated_size(const std::size_t size, const bool huge_pages) {
+        if (uses_huge_pages(size, huge_pages)) {
+            return sanisizer::product<std::size_t>(size / huge_page_size + (size % huge_page_size != 0), huge_page_size);
+        }
+        return size;
+    }
+
+    static std::size_t reserve(std::size_t& offset, std::size_t number, std::size_t type_size) {
+        const std::size_t start = offset;
+        const std::size_t bytes = sanisizer::product<std::size_t>(number, type_size);
+        offset = sanisizer::sum<std::size_t>(start, bytes);
+        const std::size_t remainder = offset % default_alignment;
+        if (remainder) {
+            offset = sanisizer::sum<std::size_t>(offset, default_alignment - remainder);
+        }
+        return start;
+    }
+
+    template<typename Type_>
+    static std::size_t reserve(std::size_t& offset, std::size_t number) {
+        return reserve(offset, number, sizeof(Type_));
+    }
+
+    template<typename Type_>
+    Type_* get(std::size_t offset) const {
+        return reinterpret_cast<Type_*>(my_data + offset);
+    }
+
+    unsigned char* data() const {
+        return my_data;
+    }
+
+    std::size_t size() const {
+        return my_size;
+    }
+
+    std::size_t alignment() const {
+        return my_alignment;
+    }
+
+private:
+    unsigned char* my_data = NULL;
+    std::size_t my_size;
+    std::size_t my_alignment = default_alignment;
+};
+
+// The arrays are read-only as they may point into a read-only memory mapping, see load_layered_sparse().
+// Layers that are attached to a LayerArena are filled through writable_array().
 template<typename Int_, typename Index_, typename ColIndex_>
 struct Holder {
-    Holder() : ptr(1) {}
-    std::vector<ColIndex_> index;
-    std::vector<Int_> value;
-    std::vector<std::size_t> ptr;
+    std::size_t num_rows = 0;
+    const std::size_t* ptr = NULL;
+    const ColIndex_* index = NULL;
+    const Int_* value = NULL;
+
+    std::size_t num_nonzero() const {
+        return ptr[num_rows];
+    }
+
+    static constexpr bool dictionary = false;
+
+    static constexpr bool escaped = false;
+};
+
+// Layer of dictionary-coded rows, where 'value' holds an 8-bit code for each non-zero element.
+// Each row has its own table of distinct values, starting at 'table + table_ptr[i]' for the row at position 'i'.
+template<typename Index_, typename ColIndex_>
+struct DictionaryHolder : public Holder<std::uint8_t, Index_, ColIndex_> {
+    const std::size_t* table_ptr = NULL;
+    const double* table = NULL;
 
-    void fill() {
-        sanisizer::resize(index, ptr.back());
-        sanisizer::resize(value, ptr.back());
+    std::size_t num_entries() const {
+        return table_ptr[this->num_rows];
     }
+
+    static constexpr bool dictionary = true;
+};
+
+// Layer of rows with a few outliers, where 'value' holds each non-zero element as an 8-bit value or 'escape_code' if it does not fit.
+// The escapes for the row at position 'i' start at 'escape_ptr[i]', where 'escape_index' holds the column index of each escaped element
+// (sorted in increasing order, as in 'index') and 'escape_value' holds its actual value.
+template<typename Index_, typename ColIndex_>
+struct EscapedHolder : public Holder<std::uint8_t, Index_, ColIndex_> {
+    const std::size_t* escape_ptr = NULL;
+    const ColIndex_* escape_index = NULL;
+    const std::uint64_t* escape_value = NULL;
+
+    std::size_t num_escapes() const {
+        return escape_ptr[this->num_rows];
+    }
+
+    static constexpr bool escaped = true;
 };
 
+// Each row code holds the category in the lowest 4 bits and the row's position in its layer in the remaining bits,
+// so that the codes are no larger than the usual 32-bit row indices.
+typedef std::uint32_t RowCode;
+
+constexpr int row_code_shift = 4;
+
+static_assert(num_categories <= (static_cast<std::size_t>(1) << row_code_shift));
+
+// Maximum number of rows in a chunk, such that every position can be stored in a row code.
+constexpr std::size_t max_row_code_rows = static_cast<std::size_t>(std::numeric_limits<RowCode>::max() >> row_code_shift) + 1;
+
+inline RowCode pack_row_code(const Category category, const std::size_t position) {
+    return (static_cast<RowCode>(position) << row_code_shift) | static_cast<RowCode>(category);
+}
+
+inline Category row_code_category(const RowCode code) {
+    return static_cast<Category>(code & ((static_cast<RowCode>(1) << row_code_shift) - 1));
+}
+
+inline std::size_t row_code_position(const RowCode code) {
+    return code >> row_code_shift;
+}
+
+template<typename Index_, typename ColIndex_>
+struct LayeredChunk {
+    Holder< std::uint8_t, Index_, ColIndex_> store8;
+    Holder<std::uint16_t, Index_, ColIndex_> store16;
+    Holder<std::uint32_t, Index_, ColIndex_> store32;
+    Holder<std::uint64_t, Index_, ColIndex_> store64;
+    Holder<       Float16, Index_, ColIndex_> storef16;
+    Holder<         float, Index_, ColIndex_> storef32;
+    Holder<        double, Index_, ColIndex_> storef64;
+    Holder<  std::int8_t, Index_, ColIndex_> storei8;
+    Holder< std::int16_t, Index_, ColIndex_> storei16;
+    Holder< std::int32_t, Index_, ColIndex_> storei32;
+    DictionaryHolder<Index_, ColIndex_> stored8;
+    EscapedHolder<Index_, ColIndex_> storee8;
+
+    // Category and in-layer position of each row, see pack_row_code().
+    // This may be shared between chunks with the same category assignments.
+    std::shared_ptr<const std::vector<RowCode> > codes;
+
+    // Owner of the memory for the layer arrays, e.g., a LayerArena or a memory-mapped file.
+    std::shared_ptr<const void> storage;
+};
+
+template<typename Index_, typename ColIndex_, class Function_>
+void dispatch_layer(const LayeredChunk<Index_, ColIndex_>& chunk, const Category cat, Function_ fun) {
+    switch (cat) {
+        case Category::U8:
+            fun(chunk.store8);
+            break;
+        case Category::U16:
+            fun(chunk.store16);
+            break;
+        case Category::U32:
+            fun(chunk.store32);
+            break;
+        case Category::U64:
+            fun(chunk.store64);
+            break;
+        case Category::F16:
+            fun(chunk.storef16);
+            break;
+        case Category::F32:
+            fun(chunk.storef32);
+            break;
+        case Category::F64:
+            fun(chunk.storef64);
+            break;
+        case Category::I8:
+            fun(chunk.storei8);
+            break;
+        case Category::I16:
+            fun(chunk.storei16);
+            break;
+        case Category::I32:
+            fun(chunk.storei32);
+            break;
+        case Category::D8:
+            fun(chunk.stored8);
+            break;
+        case Category::E8:
+            fun(chunk.storee8);
+            break;
+    }
+}
+
+// Calls 'fun' on each category and its layer, in the order of the categories.
+// 'Chunk_' may be const-qualified, in which case the layers are passed as const references.
+template<class Chunk_, class Function_>
+void for_each_layer(Chunk_& chunk, Function_ fun) {
+    fun(Category::U8, chunk.store8);
+    fun(Category::U16, chunk.store16);
+    fun(Category::U32, chunk.store32);
+    fun(Category::U64, chunk.store64);
+    fun(Category::F16, chunk.storef16);
+    fun(Category::F32, chunk.storef32);
+    fun(Category::F64, chunk.storef64);
+    fun(Category::I8, chunk.storei8);
+    fun(Category::I16, chunk.storei16);
+    fun(Category::I32, chunk.storei32);
+    fun(Category::D8, chunk.stored8);
+    fun(Category::E8, chunk.storee8);
+}
+
+// Calls 'fun' on the corresponding layers of two chunks, e.g., to copy layers from 'right' to 'left'.
+template<class Left_, class Right_, class Function_>
+void for_each_layer_pair(Left_& left, Right_& right, Function_ fun) {
+    fun(left.store8, right.store8);
+    fun(left.store16, right.store16);
+    fun(left.store32, right.store32);
+    fun(left.store64, right.store64);
+    fun(left.storef16, right.storef16);
+    fun(left.storef32, right.storef32);
+    fun(left.storef64, right.storef64);
+    fun(left.storei8, right.storei8);
+    fun(left.storei16, right.storei16);
+    fun(left.storei32, right.storei32);
+    fun(left.stored8, right.stored8);
+    fun(left.storee8, right.storee8);
+}
+
+template<typename Index_, typename ColIndex_>
+std::array<std::size_t, num_categories> layer_num_rows(const LayeredChunk<Index_, ColIndex_>& chunk) {
+    std::array<std::size_t, num_categories> output;
+    for_each_layer(chunk, [&](const Category cat, const auto& layer) -> void {
+        output[static_cast<std::size_t>(cat)] = layer.num_rows;
+    });
+    return output;
+}
+
+template<typename Index_, typename ColIndex_>
+std::array<std::size_t, num_categories> layer_num_nonzero(const LayeredChunk<Index_, ColIndex_>& chunk) {
+    std::array<std::size_t, num_categories> output;
+    for_each_layer(chunk, [&](const Category cat, const auto& layer) -> void {
+        output[static_cast<std::size_t>(cat)] = layer.num_nonzero();
+    });
+    return output;
+}
+
+template<typename Index_, typename ColIndex_>
+std::size_t layer_num_entries(const LayeredChunk<Index_, ColIndex_>& chunk) {
+    return chunk.stored8.num_entries();
+}
+
+template<typename Index_, typename ColIndex_>
+std::size_t layer_num_escapes(const LayeredChunk<Index_, ColIndex_>& chunk) {
+    return chunk.storee8.num_escapes();
+}
+
 template<typename Input_>
 using I = std::remove_cv_t<std::remove_reference_t<Input_> >;
 
-template<typename IndexIn_, typename ColIndex_> 
+// Values of a dictionary-coded row, which are decoded from the row's table on access.
+// This mimics a pointer so that it can be used in place of the value pointer of the other layers.
+struct DictionaryValues {
+    const std::uint8_t* code;
+    const double* table;
+    std::size_t table_size;
+
+    double operator[](const std::size_t i) const {
+        return table[code[i]];
+    }
+
+    double operator*() const {
+        return table[*code];
+    }
+
+    DictionaryValues operator+(const std::size_t i) const {
+        return DictionaryValues{ code + i, table, table_size };
+    }
+
+    DictionaryValues& operator++() {
+        ++code;
+        return *this;
+    }
+};
+
+// Values of a row with escapes, where escaped elements are patched in from the row's escapes on access.
+// Elements are usually accessed in order of increasing column index, so the escapes are walked with a cursor that moves forward alongside the elements.
+// A binary search is only used for the first escaped element or if the elements are accessed out of order.
+template<typename ColIndex_>
+struct EscapedValues {
+    const std::uint8_t* code;
+    const ColIndex_* index;
+    const ColIndex_* escape_index;
+    const std::uint64_t* escape_value;
+    std::size_t num_escapes;
+
+    // Position of the last escape that was accessed, or 'num_escapes' if no escape has been accessed yet.
+    mutable std::size_t cursor;
+
+    std::uint64_t operator[](const std::size_t i) const {
+        const auto current = code[i];
+        if (current != escape_code) {
+            return current;
+        }
+
+        const auto target = index[i];
+        if (cursor == num_escapes || escape_index[cursor] > target) {
+            cursor = std::lower_bound(escape_index, escape_index + num_escapes, target) - escape_index;
+        } else {
+            while (escape_index[cursor] < target) {
+                ++cursor;
+            }
+        }
+        return escape_value[cursor];
+    }
+
+    std::uint64_t operator*() const {
+        return (*this)[0];
+    }
+
+    EscapedValues operator+(const std::size_t i) const {
+        return EscapedValues{ code + i, index + i, escape_index, escape_value, num_escapes, cursor };
+    }
+
+    EscapedValues& operator++() {
+        ++code;
+        ++index;
+        return *this;
+    }
+};
+
+// Values of the row at position 'pos' of 'layer', to be indexed in the same manner as 'layer.value'.
+template<class Layer_>
+auto layer_values(const Layer_& layer, const std::size_t pos) {
+    if constexpr(Layer_::dictionary) {
+        const auto first = layer.table_ptr[pos];
+        return DictionaryValues{ layer.value, layer.table + first, layer.table_ptr[pos + 1] - first };
+    } else if constexpr(Layer_::escaped) {
+        const auto first = layer.escape_ptr[pos];
+        const std::size_t num_escapes = layer.escape_ptr[pos + 1] - first;
+        return EscapedValues<I<decltype(*(layer.index))> >{ layer.value, layer.index, layer.escape_index + first, layer.escape_value + first, num_escapes, num_escapes };
+    } else {
+        return static_cast<const I<decltype(*(layer.value))>*>(layer.value);
+    }
+}
+
+// Calls 'fun(indices, values, number)' with the column indices, values (see layer_values()) and number of the non-zero elements of 'row' in 'chunk'.
+template<typename Index_, typename ColIndex_, class Function_>
+void visit_row_segment(const LayeredChunk<Index_, ColIndex_>& chunk, const Index_ row, Function_ fun) {
+    const auto code = (*(chunk.codes))[row];
+    const auto pos = row_code_position(code);
+    dispatch_layer(chunk, row_code_category(code), [&](const auto& layer) -> void {
+        const auto start = layer.ptr[pos];
+        fun(layer.index + start, layer_values(layer, pos) + start, static_cast<std::size_t>(layer.ptr[pos + 1] - start));
+    });
+}
+
+// Same as above, but only for the non-zero elements of 'row' with local column indices in [start, end).
+template<typename Index_, typename ColIndex_, class Function_>
+void visit_row_segment(const LayeredChunk<Index_, ColIndex_>& chunk, const Index_ row, const Index_ start, const Index_ end, Function_ fun) {
+    const auto code = (*(chunk.codes))[row];
+    const auto pos = row_code_position(code);
+    dispatch_layer(chunk, row_code_category(code), [&](const auto& layer) -> void {
+        auto iStart = layer.index + layer.ptr[pos];
+        auto iEnd = layer.index + layer.ptr[pos + 1];
+        if (start) {
+            iStart = std::lower_bound(iStart, iEnd, static_cast<ColIndex_>(start));
+        }
+        if (iStart != iEnd && static_cast<Index_>(*(iEnd - 1)) >= end) { // this also ensures that 'end' fits in a ColIndex_.
+            iEnd = std::lower_bound(iStart, iEnd, static_cast<ColIndex_>(end));
+        }
+        fun(iStart, layer_values(layer, pos) + (iStart - layer.index), static_cast<std::size_t>(iEnd - iStart));
+    });
+}
+
+// Hint to bring the cache line containing 'ptr' into the cache, ignored on compilers without the builtin.
+inline void prefetch_address(const void* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr);
+#else
+    (void)ptr;
+#endif
+}
+
+// Byte offsets of each layer's arrays within a chunk's storage, indexed by the integer value of each Category.
+// This is shared by the in-memory arena and the on-disk format, so that the latter can be used directly.
+// The dictionary tables and the escapes are stored after all of the values.
+struct LayerOffsets {
+    std::array<std::size_t, num_categories> ptr{}, index{}, value{};
+    std::size_t table_ptr = 0, table = 0;
+    std::size_t escape_ptr = 0, escape_index = 0, escape_value = 0;
+    std::size_t total = 0;
+};
+
+template<typename ColIndex_>
+LayerOffsets define_layer_offsets(
+    const std::array<std::size_t, num_categories>& num_rows,
+    const std::array<std::size_t, num_categories>& num_nonzero,
+    const std::size_t num_entries,
+    const std::size_t num_escapes)
+{
+    LayerOffsets output;
+    std::size_t& offset = output.total;
+    for (std::size_t i = 0; i < num_categories; ++i) {
+        output.ptr[i] = LayerArena::reserve<std::size_t>(offset, sanisizer::sum<std::size_t>(num_rows[i], 1));
+    }
+    for (std::size_t i = 0; i < num_categories; ++i) {
+        output.index[i] = LayerArena::reserve<ColIndex_>(offset, num_nonzero[i]);
+    }
+    for (std::size_t i = 0; i < num_categories; ++i) {
+        output.value[i] = LayerArena::reserve(offset, num_nonzero[i], category_value_sizes[i]);
+    }
+    output.table_ptr = LayerArena::reserve<std::size_t>(offset, sanisizer::sum<std::size_t>(num_rows[static_cast<std::size_t>(Category::D8)], 1));
+    output.table = LayerArena::reserve<double>(offset, num_entries);
+    output.escape_ptr = LayerArena::reserve<std::size_t>(offset, sanisizer::sum<std::size_t>(num_rows[static_cast<std::size_t>(Category::E8)], 1));
+    output.escape_index = LayerArena::reserve<ColIndex_>(offset, num_escapes);
+    output.escape_value = LayerArena::reserve<std::uint64_t>(offset, num_escapes);
+    return output;
+}
+
+template<typename ColIndex_, typename Index_>
+LayerOffsets define_layer_offsets(const LayeredChunk<Index_, ColIndex_>& chunk) {
+    return define_layer_offsets<ColIndex_>(layer_num_rows(chunk), layer_num_nonzero(chunk), layer_num_entries(chunk), layer_num_escapes(chunk));
+}
+
+template<typename Index_, typename ColIndex_>
+void attach_layers(LayeredChunk<Index_, ColIndex_>& chunk, const LayerOffsets& offsets, const unsigned char* base) {
+    for_each_layer(chunk, [&](const Category cat, auto& layer) -> void {
+        const auto i = static_cast<std::size_t>(cat);
+        layer.ptr = reinterpret_cast<const std::size_t*>(base + offsets.ptr[i]);
+        layer.index = reinterpret_cast<const ColIndex_*>(base + offsets.index[i]);
+        layer.value = reinterpret_cast<const I<decltype(*layer.value)>*>(base + offsets.value[i]);
+    });
+    chunk.stored8.table_ptr = reinterpret_cast<const std::size_t*>(base + offsets.table_ptr);
+    chunk.stored8.table = reinterpret_cast<const double*>(base + offsets.table);
+    chunk.storee8.escape_ptr = reinterpret_cast<const std::size_t*>(base + offsets.escape_ptr);
+    chunk.storee8.escape_index = reinterpret_cast<const ColIndex_*>(base + offsets.escape_index);
+    chunk.storee8.escape_value = reinterpret_cast<const std::uint64_t*>(base + offsets.escape_value);
+}
+
+// Writable view of one of the arrays of a layer, for filling a layer that was just attached to a LayerArena.
+// This should never be used on layers attached to a file, which may be memory-mapped as read-only.
+template<typename Type_>
+Type_* writable_array(const Type_* array) {
+    return const_cast<Type_*>(array);
+}
+
+// Results of the first pass, i.e., the layer and number of non-zero elements for each row in each chunk.
+template<typename Count_>
+struct FirstPass {
+    std::vector<ChunkSummary> summary_per_chunk;
+    std::vector<std::vector<Count_> > num_per_chunk;
+
+    std::size_t bytes() const {
+        std::size_t output = 0;
+        for (const auto& x : summary_per_chunk) {
+            output += x.bytes();
+        }
+        for (const auto& x : num_per_chunk) {
+            output += x.size() * sizeof(Count_);
+        }
+        return output;
+    }
+};
+
+// If 'count_outliers = true', the number of outliers is also counted for each row in each chunk, so that allocate_rows() can choose the escaped layer.
+template<typename Count_, typename Index_>
+FirstPass<Count_> create_first_pass(const Index_ num_chunks, const Index_ num_rows, const bool count_outliers) {
+    FirstPass<Count_> output;
+    tatami::resize_container_to_Index_size(output.summary_per_chunk, num_chunks);
+    for (auto& x : output.summary_per_chunk) {
+        x.resize(num_rows);
+        x.count_outliers = count_outliers;
+    }
+    tatami::resize_container_to_Index_size(output.num_per_chunk, num_chunks);
+    for (auto& x : output.num_per_chunk) {
+        tatami::resize_container_to_Index_size(x, num_rows);
+    }
+    return output;
+}
+
+template<typename Index_, typename ColIndex_, typename Count_> 
 void allocate_rows(
-    const std::vector<std::vector<Category> >& max_per_chunk,
-    const std::vector<std::vector<IndexIn_> >& num_per_chunk,
-    std::vector<std::vector<IndexIn_> >& identities8,
-    std::vector<std::vector<IndexIn_> >& identities16,
-    std::vector<std::vector<IndexIn_> >& identities32,
-    std::vector<Holder<std::uint8_t, IndexIn_, ColIndex_> >& store8,
-    std::vector<Holder<std::uint16_t, IndexIn_, ColIndex_> >& store16,
-    std::vector<Holder<std::uint32_t, IndexIn_, ColIndex_> >& store32,
-    std::vector<std::vector<Category> >& assigned_category,
-    std::vector<std::vector<IndexIn_> >& assigned_position)
+    const std::vector<ChunkSummary>& summary_per_chunk,
+    const std::vector<std::vector<Count_> >& num_per_chunk,
+    std::vector<LayeredChunk<Index_, ColIndex_> >& chunks,
+    const bool huge_pages)
 {
-    const IndexIn_ num_chunks = max_per_chunk.size();
+    const auto num_chunks = summary_per_chunk.size();
     for (I<decltype(num_chunks)> chunk = 0; chunk < num_chunks; ++chunk) {
-        IndexIn_ counter8 = 0, counter16 = 0, counter32 = 0;
-        const auto& current_max = max_per_chunk[chunk];
+        const auto& current_summary = summary_per_chunk[chunk];
         const auto& current_num = num_per_chunk[chunk];
-        const IndexIn_ NR = current_max.size();
-
-        auto& asscat = assigned_category[chunk];
-        tatami::resize_container_to_Index_size(asscat, NR);
-        auto& asspos = assigned_position[chunk];
-        tatami::resize_container_to_Index_size(asspos, NR);
+        const Index_ NR = current_summary.size();
+        if (sanisizer::is_greater_than(NR, max_row_code_rows)) {
+            throw std::runtime_error("number of rows is too large for a layered matrix");
+        }
 
+        // Counting the rows and non-zero elements in each layer, so that all
+        // of this chunk's layers can be carved out of a single allocation.
+        std::array<std::size_t, num_categories> num_rows{}, num_nonzero{};
+        std::size_t num_escapes = 0;
         for (I<decltype(NR)> r = 0; r < NR; ++r) {
-            const auto cat = current_max[r];
-            const auto num = current_num[r];
-            IndexIn_ counter;
-
-            switch(current_max[r]) {
-                case Category::U8:
-                    store8[chunk].ptr.push_back(sanisizer::sum<std::size_t>(store8[chunk].ptr.back(), num));
-                    counter = counter8++;
-                    identities8[chunk].push_back(r);
-                    break;
-
-                case Category::U16:
-                    store16[chunk].ptr.push_back(sanisizer::sum<std::size_t>(store16[chunk].ptr.back(), num));
-                    counter = counter16++;
-                    identities16[chunk].push_back(r);
-                    break;
-
-                case Category::U32:
-                    store32[chunk].ptr.push_back(sanisizer::sum<std::size_t>(store32[chunk].ptr.back(), num));
-                    counter = counter32++;
-                    identities32[chunk].push_back(r);
-                    break;
+            const auto cat = choose_category<ColIndex_>(current_summary, r, current_num[r]);
+            const auto i = static_cast<std::size_t>(cat);
+            ++num_rows[i];
+            num_nonzero[i] = sanisizer::sum<std::size_t>(num_nonzero[i], current_num[r]);
+            if (cat == Category::E8) {
+                num_escapes += current_summary.num_outliers(r);
             }
+        }
+
+        auto& current = chunks[chunk];
+        const auto offsets = define_layer_offsets<ColIndex_>(num_rows, num_nonzero, 0, num_escapes);
+        auto arena = std::make_shared<const LayerArena>(offsets.total, huge_pages);
+        attach_layers(current, offsets, arena->data());
+        current.storage = std::move(arena);
+        writable_array(current.stored8.table_ptr)[0] = 0;
+        const auto escape_ptr = writable_array(current.storee8.escape_ptr);
+        escape_ptr[0] = 0;
+
+        // Indexing the row pointers by category avoids branching on each row's category.
+        std::array<std::size_t*, num_categories> ptrs;
+        for_each_layer(current, [&](const Category cat, auto& layer) -> void {
+            const auto i = static_cast<std::size_t>(cat);
+            layer.num_rows = num_rows[i];
+            ptrs[i] = writable_array(layer.ptr);
+            ptrs[i][0] = 0;
+        });
 
-            asscat[r] = cat;
-            asspos[r] = counter;
+        // The escape pointer after each row in the escaped layer is initialized to the start of the row's escapes,
+        // and is used as a cursor by fill_sparse_value() so that it points to the end of the row's escapes once the row is filled.
+        auto codes = tatami::create_container_of_Index_size<std::vector<RowCode> >(NR);
+        std::array<std::size_t, num_categories> counters{};
+        std::size_t escape_start = 0;
+        for (I<decltype(NR)> r = 0; r < NR; ++r) {
+            const auto cat = choose_category<ColIndex_>(current_summary, r, current_num[r]);
+            const auto i = static_cast<std::size_t>(cat);
+            auto& counter = counters[i];
+            ptrs[i][counter + 1] = ptrs[i][counter] + current_num[r];
+            if (cat == Category::E8) {
+                escape_ptr[counter + 1] = escape_start;
+                escape_start += current_summary.num_outliers(r);
+            }
+            codes[r] = pack_row_code(cat, counter);
+            ++counter;
         }
 
-        store8[chunk].fill();
-        store16[chunk].fill();
-        store32[chunk].fill();
+        current.codes = std::make_shared<const std::vector<RowCode> >(std::move(codes));
     }
 }
 
-template<typename IndexIn_, typename ColIndex_> 
-std::size_t get_sparse_ptr(
-    const std::vector<Holder< std::uint8_t, IndexIn_, ColIndex_> >& store8,
-    const std::vector<Holder<std::uint16_t, IndexIn_, ColIndex_> >& store16,
-    const std::vector<Holder<std::uint32_t, IndexIn_, ColIndex_> >& store32,
-    const std::vector<std::vector<Category> >& assigned_category,
-    const std::vector<std::vector<IndexIn_> >& assigned_position,
-    const IndexIn_ chunk,
-    const IndexIn_ row)
+// Maximum number of distinct values in a dictionary-coded row, i.e., the number of 8-bit codes.
+constexpr std::size_t max_dictionary_size = 256;
+
+inline std::uint64_t dictionary_key(const double x) {
+    std::uint64_t output;
+    std::memcpy(&output, &x, sizeof(output));
+    return output;
+}
+
+// Rebuilds 'chunk' after moving the row 'r' into the layer for 'categories[r]', where 'num_entries' and 'num_escapes' are the new totals for the chunk.
+// Rows that stay in the same layer are copied along with their dictionary tables or escapes.
+// For each row that changes layers, 'fill(r, layer, start, number, output, counter)' is called with the row's old layer and the range of its elements,
+// and should fill its values in the new layer at position 'counter' along with its table or escape pointers at 'counter + 1'.
+// Returns the number of bytes allocated for the new layers.
+template<typename Index_, typename ColIndex_, class Fill_>
+std::size_t rebuild_chunk(
+    LayeredChunk<Index_, ColIndex_>& chunk,
+    const std::vector<Category>& categories,
+    const std::size_t num_entries,
+    const std::size_t num_escapes,
+    const bool huge_pages,
+    Fill_ fill)
 {
-    auto arow = assigned_position[chunk][row];
-    switch (assigned_category[chunk][row]) {
-        case Category::U8:
-            return store8[chunk].ptr[arow];
-        case Category::U16:
-            return store16[chunk].ptr[arow];
-        case Category::U32:
-            return store32[chunk].ptr[arow];
+    const auto& codes = *(chunk.codes);
+    const auto NR = codes.size();
+
+    std::array<std::size_t, num_categories> num_rows{}, num_nonzero{};
+    for (I<decltype(NR)> r = 0; r < NR; ++r) {
+        const auto code = codes[r];
+        const auto pos = row_code_position(code);
+        const auto i = static_cast<std::size_t>(categories[r]);
+        ++num_rows[i];
+        dispatch_layer(chunk, row_code_category(code), [&](const auto& layer) -> void {
+            num_nonzero[i] += layer.ptr[pos + 1] - layer.ptr[pos];
+        });
     }
-    return 0;
+
+    LayeredChunk<Index_, ColIndex_> output;
+    const auto offsets = define_layer_offsets<ColIndex_>(num_rows, num_nonzero, num_entries, num_escapes);
+    auto arena = std::make_shared<const LayerArena>(offsets.total, huge_pages);
+    const std::size_t allocated = arena->size();
+    attach_layers(output, offsets, arena->data());
+    output.storage = std::move(arena);
+
+    // Copying the rows into the new layers by category, in the same manner as allocate_rows().
+    std::array<std::size_t*, num_categories> ptrs;
+    std::array<ColIndex_*, num_categories> indices;
+    std::array<unsigned char*, num_categories> values;
+    for_each_layer(output, [&](const Category cat, auto& layer) -> void {
+        const auto i = static_cast<std::size_t>(cat);
+        layer.num_rows = num_rows[i];
+        ptrs[i] = writable_array(layer.ptr);
+        ptrs[i][0] = 0;
+        indices[i] = writable_array(layer.index);
+        values[i] = reinterpret_cast<unsigned char*>(writable_array(layer.value));
+    });
+
+    const auto table_ptr = writable_array(output.stored8.table_ptr);
+    const auto table = writable_array(output.stored8.table);
+    table_ptr[0] = 0;
+    const auto escape_ptr = writable_array(output.storee8.escape_ptr);
+    const auto escape_index = writable_array(output.storee8.escape_index);
+    const auto escape_value = writable_array(output.storee8.escape_value);
+    escape_ptr[0] = 0;
+
+    auto new_codes = tatami::create_container_of_Index_size<std::vector<RowCode> >(NR);
+    std::array<std::size_t, num_categories> counters{};
+    for (I<decltype(NR)> r = 0; r < NR; ++r) {
+        const auto code = codes[r];
+        const auto pos = row_code_position(code);
+        const auto old_cat = row_code_category(code);
+        const auto cat = categories[r];
+        const auto i = static_cast<std::size_t>(cat);
+        auto& counter = counters[i];
+
+        dispatch_layer(chunk, old_cat, [&](const auto& layer) -> void {
+            const auto start = layer.ptr[pos];
+            const std::size_t number = layer.ptr[pos + 1] - start;
+            const auto base = ptrs[i][counter];
+            ptrs[i][counter + 1] = base + number;
+            std::copy_n(layer.index + start, number, indices[i] + base);
+
+            if (cat != old_cat) {
+                fill(r, layer, start, number, output, counter);
+                return;
+            }
+
+            const auto size = category_value_sizes[i];
+            std::memcpy(values[i] + base * size, layer.value + start, number * size);
+
+            if constexpr(I<decltype(layer)>::dictionary) {
+                const auto tstart = layer.table_ptr[pos], tend = layer.table_ptr[pos + 1];
+                std::copy(layer.table + tstart, layer.table + tend, table + table_ptr[counter]);
+                table_ptr[counter + 1] = table_ptr[counter] + (tend - tstart);
+
+            } else if constexpr(I<decltype(layer)>::escaped) {
+                const auto estart = layer.escape_ptr[pos], eend = layer.escape_ptr[pos + 1];
+                std::copy(layer.escape_index + estart, layer.escape_index + eend, escape_index + escape_ptr[counter]);
+                std::copy(layer.escape_value + estart, layer.escape_value + eend, escape_value + escape_ptr[counter]);
+                escape_ptr[counter + 1] = escape_ptr[counter] + (eend - estart);
+            }
+        });
+
+        new_codes[r] = pack_row_code(cat, counter);
+        ++counter;
+    }
+
+    output.codes = std::make_shared<const std::vector<RowCode> >(std::move(new_codes));
+    chunk = std::move(output);
+    return allocated;
 }
 
-template<typename IndexIn_, typename ColIndex_, typename ValueIn_>
-void fill_sparse_value(
-    std::vector<Holder< std::uint8_t, IndexIn_, ColIndex_> >& store8,
-    std::vector<Holder<std::uint16_t, IndexIn_, ColIndex_> >& store16,
-    std::vector<Holder<std::uint32_t, IndexIn_, ColIndex_> >& store32,
-    const Category cat,
-    const IndexIn_ chunk, 
-    const IndexIn_ col, 
-    const ValueIn_ val,
-    const std::size_t output_position) 
-{
-    switch (cat) {
-        case Category::U8:
-            store8[chunk].value[output_position] = val;
-            store8[chunk].index[output_position] = col;
-            break;
+// Moves each row of 'chunk' into the dictionary-coded layer if it has no more than 256 distinct values,
+// and its codes and table are smaller than its values in its current layer.
+// This is done after the layers are filled, as the number of distinct values is not known in the first pass.
+// Returns the size of the new layers and row codes that coexist with the old chunk during the rebuild, or zero if the chunk was not rebuilt.
+template<typename Index_, typename ColIndex_>
+std::size_t encode_dictionaries(LayeredChunk<Index_, ColIndex_>& chunk, const bool huge_pages) {
+    const auto& codes = *(chunk.codes);
+    const auto NR = codes.size();
 
-        case Category::U16:
-            store16[chunk].value[output_position] = val;
-            store16[chunk].index[output_position] = col;
-            break;
+    // Tables are stored as the bit patterns of the doubles, which are sorted so that codes can be assigned by binary search.
+    std::vector<Category> categories;
+    sanisizer::resize(categories, NR);
+    std::vector<std::size_t> entry_start;
+    sanisizer::resize(entry_start, sanisizer::sum<std::size_t>(NR, 1));
+    std::vector<std::uint64_t> entries, keys;
+    bool any_encoded = false;
 
-        case Category::U32:
-            store32[chunk].value[output_position] = val;
-            store32[chunk].index[output_position] = col;
-            break;
+    for (I<decltype(NR)> r = 0; r < NR; ++r) {
+        const auto code = codes[r];
+        const auto pos = row_code_position(code);
+        const auto cat = row_code_category(code);
+        categories[r] = cat;
+
+        dispatch_layer(chunk, cat, [&](const auto& layer) -> void {
+            typedef I<decltype(*(layer.value))> Int;
+            if constexpr(sizeof(Int) > 1 && !std::is_same<Int, std::uint64_t>::value) {
+                const auto start = layer.ptr[pos];
+                const std::size_t number = layer.ptr[pos + 1] - start;
+
+                // Skipping rows that cannot be smaller with a dictionary, which needs at least one entry and a table pointer.
+                if (number * (sizeof(Int) - 1) <= 2 * sizeof(double)) {
+                    return;
+                }
+
+                keys.clear();
+                for (std::size_t i = 0; i < number; ++i) {
+                    keys.push_back(dictionary_key(static_cast<double>(layer.value[start + i])));
+                }
+                std::sort(keys.begin(), keys.end());
+                keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+                if (keys.size() > max_dictionary_size || number + (keys.size() + 1) * sizeof(double) >= number * sizeof(Int)) {
+                    return;
+                }
+
+                entries.insert(entries.end(), keys.begin(), keys.end());
+                categories[r] = Category::D8;
+                any_encoded = true;
+            }
+        });
+
+        entry_start[r + 1] = entries.size();
     }
+
+    if (!any_encoded) {
+        return 0;
+    }
+
+    // Existing dictionary-coded rows are retained with their tables.
+    const auto num_entries = sanisizer::sum<std::size_t>(layer_num_entries(chunk), entries.size());
+    const auto allocated = rebuild_chunk(chunk, categories, num_entries, layer_num_escapes(chunk), huge_pages, [&](const auto r, const auto& layer, const std::size_t start, const std::size_t number, auto& output, const std::size_t counter) -> void {
+        const auto& dict = output.stored8;
+        const auto base = dict.ptr[counter];
+        const auto value = writable_array(dict.value);
+        const auto kstart = entries.begin() + entry_start[r], kend = entries.begin() + entry_start[r + 1];
+        for (std::size_t k = 0; k < number; ++k) {
+            const auto key = dictionary_key(static_cast<double>(layer.value[start + k]));
+            value[base + k] = static_cast<std::uint8_t>(std::lower_bound(kstart, kend, key) - kstart);
+        }
+
+        const auto table_ptr = writable_array(dict.table_ptr);
+        const auto tstart = table_ptr[counter];
+        std::memcpy(writable_array(dict.table) + tstart, entries.data() + entry_start[r], (kend - kstart) * sizeof(double));
+        table_ptr[counter + 1] = tstart + (kend - kstart);
+    });
+
+    return sanisizer::sum<std::size_t>(allocated, sanisizer::product<std::size_t>(NR, sizeof(RowCode)));
 }
 
-template<typename ValueOut_, typename IndexOut_, typename IndexIn_, typename ColIndex_> 
-std::shared_ptr<tatami::Matrix<ValueOut_, IndexOut_> > consolidate_matrices(
-    const std::vector<std::vector<IndexIn_> >& identities8,
-    const std::vector<std::vector<IndexIn_> >& identities16,
-    const std::vector<std::vector<IndexIn_> >& identities32,
-    std::vector<Holder< std::uint8_t, IndexIn_, ColIndex_> > store8,
-    std::vector<Holder<std::uint16_t, IndexIn_, ColIndex_> > store16,
-    std::vector<Holder<std::uint32_t, IndexIn_, ColIndex_> > store32,
-    const IndexIn_ NR,
-    const IndexIn_ chunk_size,
-    const IndexIn_ leftovers)
-{
-    std::vector<std::shared_ptr<const tatami::Matrix<ValueOut_, IndexOut_> > > col_combined;
-    IndexIn_ num_chunks = identities8.size();
-    col_combined.reserve(num_chunks);
-
-    for (I<decltype(num_chunks)> c = 0; c < num_chunks; ++c) {
-        std::vector<std::shared_ptr<const tatami::Matrix<ValueOut_, IndexOut_> > > row_combined;
-        IndexOut_ current_size = (c + 1 == num_chunks ? leftovers : chunk_size);
-        row_combined.reserve(3);
-
-        std::vector<IndexIn_> reordered(NR);
-        IndexIn_ counter = 0;
-
-        if (!(identities8[c].empty())) {
-            row_combined.emplace_back(new tatami::CompressedSparseRowMatrix<ValueOut_, IndexOut_, std::vector<std::uint8_t>, std::vector<ColIndex_>, std::vector<std::size_t> >(
-                identities8[c].size(), current_size, std::move(store8[c].value), std::move(store8[c].index), std::move(store8[c].ptr), false
-            ));
-            for (auto& i : identities8[c]) {
-                reordered[i] = counter++;
+// Returns the sum of the largest rebuild in each thread, i.e., an upper bound on the size of the copies that coexist with the chunks.
+template<typename Index_, typename ColIndex_>
+std::size_t encode_dictionaries(std::vector<LayeredChunk<Index_, ColIndex_> >& chunks, const bool huge_pages, const int num_threads) {
+    std::vector<std::size_t> largest(static_cast<std::size_t>(std::max(num_threads, 1)));
+    tatami::parallelize([&](const int t, const std::size_t start, const std::size_t length) -> void {
+        for (std::size_t c = start, end = start + length; c < end; ++c) {
+            largest[t] = std::max(largest[t], encode_dictionaries(chunks[c], huge_pages));
+        }
+    }, chunks.size(), num_threads);
+    return std::accumulate(largest.begin(), largest.end(), static_cast<std::size_t>(0));
+}
+
+// Thread-safe LRU cache of chunks, bounded by the total size of their layer arrays.
+// 'Loader_' should be a function object that creates a chunk from its index and can be called from multiple threads.
+template<typename Index_, typename ColIndex_, class Loader_>
+class ChunkCache {
+public:
+    ChunkCache(Loader_ loader, std::vector<std::size_t> chunk_bytes, const std::size_t budget) :
+        my_loader(std::move(loader)),
+        my_chunk_bytes(std::move(chunk_bytes)),
+        my_budget(budget)
+    {
+        sanisizer::resize(my_entries, my_chunk_bytes.size());
+    }
+
+public:
+    std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > get(const std::size_t c) {
+        std::promise<std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > > promise;
+        {
+            std::unique_lock<std::mutex> lck(my_mutex);
+            auto& entry = my_entries[c];
+            if (entry.chunk) {
+                my_order.splice(my_order.begin(), my_order, entry.position);
+                return entry.chunk;
             }
+
+            // If another thread is already loading this chunk, we wait for its result instead of loading it again.
+            if (entry.loading.valid()) {
+                auto loading = entry.loading;
+                lck.unlock();
+                return loading.get();
+            }
+            entry.loading = promise.get_future().share();
         }
 
-        if (!(identities16[c].empty())) {
-            row_combined.emplace_back(new tatami::CompressedSparseRowMatrix<ValueOut_, IndexOut_, std::vector<std::uint16_t>, std::vector<ColIndex_>, std::vector<std::size_t> >(
-                identities16[c].size(), current_size, std::move(store16[c].value), std::move(store16[c].index), std::move(store16[c].ptr), false
-            ));
-            for (auto& i : identities16[c]) {
-                reordered[i] = counter++;
+        // Loading outside of the lock so that other threads can still use the cached chunks.
+        std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > loaded;
+        try {
+            loaded = std::make_shared<const LayeredChunk<Index_, ColIndex_> >(my_loader(c));
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lck(my_mutex);
+                my_entries[c].loading = Loading(); // so that later requests will try again.
             }
+            promise.set_exception(std::current_exception());
+            throw;
         }
 
-        if (!(identities32[c].empty()) || row_combined.empty()) { // make sure that at least one matrix is fed into the DelayedBind.
-            row_combined.emplace_back(new tatami::CompressedSparseRowMatrix<ValueOut_, IndexOut_, std::vector<uint32_t>, std::vector<ColIndex_>, std::vector<std::size_t> >(
-                identities32[c].size(), current_size, std::move(store32[c].value), std::move(store32[c].index), std::move(store32[c].ptr), false
-            ));
-            for (auto& i : identities32[c]) {
-                reordered[i] = counter++;
+        {
+            std::lock_guard<std::mutex> lck(my_mutex);
+            auto& entry = my_entries[c];
+            entry.chunk = loaded;
+            entry.loading = Loading();
+            my_order.push_front(c);
+            entry.position = my_order.begin();
+            my_used += my_chunk_bytes[c];
+
+            while (my_used > my_budget && my_order.size() > 1) {
+                const auto last = my_order.back();
+                my_order.pop_back();
+                my_used -= my_chunk_bytes[last];
+                my_entries[last].chunk.reset(); // extractors that are still using this chunk keep it alive.
             }
         }
 
-        if (row_combined.size() == 1) {
-            col_combined.push_back(std::move(row_combined.front()));
-        } else {
-            col_combined.push_back(
-                tatami::make_DelayedSubset<ValueOut_, IndexOut_>(
-                    std::make_shared<const tatami::DelayedBind<ValueOut_, IndexOut_> >(std::move(row_combined), true),
-                    std::move(reordered),
-                    true
-                )
-            );
+        promise.set_value(loaded);
+        return loaded;
+    }
+
+    std::size_t cached_bytes() {
+        std::lock_guard<std::mutex> lck(my_mutex);
+        return my_used;
+    }
+
+    bool fits() const {
+        std::size_t total = 0;
+        for (auto b : my_chunk_bytes) {
+            total = sanisizer::sum<std::size_t>(total, b);
+        }
+        return total <= my_budget;
+    }
+
+    const Loader_& loader() const {
+        return my_loader;
+    }
+
+private:
+    Loader_ my_loader;
+    std::vector<std::size_t> my_chunk_bytes;
+
+    typedef std::shared_future<std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > > Loading;
+
+    struct Entry {
+        std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > chunk;
+        std::list<std::size_t>::iterator position;
+        Loading loading; // only valid while the chunk is being loaded by another thread.
+    };
+
+    std::mutex my_mutex;
+    std::vector<Entry> my_entries;
+    std::list<std::size_t> my_order; // most recently used at the front.
+    std::size_t my_used = 0;
+    std::size_t my_budget;
+};
+
+// Chunk source for the LayeredSparseMatrix extractors, holding a reference to the current chunk so that it is not freed by eviction.
+// As each extractor is used by a single thread, this effectively acts as a per-thread buffer for the decoded chunk.
+template<typename Index_, typename ColIndex_, class Cache_>
+class CachedChunks {
+public:
+    CachedChunks(Cache_* cache) : my_cache(cache) {}
+
+    const LayeredChunk<Index_, ColIndex_>& get(const Index_ c) {
+        if (!my_current || c != my_current_index) {
+            std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > next;
+            if (my_prefetcher) {
+                std::lock_guard<std::mutex> lck(my_prefetcher->mutex);
+                if (my_prefetcher->loaded && my_prefetcher->loaded_index == c) {
+                    next = std::move(my_prefetcher->loaded);
+                } else if (my_prefetcher->requested && my_prefetcher->request == c) {
+                    my_prefetcher->requested = false; // no point loading it in the background as we need it now.
+                }
+            }
+
+            // If the background thread is already loading this chunk, the cache makes us wait for it.
+            my_current = (next ? std::move(next) : my_cache->get(c));
+            my_current_index = c;
         }
+        return *my_current;
+    }
+
+    const LayeredChunk<Index_, ColIndex_>* peek(const Index_ c) const {
+        return (my_current && c == my_current_index ? my_current.get() : NULL);
     }
 
-    return std::make_shared<tatami::DelayedBind<ValueOut_, IndexOut_> >(std::move(col_combined), false);
+    // Loads the chunk in a background thread so that it is ready when get() is called.
+    // The thread is only started on the first request and is reused for all later requests from this extractor.
+    // Only one chunk is loaded at a time, so a request that has not yet started is replaced by the next request.
+    void prefetch(const Index_ c) {
+        if (my_current && c == my_current_index) {
+            return;
+        }
+        if (!my_prefetcher) {
+            my_prefetcher = std::make_unique<Prefetcher>(my_cache);
+        }
+        {
+            std::lock_guard<std::mutex> lck(my_prefetcher->mutex);
+            if (my_prefetcher->loaded && my_prefetcher->loaded_index == c) {
+                return;
+            }
+            my_prefetcher->request = c;
+            my_prefetcher->requested = true;
+        }
+        my_prefetcher->condition.notify_one();
+    }
+
+private:
+    Cache_* my_cache;
+    std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > my_current;
+    Index_ my_current_index = 0;
+
+    // Held by pointer so that the CachedChunks can still be moved into the extractors.
+    struct Prefetcher {
+        Prefetcher(Cache_* cache) : worker([this, cache]() -> void { run(cache); }) {}
+
+        // Unstarted requests are dropped, but we still have to wait for any load in progress.
+        ~Prefetcher() {
+            {
+                std::lock_guard<std::mutex> lck(mutex);
+                stop = true;
+            }
+            condition.notify_one();
+            worker.join();
+        }
+
+        void run(Cache_* cache) {
+            std::unique_lock<std::mutex> lck(mutex);
+            while (true) {
+                condition.wait(lck, [&]() -> bool { return stop || requested; });
+                if (stop) {
+                    return;
+                }
+                const Index_ c = request;
+                requested = false;
+                lck.unlock();
+
+                std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > current;
+                try {
+                    current = cache->get(c);
+                } catch (...) {
+                    // Errors are ignored here as they will be raised again when the chunk is actually requested.
+                }
+
+                lck.lock();
+                loaded = std::move(current);
+                loaded_index = c;
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stop = false;
+        bool requested = false;
+        Index_ request = 0;
+        std::shared_ptr<const LayeredChunk<Index_, ColIndex_> > loaded;
+        Index_ loaded_index = 0;
+        std::thread worker; // declared last so that it starts after the other members are initialized.
+    };
+
+    std::unique_ptr<Prefetcher> my_prefetcher;
+};
+
+// Constants for the binary format, see save_layered_sparse() for details.
+constexpr std::size_t file_header_words = 16;
+constexpr std::size_t file_directory_words = 5 + 2 * num_categories;
+constexpr std::uint64_t file_version = 1;
+constexpr std::uint64_t file_byte_order = 0x0102030405060708ull;
+constexpr char file_magic[8] = { 'T', 'L', 'A', 'Y', 'E', 'R', 'E', 'D' };
+
+inline std::size_t pad_file_offset(const std::size_t offset) {
+    const std::size_t remainder = offset % LayerArena::default_alignment;
+    return (remainder ? sanisizer::sum<std::size_t>(offset, LayerArena::default_alignment - remainder) : offset);
+}
+
+template<typename Index_, typename ColIndex_> 
+std::size_t get_sparse_ptr(const std::vector<LayeredChunk<Index_, ColIndex_> >& chunks, const std::size_t chunk, const std::size_t row) {
+    const auto& current = chunks[chunk];
+    const auto code = (*(current.codes))[row];
+    const auto arow = row_code_position(code);
+    std::size_t output = 0;
+    dispatch_layer(current, row_code_category(code), [&](const auto& layer) -> void {
+        output = layer.ptr[arow];
+    });
+    return output;
+}
+
+template<typename Index_, typename ColIndex_, typename Column_, typename ValueIn_>
+void fill_sparse_value(
+    std::vector<LayeredChunk<Index_, ColIndex_> >& chunks,
+    const std::size_t chunk, 
+    const std::size_t row, 
+    const Column_ col, 
+    const ValueIn_ val,
+    const std::size_t output_position) 
+{
+    const auto& current = chunks[chunk];
+    const auto code = (*(current.codes))[row];
+    dispatch_layer(current, row_code_category(code), [&](const auto& layer) -> void {
+        writable_array(layer.index)[output_position] = col;
+
+        if constexpr(I<decltype(layer)>::escaped) {
+            // Escapes are appended at the row's cursor, see allocate_rows(), so they are sorted if each row is filled in order of increasing column index.
+            if (is_outlier(val)) {
+                writable_array(layer.value)[output_position] = escape_code;
+                auto& cursor = writable_array(layer.escape_ptr)[row_code_position(code) + 1];
+                writable_array(layer.escape_index)[cursor] = col;
+                writable_array(layer.escape_value)[cursor] = static_cast<std::uint64_t>(val);
+                ++cursor;
+            } else {
+                writable_array(layer.value)[output_position] = static_cast<std::uint8_t>(val);
+            }
+        } else {
+            writable_array(layer.value)[output_position] = static_cast<I<decltype(*layer.value)> >(val);
+        }
+    });
+}
+
+// Avoids comparisons that are always false for unsigned types, which trigger -Wtype-limits.
+template<typename Integer_>
+bool is_negative(const Integer_ x) {
+    if constexpr(std::is_signed<Integer_>::value) {
+        return x < 0;
+    } else {
+        return false;
+    }
 }
 
 template<typename Output_, typename ColumnIndex_, typename Input_>
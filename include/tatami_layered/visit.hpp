@@ -0,0 +1,230 @@
+#ifndef TATAMI_LAYERED_VISIT_HPP
+#define TATAMI_LAYERED_VISIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#include "utils.hpp"
+#include "LayeredSparseMatrix.hpp"
+
+/**
+ * @file visit.hpp
+ * @brief Visit the raw layer data of a layered sparse matrix.
+ */
+
+namespace tatami_layered {
+
+/**
+ * @brief Non-zero elements of a row segment in one layer.
+ *
+ * @tparam Int_ Type of the layer's values, i.e., `std::uint8_t`, `std::uint16_t`, `std::uint32_t` or `std::uint64_t` for the unsigned integer layers,
+ * `std::int8_t`, `std::int16_t` or `std::int32_t` for the signed integer layers, and `Float16`, `float` or `double` for the floating-point layers.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ */
+template<typename Int_, typename ColumnIndex_>
+struct LayerSpan {
+    /**
+     * Pointer to the column indices of the non-zero elements, relative to the start of the chunk.
+     * These are sorted in increasing order.
+     */
+    const ColumnIndex_* index;
+
+    /**
+     * Pointer to the values of the non-zero elements, in their native type.
+     */
+    const Int_* value;
+
+    /**
+     * Number of non-zero elements.
+     */
+    std::size_t number;
+};
+
+/**
+ * @brief Non-zero elements of a row segment in the dictionary-coded layer.
+ *
+ * Each non-zero element is stored as an 8-bit code into a table of the row's distinct values in the chunk, see `ConvertToLayeredSparseOptions::dictionary`.
+ * The `index`, `value` and `number` members can be used in the same manner as those of a `LayerSpan`, so that generic kernels do not need to handle this layer specially.
+ *
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ */
+template<typename ColumnIndex_>
+struct DictionarySpan {
+    /**
+     * Pointer to the column indices of the non-zero elements, relative to the start of the chunk.
+     * These are sorted in increasing order.
+     */
+    const ColumnIndex_* index;
+
+    /**
+     * Decoded values of the non-zero elements, where `value[i]` is a `double` equal to `table[code[i]]`.
+     */
+    DictionaryValues value;
+
+    /**
+     * Number of non-zero elements.
+     */
+    std::size_t number;
+
+    /**
+     * Pointer to the codes of the non-zero elements.
+     */
+    const std::uint8_t* code;
+
+    /**
+     * Pointer to the table of distinct values for this row segment.
+     */
+    const double* table;
+
+    /**
+     * Number of entries in `table`, no greater than 256.
+     */
+    std::size_t table_size;
+};
+
+/**
+ * @brief Non-zero elements of a row segment in the escaped layer.
+ *
+ * Each non-zero element is stored as an 8-bit unsigned integer, except for a few outliers that are stored separately as escapes, see `ConvertToLayeredSparseOptions::outliers`.
+ * The `index`, `value` and `number` members can be used in the same manner as those of a `LayerSpan`, so that generic kernels do not need to handle this layer specially.
+ *
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ */
+template<typename ColumnIndex_>
+struct EscapedSpan {
+    /**
+     * Pointer to the column indices of the non-zero elements, relative to the start of the chunk.
+     * These are sorted in increasing order.
+     */
+    const ColumnIndex_* index;
+
+    /**
+     * Values of the non-zero elements, where `value[i]` is a `std::uint64_t` equal to `code[i]`, or to the escape for `index[i]` if `code[i]` is 255.
+     */
+    EscapedValues<ColumnIndex_> value;
+
+    /**
+     * Number of non-zero elements.
+     */
+    std::size_t number;
+
+    /**
+     * Pointer to the 8-bit values of the non-zero elements, where 255 indicates that the value is stored as an escape.
+     */
+    const std::uint8_t* code;
+
+    /**
+     * Pointer to the column indices of the escaped elements, relative to the start of the chunk.
+     * These are sorted in increasing order.
+     */
+    const ColumnIndex_* escape_index;
+
+    /**
+     * Pointer to the values of the escaped elements.
+     */
+    const std::uint64_t* escape_value;
+
+    /**
+     * Number of escaped elements.
+     */
+    std::size_t num_escapes;
+};
+
+/**
+ * @cond
+ */
+namespace visit_internal {
+
+template<typename Value_, typename Index_, typename ColumnIndex_>
+void check_untransformed(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat) {
+    if (mat.get_fused_transform()) {
+        throw std::runtime_error("raw layer data cannot be visited in a layered matrix with a fused transformation");
+    }
+}
+
+template<typename Index_, typename ColumnIndex_, class Function_>
+void visit_segment(const LayeredChunk<Index_, ColumnIndex_>& chunk, const Index_ row, Function_ fun) {
+    visit_row_segment(chunk, row, [&](const ColumnIndex_* indices, const auto values, const std::size_t number) -> void {
+        typedef I<decltype(values)> Values;
+        if constexpr(std::is_same<Values, DictionaryValues>::value) {
+            fun(DictionarySpan<ColumnIndex_>{ indices, values, number, values.code, values.table, values.table_size });
+        } else if constexpr(std::is_same<Values, EscapedValues<ColumnIndex_> >::value) {
+            fun(EscapedSpan<ColumnIndex_>{ indices, values, number, values.code, values.escape_index, values.escape_value, values.num_escapes });
+        } else {
+            fun(LayerSpan<I<decltype(*values)>, ColumnIndex_>{ indices, values, number });
+        }
+    });
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Visit the non-zero elements of a row of a layered sparse matrix in their native integer types.
+ * This bypasses the `tatami::Matrix` interface and its conversion to `Value_`,
+ * allowing users to write custom kernels (e.g., sums, binning, thresholding) that operate on the narrow integer types of each layer.
+ * As `fun` is called with a different `LayerSpan` type for each layer (or a `DictionarySpan` or `EscapedSpan` for the dictionary-coded and escaped layers), it is instantiated separately for each value type at compile time, e.g., by using a generic lambda.
+ * An error is thrown if `mat` has a fused transformation, see `LayeredSparseMatrix::fuse_transform()`.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam Function_ Function object to be called for each chunk.
+ *
+ * @param mat A layered sparse matrix.
+ * @param row Index of the row, which should be non-negative and less than the number of rows in `mat`.
+ * @param fun Function object that accepts two arguments, the index of the first column of the chunk (as an `Index_`) and a `LayerSpan`, `DictionarySpan` or `EscapedSpan` containing the row's non-zero elements in that chunk.
+ * This is called once for each chunk in order of increasing columns, including chunks where the row has no non-zero elements.
+ * The full column index of each element is the sum of the first argument and the relevant entry of `LayerSpan::index`.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, class Function_>
+void visit_row(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const Index_ row, Function_ fun) {
+    visit_internal::check_untransformed(mat);
+    const auto& chunks = mat.get_chunks();
+    const Index_ chunk_size = mat.get_chunk_size();
+    const Index_ nchunks = chunks.size();
+
+    for (Index_ c = 0; c < nchunks; ++c) {
+        const Index_ column_start = c * chunk_size;
+        visit_internal::visit_segment(chunks[c], row, [&](const auto& span) -> void {
+            fun(column_start, span);
+        });
+    }
+}
+
+/**
+ * Visit the non-zero elements of all rows in a chunk of a layered sparse matrix in their native integer types.
+ * This is the chunk-wise counterpart to `visit_row()`, which is more cache-friendly when the kernel needs to process every row, e.g., computing column sums.
+ * An error is thrown if `mat` has a fused transformation.
+ *
+ * @tparam Value_ Type of data value for the `tatami::Matrix` interface.
+ * @tparam Index_ Integer type for the row/column indices.
+ * @tparam ColumnIndex_ Integer type for the stored column indices.
+ * @tparam Function_ Function object to be called for each row.
+ *
+ * @param mat A layered sparse matrix.
+ * @param chunk Index of the chunk, which should be non-negative and less than `LayeredSparseMatrix::num_chunks()`.
+ * The first column of this chunk is `chunk * mat.get_chunk_size()`.
+ * @param fun Function object that accepts two arguments, the index of the row (as an `Index_`) and a `LayerSpan`, `DictionarySpan` or `EscapedSpan` containing the row's non-zero elements in the chunk.
+ * This is called once for each row in order of increasing row index, including rows with no non-zero elements in the chunk.
+ */
+template<typename Value_, typename Index_, typename ColumnIndex_, class Function_>
+void visit_chunk(const LayeredSparseMatrix<Value_, Index_, ColumnIndex_>& mat, const Index_ chunk, Function_ fun) {
+    visit_internal::check_untransformed(mat);
+    const auto& current = mat.get_chunks()[chunk];
+    const Index_ NR = mat.nrow();
+
+    for (Index_ r = 0; r < NR; ++r) {
+        visit_internal::visit_segment(current, r, [&](const auto& span) -> void {
+            fun(r, span);
+        });
+    }
+}
+
+}
+
+#endif
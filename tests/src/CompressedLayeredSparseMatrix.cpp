@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+
+#if __has_include("zlib.h")
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/CompressedLayeredSparseMatrix.hpp"
+
+#include "mock_layered_sparse_data.h"
+#include "test_oracular_access.h"
+
+class CompressedLayeredSparseMatrixTest : public ::testing::TestWithParam<std::tuple<int, std::size_t> > {
+protected:
+    inline static std::shared_ptr<tatami::NumericMatrix> ref;
+    inline static std::shared_ptr<tatami_layered::LayeredSparseMatrix<double, int, std::uint8_t> > layered;
+    inline static int last_NC = -1;
+
+    static void assemble(int NC) {
+        if (NC == last_NC) {
+            return;
+        }
+        last_NC = NC;
+
+        size_t NR = 120;
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+        typedef tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> SparseMat; 
+        ref.reset(new SparseMat(NR, NC, std::move(vals), std::move(rows), std::move(indptrs))); 
+
+        tatami_layered::ConvertToLayeredSparseOptions copt;
+        copt.chunk_size = 30;
+        layered = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(*ref, copt);
+    }
+};
+
+TEST_P(CompressedLayeredSparseMatrixTest, Access) {
+    auto param = GetParam();
+    assemble(std::get<0>(param));
+
+    tatami_layered::CompressLayeredSparseOptions opt;
+    opt.cache_size = std::get<1>(param);
+    auto mat = tatami_layered::compress_layered_sparse(*layered, opt);
+    EXPECT_EQ(mat->nrow(), ref->nrow());
+    EXPECT_EQ(mat->ncol(), ref->ncol());
+    EXPECT_EQ(mat->get_chunk_size(), 30);
+    EXPECT_TRUE(mat->is_sparse());
+    EXPECT_GT(mat->compressed_bytes(), 0);
+
+    tatami_test::test_simple_row_access(*mat, *ref);
+    tatami_test::test_simple_column_access(*mat, *ref);
+
+    // Oracles are used to load the next chunk in the background.
+    EXPECT_TRUE(mat->uses_oracle(false));
+    test_oracular_access(*mat, *ref, true, std::get<0>(param));
+    test_oracular_access(*mat, *ref, false, std::get<0>(param) + 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    CompressedLayeredSparseMatrix,
+    CompressedLayeredSparseMatrixTest,
+    ::testing::Combine(
+        ::testing::Values(50, 120), // number of columns
+        ::testing::Values(0, 5000, 100000000) // cache size
+    )
+);
+
+TEST(CompressedLayeredSparseMatrix, Parallel) {
+    size_t NR = 100, NC = 200;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+    tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> ref(NR, NC, std::move(vals), std::move(rows), std::move(indptrs));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 16;
+    auto layered = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::CompressLayeredSparseOptions opt;
+    opt.num_threads = 3;
+    opt.cache_size = 2000;
+    opt.compression_level = 9;
+    auto mat = tatami_layered::compress_layered_sparse(*layered, opt);
+
+    tatami_test::test_simple_row_access(*mat, ref);
+    tatami_test::test_simple_column_access(*mat, ref);
+
+    // Extractors in different threads share the cache.
+    tatami::parallelize([&](int, int start, int length) -> void {
+        auto ext = mat->dense_column();
+        auto rext = ref.dense_column();
+        std::vector<double> buffer(NR), rbuffer(NR);
+        for (int c = start, end = start + length; c < end; ++c) {
+            auto ptr = ext->fetch(c, buffer.data());
+            auto rptr = rext->fetch(c, rbuffer.data());
+            for (size_t r = 0; r < NR; ++r) {
+                EXPECT_EQ(ptr[r], rptr[r]);
+            }
+        }
+    }, static_cast<int>(NC), 4);
+}
+
+TEST(CompressedLayeredSparseMatrix, Compression) {
+    // Highly repetitive data should compress well.
+    size_t NR = 200, NC = 100;
+    std::vector<double> dense(NR * NC);
+    for (size_t r = 0; r < NR; ++r) {
+        for (size_t c = 0; c < NC; c += 4) {
+            dense[r * NC + c] = 1;
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, std::move(dense));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 50;
+    auto layered = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::CompressLayeredSparseOptions opt;
+    opt.cache_size = 0;
+    auto mat = tatami_layered::compress_layered_sparse(*layered, opt);
+    EXPECT_LT(mat->compressed_bytes(), NR * NC / 4);
+    EXPECT_EQ(mat->cached_bytes(), 0);
+
+    tatami_test::test_simple_row_access(*mat, ref);
+    EXPECT_GT(mat->cached_bytes(), 0);
+}
+
+TEST(CompressedLayeredSparseMatrix, Dictionary) {
+    size_t NR = 30, NC = 200;
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, mock_dictionary_data(NR, NC));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.dictionary = true;
+    auto layered = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    EXPECT_EQ(layered->get_chunks()[0].stored8.num_rows, 15);
+
+    tatami_layered::CompressLayeredSparseOptions opt;
+    opt.cache_size = 0;
+    auto mat = tatami_layered::compress_layered_sparse(*layered, opt);
+    tatami_test::test_simple_row_access(*mat, ref);
+    tatami_test::test_simple_column_access(*mat, ref);
+}
+
+TEST(CompressedLayeredSparseMatrix, Outliers) {
+    size_t NR = 30, NC = 200;
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, mock_outlier_data(NR, NC));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto layered = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    EXPECT_EQ(layered->get_chunks()[0].storee8.num_rows, 18);
+
+    tatami_layered::CompressLayeredSparseOptions opt;
+    opt.cache_size = 0;
+    auto mat = tatami_layered::compress_layered_sparse(*layered, opt);
+    tatami_test::test_simple_row_access(*mat, ref);
+    tatami_test::test_simple_column_access(*mat, ref);
+}
+
+TEST(CompressedLayeredSparseMatrix, Errors) {
+    tatami::DenseRowMatrix<double, int> ref(10, 20, std::vector<double>(200, 1));
+    auto layered = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_layered::FusedTransform transform;
+    transform.log1p = true;
+    auto fused = layered->fuse_transform(std::move(transform));
+    tatami_test::throws_error([&]() {
+        tatami_layered::compress_layered_sparse(*fused, tatami_layered::CompressLayeredSparseOptions());
+    }, "fused transformation");
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+
+#include "mock_layered_sparse_data.h"
+#include "test_oracular_access.h"
+
+#include <cmath>
+
+class LayeredSparseMatrixTest : public ::testing::TestWithParam<int> {
+protected:
+    static std::shared_ptr<tatami::NumericMatrix> create_reference(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+        typedef tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> SparseMat; 
+        return std::shared_ptr<tatami::NumericMatrix>(new SparseMat(NR, NC, std::move(vals), std::move(rows), std::move(indptrs))); 
+    }
+};
+
+TEST_P(LayeredSparseMatrixTest, Access) {
+    // Checking that we handle the number of columns being an exact multiple of the chunk size.
+    size_t NR = 200, NC = GetParam();
+    auto ref = create_reference(NR, NC);
+
+    tatami_layered::ConvertToLayeredSparseOptions opt;
+    opt.chunk_size = 64;
+    auto out = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(*ref, opt);
+    EXPECT_EQ(out->get_chunk_size(), 64);
+    EXPECT_EQ(out->num_chunks(), std::max(1, static_cast<int>((NC + 63) / 64)));
+
+    int total = 0;
+    for (int c = 0, end = out->num_chunks(); c < end; ++c) {
+        total += out->chunk_extent(c);
+    }
+    EXPECT_EQ(total, NC);
+
+    tatami_test::test_simple_row_access(*out, *ref);
+    tatami_test::test_simple_column_access(*out, *ref);
+
+    // Oracles are used for prefetching the upcoming rows.
+    EXPECT_TRUE(out->uses_oracle(true));
+    test_oracular_access(*out, *ref, true, NC);
+    test_oracular_access(*out, *ref, false, NC + 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    LayeredSparseMatrix,
+    LayeredSparseMatrixTest,
+    ::testing::Values(50, 128, 200, 256) // number of columns, including exact multiples of the chunk size.
+);
+
+TEST(LayeredSparseMatrix, SharedCodes) {
+    size_t NR = 20, NC = 100;
+    std::vector<double> full(NR * NC);
+    for (size_t r = 0; r < NR; ++r) {
+        full[r * NC + (r * 7) % NC] = (r % 2 ? 1000 : 1); // same category for each row in every chunk.
+        full[r * NC + (r * 13 + 50) % NC] = (r % 2 ? 2000 : 2);
+    }
+    auto ref = std::make_shared<tatami::DenseRowMatrix<double, int> >(NR, NC, std::move(full));
+
+    tatami_layered::ConvertToLayeredSparseOptions opt;
+    opt.chunk_size = 10;
+    auto out = tatami_layered::convert_to_layered_sparse(*ref, opt);
+    const auto& chunks = out->get_chunks();
+    ASSERT_EQ(chunks.size(), 10);
+
+    // Chunks with identical codes should be sharing the same vector.
+    for (size_t c = 1; c < chunks.size(); ++c) {
+        for (size_t c2 = 0; c2 < c; ++c2) {
+            if (*(chunks[c].codes) == *(chunks[c2].codes)) {
+                EXPECT_EQ(chunks[c].codes.get(), chunks[c2].codes.get());
+            }
+        }
+    }
+
+    tatami_test::test_simple_row_access(*out, *ref);
+    tatami_test::test_simple_column_access(*out, *ref);
+
+    // All-U8 chunks definitely share their codes.
+    std::vector<double> small(NR * NC);
+    for (size_t r = 0; r < NR; ++r) {
+        small[r * NC + (r * 7) % NC] = 5;
+    }
+    auto sref = std::make_shared<tatami::DenseRowMatrix<double, int> >(NR, NC, std::move(small));
+    auto sout = tatami_layered::convert_to_layered_sparse(*sref, opt);
+    const auto& schunks = sout->get_chunks();
+    for (size_t c = 1; c < schunks.size(); ++c) {
+        EXPECT_EQ(schunks[c].codes.get(), schunks[0].codes.get());
+    }
+
+    tatami_test::test_simple_row_access(*sout, *sref);
+    tatami_test::test_simple_column_access(*sout, *sref);
+}
+
+TEST(LayeredSparseMatrix, Errors) {
+    std::vector<tatami_layered::LayeredChunk<int, std::uint16_t> > chunks(2);
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::LayeredSparseMatrix<double, int> mat(10, 20, 20, chunks);
+    }, "number of chunks");
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::LayeredSparseMatrix<double, int> mat(10, 20, 10, chunks);
+    }, "row codes");
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::LayeredSparseMatrix<double, int> mat(10, 20, 0, chunks);
+    }, "chunk size");
+}
+
+class LayeredSparseMatrixFusedTest : public ::testing::TestWithParam<std::tuple<bool, bool, bool, double> > {};
+
+TEST_P(LayeredSparseMatrixFusedTest, Access) {
+    auto param = GetParam();
+    size_t NR = 80, NC = 150;
+
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    std::vector<double> full(NR * NC);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        full[rows[i] * NC + cols[i]] = vals[i];
+    }
+
+    tatami::DenseRowMatrix<double, int> raw(NR, NC, full);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    auto mat = tatami_layered::convert_to_layered_sparse(raw, copt);
+
+    tatami_layered::FusedTransform transform;
+    if (std::get<0>(param)) {
+        for (size_t r = 0; r < NR; ++r) {
+            transform.row_factors.push_back(1.0 / (r + 1));
+        }
+    }
+    if (std::get<1>(param)) {
+        for (size_t c = 0; c < NC; ++c) {
+            transform.column_factors.push_back(1.0 / (c % 7 + 1));
+        }
+    }
+    transform.log1p = std::get<2>(param);
+    transform.lower = std::get<3>(param);
+    transform.upper = 1000;
+
+    auto fused = mat->fuse_transform(transform);
+    EXPECT_EQ(fused->get_fused_transform() != NULL, true);
+    EXPECT_EQ(fused->is_sparse(), transform.lower <= 0);
+    EXPECT_EQ(mat->get_fused_transform(), static_cast<const tatami_layered::FusedTransform*>(NULL));
+
+    for (size_t r = 0; r < NR; ++r) {
+        for (size_t c = 0; c < NC; ++c) {
+            auto& x = full[r * NC + c];
+            if (!transform.row_factors.empty()) {
+                x *= transform.row_factors[r];
+            }
+            if (!transform.column_factors.empty()) {
+                x *= transform.column_factors[c];
+            }
+            if (transform.log1p) {
+                x = std::log1p(x);
+            }
+            x = std::min(std::max(x, transform.lower), transform.upper);
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, std::move(full));
+
+    tatami_test::test_simple_row_access(*fused, ref);
+    tatami_test::test_simple_column_access(*fused, ref);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    LayeredSparseMatrix,
+    LayeredSparseMatrixFusedTest,
+    ::testing::Combine(
+        ::testing::Values(false, true), // row scaling
+        ::testing::Values(false, true), // column scaling
+        ::testing::Values(false, true), // log1p
+        ::testing::Values(-1.0, 0.5) // lower bound, where a positive bound discards sparsity.
+    )
+);
+
+TEST(LayeredSparseMatrix, FusedErrors) {
+    std::vector<double> full(20);
+    tatami::DenseRowMatrix<double, int> raw(4, 5, full);
+    auto mat = tatami_layered::convert_to_layered_sparse(raw, tatami_layered::ConvertToLayeredSparseOptions());
+
+    tatami_layered::FusedTransform transform;
+    transform.row_factors.resize(3);
+    tatami_test::throws_error([&]() -> void {
+        mat->fuse_transform(transform);
+    }, "row_factors");
+
+    transform.row_factors.clear();
+    transform.column_factors.resize(4);
+    tatami_test::throws_error([&]() -> void {
+        mat->fuse_transform(transform);
+    }, "column_factors");
+
+    transform.column_factors.clear();
+    auto fused = mat->fuse_transform(transform);
+    tatami_test::throws_error([&]() -> void {
+        fused->fuse_transform(transform);
+    }, "already");
+}
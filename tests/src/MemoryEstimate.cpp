@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/describe_layered_sparse.hpp"
+#include "tatami_layered/read_layered_sparse_from_matrix_market.hpp"
+
+#include "mock_layered_sparse_data.h"
+#include "temp_file_path.h"
+
+#include <fstream>
+
+class MemoryEstimateTest : public ::testing::TestWithParam<std::tuple<bool, int> > {
+protected:
+    inline static size_t NR = 150, NC = 320;
+    inline static std::vector<size_t> rows, cols;
+    inline static std::vector<int> vals;
+    inline static std::shared_ptr<tatami::NumericMatrix> ref_row, ref_column;
+
+    static void SetUpTestSuite() {
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+        ref_column.reset(new tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)>(NR, NC, vals, rows, indptrs));
+        ref_row = tatami::convert_to_compressed_sparse<double, int>(*ref_column, true, tatami::ConvertToCompressedSparseOptions());
+    }
+
+    // Layers and row codes of the constructed matrix, before any sharing of row codes.
+    template<class Matrix_>
+    static size_t unshared_bytes(const Matrix_& mat) {
+        auto described = tatami_layered::describe_layered_sparse(mat);
+        return described.memory_usage() - described.code_bytes + described.chunks.size() * NR * sizeof(tatami_layered::RowCode);
+    }
+};
+
+TEST_P(MemoryEstimateTest, Convert) {
+    auto param = GetParam();
+    const auto& ref = (std::get<0>(param) ? *ref_row : *ref_column);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.num_threads = std::get<1>(param);
+
+    auto composition = tatami_layered::scan_layered_sparse(ref, copt);
+    auto estimate = tatami_layered::estimate_convert_to_layered_sparse(ref, composition, copt);
+    auto estimate2 = tatami_layered::estimate_convert_to_layered_sparse(ref, copt);
+    EXPECT_EQ(estimate.final_bytes, estimate2.final_bytes);
+    EXPECT_EQ(estimate.transient_bytes, estimate2.transient_bytes);
+    EXPECT_EQ(estimate.peak_bytes, estimate.final_bytes + estimate.transient_bytes);
+
+    tatami_layered::Instrumentation instr;
+    copt.instrumentation = &instr;
+    auto out = tatami_layered::convert_to_layered_sparse(ref, copt);
+    EXPECT_EQ(estimate.final_bytes, unshared_bytes(*out));
+    EXPECT_GE(estimate.transient_bytes, instr.transient_bytes);
+
+    // Enforcing the budget.
+    copt.max_memory = estimate.peak_bytes;
+    auto out2 = tatami_layered::convert_to_layered_sparse(ref, copt);
+    tatami_test::test_simple_row_access(*out2, *ref_row);
+
+    copt.max_memory = estimate.peak_bytes - 1;
+    tatami_test::throws_error([&]() {
+        tatami_layered::convert_to_layered_sparse(ref, copt);
+    }, "exceeds 'max_memory'");
+}
+
+TEST_P(MemoryEstimateTest, MatrixMarket) {
+    auto param = GetParam();
+    auto path = temp_file_path("tatami-tests-ext-MemoryEstimate");
+    {
+        std::ofstream file_out(path);
+        file_out << "%%MatrixMarket matrix coordinate integer general\n" << NR << " " << NC << " " << vals.size() << "\n";
+        for (size_t i = 0; i < vals.size(); ++i) {
+            file_out << rows[i] + 1 << " " << cols[i] + 1 << " " << vals[i] << "\n";
+        }
+    }
+
+    tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+    ropt.chunk_size = 50;
+    ropt.num_threads = std::get<1>(param);
+    ropt.huge_pages = std::get<0>(param);
+
+    auto composition = tatami_layered::scan_layered_sparse_from_matrix_market_text_file(path.c_str(), ropt);
+    auto estimate = tatami_layered::estimate_read_layered_sparse_from_matrix_market(composition, ropt);
+    EXPECT_EQ(estimate.peak_bytes, estimate.final_bytes + estimate.transient_bytes);
+
+    auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_file(path.c_str(), ropt);
+    EXPECT_EQ(estimate.final_bytes, unshared_bytes(*out)); // all chunks are smaller than a huge page, so no rounding is involved.
+
+    auto described = tatami_layered::describe_layered_sparse(*out);
+    ASSERT_EQ(described.chunks.size(), composition.chunks.size());
+    for (size_t c = 0; c < described.chunks.size(); ++c) {
+        EXPECT_EQ(described.chunks[c].num_rows, composition.chunks[c].num_rows);
+        EXPECT_EQ(described.chunks[c].num_nonzero, composition.chunks[c].num_nonzero);
+    }
+
+    ropt.max_memory = estimate.peak_bytes;
+    auto out2 = tatami_layered::read_layered_sparse_from_matrix_market_text_file(path.c_str(), ropt);
+    tatami_test::test_simple_row_access(*out2, *ref_row);
+
+    ropt.max_memory = estimate.peak_bytes - 1;
+    tatami_test::throws_error([&]() {
+        tatami_layered::read_layered_sparse_from_matrix_market_text_file(path.c_str(), ropt);
+    }, "exceeds 'max_memory'");
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    MemoryEstimate,
+    MemoryEstimateTest,
+    ::testing::Combine(
+        ::testing::Values(true, false), // row-major input or huge pages
+        ::testing::Values(1, 3)         // number of threads
+    )
+);
+
+TEST(MemoryEstimate, HugePages) {
+    tatami_layered::LayerComposition composition;
+    tatami_layered::ChunkComposition chunk;
+    chunk.value_bytes = 3000000;
+    chunk.code_bytes = 800;
+    tatami_layered::add_chunk(composition, chunk);
+
+    auto regular = tatami_layered::estimate_memory(composition, false, 100, 200, 150);
+    EXPECT_EQ(regular.final_bytes, 3000800);
+    EXPECT_EQ(regular.transient_bytes, 200);
+    EXPECT_EQ(regular.peak_bytes, 3001000);
+
+    auto huge = tatami_layered::estimate_memory(composition, true, 100, 200, 300);
+    EXPECT_EQ(huge.transient_bytes, 300);
+    EXPECT_EQ(huge.final_bytes, tatami_layered::LayerArena::allocated_size(3000000, true) + 800);
+#ifdef TATAMI_LAYERED_HAS_MADVISE
+    EXPECT_EQ(huge.final_bytes, 4194304 + 800);
+#endif
+}
+
+TEST(MemoryEstimate, ArenaBytes) {
+    size_t NR = 30, NC = 200;
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, mock_dictionary_data(NR, NC));
+
+    auto arena_bytes = [](const auto& chunk) -> size_t {
+        return std::static_pointer_cast<const tatami_layered::LayerArena>(chunk.storage)->size();
+    };
+
+    for (int threads : { 1, 3 }) {
+        tatami_layered::ConvertToLayeredSparseOptions copt;
+        copt.chunk_size = 64;
+        copt.num_threads = threads;
+        copt.dictionary = false;
+        auto composition = tatami_layered::scan_layered_sparse(ref, copt);
+        auto plain_estimate = tatami_layered::estimate_convert_to_layered_sparse(ref, composition, copt);
+
+        auto plain = tatami_layered::convert_to_layered_sparse(ref, copt);
+        const auto& plain_chunks = plain->get_chunks();
+        ASSERT_EQ(plain_chunks.size(), composition.chunks.size());
+        size_t allocated = 0;
+        for (size_t c = 0; c < plain_chunks.size(); ++c) {
+            EXPECT_EQ(arena_bytes(plain_chunks[c]), tatami_layered::LayerArena::allocated_size(tatami_layered::estimate_layer_bytes(composition.chunks[c]), false));
+            allocated += arena_bytes(plain_chunks[c]) + NR * sizeof(tatami_layered::RowCode);
+        }
+        EXPECT_EQ(plain_estimate.final_bytes, allocated);
+
+        // Re-encoding a copy of the chunks, to compare the arenas of the rebuilt chunks to the estimate.
+        auto chunks = plain_chunks;
+        const auto copies = tatami_layered::encode_dictionaries(chunks, false, threads);
+        EXPECT_GT(copies, 0);
+        EXPECT_LE(copies, tatami_layered::estimate_dictionary_pass(composition, false, threads));
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            EXPECT_LE(arena_bytes(chunks[c]), arena_bytes(plain_chunks[c]));
+        }
+        EXPECT_GT(chunks[0].stored8.num_rows, 0);
+
+        tatami_layered::Instrumentation instr;
+        copt.dictionary = true;
+        copt.instrumentation = &instr;
+        auto estimate = tatami_layered::estimate_convert_to_layered_sparse(ref, composition, copt);
+        auto coded = tatami_layered::convert_to_layered_sparse(ref, copt);
+        EXPECT_GE(instr.transient_bytes, copies);
+        EXPECT_GE(estimate.transient_bytes, instr.transient_bytes);
+        size_t coded_allocated = 0;
+        for (const auto& chunk : coded->get_chunks()) {
+            coded_allocated += arena_bytes(chunk) + NR * sizeof(tatami_layered::RowCode);
+        }
+        EXPECT_LT(coded_allocated, estimate.final_bytes);
+        EXPECT_EQ(estimate.final_bytes, plain_estimate.final_bytes);
+
+        // Enforcing the budget with the rebuild.
+        copt.instrumentation = NULL;
+        copt.max_memory = estimate.peak_bytes;
+        auto coded2 = tatami_layered::convert_to_layered_sparse(ref, copt);
+        tatami_test::test_simple_row_access(*coded2, ref);
+    }
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/save_layered_sparse.hpp"
+#include "tatami_layered/OutOfCoreLayeredSparseMatrix.hpp"
+
+#include "mock_layered_sparse_data.h"
+#include "test_oracular_access.h"
+#include "temp_file_path.h"
+
+class OutOfCoreLayeredSparseMatrixTest : public ::testing::TestWithParam<std::tuple<int, std::size_t> > {
+protected:
+    inline static std::shared_ptr<tatami::NumericMatrix> ref;
+    inline static std::string path;
+    inline static int last_NC = -1;
+
+    static void assemble(int NC) {
+        if (NC == last_NC) {
+            return;
+        }
+        last_NC = NC;
+
+        size_t NR = 120;
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+        typedef tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> SparseMat; 
+        ref.reset(new SparseMat(NR, NC, std::move(vals), std::move(rows), std::move(indptrs))); 
+
+        tatami_layered::ConvertToLayeredSparseOptions copt;
+        copt.chunk_size = 30;
+        auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(*ref, copt);
+        path = temp_file_path("tatami-layered-ooc");
+        tatami_layered::save_layered_sparse(*mat, path.c_str());
+    }
+};
+
+TEST_P(OutOfCoreLayeredSparseMatrixTest, Access) {
+    auto param = GetParam();
+    assemble(std::get<0>(param));
+
+    tatami_layered::OutOfCoreLayeredSparseMatrixOptions opt;
+    opt.cache_size = std::get<1>(param);
+    opt.access_pattern = tatami_layered::AccessPattern::SEQUENTIAL;
+    tatami_layered::OutOfCoreLayeredSparseMatrix<double, int, std::uint8_t> mat(path, opt);
+    EXPECT_EQ(mat.nrow(), ref->nrow());
+    EXPECT_EQ(mat.ncol(), ref->ncol());
+    EXPECT_EQ(mat.get_chunk_size(), 30);
+    if (opt.cache_size == 0) {
+        EXPECT_FALSE(mat.prefer_rows());
+    } else if (opt.cache_size > 1000000) {
+        EXPECT_TRUE(mat.prefer_rows());
+    }
+
+    tatami_test::test_simple_row_access(mat, *ref);
+    tatami_test::test_simple_column_access(mat, *ref);
+
+    // Oracles are used to load the next chunk in the background.
+    EXPECT_TRUE(mat.uses_oracle(false));
+    test_oracular_access(mat, *ref, true, std::get<0>(param));
+    test_oracular_access(mat, *ref, false, std::get<0>(param) + 1);
+
+    // Only one chunk is held by the cache if the budget is too small.
+    if (opt.cache_size == 0) {
+        auto ext = mat.dense_column();
+        std::vector<double> buffer(mat.nrow());
+        ext->fetch(0, buffer.data());
+        auto first = mat.cached_bytes();
+        EXPECT_GT(first, 0);
+        ext->fetch(mat.ncol() - 1, buffer.data());
+        auto last = mat.cached_bytes();
+        EXPECT_GT(last, 0);
+        EXPECT_LT(last, first * 2);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    OutOfCoreLayeredSparseMatrix,
+    OutOfCoreLayeredSparseMatrixTest,
+    ::testing::Combine(
+        ::testing::Values(50, 120), // number of columns
+        ::testing::Values(0, 5000, 100000000) // cache size
+    )
+);
+
+TEST(OutOfCoreLayeredSparseMatrix, Threaded) {
+    size_t NR = 100, NC = 200;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+    tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> ref(NR, NC, std::move(vals), std::move(rows), std::move(indptrs));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 20;
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, copt);
+    auto path = temp_file_path("tatami-layered-ooc");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+
+    tatami_layered::OutOfCoreLayeredSparseMatrixOptions opt;
+    opt.cache_size = 2000; // forcing lots of evictions.
+    tatami_layered::OutOfCoreLayeredSparseMatrix<double, int> ooc(path, opt);
+
+    std::vector<int> mismatches(4);
+    tatami::parallelize([&](int t, int start, int length) -> void {
+        auto oext = ooc.dense_column();
+        auto rext = ref.dense_column();
+        std::vector<double> obuffer(NR), rbuffer(NR);
+        for (int rep = 0; rep < 3; ++rep) {
+            for (int c = start; c < start + length; ++c) {
+                auto optr = oext->fetch(c, obuffer.data());
+                auto rptr = rext->fetch(c, rbuffer.data());
+                mismatches[t] += !std::equal(optr, optr + NR, rptr);
+            }
+        }
+    }, static_cast<int>(NC), 4);
+
+    for (auto m : mismatches) {
+        EXPECT_EQ(m, 0);
+    }
+}
+
+TEST(OutOfCoreLayeredSparseMatrix, Errors) {
+    tatami_layered::OutOfCoreLayeredSparseMatrixOptions opt;
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::OutOfCoreLayeredSparseMatrix<double, int> mat(temp_file_path("tatami-layered-ooc-missing"), opt);
+    }, "failed to open");
+}
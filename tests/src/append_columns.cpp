@@ -0,0 +1,267 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/append_columns.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+class AppendColumnsTest : public ::testing::TestWithParam<std::tuple<int, int, bool> > {
+protected:
+    static std::vector<double> create_dense(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        if (NC) {
+            mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        }
+        std::vector<double> full(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+        return full;
+    }
+
+    // Creates a matrix from columns [start, end) of a row-major array.
+    static std::shared_ptr<tatami::NumericMatrix> subset_columns(const std::vector<double>& full, size_t NR, size_t NC, size_t start, size_t end, bool sparse) {
+        const size_t width = end - start;
+        if (!sparse) {
+            std::vector<double> sub(NR * width);
+            for (size_t r = 0; r < NR; ++r) {
+                std::copy_n(full.begin() + r * NC + start, width, sub.begin() + r * width);
+            }
+            return std::make_shared<tatami::DenseRowMatrix<double, int> >(NR, width, std::move(sub));
+        }
+
+        std::vector<double> vals;
+        std::vector<int> idx;
+        std::vector<size_t> ptrs(1);
+        for (size_t r = 0; r < NR; ++r) {
+            for (size_t c = start; c < end; ++c) {
+                auto x = full[r * NC + c];
+                if (x) {
+                    vals.push_back(x);
+                    idx.push_back(c - start);
+                }
+            }
+            ptrs.push_back(vals.size());
+        }
+        return std::make_shared<tatami::CompressedSparseRowMatrix<double, int> >(NR, width, std::move(vals), std::move(idx), std::move(ptrs));
+    }
+};
+
+TEST_P(AppendColumnsTest, Basic) {
+    auto param = GetParam();
+    size_t NR = 80;
+    size_t NC_first = std::get<0>(param);
+    size_t NC_second = std::get<1>(param);
+    bool sparse = std::get<2>(param);
+
+    size_t NC = NC_first + NC_second;
+    auto full = create_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 30;
+    auto first = subset_columns(full, NR, NC, 0, NC_first, sparse);
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(*first, copt);
+
+    tatami_layered::AppendColumnsOptions aopt;
+    aopt.num_threads = 3;
+    auto second = subset_columns(full, NR, NC, NC_first, NC, sparse);
+    auto appended = tatami_layered::append_columns(*mat, *second, aopt);
+
+    EXPECT_EQ(appended->nrow(), NR);
+    EXPECT_EQ(appended->ncol(), NC);
+    EXPECT_EQ(appended->get_chunk_size(), 30);
+    EXPECT_EQ(appended->num_chunks(), std::max(static_cast<size_t>(1), (NC + 29) / 30));
+    if (NC) {
+        tatami_test::test_simple_row_access(*appended, ref);
+        tatami_test::test_simple_column_access(*appended, ref);
+    }
+
+    // Full chunks of the original matrix are shared.
+    const auto& old_chunks = mat->get_chunks();
+    const auto& new_chunks = appended->get_chunks();
+    for (size_t c = 0; c < NC_first / 30; ++c) {
+        EXPECT_EQ(old_chunks[c].storage.get(), new_chunks[c].storage.get());
+        EXPECT_EQ(old_chunks[c].codes.get(), new_chunks[c].codes.get());
+    }
+
+    // Same result as converting everything at once.
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(direct->get_chunks()[c].codes), *(new_chunks[c].codes));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    AppendColumns,
+    AppendColumnsTest,
+    ::testing::Combine(
+        ::testing::Values(0, 25, 60, 77), // number of existing columns, including exact multiples of the chunk size.
+        ::testing::Values(0, 3, 5, 50, 91), // number of new columns
+        ::testing::Values(false, true) // whether the new batch is sparse.
+    )
+);
+
+TEST(AppendColumns, Repeated) {
+    size_t NR = 50, NC = 200;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    std::vector<double> full(NR * NC);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        full[rows[i] * NC + cols[i]] = vals[i];
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    // Daily batches of varying sizes.
+    std::vector<size_t> boundaries { 0, 17, 18, 64, 130, 131, 200 };
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 16;
+    auto current = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(tatami::DenseRowMatrix<double, int>(NR, 0, std::vector<double>()), copt);
+
+    for (size_t b = 1; b < boundaries.size(); ++b) {
+        const size_t start = boundaries[b - 1], end = boundaries[b], width = end - start;
+        std::vector<double> sub(NR * width);
+        for (size_t r = 0; r < NR; ++r) {
+            std::copy_n(full.begin() + r * NC + start, width, sub.begin() + r * width);
+        }
+        current = tatami_layered::append_columns(*current, tatami::DenseRowMatrix<double, int>(NR, width, std::move(sub)), tatami_layered::AppendColumnsOptions());
+        EXPECT_EQ(current->ncol(), end);
+    }
+
+    tatami_test::test_simple_row_access(*current, ref);
+    tatami_test::test_simple_column_access(*current, ref);
+}
+
+TEST(AppendColumns, Dictionary) {
+    size_t NR = 30, NC = 128;
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.dictionary = true;
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    // Splitting in the middle of the second chunk, so that its dictionary-coded rows need to be re-encoded.
+    const size_t split = 100;
+    std::vector<double> first(NR * split), second(NR * (NC - split));
+    for (size_t r = 0; r < NR; ++r) {
+        std::copy_n(full.begin() + r * NC, split, first.begin() + r * split);
+        std::copy_n(full.begin() + r * NC + split, NC - split, second.begin() + r * (NC - split));
+    }
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(tatami::DenseRowMatrix<double, int>(NR, split, std::move(first)), copt);
+    tatami::DenseRowMatrix<double, int> batch(NR, NC - split, std::move(second));
+
+    tatami_layered::AppendColumnsOptions aopt;
+    aopt.dictionary = false;
+    auto decoded = tatami_layered::append_columns(*mat, batch, aopt);
+    tatami_test::test_simple_row_access(*decoded, ref);
+    EXPECT_EQ(decoded->get_chunks()[1].stored8.num_rows, 0);
+
+    aopt.dictionary = true;
+    aopt.num_threads = 2;
+    auto appended = tatami_layered::append_columns(*mat, batch, aopt);
+    tatami_test::test_simple_row_access(*appended, ref);
+    tatami_test::test_simple_column_access(*appended, ref);
+    EXPECT_GT(appended->get_chunks()[1].stored8.num_rows, 0);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(direct->get_chunks()[c].codes), *(appended->get_chunks()[c].codes));
+    }
+}
+
+TEST(AppendColumns, Outliers) {
+    size_t NR = 30, NC = 128;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    const size_t split = 100;
+    std::vector<double> first(NR * split), second(NR * (NC - split));
+    for (size_t r = 0; r < NR; ++r) {
+        std::copy_n(full.begin() + r * NC, split, first.begin() + r * split);
+        std::copy_n(full.begin() + r * NC + split, NC - split, second.begin() + r * (NC - split));
+    }
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(tatami::DenseRowMatrix<double, int>(NR, split, std::move(first)), copt);
+    tatami::DenseRowMatrix<double, int> batch(NR, NC - split, std::move(second));
+
+    tatami_layered::AppendColumnsOptions aopt;
+    aopt.outliers = false;
+    auto restored = tatami_layered::append_columns(*mat, batch, aopt);
+    tatami_test::test_simple_row_access(*restored, ref);
+    EXPECT_EQ(restored->get_chunks()[1].storee8.num_rows, 0);
+
+    aopt.outliers = true;
+    aopt.num_threads = 2;
+    auto appended = tatami_layered::append_columns(*mat, batch, aopt);
+    tatami_test::test_simple_row_access(*appended, ref);
+    tatami_test::test_simple_column_access(*appended, ref);
+    EXPECT_EQ(appended->get_chunks()[1].storee8.num_rows, direct->get_chunks()[1].storee8.num_rows);
+    EXPECT_GT(appended->get_chunks()[1].storee8.num_rows, 0);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(direct->get_chunks()[c].codes), *(appended->get_chunks()[c].codes));
+    }
+}
+
+TEST(AppendColumns, Tolerance) {
+    size_t NR = 4, NC_first = 10, NC_second = 6, NC = NC_first + NC_second;
+    std::vector<double> full(NR * NC);
+    for (size_t r = 0; r < NR; ++r) {
+        for (size_t c = 0; c < NC_first; ++c) {
+            full[r * NC + c] = static_cast<float>(0.1 * (r * NC + c + 1)); // exactly representable in single precision but not in half precision.
+        }
+        for (size_t c = NC_first; c < NC; ++c) {
+            full[r * NC + c] = 0.5 * (c + 1);
+        }
+    }
+
+    std::vector<double> first(NR * NC_first), second(NR * NC_second);
+    for (size_t r = 0; r < NR; ++r) {
+        std::copy_n(full.begin() + r * NC, NC_first, first.begin() + r * NC_first);
+        std::copy_n(full.begin() + r * NC + NC_first, NC_second, second.begin() + r * NC_second);
+    }
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 32;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(tatami::DenseRowMatrix<double, int>(NR, NC_first, std::move(first)), copt);
+    EXPECT_EQ(mat->get_chunks()[0].storef32.num_rows, NR);
+
+    // The tolerance only applies to the new batch, so the leftover values should still be stored in single precision.
+    tatami_layered::AppendColumnsOptions aopt;
+    aopt.tolerance = 1e-3;
+    auto appended = tatami_layered::append_columns(*mat, tatami::DenseRowMatrix<double, int>(NR, NC_second, std::move(second)), aopt);
+    EXPECT_EQ(appended->get_chunks()[0].storef32.num_rows, NR);
+    EXPECT_EQ(appended->get_chunks()[0].storef16.num_rows, 0);
+
+    auto ext = appended->dense_row();
+    std::vector<double> buffer(NC);
+    for (size_t r = 0; r < NR; ++r) {
+        auto ptr = ext->fetch(r, buffer.data());
+        for (size_t c = 0; c < NC_first; ++c) {
+            EXPECT_EQ(ptr[c], full[r * NC + c]);
+        }
+    }
+}
+
+TEST(AppendColumns, Errors) {
+    tatami::DenseRowMatrix<double, int> ref(10, 20, std::vector<double>(200, 1));
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, tatami_layered::ConvertToLayeredSparseOptions());
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::append_columns(*mat, tatami::DenseRowMatrix<double, int>(5, 20, std::vector<double>(100)), tatami_layered::AppendColumnsOptions());
+    }, "number of rows");
+
+    tatami_layered::FusedTransform transform;
+    transform.log1p = true;
+    auto fused = mat->fuse_transform(std::move(transform));
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::append_columns(*fused, ref, tatami_layered::AppendColumnsOptions());
+    }, "fused transformation");
+}
@@ -0,0 +1,331 @@
+#include <gtest/gtest.h>
+
+#include <numeric>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/bind.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+typedef tatami_layered::LayeredSparseMatrix<double, int, std::uint16_t> Layered;
+
+static std::vector<double> mock_dense(size_t NR, size_t NC) {
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    std::vector<double> full(NR * NC);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        full[rows[i] * NC + cols[i]] = vals[i];
+    }
+    return full;
+}
+
+static std::shared_ptr<const Layered> convert_submatrix(const std::vector<double>& full, size_t NC, size_t rstart, size_t rend, size_t cstart, size_t cend, int chunk_size, bool dictionary = false, bool outliers = false) {
+    const size_t width = cend - cstart;
+    std::vector<double> sub;
+    sub.reserve((rend - rstart) * width);
+    for (size_t r = rstart; r < rend; ++r) {
+        sub.insert(sub.end(), full.begin() + r * NC + cstart, full.begin() + r * NC + cend);
+    }
+    tatami::DenseRowMatrix<double, int> mat(rend - rstart, width, std::move(sub));
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = chunk_size;
+    copt.dictionary = dictionary;
+    copt.outliers = outliers;
+    return tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(mat, copt);
+}
+
+class CbindTest : public ::testing::TestWithParam<std::tuple<std::vector<int>, int, int> > {};
+
+TEST_P(CbindTest, Basic) {
+    auto param = GetParam();
+    const auto& widths = std::get<0>(param);
+    int chunk_size = std::get<1>(param);
+    int other_chunk_size = std::get<2>(param);
+
+    size_t NR = 70, NC = std::accumulate(widths.begin(), widths.end(), 0);
+    auto full = mock_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    std::vector<std::shared_ptr<const Layered> > mats;
+    size_t start = 0;
+    for (size_t i = 0; i < widths.size(); ++i) {
+        mats.push_back(convert_submatrix(full, NC, 0, NR, start, start + widths[i], (i ? other_chunk_size : chunk_size)));
+        start += widths[i];
+    }
+
+    tatami_layered::BindOptions bopt;
+    bopt.num_threads = 3;
+    auto combined = tatami_layered::cbind(mats, bopt);
+    EXPECT_EQ(combined->nrow(), NR);
+    EXPECT_EQ(combined->ncol(), NC);
+    EXPECT_EQ(combined->get_chunk_size(), chunk_size);
+    EXPECT_EQ(combined->num_chunks(), (NC + chunk_size - 1) / chunk_size);
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+
+    // Same layers as converting everything at once.
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = chunk_size;
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, copt);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(direct->get_chunks()[c].codes), *(combined->get_chunks()[c].codes));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Bind,
+    CbindTest,
+    ::testing::Combine(
+        ::testing::Values(
+            std::vector<int>{ 50 },
+            std::vector<int>{ 20, 20, 20 }, // aligned
+            std::vector<int>{ 20, 17, 33 }, // unaligned
+            std::vector<int>{ 7, 0, 45, 3 } // with an empty matrix
+        ),
+        ::testing::Values(10, 20),
+        ::testing::Values(10, 13)
+    )
+);
+
+TEST(Cbind, Sharing) {
+    size_t NR = 40, NC = 100;
+    auto full = mock_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    auto first = convert_submatrix(full, NC, 0, NR, 0, 40, 20);
+    auto second = convert_submatrix(full, NC, 0, NR, 40, 85, 20);
+    auto third = convert_submatrix(full, NC, 0, NR, 85, 100, 20);
+    auto combined = tatami_layered::cbind<double, int, std::uint16_t>({ first, second, third }, tatami_layered::BindOptions());
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+
+    // All chunks of 'first' and the first two chunks of 'second' are re-used.
+    const auto& chunks = combined->get_chunks();
+    ASSERT_EQ(chunks.size(), 5);
+    EXPECT_EQ(chunks[0].storage, first->get_chunks()[0].storage);
+    EXPECT_EQ(chunks[1].storage, first->get_chunks()[1].storage);
+    EXPECT_EQ(chunks[2].storage, second->get_chunks()[0].storage);
+    EXPECT_EQ(chunks[3].storage, second->get_chunks()[1].storage);
+    EXPECT_NE(chunks[4].storage, second->get_chunks()[2].storage);
+    EXPECT_NE(chunks[4].storage, third->get_chunks()[0].storage);
+}
+
+TEST(Cbind, FloatingPoint) {
+    size_t NR = 50, NC = 70;
+    auto full = mock_dense(NR, NC);
+    for (size_t r = 0; r < NR; r += 3) {
+        for (size_t c = r % 7; c < NC; c += 11) {
+            full[r * NC + c] = -0.25 * (c + 1);
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    auto first = convert_submatrix(full, NC, 0, NR, 0, 23, 10);
+    auto second = convert_submatrix(full, NC, 0, NR, 23, 70, 13);
+    auto combined = tatami_layered::cbind<double, int, std::uint16_t>({ first, second }, tatami_layered::BindOptions());
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+
+    // Partial segments of floating-point rows are re-categorized to give the same layers as a direct conversion.
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 10;
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, copt);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(direct->get_chunks()[c].codes), *(combined->get_chunks()[c].codes));
+    }
+}
+
+TEST(Cbind, Dictionary) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    // Aligned chunks are shared, including their dictionaries.
+    auto first = convert_submatrix(full, NC, 0, NR, 0, 128, 64, true);
+    auto second = convert_submatrix(full, NC, 0, NR, 128, 200, 64, true);
+    auto combined = tatami_layered::cbind<double, int, std::uint16_t>({ first, second }, tatami_layered::BindOptions());
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+    EXPECT_EQ(combined->get_chunks()[0].stored8.num_rows, 15);
+
+    // Otherwise, dictionary-coded rows are encoded again in the assembled chunks if requested.
+    auto left = convert_submatrix(full, NC, 0, NR, 0, 100, 64, true);
+    auto right = convert_submatrix(full, NC, 0, NR, 100, 200, 64, true);
+    auto direct = convert_submatrix(full, NC, 0, NR, 0, 200, 64, true);
+    tatami_layered::BindOptions bopt;
+    bopt.dictionary = true;
+    bopt.outliers = false;
+    bopt.num_threads = 2;
+    auto rebuilt = tatami_layered::cbind<double, int, std::uint16_t>({ left, right }, bopt);
+    tatami_test::test_simple_row_access(*rebuilt, ref);
+    tatami_test::test_simple_column_access(*rebuilt, ref);
+    EXPECT_GT(rebuilt->get_chunks()[1].stored8.num_rows, 0);
+    EXPECT_EQ(*(rebuilt->get_chunks()[1].codes), *(direct->get_chunks()[1].codes));
+
+    // Otherwise, they are decoded into their native layers.
+    bopt.dictionary = false;
+    auto decoded = tatami_layered::cbind<double, int, std::uint16_t>({ left, right }, bopt);
+    tatami_test::test_simple_row_access(*decoded, ref);
+    EXPECT_EQ(decoded->get_chunks()[1].stored8.num_rows, 0);
+    EXPECT_EQ(decoded->get_chunks()[1].store16.num_rows, 10);
+}
+
+TEST(Cbind, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    // Aligned chunks are shared, including their escapes.
+    auto first = convert_submatrix(full, NC, 0, NR, 0, 128, 64, false, true);
+    auto second = convert_submatrix(full, NC, 0, NR, 128, 200, 64, false, true);
+    auto combined = tatami_layered::cbind<double, int, std::uint16_t>({ first, second }, tatami_layered::BindOptions());
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+    EXPECT_EQ(combined->get_chunks()[0].storee8.num_rows, 18);
+
+    // Otherwise, rows with escapes are escaped again in the assembled chunks if requested.
+    auto left = convert_submatrix(full, NC, 0, NR, 0, 100, 64, false, true);
+    auto right = convert_submatrix(full, NC, 0, NR, 100, 200, 64, false, true);
+    auto direct = convert_submatrix(full, NC, 0, NR, 0, 200, 64, false, true);
+    tatami_layered::BindOptions bopt;
+    bopt.outliers = true;
+    bopt.num_threads = 2;
+    auto rebuilt = tatami_layered::cbind<double, int, std::uint16_t>({ left, right }, bopt);
+    tatami_test::test_simple_row_access(*rebuilt, ref);
+    tatami_test::test_simple_column_access(*rebuilt, ref);
+    EXPECT_GT(rebuilt->get_chunks()[1].storee8.num_rows, 0);
+    EXPECT_EQ(rebuilt->get_chunks()[1].storee8.num_escapes(), direct->get_chunks()[1].storee8.num_escapes());
+    EXPECT_EQ(*(rebuilt->get_chunks()[1].codes), *(direct->get_chunks()[1].codes));
+
+    // Otherwise, they are decoded into their native layers.
+    bopt.outliers = false;
+    auto decoded = tatami_layered::cbind<double, int, std::uint16_t>({ left, right }, bopt);
+    tatami_test::test_simple_row_access(*decoded, ref);
+    EXPECT_EQ(decoded->get_chunks()[1].storee8.num_rows, 0);
+    EXPECT_EQ(decoded->get_chunks()[1].store16.num_rows, 12);
+    EXPECT_EQ(decoded->get_chunks()[1].store32.num_rows, 6);
+}
+
+class RbindTest : public ::testing::TestWithParam<std::tuple<std::vector<int>, int> > {};
+
+TEST_P(RbindTest, Basic) {
+    auto param = GetParam();
+    const auto& heights = std::get<0>(param);
+    int chunk_size = std::get<1>(param);
+
+    size_t NR = std::accumulate(heights.begin(), heights.end(), 0), NC = 55;
+    auto full = mock_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    std::vector<std::shared_ptr<const Layered> > mats;
+    size_t start = 0;
+    for (auto h : heights) {
+        mats.push_back(convert_submatrix(full, NC, start, start + h, 0, NC, chunk_size));
+        start += h;
+    }
+
+    tatami_layered::BindOptions bopt;
+    bopt.num_threads = 2;
+    auto combined = tatami_layered::rbind(mats, bopt);
+    EXPECT_EQ(combined->nrow(), NR);
+    EXPECT_EQ(combined->ncol(), NC);
+    EXPECT_EQ(combined->get_chunk_size(), chunk_size);
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = chunk_size;
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, copt);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        const auto& dchunk = direct->get_chunks()[c];
+        const auto& cchunk = combined->get_chunks()[c];
+        EXPECT_EQ(dchunk.store8.num_rows + dchunk.store16.num_rows + dchunk.store32.num_rows + dchunk.store64.num_rows, NR);
+        EXPECT_EQ(dchunk.store8.num_rows, cchunk.store8.num_rows);
+        EXPECT_EQ(dchunk.store16.num_rows, cchunk.store16.num_rows);
+        EXPECT_EQ(dchunk.store32.num_rows, cchunk.store32.num_rows);
+        EXPECT_EQ(dchunk.store64.num_rows, cchunk.store64.num_rows);
+    }
+}
+
+TEST(Rbind, Dictionary) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    auto first = convert_submatrix(full, NC, 0, 13, 0, NC, 64, true);
+    auto second = convert_submatrix(full, NC, 13, NR, 0, NC, 64, true);
+    auto combined = tatami_layered::rbind<double, int, std::uint16_t>({ first, second }, tatami_layered::BindOptions());
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+
+    const auto& chunk = combined->get_chunks()[0];
+    EXPECT_EQ(chunk.stored8.num_rows, 15);
+    EXPECT_EQ(chunk.stored8.num_entries(), first->get_chunks()[0].stored8.num_entries() + second->get_chunks()[0].stored8.num_entries());
+}
+
+TEST(Rbind, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    auto first = convert_submatrix(full, NC, 0, 13, 0, NC, 64, false, true);
+    auto second = convert_submatrix(full, NC, 13, NR, 0, NC, 64, false, true);
+    auto combined = tatami_layered::rbind<double, int, std::uint16_t>({ first, second }, tatami_layered::BindOptions());
+    tatami_test::test_simple_row_access(*combined, ref);
+    tatami_test::test_simple_column_access(*combined, ref);
+
+    const auto& chunk = combined->get_chunks()[0];
+    EXPECT_EQ(chunk.storee8.num_rows, 18);
+    EXPECT_EQ(chunk.storee8.num_escapes(), 24);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Bind,
+    RbindTest,
+    ::testing::Combine(
+        ::testing::Values(
+            std::vector<int>{ 50 },
+            std::vector<int>{ 10, 20, 30 },
+            std::vector<int>{ 25, 0, 1, 40 }
+        ),
+        ::testing::Values(10, 16, 100)
+    )
+);
+
+TEST(Bind, Errors) {
+    tatami::DenseRowMatrix<double, int> ref(10, 20, std::vector<double>(200, 1));
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, tatami_layered::ConvertToLayeredSparseOptions());
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::cbind(std::vector<std::shared_ptr<const Layered> >(), tatami_layered::BindOptions());
+    }, "at least one");
+
+    tatami::DenseRowMatrix<double, int> other(5, 20, std::vector<double>(100, 1));
+    auto omat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(other, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::cbind<double, int, std::uint16_t>({ mat, omat }, tatami_layered::BindOptions());
+    }, "same number of rows");
+
+    tatami::DenseRowMatrix<double, int> other2(10, 5, std::vector<double>(50, 1));
+    auto omat2 = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(other2, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::rbind<double, int, std::uint16_t>({ mat, omat2 }, tatami_layered::BindOptions());
+    }, "same number of columns");
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 7;
+    auto rechunked = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, copt);
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::rbind<double, int, std::uint16_t>({ mat, rechunked }, tatami_layered::BindOptions());
+    }, "same chunk size");
+
+    tatami_layered::FusedTransform transform;
+    transform.log1p = true;
+    std::shared_ptr<const Layered> fused = mat->fuse_transform(std::move(transform));
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::cbind<double, int, std::uint16_t>({ mat, fused }, tatami_layered::BindOptions());
+    }, "fused transformation");
+}
@@ -6,6 +6,8 @@
 
 #include "mock_layered_sparse_data.h"
 
+#include <algorithm>
+
 typedef std::vector<int> IntVec;
 
 class ConvertToLayeredSparseTest : public ::testing::TestWithParam<std::tuple<int, int, IntVec, IntVec, IntVec> > {
@@ -70,6 +72,13 @@ TEST_P(ConvertToLayeredSparseTest, FromDenseColumn) {
 
     tatami_test::test_simple_row_access(*out, *ref);
     tatami_test::test_simple_column_access(*out, *ref);
+
+    // Each thread only extracts its own range of rows from each column.
+    tatami_layered::ConvertToLayeredSparseOptions opt;
+    opt.num_threads = 3;
+    auto par = tatami_layered::convert_to_layered_sparse(*ref, opt);
+    tatami_test::test_simple_row_access(*par, *ref);
+    tatami_test::test_simple_column_access(*par, *ref);
 }
 
 TEST_P(ConvertToLayeredSparseTest, FromDenseRow) {
@@ -222,6 +231,29 @@ TEST_P(ConvertToLayeredSparseHardTest, Chunk8) {
     }
 }
 
+TEST_P(ConvertToLayeredSparseHardTest, HugePages) {
+    auto param = GetParam();
+    size_t NR = std::get<0>(param);
+    size_t NC = 1000;
+    auto nthreads = std::get<1>(param);
+
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+
+    auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+    typedef tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> SparseMat; 
+    auto ref = std::shared_ptr<tatami::NumericMatrix>(new SparseMat(NR, NC, std::move(vals), std::move(rows), std::move(indptrs))); 
+
+    tatami_layered::ConvertToLayeredSparseOptions opt;
+    opt.num_threads = nthreads;
+    opt.huge_pages = true;
+    auto out = tatami_layered::convert_to_layered_sparse(*ref, opt);
+
+    tatami_test::test_simple_row_access(*out, *ref);
+    tatami_test::test_simple_column_access(*out, *ref);
+}
+
 INSTANTIATE_TEST_SUITE_P(
     ConvertToLayeredSparseHard,
     ConvertToLayeredSparseHardTest,
@@ -230,3 +262,371 @@ INSTANTIATE_TEST_SUITE_P(
         ::testing::Values(1, 3)          // number of threads
     )
 );
+
+TEST(ConvertToLayeredSparse, Instrumentation) {
+    size_t NR = 500, NC = 300;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    const std::size_t nnz = vals.size() - std::count(vals.begin(), vals.end(), 0); // explicit zeros are dropped.
+
+    auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+    typedef tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> SparseMat; 
+    auto ref = std::shared_ptr<tatami::NumericMatrix>(new SparseMat(NR, NC, std::move(vals), std::move(rows), std::move(indptrs))); 
+    auto ref_row = tatami::convert_to_compressed_sparse<double, int>(*ref, true, tatami::ConvertToCompressedSparseOptions());
+
+    for (auto row : { true, false }) {
+        tatami_layered::Instrumentation instr;
+        tatami_layered::ConvertToLayeredSparseOptions opt;
+        opt.chunk_size = 64;
+        opt.num_threads = 2;
+        opt.instrumentation = &instr;
+
+        const auto& input = (row ? *ref_row : *ref);
+        auto out = tatami_layered::convert_to_layered_sparse(input, opt);
+        tatami_test::test_simple_row_access(*out, *ref);
+
+        EXPECT_EQ(instr.num_nonzero, nnz);
+        EXPECT_GT(instr.layer_bytes, nnz);
+        EXPECT_GT(instr.transient_bytes, 0);
+        EXPECT_EQ(instr.bytes_read, 0);
+        EXPECT_GE(instr.scan_seconds, 0);
+        EXPECT_GE(instr.allocate_seconds, 0);
+        EXPECT_GE(instr.fill_seconds, 0);
+        EXPECT_GE(instr.consolidate_seconds, 0);
+
+        // Accumulates across calls.
+        auto previous = instr.num_nonzero;
+        tatami_layered::convert_to_layered_sparse(input, opt);
+        EXPECT_EQ(instr.num_nonzero, previous * 2);
+    }
+}
+
+TEST(ConvertToLayeredSparse, SixtyFourBit) {
+    size_t NR = 4, NC = 6;
+    std::vector<double> full {
+        1, 0, 200, 0, 0, 3,
+        0, 5000000000, 0, 7, 0, 1,
+        70000, 0, 0, 0, 1000000000000000, 0,
+        0, 300, 0, 0, 2, 0
+    };
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    for (auto row : { true, false }) {
+        tatami_layered::ConvertToLayeredSparseOptions opt;
+        opt.chunk_size = 3;
+        std::shared_ptr<tatami::NumericMatrix> input;
+        if (row) {
+            input.reset(new tatami::DenseRowMatrix<double, int>(NR, NC, full));
+        } else {
+            input = tatami::convert_to_compressed_sparse<double, int>(ref, false, tatami::ConvertToCompressedSparseOptions());
+        }
+
+        auto out = tatami_layered::convert_to_layered_sparse(*input, opt);
+        tatami_test::test_simple_row_access(*out, ref);
+        tatami_test::test_simple_column_access(*out, ref);
+
+        // Only the rows with large values are promoted, and only in the chunks where those values occur.
+        const auto& chunks = out->get_chunks();
+        EXPECT_EQ(chunks[0].store64.num_rows, 1);
+        EXPECT_EQ(chunks[0].store8.num_rows, 1);
+        EXPECT_EQ(chunks[0].store16.num_rows, 1);
+        EXPECT_EQ(chunks[0].store32.num_rows, 1);
+        EXPECT_EQ(chunks[1].store64.num_rows, 1);
+        EXPECT_EQ(chunks[1].store8.num_rows, 3);
+    }
+}
+
+TEST(ConvertToLayeredSparse, FloatingPoint) {
+    size_t NR = 5, NC = 6;
+    std::vector<double> full {
+        1, 0, 200, 0, 0, 3,
+        0, 0.5, 0, -7, 0, 1,
+        0.1, 0, 0, 0, 2.25, 0,
+        0, 300, -0.1, 0, 2, 0,
+        1e-3, 0, 1e30, 4, 0, 0
+    };
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    for (auto row : { true, false }) {
+        std::shared_ptr<tatami::NumericMatrix> input;
+        if (row) {
+            input.reset(new tatami::DenseRowMatrix<double, int>(NR, NC, full));
+        } else {
+            input = tatami::convert_to_compressed_sparse<double, int>(ref, false, tatami::ConvertToCompressedSparseOptions());
+        }
+
+        // By default, all values are stored exactly.
+        tatami_layered::ConvertToLayeredSparseOptions opt;
+        opt.chunk_size = 3;
+        opt.num_threads = 2;
+        auto out = tatami_layered::convert_to_layered_sparse(*input, opt);
+        tatami_test::test_simple_row_access(*out, ref);
+        tatami_test::test_simple_column_access(*out, ref);
+
+        const auto& chunks = out->get_chunks();
+        EXPECT_EQ(chunks[0].store8.num_rows, 1);
+        EXPECT_EQ(chunks[0].storef16.num_rows, 1); // 0.5 is exact in half precision.
+        EXPECT_EQ(chunks[0].storef32.num_rows, 0);
+        EXPECT_EQ(chunks[0].storef64.num_rows, 3); // 0.1, -0.1 and 1e-3 are not exact in narrower types.
+        EXPECT_EQ(chunks[1].store8.num_rows, 3);
+        EXPECT_EQ(chunks[1].storef16.num_rows, 1); // 2.25 is exact in half precision.
+        EXPECT_EQ(chunks[1].storei8.num_rows, 1); // -7 and 1 are integers.
+        EXPECT_EQ(chunks[1].store8.num_rows + chunks[1].storef16.num_rows + chunks[1].storei8.num_rows, NR);
+
+        // Loosening the tolerance allows for narrower types.
+        opt.tolerance = 1e-3;
+        auto lossy = tatami_layered::convert_to_layered_sparse(*input, opt);
+        const auto& lchunks = lossy->get_chunks();
+        EXPECT_EQ(lchunks[0].storef16.num_rows, 3); // integers up to 2^11 (e.g., 300) are exact in half precision.
+        EXPECT_EQ(lchunks[0].storef32.num_rows, 1); // 1e30 is too large for half precision.
+        EXPECT_EQ(lchunks[0].storef64.num_rows, 0);
+
+        auto lext = lossy->dense_row();
+        std::vector<double> buffer(NC);
+        for (size_t r = 0; r < NR; ++r) {
+            auto ptr = lext->fetch(r, buffer.data());
+            for (size_t c = 0; c < NC; ++c) {
+                const double expected = full[r * NC + c];
+                EXPECT_LE(std::abs(ptr[c] - expected), std::abs(expected) * 1e-3);
+            }
+        }
+    }
+}
+
+TEST(ConvertToLayeredSparse, MixedIntegerFloat) {
+    // Integers are promoted to the floating-point type that can hold them exactly, i.e., up to 2^11 for half precision and 2^24 for single precision.
+    size_t NR = 3, NC = 4;
+    std::vector<double> full {
+        0.5, 200, 0, -1000,
+        3000, 0.5, 0, 0,
+        0.25, 0, 20000000, 0
+    };
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions opt;
+    auto out = tatami_layered::convert_to_layered_sparse(ref, opt);
+    tatami_test::test_simple_row_access(*out, ref);
+
+    const auto& chunk = out->get_chunks()[0];
+    EXPECT_EQ(chunk.storef16.num_rows, 1);
+    EXPECT_EQ(chunk.storef32.num_rows, 1);
+    EXPECT_EQ(chunk.storef64.num_rows, 1);
+}
+
+TEST(ConvertToLayeredSparse, UnsignedInput) {
+    // Unsigned integer inputs take a different path in the first pass.
+    size_t NR = 3, NC = 5;
+    std::vector<std::uint32_t> full {
+        0, 200, 0, 1000, 0,
+        5, 0, 100000, 0, 255,
+        0, 0, 0, 0, 70000
+    };
+    std::vector<double> dfull(full.begin(), full.end());
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, dfull);
+
+    std::vector<std::uint32_t> tfull(NR * NC);
+    for (size_t r = 0; r < NR; ++r) {
+        for (size_t c = 0; c < NC; ++c) {
+            tfull[c * NR + r] = full[r * NC + c];
+        }
+    }
+
+    for (auto row : { true, false }) {
+        tatami::DenseMatrix<std::uint32_t, int, std::vector<std::uint32_t> > input(NR, NC, (row ? full : tfull), row);
+        tatami_layered::ConvertToLayeredSparseOptions opt;
+        opt.chunk_size = 2;
+        auto out = tatami_layered::convert_to_layered_sparse(input, opt);
+        tatami_test::test_simple_row_access(*out, ref);
+
+        const auto& chunks = out->get_chunks();
+        EXPECT_EQ(chunks[0].store8.num_rows, 3);
+        EXPECT_EQ(chunks[1].store8.num_rows, 1);
+        EXPECT_EQ(chunks[1].store16.num_rows, 1);
+        EXPECT_EQ(chunks[1].store32.num_rows, 1);
+        EXPECT_EQ(chunks[2].store8.num_rows, 2);
+        EXPECT_EQ(chunks[2].store32.num_rows, 1);
+    }
+}
+
+TEST(ConvertToLayeredSparse, ThreadIndependent) {
+    // The layer should not depend on how the columns are split across threads.
+    size_t NR = 2, NC = 3;
+    std::vector<double> full {
+        -5, 200, 0.5,
+        0.5, 3000, -5
+    };
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+    auto input = tatami::convert_to_compressed_sparse<double, int>(ref, false, tatami::ConvertToCompressedSparseOptions());
+
+    for (int threads : { 1, 2, 3 }) {
+        tatami_layered::ConvertToLayeredSparseOptions opt;
+        opt.num_threads = threads;
+        auto out = tatami_layered::convert_to_layered_sparse(*input, opt);
+        tatami_test::test_simple_row_access(*out, ref);
+
+        const auto& chunk = out->get_chunks()[0];
+        EXPECT_EQ(chunk.storef16.num_rows, 1);
+        EXPECT_EQ(chunk.storef32.num_rows, 1);
+    }
+}
+
+TEST(ConvertToLayeredSparse, SignedInteger) {
+    // Rows with negative integers are stored in the smallest signed type that holds both their minimum and maximum.
+    size_t NR = 4, NC = 6;
+    std::vector<double> full {
+        -5, 0, 5, 100, 0, 0,
+        -5, 200, 0, 0, -1000, 0,
+        0, -5, 40000, 0, 0, -100000,
+        -5, 0, 3000000000, 1, -1, 0.5
+    };
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    for (auto row : { true, false }) {
+        std::shared_ptr<tatami::NumericMatrix> input;
+        if (row) {
+            input.reset(new tatami::DenseRowMatrix<double, int>(NR, NC, full));
+        } else {
+            input = tatami::convert_to_compressed_sparse<double, int>(ref, false, tatami::ConvertToCompressedSparseOptions());
+        }
+
+        for (int threads : { 1, 3 }) {
+            tatami_layered::ConvertToLayeredSparseOptions opt;
+            opt.chunk_size = 3;
+            opt.num_threads = threads;
+            auto out = tatami_layered::convert_to_layered_sparse(*input, opt);
+            tatami_test::test_simple_row_access(*out, ref);
+            tatami_test::test_simple_column_access(*out, ref);
+
+            const auto& chunks = out->get_chunks();
+            EXPECT_EQ(chunks[0].storei8.num_rows, 1);
+            EXPECT_EQ(chunks[0].storei8.value[0], -5);
+            EXPECT_EQ(chunks[0].storei8.value[1], 5);
+            EXPECT_EQ(chunks[0].storei16.num_rows, 1);
+            EXPECT_EQ(chunks[0].storei32.num_rows, 1);
+            EXPECT_EQ(chunks[0].storef64.num_rows, 1); // 3000000000 is too large for a 32-bit signed integer.
+
+            EXPECT_EQ(chunks[1].store8.num_rows, 1);
+            EXPECT_EQ(chunks[1].storei16.num_rows, 1);
+            EXPECT_EQ(chunks[1].storei32.num_rows, 1);
+            EXPECT_EQ(chunks[1].storef16.num_rows, 1);
+        }
+    }
+}
+
+TEST(ConvertToLayeredSparse, Dictionary) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    for (auto row : { true, false }) {
+        std::shared_ptr<tatami::NumericMatrix> input;
+        if (row) {
+            input.reset(new tatami::DenseRowMatrix<double, int>(NR, NC, full));
+        } else {
+            input = tatami::convert_to_compressed_sparse<double, int>(ref, false, tatami::ConvertToCompressedSparseOptions());
+        }
+
+        for (int threads : { 1, 3 }) {
+            tatami_layered::Instrumentation instr;
+            tatami_layered::ConvertToLayeredSparseOptions opt;
+            opt.chunk_size = 64;
+            opt.num_threads = threads;
+            opt.dictionary = true;
+            opt.instrumentation = &instr;
+            auto out = tatami_layered::convert_to_layered_sparse(*input, opt);
+            tatami_test::test_simple_row_access(*out, ref);
+            tatami_test::test_simple_column_access(*out, ref);
+
+            const auto& chunk = out->get_chunks()[0];
+            EXPECT_EQ(chunk.stored8.num_rows, 15);
+            EXPECT_EQ(chunk.stored8.num_entries(), 50); // 4 distinct values for rows 0 and 1, 2 for row 3.
+            EXPECT_EQ(chunk.store8.num_rows, 5);
+            EXPECT_EQ(chunk.store16.num_rows, 5);
+            EXPECT_EQ(chunk.store32.num_rows, 5);
+            EXPECT_EQ(chunk.storef16.num_rows, 0);
+            EXPECT_EQ(chunk.storei32.num_rows, 0);
+            EXPECT_EQ(tatami_layered::row_code_category((*(chunk.codes))[0]), tatami_layered::Category::D8);
+            EXPECT_EQ(tatami_layered::row_code_category((*(chunk.codes))[2]), tatami_layered::Category::U16);
+
+            // The last chunk only has 8 columns, so none of its rows are worth encoding.
+            EXPECT_EQ(out->get_chunks().back().stored8.num_rows, 0);
+            EXPECT_GE(instr.encode_seconds, 0);
+
+            tatami_layered::Instrumentation plain_instr;
+            opt.dictionary = false;
+            opt.instrumentation = &plain_instr;
+            auto plain = tatami_layered::convert_to_layered_sparse(*input, opt);
+            EXPECT_EQ(plain->get_chunks()[0].stored8.num_rows, 0);
+            EXPECT_EQ(plain_instr.encode_seconds, 0);
+            EXPECT_EQ(plain_instr.num_nonzero, instr.num_nonzero);
+            EXPECT_LT(instr.layer_bytes, plain_instr.layer_bytes);
+        }
+    }
+}
+
+TEST(ConvertToLayeredSparse, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    for (auto row : { true, false }) {
+        std::shared_ptr<tatami::NumericMatrix> input;
+        if (row) {
+            input.reset(new tatami::DenseRowMatrix<double, int>(NR, NC, full));
+        } else {
+            input = tatami::convert_to_compressed_sparse<double, int>(ref, false, tatami::ConvertToCompressedSparseOptions());
+        }
+
+        for (int threads : { 1, 3 }) {
+            tatami_layered::Instrumentation instr;
+            tatami_layered::ConvertToLayeredSparseOptions opt;
+            opt.chunk_size = 64;
+            opt.num_threads = threads;
+            opt.dictionary = false;
+            opt.outliers = true;
+            opt.instrumentation = &instr;
+            auto out = tatami_layered::convert_to_layered_sparse(*input, opt);
+            tatami_test::test_simple_row_access(*out, ref);
+            tatami_test::test_simple_column_access(*out, ref);
+
+            const auto& chunk = out->get_chunks()[0];
+            EXPECT_EQ(chunk.storee8.num_rows, 18);
+            EXPECT_EQ(chunk.storee8.num_escapes(), 24); // 1 outlier for rows 0 and 4, 2 for row 1.
+            EXPECT_EQ(chunk.store8.num_rows, 6);
+            EXPECT_EQ(chunk.store16.num_rows, 6);
+            EXPECT_EQ(chunk.store32.num_rows, 0);
+            EXPECT_EQ(chunk.store64.num_rows, 0);
+            EXPECT_EQ(tatami_layered::row_code_category((*(chunk.codes))[4]), tatami_layered::Category::E8);
+            EXPECT_EQ(tatami_layered::row_code_category((*(chunk.codes))[3]), tatami_layered::Category::U16);
+
+            const auto& second = out->get_chunks()[1];
+            EXPECT_EQ(second.storee8.num_rows, 12);
+            EXPECT_EQ(second.storee8.num_escapes(), 24);
+
+            // The last chunk has no outliers at all.
+            EXPECT_EQ(out->get_chunks().back().storee8.num_rows, 0);
+            EXPECT_GE(instr.encode_seconds, 0);
+
+            tatami_layered::Instrumentation plain_instr;
+            opt.outliers = false;
+            opt.instrumentation = &plain_instr;
+            auto plain = tatami_layered::convert_to_layered_sparse(*input, opt);
+            EXPECT_EQ(plain->get_chunks()[0].storee8.num_rows, 0);
+            EXPECT_EQ(plain_instr.encode_seconds, 0);
+            EXPECT_EQ(plain_instr.num_nonzero, instr.num_nonzero);
+            EXPECT_LT(instr.layer_bytes, plain_instr.layer_bytes);
+
+            // Escapes are chosen in the first pass, so dictionary coding only considers the remaining rows.
+            opt.outliers = true;
+            opt.dictionary = true;
+            opt.instrumentation = NULL;
+            auto both = tatami_layered::convert_to_layered_sparse(*input, opt);
+            tatami_test::test_simple_row_access(*both, ref);
+            const auto& bchunk = both->get_chunks()[0];
+            EXPECT_EQ(bchunk.stored8.num_rows, 0);
+            EXPECT_EQ(bchunk.storee8.num_rows, 18);
+            EXPECT_EQ(bchunk.storee8.num_escapes(), 24);
+        }
+    }
+}
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/describe_layered_sparse.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+#include <unordered_set>
+
+class DescribeLayeredSparseTest : public ::testing::TestWithParam<int> {
+protected:
+    inline static size_t NR = 80, NC = 250;
+    inline static std::vector<double> full;
+    inline static std::shared_ptr<tatami::NumericMatrix> ref_row, ref_column;
+
+    static void SetUpTestSuite() {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        full.resize(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+        ref_row.reset(new tatami::DenseRowMatrix<double, int>(NR, NC, full));
+        std::vector<double> transposed(NR * NC);
+        for (size_t r = 0; r < NR; ++r) {
+            for (size_t c = 0; c < NC; ++c) {
+                transposed[c * NR + r] = full[r * NC + c];
+            }
+        }
+        ref_column.reset(new tatami::DenseColumnMatrix<double, int>(NR, NC, std::move(transposed)));
+    }
+};
+
+TEST_P(DescribeLayeredSparseTest, Basic) {
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = GetParam();
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(*ref_row, copt);
+    auto described = tatami_layered::describe_layered_sparse(*mat);
+    ASSERT_EQ(described.chunks.size(), mat->num_chunks());
+
+    // Computing the expected counts by hand.
+    const size_t chunk_size = copt.chunk_size;
+    std::array<size_t, tatami_layered::num_categories> expected_rows{}, expected_nonzero{};
+    size_t total_nnz = 0;
+    for (size_t c = 0; c < described.chunks.size(); ++c) {
+        std::array<size_t, tatami_layered::num_categories> chunk_rows{}, chunk_nonzero{};
+        for (size_t r = 0; r < NR; ++r) {
+            double maxed = 0;
+            size_t num = 0;
+            for (size_t j = c * chunk_size, end = std::min(NC, (c + 1) * chunk_size); j < end; ++j) {
+                const auto val = full[r * NC + j];
+                maxed = std::max(maxed, val);
+                num += (val != 0);
+            }
+            const auto cat = static_cast<int>(tatami_layered::categorize(maxed));
+            ++chunk_rows[cat];
+            chunk_nonzero[cat] += num;
+            total_nnz += num;
+        }
+
+        const auto& current = described.chunks[c];
+        EXPECT_EQ(current.num_rows, chunk_rows);
+        EXPECT_EQ(current.num_nonzero, chunk_nonzero);
+        EXPECT_EQ(current.value_bytes, chunk_nonzero[0] + chunk_nonzero[1] * 2 + chunk_nonzero[2] * 4 + chunk_nonzero[3] * 8);
+        EXPECT_EQ(current.index_bytes, (chunk_nonzero[0] + chunk_nonzero[1] + chunk_nonzero[2] + chunk_nonzero[3]) * sizeof(std::uint16_t));
+        EXPECT_EQ(current.pointer_bytes, (NR + tatami_layered::num_categories + 2) * sizeof(std::size_t)); // plus the dictionary table and escape pointers.
+        EXPECT_LT(current.padding_bytes, 64 * (3 * tatami_layered::num_categories + 5));
+        EXPECT_EQ(current.num_entries, 0);
+        EXPECT_EQ(current.num_escapes, 0);
+
+        for (size_t i = 0; i < tatami_layered::num_categories; ++i) {
+            expected_rows[i] += chunk_rows[i];
+            expected_nonzero[i] += chunk_nonzero[i];
+        }
+    }
+
+    EXPECT_EQ(described.num_rows, expected_rows);
+    EXPECT_EQ(described.num_nonzero, expected_nonzero);
+    EXPECT_EQ(described.csr_bytes, total_nnz * (sizeof(double) + sizeof(int)) + (NR + 1) * sizeof(std::size_t));
+
+    // Shared codes are only counted once.
+    std::unordered_set<const void*> unique_codes;
+    size_t total = 0;
+    for (size_t c = 0; c < described.chunks.size(); ++c) {
+        unique_codes.insert(mat->get_chunks()[c].codes.get());
+        total += described.chunks[c].memory_usage();
+    }
+    EXPECT_EQ(described.code_bytes, unique_codes.size() * NR * sizeof(tatami_layered::RowCode));
+    EXPECT_EQ(described.memory_usage(), total);
+    EXPECT_EQ(
+        described.memory_usage(),
+        described.value_bytes + described.index_bytes + described.pointer_bytes + described.code_bytes + described.padding_bytes
+    );
+}
+
+TEST_P(DescribeLayeredSparseTest, Scan) {
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = GetParam();
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(*ref_row, copt);
+    auto described = tatami_layered::describe_layered_sparse(*mat);
+
+    for (auto row : { true, false }) {
+        for (int threads : { 1, 3 }) {
+            copt.num_threads = threads;
+            auto scanned = tatami_layered::scan_layered_sparse<double, int, std::uint8_t>(row ? *ref_row : *ref_column, copt);
+            ASSERT_EQ(scanned.chunks.size(), described.chunks.size());
+            for (size_t c = 0; c < scanned.chunks.size(); ++c) {
+                const auto& left = scanned.chunks[c];
+                const auto& right = described.chunks[c];
+                EXPECT_EQ(left.num_rows, right.num_rows);
+                EXPECT_EQ(left.num_nonzero, right.num_nonzero);
+                EXPECT_EQ(left.value_bytes, right.value_bytes);
+                EXPECT_EQ(left.index_bytes, right.index_bytes);
+                EXPECT_EQ(left.pointer_bytes, right.pointer_bytes);
+                EXPECT_EQ(left.padding_bytes, right.padding_bytes);
+                EXPECT_EQ(left.code_bytes, NR * sizeof(tatami_layered::RowCode)); // no sharing is assumed.
+            }
+
+            EXPECT_EQ(scanned.csr_bytes, described.csr_bytes);
+            EXPECT_GE(scanned.memory_usage(), described.memory_usage());
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    DescribeLayeredSparse,
+    DescribeLayeredSparseTest,
+    ::testing::Values(7, 50, 256)  // chunk size
+);
+
+TEST(DescribeLayeredSparse, SharedCodes) {
+    // All chunks have the same layer assignments, so the codes are shared.
+    size_t NR = 10, NC = 40;
+    std::vector<double> full(NR * NC);
+    for (size_t r = 0; r < NR; ++r) {
+        for (size_t c = 0; c < NC; c += 2) {
+            full[r * NC + c] = (r % 2 ? 1000 : 1);
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, std::move(full));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 10;
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, copt);
+    auto described = tatami_layered::describe_layered_sparse(*mat);
+    ASSERT_EQ(described.chunks.size(), 4);
+    EXPECT_EQ(described.chunks[0].code_bytes, NR * sizeof(tatami_layered::RowCode));
+    for (size_t c = 1; c < 4; ++c) {
+        EXPECT_EQ(described.chunks[c].code_bytes, 0);
+    }
+    EXPECT_EQ(described.code_bytes, NR * sizeof(tatami_layered::RowCode));
+    EXPECT_EQ(described.num_rows[static_cast<int>(tatami_layered::Category::U8)], 20);
+    EXPECT_EQ(described.num_rows[static_cast<int>(tatami_layered::Category::U16)], 20);
+    EXPECT_EQ(described.num_nonzero[static_cast<int>(tatami_layered::Category::U16)], 100);
+
+    auto scanned = tatami_layered::scan_layered_sparse(ref, copt);
+    EXPECT_EQ(scanned.code_bytes, 4 * NR * sizeof(tatami_layered::RowCode));
+}
+
+TEST(DescribeLayeredSparse, Outliers) {
+    size_t NR = 30, NC = 200;
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, mock_outlier_data(NR, NC));
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    auto described = tatami_layered::describe_layered_sparse(*mat);
+
+    const auto& first = described.chunks[0];
+    EXPECT_EQ(first.num_rows[static_cast<int>(tatami_layered::Category::E8)], 18);
+    EXPECT_EQ(first.num_escapes, 24);
+    EXPECT_EQ(described.num_escapes, 24 + 24 + 12);
+
+    // The escaped rows are chosen in the first pass, so the scan predicts them exactly.
+    auto scanned = tatami_layered::scan_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    EXPECT_EQ(scanned.num_rows, described.num_rows);
+    EXPECT_EQ(scanned.num_escapes, described.num_escapes);
+    EXPECT_EQ(scanned.value_bytes, described.value_bytes);
+    EXPECT_EQ(scanned.index_bytes, described.index_bytes);
+
+    // Each escape is stored as its column index and a 64-bit value.
+    size_t nnz = 0;
+    for (auto n : first.num_nonzero) {
+        nnz += n;
+    }
+    EXPECT_EQ(first.index_bytes, nnz + first.num_escapes);
+    EXPECT_EQ(first.pointer_bytes, (NR + 18 + tatami_layered::num_categories + 2) * sizeof(std::size_t)); // plus an escape pointer for each row in the escaped layer.
+
+    tatami_layered::Instrumentation instr;
+    copt.instrumentation = &instr;
+    tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    EXPECT_EQ(described.memory_usage() - described.code_bytes, instr.layer_bytes - mat->num_chunks() * NR * sizeof(tatami_layered::RowCode));
+}
@@ -0,0 +1,358 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/extract_rows.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+#include <random>
+
+class ExtractRowsTest : public ::testing::TestWithParam<std::tuple<int, std::pair<double, double>, int> > {
+protected:
+    static std::shared_ptr<tatami::NumericMatrix> create_reference(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+        typedef tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> SparseMat; 
+        return std::shared_ptr<tatami::NumericMatrix>(new SparseMat(NR, NC, std::move(vals), std::move(rows), std::move(indptrs))); 
+    }
+
+    static std::vector<double> create_dense(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        std::vector<double> full(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+        return full;
+    }
+
+    static std::vector<int> choose_rows(int NR) {
+        std::mt19937_64 rng(NR);
+        std::vector<int> output;
+        for (int i = 0; i < 50; ++i) {
+            output.push_back(rng() % NR); // unsorted and with duplicates.
+        }
+        return output;
+    }
+
+    static void compare(
+        const tatami::NumericMatrix& mat,
+        const tatami::NumericMatrix& ref,
+        const std::vector<int>& rows,
+        int column_start,
+        int column_length,
+        const tatami_layered::ExtractRowsOptions& opt)
+    {
+        auto layered = dynamic_cast<const tatami_layered::LayeredSparseMatrix<double, int, std::uint8_t>*>(&mat);
+        ASSERT_TRUE(layered != NULL);
+
+        std::vector<double> dense(rows.size() * column_length);
+        tatami_layered::extract_dense_rows(*layered, rows, column_start, column_length, dense.data(), opt);
+        tatami_layered::ExtractedSparseRows<double, int> sparse;
+        tatami_layered::extract_sparse_rows(*layered, rows, column_start, column_length, sparse, opt);
+        ASSERT_EQ(sparse.pointers.size(), rows.size() + 1);
+
+        auto dext = ref.dense_row(column_start, column_length);
+        auto sext = ref.sparse_row(column_start, column_length);
+        std::vector<double> dbuffer(column_length), vbuffer(column_length);
+        std::vector<int> ibuffer(column_length);
+
+        for (size_t k = 0; k < rows.size(); ++k) {
+            auto dptr = dext->fetch(rows[k], dbuffer.data());
+            EXPECT_EQ(std::vector<double>(dptr, dptr + column_length), std::vector<double>(dense.begin() + k * column_length, dense.begin() + (k + 1) * column_length));
+
+            // The reference may contain explicit zeros, which are not stored in the layered matrix.
+            auto range = sext->fetch(rows[k], vbuffer.data(), ibuffer.data());
+            std::vector<double> expected_values;
+            std::vector<int> expected_indices;
+            for (int i = 0; i < range.number; ++i) {
+                if (range.value[i]) {
+                    expected_values.push_back(range.value[i]);
+                    expected_indices.push_back(range.index[i]);
+                }
+            }
+            auto start = sparse.pointers[k], end = sparse.pointers[k + 1];
+            EXPECT_EQ(expected_values, std::vector<double>(sparse.values.begin() + start, sparse.values.begin() + end));
+            EXPECT_EQ(expected_indices, std::vector<int>(sparse.indices.begin() + start, sparse.indices.begin() + end));
+        }
+        EXPECT_EQ(sparse.values.size(), sparse.pointers.back());
+    }
+};
+
+TEST_P(ExtractRowsTest, Basic) {
+    auto param = GetParam();
+    size_t NR = 150, NC = std::get<0>(param);
+    auto ref = create_reference(NR, NC);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 32;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(*ref, copt);
+
+    auto interval = std::get<1>(param);
+    int column_start = NC * interval.first;
+    int column_length = NC * interval.second - column_start;
+    tatami_layered::ExtractRowsOptions opt;
+    opt.num_threads = std::get<2>(param);
+    compare(*mat, *ref, choose_rows(NR), column_start, column_length, opt);
+}
+
+TEST_P(ExtractRowsTest, FloatingPoint) {
+    auto param = GetParam();
+    size_t NR = 150, NC = std::get<0>(param);
+    auto full = create_dense(NR, NC);
+    size_t counter = 0;
+    for (auto& x : full) {
+        if (x) {
+            ++counter;
+            if (counter % 3 == 0) {
+                x *= -0.37;
+            } else if (counter % 5 == 0) {
+                x += 0.5;
+            }
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 32;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    auto interval = std::get<1>(param);
+    int column_start = NC * interval.first;
+    int column_length = NC * interval.second - column_start;
+    tatami_layered::ExtractRowsOptions opt;
+    opt.num_threads = std::get<2>(param);
+    compare(*mat, ref, choose_rows(NR), column_start, column_length, opt);
+}
+
+TEST_P(ExtractRowsTest, SignedInteger) {
+    auto param = GetParam();
+    size_t NR = 150, NC = std::get<0>(param);
+    auto full = create_dense(NR, NC);
+    size_t counter = 0;
+    for (auto& x : full) {
+        if (x) {
+            ++counter;
+            if (counter % 3 == 0) {
+                x = -x;
+            }
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 32;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    auto interval = std::get<1>(param);
+    int column_start = NC * interval.first;
+    int column_length = NC * interval.second - column_start;
+    tatami_layered::ExtractRowsOptions opt;
+    opt.num_threads = std::get<2>(param);
+    compare(*mat, ref, choose_rows(NR), column_start, column_length, opt);
+}
+
+TEST_P(ExtractRowsTest, Dictionary) {
+    auto param = GetParam();
+    size_t NR = 30, NC = std::get<0>(param);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, mock_dictionary_data(NR, NC));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.dictionary = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    auto interval = std::get<1>(param);
+    int column_start = NC * interval.first;
+    int column_length = NC * interval.second - column_start;
+    tatami_layered::ExtractRowsOptions opt;
+    opt.num_threads = std::get<2>(param);
+    compare(*mat, ref, choose_rows(NR), column_start, column_length, opt);
+}
+
+TEST_P(ExtractRowsTest, Outliers) {
+    auto param = GetParam();
+    size_t NR = 30, NC = std::get<0>(param);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, mock_outlier_data(NR, NC));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    auto interval = std::get<1>(param);
+    int column_start = NC * interval.first;
+    int column_length = NC * interval.second - column_start;
+    tatami_layered::ExtractRowsOptions opt;
+    opt.num_threads = std::get<2>(param);
+    compare(*mat, ref, choose_rows(NR), column_start, column_length, opt);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    ExtractRows,
+    ExtractRowsTest,
+    ::testing::Combine(
+        ::testing::Values(50, 128, 203), // number of columns
+        ::testing::Values(
+            std::make_pair(0.0, 1.0),
+            std::make_pair(0.1, 0.6),
+            std::make_pair(0.55, 0.95),
+            std::make_pair(0.3, 0.3)
+        ),
+        ::testing::Values(1, 3) // number of threads
+    )
+);
+
+TEST(ExtractRows, FullChunk) {
+    // Checking that we handle chunks that span the full range of the column index type.
+    size_t NR = 40, NC = 600;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+    tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> ref(NR, NC, std::move(vals), std::move(rows), std::move(indptrs));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 1000;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    EXPECT_EQ(mat->get_chunk_size(), 256);
+
+    std::vector<int> chosen { 5, 39, 0, 20, 5 };
+    std::vector<double> dense(chosen.size() * 300);
+    tatami_layered::extract_dense_rows(*mat, chosen, 100, 300, dense.data(), tatami_layered::ExtractRowsOptions());
+    tatami_layered::ExtractedSparseRows<double, int> sparse;
+    tatami_layered::extract_sparse_rows(*mat, chosen, 100, 300, sparse, tatami_layered::ExtractRowsOptions());
+
+    auto ext = ref.dense_row(100, 300);
+    std::vector<double> buffer(300);
+    for (size_t k = 0; k < chosen.size(); ++k) {
+        auto ptr = ext->fetch(chosen[k], buffer.data());
+        EXPECT_EQ(std::vector<double>(ptr, ptr + 300), std::vector<double>(dense.begin() + k * 300, dense.begin() + (k + 1) * 300));
+
+        std::vector<double> densified(300);
+        for (auto i = sparse.pointers[k]; i < sparse.pointers[k + 1]; ++i) {
+            densified[sparse.indices[i] - 100] = sparse.values[i];
+        }
+        EXPECT_EQ(std::vector<double>(ptr, ptr + 300), densified);
+    }
+}
+
+TEST(ExtractRows, PartialEscapes) {
+    // In the first chunk, rows 1 (modulo 5) have escapes at columns 3 and 43, and rows 0 (modulo 5) have an escape at column 25.
+    // Column blocks that start after some of a row's escapes must skip them without consuming any of the later ones.
+    size_t NR = 30, NC = 128;
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, mock_outlier_data(NR, NC));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+    EXPECT_EQ(mat->get_chunks()[0].storee8.num_rows, 18);
+
+    std::vector<int> chosen { 1, 0, 6, 4, 1, 29, 11 };
+    for (int threads : { 1, 3 }) {
+        tatami_layered::ExtractRowsOptions opt;
+        opt.num_threads = threads;
+        for (auto interval : std::vector<std::pair<int, int> >{ { 4, 40 }, { 26, 20 }, { 43, 1 }, { 43, 60 }, { 44, 84 } }) {
+            auto column_start = interval.first, column_length = interval.second;
+            std::vector<double> dense(chosen.size() * column_length);
+            tatami_layered::extract_dense_rows(*mat, chosen, column_start, column_length, dense.data(), opt);
+            tatami_layered::ExtractedSparseRows<double, int> sparse;
+            tatami_layered::extract_sparse_rows(*mat, chosen, column_start, column_length, sparse, opt);
+
+            auto ext = ref.dense_row(column_start, column_length);
+            std::vector<double> buffer(column_length);
+            for (size_t k = 0; k < chosen.size(); ++k) {
+                auto ptr = ext->fetch(chosen[k], buffer.data());
+                std::vector<double> expected(ptr, ptr + column_length);
+                EXPECT_EQ(expected, std::vector<double>(dense.begin() + k * column_length, dense.begin() + (k + 1) * column_length));
+
+                std::vector<double> densified(column_length);
+                for (auto i = sparse.pointers[k]; i < sparse.pointers[k + 1]; ++i) {
+                    densified[sparse.indices[i] - column_start] = sparse.values[i];
+                }
+                EXPECT_EQ(expected, densified);
+            }
+        }
+    }
+}
+
+TEST(ExtractRows, Fused) {
+    size_t NR = 60, NC = 90;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+    auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+    tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> raw(NR, NC, std::move(vals), std::move(rows), std::move(indptrs));
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 20;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(raw, copt);
+
+    for (double lower : { 0.0, 0.5 }) {
+        tatami_layered::FusedTransform transform;
+        transform.log1p = true;
+        transform.lower = lower;
+        auto fused = mat->fuse_transform(transform);
+
+        std::vector<int> chosen { 3, 59, 17, 17, 0 };
+        std::vector<double> dense(chosen.size() * 50);
+        tatami_layered::extract_dense_rows(*fused, chosen, 25, 50, dense.data(), tatami_layered::ExtractRowsOptions());
+        tatami_layered::ExtractedSparseRows<double, int> sparse;
+        tatami_layered::extract_sparse_rows(*fused, chosen, 25, 50, sparse, tatami_layered::ExtractRowsOptions());
+
+        auto dext = fused->dense_row(25, 50);
+        auto sext = fused->sparse_row(25, 50);
+        std::vector<double> dbuffer(50), vbuffer(50);
+        std::vector<int> ibuffer(50);
+        for (size_t k = 0; k < chosen.size(); ++k) {
+            auto dptr = dext->fetch(chosen[k], dbuffer.data());
+            EXPECT_EQ(std::vector<double>(dptr, dptr + 50), std::vector<double>(dense.begin() + k * 50, dense.begin() + (k + 1) * 50));
+
+            auto range = sext->fetch(chosen[k], vbuffer.data(), ibuffer.data());
+            auto start = sparse.pointers[k], end = sparse.pointers[k + 1];
+            EXPECT_EQ(std::vector<double>(range.value, range.value + range.number), std::vector<double>(sparse.values.begin() + start, sparse.values.begin() + end));
+            EXPECT_EQ(std::vector<int>(range.index, range.index + range.number), std::vector<int>(sparse.indices.begin() + start, sparse.indices.begin() + end));
+        }
+    }
+}
+
+TEST(ExtractRows, Errors) {
+    tatami::DenseRowMatrix<double, int> ref(10, 20, std::vector<double>(200, 1));
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, tatami_layered::ConvertToLayeredSparseOptions());
+    std::vector<double> buffer(1000);
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::extract_dense_rows(*mat, std::vector<int>{ 10 }, 0, 20, buffer.data(), tatami_layered::ExtractRowsOptions());
+    }, "number of rows");
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::extract_dense_rows(*mat, std::vector<int>{ 0 }, 5, 20, buffer.data(), tatami_layered::ExtractRowsOptions());
+    }, "subinterval");
+}
+
+TEST(ExtractRows, UnsignedIndex) {
+    std::vector<double> full(200);
+    for (std::size_t i = 0; i < full.size(); ++i) {
+        full[i] = (i % 3 ? 0 : i);
+    }
+    tatami::DenseRowMatrix<double, unsigned> ref(10, 20, full);
+    auto mat = tatami_layered::convert_to_layered_sparse<double, unsigned, std::uint8_t>(ref, tatami_layered::ConvertToLayeredSparseOptions());
+
+    std::vector<unsigned> rows { 1, 7 };
+    std::vector<double> buffer(rows.size() * 15);
+    tatami_layered::extract_dense_rows(*mat, rows, 5u, 15u, buffer.data(), tatami_layered::ExtractRowsOptions());
+    for (std::size_t k = 0; k < rows.size(); ++k) {
+        std::vector<double> expected(full.begin() + rows[k] * 20 + 5, full.begin() + rows[k] * 20 + 20);
+        EXPECT_EQ(std::vector<double>(buffer.begin() + k * 15, buffer.begin() + (k + 1) * 15), expected);
+    }
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::extract_dense_rows(*mat, std::vector<unsigned>{ 0 }, 25u, 0u, buffer.data(), tatami_layered::ExtractRowsOptions());
+    }, "subinterval");
+}
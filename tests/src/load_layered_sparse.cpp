@@ -0,0 +1,281 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/save_layered_sparse.hpp"
+#include "tatami_layered/load_layered_sparse.hpp"
+
+#include "mock_layered_sparse_data.h"
+#include "temp_file_path.h"
+
+#include <fstream>
+
+class LoadLayeredSparseTest : public ::testing::TestWithParam<std::tuple<int, bool> > {
+protected:
+    static std::shared_ptr<tatami::NumericMatrix> create_reference(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        auto indptrs = tatami::compress_sparse_triplets<false>(NR, NC, vals, rows, cols);
+        typedef tatami::CompressedSparseColumnMatrix<double, int, decltype(vals), decltype(rows), decltype(indptrs)> SparseMat; 
+        return std::shared_ptr<tatami::NumericMatrix>(new SparseMat(NR, NC, std::move(vals), std::move(rows), std::move(indptrs))); 
+    }
+};
+
+TEST_P(LoadLayeredSparseTest, RoundTrip) {
+    auto param = GetParam();
+    size_t NR = 150, NC = std::get<0>(param);
+    auto ref = create_reference(NR, NC);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 50;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(*ref, copt);
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+
+    tatami_layered::LoadLayeredSparseOptions lopt;
+    lopt.memory_map = std::get<1>(param);
+    auto loaded = tatami_layered::load_layered_sparse<double, int, std::uint8_t>(path.c_str(), lopt);
+    EXPECT_EQ(loaded->nrow(), NR);
+    EXPECT_EQ(loaded->ncol(), NC);
+    EXPECT_EQ(loaded->get_chunk_size(), 50);
+    EXPECT_EQ(loaded->num_chunks(), mat->num_chunks());
+
+    // Shared code vectors are preserved.
+    const auto& original_chunks = mat->get_chunks();
+    const auto& loaded_chunks = loaded->get_chunks();
+    for (size_t c = 1; c < original_chunks.size(); ++c) {
+        EXPECT_EQ(original_chunks[c].codes == original_chunks[0].codes, loaded_chunks[c].codes == loaded_chunks[0].codes);
+    }
+
+    tatami_test::test_simple_row_access(*loaded, *ref);
+    tatami_test::test_simple_column_access(*loaded, *ref);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    LoadLayeredSparse,
+    LoadLayeredSparseTest,
+    ::testing::Combine(
+        ::testing::Values(20, 100, 133), // number of columns
+        ::testing::Values(false, true) // whether to memory-map.
+    )
+);
+
+TEST(LoadLayeredSparse, Empty) {
+    tatami::DenseRowMatrix<double, int> empty(0, 10, std::vector<double>());
+    auto mat = tatami_layered::convert_to_layered_sparse(empty, tatami_layered::ConvertToLayeredSparseOptions());
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+
+    auto loaded = tatami_layered::load_layered_sparse(path.c_str(), tatami_layered::LoadLayeredSparseOptions());
+    EXPECT_EQ(loaded->nrow(), 0);
+    EXPECT_EQ(loaded->ncol(), 10);
+}
+
+TEST(LoadLayeredSparse, Errors) {
+    std::vector<double> full { 1, 0, 300, 0, 70000, 2 };
+    tatami::DenseRowMatrix<double, int> ref(2, 3, full);
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, tatami_layered::ConvertToLayeredSparseOptions());
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+    tatami_layered::LoadLayeredSparseOptions lopt;
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::load_layered_sparse<double, int, std::uint8_t>(path.c_str(), lopt);
+    }, "column index");
+
+    {
+        std::ifstream input(path, std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        input.close();
+
+        auto truncated = temp_file_path("tatami-layered-save");
+        std::ofstream output(truncated, std::ios::binary);
+        output.write(contents.data(), contents.size() / 2);
+        output.close();
+        tatami_test::throws_error([&]() -> void {
+            tatami_layered::load_layered_sparse(truncated.c_str(), lopt);
+        }, "invalid data section");
+
+        contents[0] = 'X';
+        auto corrupted = temp_file_path("tatami-layered-save");
+        std::ofstream output2(corrupted, std::ios::binary);
+        output2.write(contents.data(), contents.size());
+        output2.close();
+        tatami_test::throws_error([&]() -> void {
+            tatami_layered::load_layered_sparse(corrupted.c_str(), lopt);
+        }, "does not contain");
+
+        // Files with a different number of layers are rejected, rather than misinterpreting the chunk directory.
+        contents[0] = 'T';
+        contents[9 * sizeof(std::uint64_t)] = 10;
+        auto relayered = temp_file_path("tatami-layered-save");
+        std::ofstream output3(relayered, std::ios::binary);
+        output3.write(contents.data(), contents.size());
+        output3.close();
+        tatami_test::throws_error([&]() -> void {
+            tatami_layered::load_layered_sparse(relayered.c_str(), lopt);
+        }, "has 10 layers");
+    }
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::load_layered_sparse((path + "_missing").c_str(), lopt);
+    }, "failed to open");
+
+    tatami_layered::FusedTransform transform;
+    transform.log1p = true;
+    auto fused = mat->fuse_transform(transform);
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::save_layered_sparse(*fused, path.c_str());
+    }, "fused");
+}
+
+TEST(LoadLayeredSparse, Validation) {
+    std::vector<double> full { 1, 0, 3, 0, 5, 2 };
+    tatami::DenseRowMatrix<double, int> ref(2, 3, full);
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, tatami_layered::ConvertToLayeredSparseOptions());
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+    std::ifstream input(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    input.close();
+
+    // Finding the 16-bit column indices of the 8-bit layer, i.e., [0, 2] and [1, 2].
+    const std::string indices("\x00\x00\x02\x00\x01\x00\x02\x00", 8);
+    const auto pos = contents.find(indices);
+    ASSERT_NE(pos, std::string::npos);
+
+    auto check = [&](const std::string& replacement, const std::string& message) -> void {
+        auto corrupted = contents;
+        corrupted.replace(pos, replacement.size(), replacement);
+        auto cpath = temp_file_path("tatami-layered-save");
+        std::ofstream output(cpath, std::ios::binary);
+        output.write(corrupted.data(), corrupted.size());
+        output.close();
+
+        for (auto mm : { true, false }) {
+            tatami_layered::LoadLayeredSparseOptions lopt;
+            lopt.memory_map = mm;
+            tatami_test::throws_error([&]() -> void {
+                tatami_layered::load_layered_sparse(cpath.c_str(), lopt);
+            }, message);
+
+            // Trusted files are loaded without checking the arrays.
+            lopt.validate = false;
+            auto loaded = tatami_layered::load_layered_sparse(cpath.c_str(), lopt);
+            EXPECT_EQ(loaded->ncol(), 3);
+        }
+    };
+
+    check(std::string("\x00\x00\x09\x00", 4), "invalid column indices"); // out of range.
+    check(std::string("\x00\x00\x00\x00", 4), "invalid column indices"); // not strictly increasing.
+}
+
+TEST(LoadLayeredSparse, SixtyFourBit) {
+    std::vector<double> full { 1, 0, 300, 0, 70000, 2, 10000000000, 0, 0 };
+    tatami::DenseRowMatrix<double, int> ref(3, 3, full);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 2;
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, copt);
+    EXPECT_EQ(mat->get_chunks()[0].store64.num_rows, 1);
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+    for (auto mapped : { false, true }) {
+        tatami_layered::LoadLayeredSparseOptions lopt;
+        lopt.memory_map = mapped;
+        auto loaded = tatami_layered::load_layered_sparse(path.c_str(), lopt);
+        tatami_test::test_simple_row_access(*loaded, ref);
+        tatami_test::test_simple_column_access(*loaded, ref);
+    }
+}
+
+TEST(LoadLayeredSparse, FloatingPoint) {
+    std::vector<double> full { 1.5, 0, 0.5, 0, -70000.5, 2, 0.1, 0, 1e30 };
+    tatami::DenseRowMatrix<double, int> ref(3, 3, full);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 2;
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, copt);
+    EXPECT_EQ(mat->get_chunks()[0].storef16.num_rows, 1);
+    EXPECT_EQ(mat->get_chunks()[0].storef32.num_rows, 1);
+    EXPECT_EQ(mat->get_chunks()[0].storef64.num_rows, 1);
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+    for (auto mapped : { false, true }) {
+        tatami_layered::LoadLayeredSparseOptions lopt;
+        lopt.memory_map = mapped;
+        auto loaded = tatami_layered::load_layered_sparse(path.c_str(), lopt);
+        tatami_test::test_simple_row_access(*loaded, ref);
+        tatami_test::test_simple_column_access(*loaded, ref);
+    }
+}
+
+TEST(LoadLayeredSparse, SignedInteger) {
+    std::vector<double> full { -1, 0, 5, 200, -3, 0, 0, -70000, 2 };
+    tatami::DenseRowMatrix<double, int> ref(3, 3, full);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 2;
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, copt);
+    EXPECT_EQ(mat->get_chunks()[0].storei8.num_rows, 1);
+    EXPECT_EQ(mat->get_chunks()[0].storei16.num_rows, 1);
+    EXPECT_EQ(mat->get_chunks()[0].storei32.num_rows, 1);
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+    for (auto mapped : { false, true }) {
+        tatami_layered::LoadLayeredSparseOptions lopt;
+        lopt.memory_map = mapped;
+        auto loaded = tatami_layered::load_layered_sparse(path.c_str(), lopt);
+        tatami_test::test_simple_row_access(*loaded, ref);
+        tatami_test::test_simple_column_access(*loaded, ref);
+    }
+}
+
+TEST(LoadLayeredSparse, Dictionary) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.dictionary = true;
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, copt);
+    EXPECT_EQ(mat->get_chunks()[0].stored8.num_rows, 15);
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+    for (auto mapped : { false, true }) {
+        tatami_layered::LoadLayeredSparseOptions lopt;
+        lopt.memory_map = mapped;
+        auto loaded = tatami_layered::load_layered_sparse(path.c_str(), lopt);
+        tatami_test::test_simple_row_access(*loaded, ref);
+        tatami_test::test_simple_column_access(*loaded, ref);
+        EXPECT_EQ(loaded->get_chunks()[0].stored8.num_entries(), mat->get_chunks()[0].stored8.num_entries());
+    }
+}
+
+TEST(LoadLayeredSparse, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, copt);
+    EXPECT_EQ(mat->get_chunks()[0].storee8.num_rows, 18);
+
+    auto path = temp_file_path("tatami-layered-save");
+    tatami_layered::save_layered_sparse(*mat, path.c_str());
+    for (auto mapped : { false, true }) {
+        tatami_layered::LoadLayeredSparseOptions lopt;
+        lopt.memory_map = mapped;
+        auto loaded = tatami_layered::load_layered_sparse(path.c_str(), lopt);
+        tatami_test::test_simple_row_access(*loaded, ref);
+        tatami_test::test_simple_column_access(*loaded, ref);
+        EXPECT_EQ(loaded->get_chunks()[0].storee8.num_escapes(), mat->get_chunks()[0].storee8.num_escapes());
+    }
+}
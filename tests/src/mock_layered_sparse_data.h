@@ -3,6 +3,7 @@
 
 #include <random>
 #include <vector>
+#include <algorithm>
 
 inline void mock_layered_sparse_data(std::size_t NR, std::size_t NC, std::vector<std::size_t>& rows, std::vector<std::size_t>& cols, std::vector<int>& vals) {
     std::mt19937_64 rng(NR * NC + 1);
@@ -55,4 +56,69 @@ inline void mock_layered_sparse_data(std::size_t NR, std::size_t NC, std::vector
     return;
 }
 
+// Dense row-major matrix where some rows have few distinct values in each chunk, for testing the dictionary-coded layer.
+// With a chunk size of 64, rows 0, 1 and 3 (modulo 6) in each full chunk should be dictionary-coded, while the others remain in their native layers.
+inline std::vector<double> mock_dictionary_data(std::size_t NR, std::size_t NC) {
+    std::vector<double> full(NR * NC);
+    for (std::size_t r = 0; r < NR; ++r) {
+        auto ptr = full.data() + r * NC;
+        for (std::size_t c = 0; c < NC; ++c) {
+            switch (r % 6) {
+                case 0: // small counts with a large outlier, in the 16-bit layer.
+                    ptr[c] = (c % 4 == 3 ? 1000 : c % 4 + 1);
+                    break;
+                case 1: // half-precision values.
+                    ptr[c] = (c % 4 == 3 ? -3.25 : c % 4 + 0.5);
+                    break;
+                case 2: // too many distinct values.
+                    ptr[c] = c + 256;
+                    break;
+                case 3: // sparse negative values in the 32-bit signed layer.
+                    if (c % 3 == 0) {
+                        ptr[c] = (c % 2 ? -1 : -50000);
+                    }
+                    break;
+                case 4: // already in the 8-bit layer.
+                    ptr[c] = c % 5;
+                    break;
+                default: // too few non-zero values.
+                    if (c == 10) {
+                        ptr[c] = 70000;
+                    } else if (c == 20) {
+                        ptr[c] = 1;
+                    }
+            }
+        }
+    }
+    return full;
+}
+
+// Dense row-major matrix where some rows have a few large values among small counts, for testing the escaped layer.
+// With a chunk size of 64, rows 0, 1 and 4 (modulo 5) in the first chunk should be stored with escapes, while the others remain in their native layers.
+inline std::vector<double> mock_outlier_data(std::size_t NR, std::size_t NC) {
+    std::vector<double> full(NR * NC);
+    for (std::size_t r = 0; r < NR; ++r) {
+        auto ptr = full.data() + r * NC;
+        for (std::size_t c = 0; c < NC; ++c) {
+            switch (r % 5) {
+                case 0: // rare outliers in the 16-bit layer.
+                    ptr[c] = (c % 50 == 25 ? 1000 : c % 7 + 1);
+                    break;
+                case 1: // rare outliers in the 32-bit layer.
+                    ptr[c] = (c % 40 == 3 ? 100000 : c % 7 + 1);
+                    break;
+                case 2: // already in the 8-bit layer, even with the escape code.
+                    ptr[c] = (c % 3 == 0 ? 255 : 1);
+                    break;
+                case 3: // too many outliers.
+                    ptr[c] = c + 300;
+                    break;
+                default: // a single outlier in the 64-bit layer.
+                    ptr[c] = (c == 10 ? 5000000000.0 : c % 2);
+            }
+        }
+    }
+    return full;
+}
+
 #endif
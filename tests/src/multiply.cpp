@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/multiply.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+#include <cmath>
+#include <random>
+
+class MultiplyTest : public ::testing::TestWithParam<std::tuple<int, int, int> > {
+protected:
+    static std::vector<double> create_dense(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        std::vector<double> full(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+        return full;
+    }
+
+    static std::vector<double> create_right(size_t NR, size_t NC) {
+        std::mt19937_64 rng(NR * 13 + NC);
+        std::uniform_real_distribution<double> dist;
+        std::vector<double> output(NR * NC);
+        for (auto& o : output) {
+            o = dist(rng);
+        }
+        return output;
+    }
+
+    // Tolerances are scaled by the product of the absolute values, as the signed tests involve some cancellation.
+    static void compare(const std::vector<double>& observed, const std::vector<double>& expected, const std::vector<double>& scale) {
+        ASSERT_EQ(observed.size(), expected.size());
+        for (size_t i = 0; i < observed.size(); ++i) {
+            EXPECT_NEAR(observed[i], expected[i], scale[i] * 1e-10 + 1e-10);
+        }
+    }
+
+    template<class Matrix_>
+    static void check(const Matrix_& mat, const std::vector<double>& full, size_t NR, size_t NC, size_t K, const tatami_layered::MultiplyOptions& opt) {
+        // Regular multiplication.
+        {
+            auto right = create_right(NC, K);
+            std::vector<double> expected(NR * K), scale(NR * K);
+            for (size_t r = 0; r < NR; ++r) {
+                for (size_t c = 0; c < NC; ++c) {
+                    for (size_t k = 0; k < K; ++k) {
+                        expected[r * K + k] += full[r * NC + c] * right[c * K + k];
+                        scale[r * K + k] += std::abs(full[r * NC + c]) * right[c * K + k];
+                    }
+                }
+            }
+
+            std::vector<double> observed(NR * K, -1); // checking that the output is correctly zeroed.
+            tatami_layered::multiply(mat, right.data(), K, observed.data(), opt);
+            compare(observed, expected, scale);
+        }
+
+        // Transposed multiplication.
+        {
+            auto right = create_right(NR, K);
+            std::vector<double> expected(NC * K), scale(NC * K);
+            for (size_t r = 0; r < NR; ++r) {
+                for (size_t c = 0; c < NC; ++c) {
+                    for (size_t k = 0; k < K; ++k) {
+                        expected[c * K + k] += full[r * NC + c] * right[r * K + k];
+                        scale[c * K + k] += std::abs(full[r * NC + c]) * right[r * K + k];
+                    }
+                }
+            }
+
+            std::vector<double> observed(NC * K, -1);
+            tatami_layered::multiply_transposed(mat, right.data(), K, observed.data(), opt);
+            compare(observed, expected, scale);
+        }
+    }
+};
+
+TEST_P(MultiplyTest, Basic) {
+    auto param = GetParam();
+    size_t NR = 120, NC = std::get<0>(param), K = std::get<1>(param);
+    auto full = create_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 40;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::MultiplyOptions opt;
+    opt.num_threads = std::get<2>(param);
+    check(*mat, full, NR, NC, K, opt);
+}
+
+TEST_P(MultiplyTest, FloatingPoint) {
+    auto param = GetParam();
+    size_t NR = 120, NC = std::get<0>(param), K = std::get<1>(param);
+    auto full = create_dense(NR, NC);
+    size_t counter = 0;
+    for (auto& x : full) {
+        if (x) {
+            ++counter;
+            if (counter % 3 == 0) {
+                x *= -0.37;
+            } else if (counter % 5 == 0) {
+                x += 0.5;
+            }
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 40;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::MultiplyOptions opt;
+    opt.num_threads = std::get<2>(param);
+    check(*mat, full, NR, NC, K, opt);
+}
+
+TEST_P(MultiplyTest, SignedInteger) {
+    auto param = GetParam();
+    size_t NR = 120, NC = std::get<0>(param), K = std::get<1>(param);
+    auto full = create_dense(NR, NC);
+    size_t counter = 0;
+    for (auto& x : full) {
+        if (x) {
+            ++counter;
+            if (counter % 3 == 0) {
+                x = -x;
+            }
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 40;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::MultiplyOptions opt;
+    opt.num_threads = std::get<2>(param);
+    check(*mat, full, NR, NC, K, opt);
+}
+
+TEST_P(MultiplyTest, Dictionary) {
+    auto param = GetParam();
+    size_t NR = 30, NC = std::get<0>(param), K = std::get<1>(param);
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.dictionary = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::MultiplyOptions opt;
+    opt.num_threads = std::get<2>(param);
+    check(*mat, full, NR, NC, K, opt);
+}
+
+TEST_P(MultiplyTest, Outliers) {
+    auto param = GetParam();
+    size_t NR = 30, NC = std::get<0>(param), K = std::get<1>(param);
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::MultiplyOptions opt;
+    opt.num_threads = std::get<2>(param);
+    check(*mat, full, NR, NC, K, opt);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Multiply,
+    MultiplyTest,
+    ::testing::Combine(
+        ::testing::Values(5, 40, 101), // number of columns
+        ::testing::Values(1, 3), // number of columns of the right-hand matrix
+        ::testing::Values(1, 2, 4) // number of threads, covering both parallelization strategies for the transposed product.
+    )
+);
+
+TEST(Multiply, Fused) {
+    std::vector<double> full { 0, 1, 0, 2, 0, 0 };
+    tatami::DenseRowMatrix<double, int> ref(2, 3, full);
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_layered::FusedTransform transform;
+    transform.log1p = true;
+    auto fused = mat->fuse_transform(transform);
+
+    tatami_layered::MultiplyOptions opt;
+    std::vector<double> right(3, 1), output(3);
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::multiply(*fused, right.data(), 1, output.data(), opt);
+    }, "fused");
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::multiply_transposed(*fused, right.data(), 1, output.data(), opt);
+    }, "fused");
+}
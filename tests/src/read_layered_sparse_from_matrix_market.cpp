@@ -100,6 +100,279 @@ TEST(ReadLayeredSparseFromMatrixMarket, Real) {
 }
 
 
+TEST(ReadLayeredSparseFromMatrixMarket, SixtyFourBit) {
+    std::string buffer = "%%MatrixMarket matrix coordinate integer general\n3 4 5\n1 1 5\n2 3 9000000000000000000\n3 2 70000\n2 1 1\n1 4 10000000000\n";
+    tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+    ropt.chunk_size = 2;
+    auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size(), ropt);
+
+    const auto& chunks = out->get_chunks();
+    EXPECT_EQ(chunks[0].store64.num_rows, 0);
+    EXPECT_EQ(chunks[1].store64.num_rows, 2);
+    EXPECT_EQ(chunks[1].store64.value[0], 10000000000ull);
+    EXPECT_EQ(chunks[1].store64.value[1], 9000000000000000000ull);
+
+    auto ext = out->dense_row();
+    std::vector<double> output(4);
+    auto ptr = ext->fetch(1, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 4), std::vector<double>({ 1, 0, 9000000000000000000.0, 0 }));
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, SixtyFourBitUnsigned) {
+    // Values above 2^63 - 1 only fit in an unsigned 64-bit integer.
+    std::string buffer = "%%MatrixMarket matrix coordinate integer general\n2 3 4\n1 1 10000000000000000000\n1 3 18446744073709551615\n2 2 -9223372036854775808\n2 1 +3\n";
+    tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+    ropt.chunk_size = 2;
+    auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size(), ropt);
+
+    const auto& chunks = out->get_chunks();
+    EXPECT_EQ(chunks[0].store64.num_rows, 1);
+    EXPECT_EQ(chunks[0].store64.value[0], 10000000000000000000ull);
+    EXPECT_EQ(chunks[1].store64.num_rows, 1);
+    EXPECT_EQ(chunks[1].store64.value[0], 18446744073709551615ull);
+    EXPECT_EQ(chunks[0].storef32.num_rows, 1); // no signed layer is large enough for -2^63, but it is exactly representable in single precision.
+
+    auto ext = out->dense_row();
+    std::vector<double> output(3);
+    auto ptr = ext->fetch(0, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 3), std::vector<double>({ 10000000000000000000.0, 0, 18446744073709551615.0 }));
+    ptr = ext->fetch(1, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 3), std::vector<double>({ 3, -9223372036854775808.0, 0 }));
+
+    // Overflow is only detected by our own parser, which is used once a negative value is present.
+    std::string overflow = "%%MatrixMarket matrix coordinate integer general\n2 1 2\n1 1 18446744073709551616\n2 1 -1\n";
+    tatami_test::throws_error([&]() -> void { 
+        tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(overflow.data()), overflow.size());
+    }, "does not fit in 64 bits");
+
+    std::string truncated = "%%MatrixMarket matrix coordinate integer general\n2 2 2\n1 1 -5\n";
+    tatami_test::throws_error([&]() -> void { 
+        tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(truncated.data()), truncated.size());
+    }, "fewer lines");
+
+    std::string out_of_range = "%%MatrixMarket matrix coordinate integer general\n% some comment\n2 2 2\n2 2 -1\n3 1 5\n";
+    tatami_test::throws_error([&]() -> void { 
+        tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(out_of_range.data()), out_of_range.size());
+    }, "row index out of range on line 5");
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, HasSignedLines) {
+    auto check = [](const std::string& contents) -> bool {
+        byteme::RawBufferReader reader(reinterpret_cast<const unsigned char*>(contents.data()), contents.size());
+        byteme::PerByteSerial<char, byteme::Reader*> pb(&reader);
+        return tatami_layered::has_signed_lines(pb);
+    };
+
+    EXPECT_FALSE(check("%%MatrixMarket matrix coordinate integer general\n% made on 2020-01-01\n2 2 1\n1 1 5\n"));
+    EXPECT_TRUE(check("%%MatrixMarket matrix coordinate integer general\n2 2 1\n1 1 -5\n"));
+    EXPECT_TRUE(check("%%MatrixMarket matrix coordinate integer general\n\n2 2 1\n% comment\n1 1 +5"));
+    EXPECT_FALSE(check("%%MatrixMarket matrix coordinate integer general\n2 2 1\n1 1 5\n%-1\n"));
+
+    // Malformed files without a sign are not re-read by our own parser.
+    std::string malformed = "%%MatrixMarket matrix coordinate integer general\n2 2 2\n1 1 5\n";
+    EXPECT_ANY_THROW(tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(malformed.data()), malformed.size()));
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, SignedComments) {
+    std::string buffer = "%%MatrixMarket matrix coordinate integer general\n% some comment\n2 2 3\n1 1 -2\n% another comment\n\n2 2 10000000000000000000\n2 1 7\n";
+    auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size());
+
+    auto ext = out->dense_row();
+    std::vector<double> output(2);
+    auto ptr = ext->fetch(0, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 2), std::vector<double>({ -2, 0 }));
+    ptr = ext->fetch(1, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 2), std::vector<double>({ 7, 10000000000000000000.0 }));
+
+    // Array files are also handled, in column-major order.
+    std::string array = "%%MatrixMarket matrix array integer general\n2 2\n1\n-2\n% comment\n3\n4\n";
+    auto aout = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(array.data()), array.size());
+    auto aext = aout->dense_row();
+    ptr = aext->fetch(0, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 2), std::vector<double>({ 1, 3 }));
+    ptr = aext->fetch(1, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 2), std::vector<double>({ -2, 4 }));
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, IntegerThreads) {
+    std::size_t NR = 1234, NC = 567;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+
+    // Also checking a file with negative values, which is read by our own parser regardless of the number of threads.
+    for (auto negate : { false, true }) {
+        if (negate) {
+            for (std::size_t i = 0; i < vals.size(); i += 7) {
+                vals[i] *= -1;
+            }
+        }
+
+        std::stringstream buf_out;
+        write_matrix_market(buf_out, NR, NC, vals, rows, cols, /* scrambled = */ true, /* integer = */ true);
+        const auto contents = buf_out.str();
+
+        tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+        ropt.chunk_size = 100;
+        auto ref = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(contents.data()), contents.size(), ropt);
+
+        ropt.num_threads = 3;
+        ropt.buffer_size = 1000; // forcing multiple blocks.
+        auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(contents.data()), contents.size(), ropt);
+        tatami_test::test_simple_row_access(*out, *ref);
+        tatami_test::test_simple_column_access(*out, *ref);
+
+        const auto& rchunks = ref->get_chunks();
+        const auto& ochunks = out->get_chunks();
+        ASSERT_EQ(rchunks.size(), ochunks.size());
+        for (std::size_t i = 0; i < rchunks.size(); ++i) {
+            EXPECT_EQ(rchunks[i].store8.num_rows, ochunks[i].store8.num_rows);
+            EXPECT_EQ(rchunks[i].store16.num_rows, ochunks[i].store16.num_rows);
+            EXPECT_EQ(rchunks[i].storei8.num_rows, ochunks[i].storei8.num_rows);
+        }
+    }
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, SignedInteger) {
+    std::string buffer = "%%MatrixMarket matrix coordinate integer general\n3 4 6\n1 1 -5\n1 2 5\n2 1 200\n2 2 -1\n3 3 -100000\n3 4 7\n";
+    tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+    ropt.chunk_size = 2;
+    auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size(), ropt);
+
+    const auto& chunks = out->get_chunks();
+    EXPECT_EQ(chunks[0].storei8.num_rows, 1);
+    EXPECT_EQ(chunks[0].storei16.num_rows, 1);
+    EXPECT_EQ(chunks[0].store8.num_rows, 1);
+    EXPECT_EQ(chunks[1].storei32.num_rows, 1);
+    EXPECT_EQ(chunks[1].store8.num_rows, 2);
+
+    auto ext = out->dense_row();
+    std::vector<double> output(4);
+    auto ptr = ext->fetch(0, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 4), std::vector<double>({ -5, 5, 0, 0 }));
+    ptr = ext->fetch(1, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 4), std::vector<double>({ 200, -1, 0, 0 }));
+    ptr = ext->fetch(2, output.data());
+    EXPECT_EQ(std::vector<double>(ptr, ptr + 4), std::vector<double>({ 0, 0, -100000, 7 }));
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, FloatingPoint) {
+    std::string buffer = "%%MatrixMarket matrix coordinate real general\n3 4 6\n1 1 5\n2 3 0.1\n3 2 -2.5\n2 1 1\n1 4 1e30\n3 1 1.5\n";
+    tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+    ropt.chunk_size = 2;
+    auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size(), ropt);
+
+    {
+        const auto& chunks = out->get_chunks();
+        EXPECT_EQ(chunks[0].store8.num_rows, 2);
+        EXPECT_EQ(chunks[0].storef16.num_rows, 1);
+        EXPECT_EQ(chunks[1].storef64.num_rows, 2);
+
+        auto ext = out->dense_row();
+        std::vector<double> output(4);
+        auto ptr = ext->fetch(1, output.data());
+        EXPECT_EQ(std::vector<double>(ptr, ptr + 4), std::vector<double>({ 1, 0, 0.1, 0 }));
+        ptr = ext->fetch(2, output.data());
+        EXPECT_EQ(std::vector<double>(ptr, ptr + 4), std::vector<double>({ 1.5, -2.5, 0, 0 }));
+    }
+
+    ropt.tolerance = 1e-3;
+    auto lossy = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size(), ropt);
+    {
+        const auto& chunks = lossy->get_chunks();
+        EXPECT_EQ(chunks[1].storef16.num_rows, 1);
+        EXPECT_EQ(chunks[1].storef32.num_rows, 1);
+
+        auto ext = lossy->dense_row();
+        std::vector<double> output(4);
+        auto ptr = ext->fetch(0, output.data());
+        EXPECT_EQ(ptr[0], 5);
+        EXPECT_NEAR(ptr[3], 1e30, 1e27);
+        ptr = ext->fetch(1, output.data());
+        EXPECT_NEAR(ptr[2], 0.1, 1e-4);
+    }
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, Dictionary) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_dictionary_data(NR, NC);
+    std::vector<double> vals;
+    std::vector<size_t> rows, cols;
+    for (size_t r = 0; r < NR; ++r) {
+        for (size_t c = 0; c < NC; ++c) {
+            if (full[r * NC + c]) {
+                vals.push_back(full[r * NC + c]);
+                rows.push_back(r);
+                cols.push_back(c);
+            }
+        }
+    }
+
+    std::stringstream buf_out;
+    write_matrix_market(buf_out, NR, NC, vals, rows, cols, true, false);
+    const auto contents = buf_out.str();
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, std::move(full));
+
+    tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+    ropt.chunk_size = 64;
+    ropt.dictionary = true;
+    for (int threads : { 1, 3 }) {
+        ropt.num_threads = threads;
+        auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(contents.data()), contents.size(), ropt);
+        const auto& chunks = out->get_chunks();
+        EXPECT_EQ(chunks[0].stored8.num_rows, 15);
+        EXPECT_EQ(chunks[0].stored8.num_entries(), 50);
+        EXPECT_EQ(chunks[0].storef16.num_rows, 0);
+        tatami_test::test_simple_row_access(*out, ref);
+        tatami_test::test_simple_column_access(*out, ref);
+    }
+}
+
+TEST(ReadLayeredSparseFromMatrixMarket, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    std::vector<double> vals;
+    std::vector<size_t> rows, cols;
+    for (size_t r = 0; r < NR; ++r) {
+        for (size_t c = 0; c < NC; ++c) {
+            if (full[r * NC + c]) {
+                vals.push_back(full[r * NC + c]);
+                rows.push_back(r);
+                cols.push_back(c);
+            }
+        }
+    }
+
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, std::move(full));
+
+    // Scrambling the lines also checks that the escapes are sorted along with the rest of each row.
+    for (auto scramble : { false, true }) {
+        std::stringstream buf_out;
+        buf_out.precision(12); // to write the 64-bit outliers exactly.
+        write_matrix_market(buf_out, NR, NC, vals, rows, cols, scramble, false);
+        const auto contents = buf_out.str();
+
+        tatami_layered::ReadLayeredSparseFromMatrixMarketOptions ropt;
+        ropt.chunk_size = 64;
+        ropt.outliers = true;
+        for (int threads : { 1, 3 }) {
+            ropt.num_threads = threads;
+            auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(contents.data()), contents.size(), ropt);
+            const auto& chunks = out->get_chunks();
+            EXPECT_EQ(chunks[0].storee8.num_rows, 18);
+            EXPECT_EQ(chunks[0].storee8.num_escapes(), 24);
+            EXPECT_EQ(chunks[0].store64.num_rows, 0);
+            tatami_test::test_simple_row_access(*out, ref);
+            tatami_test::test_simple_column_access(*out, ref);
+        }
+
+        ropt.outliers = false;
+        auto plain = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(contents.data()), contents.size(), ropt);
+        EXPECT_EQ(plain->get_chunks()[0].storee8.num_rows, 0);
+        tatami_test::test_simple_row_access(*plain, ref);
+    }
+}
+
 TEST(ReadLayeredSparseFromMatrixMarket, Pattern) {
     std::string buffer = "%%MatrixMarket matrix coordinate pattern general\n1 1 0\n";
     tatami_test::throws_error([&]() -> void { 
@@ -201,3 +474,42 @@ INSTANTIATE_TEST_SUITE_P(
     ReadLayeredSparseFromMatrixMarketFormatTest,
     ::testing::Values(0, 1, 2)  // Gzipped?
 );
+
+TEST(ReadLayeredSparseFromMatrixMarket, Instrumentation) {
+    std::size_t NR = 200, NC = 150;
+    std::vector<size_t> rows, cols;
+    std::vector<int> vals;
+    mock_layered_sparse_data(NR, NC, rows, cols, vals);
+
+    std::stringstream buf_out;
+    write_matrix_market(buf_out, NR, NC, vals, rows, cols, /* scrambled = */ true, /* integer = */ true);
+    auto contents = buf_out.str();
+    auto path = temp_file_path("tatami-tests-ext-MatrixMarket-instr");
+    {
+        std::ofstream file_out(path);
+        file_out << contents;
+    }
+
+    tatami_layered::Instrumentation instr;
+    tatami_layered::ReadLayeredSparseFromMatrixMarketOptions opt;
+    opt.chunk_size = 32;
+    opt.instrumentation = &instr;
+
+    auto out = tatami_layered::read_layered_sparse_from_matrix_market_text_file(path.c_str(), opt);
+    EXPECT_EQ(instr.num_nonzero, vals.size());
+    EXPECT_EQ(instr.bytes_read, contents.size() * 2);
+    EXPECT_GT(instr.layer_bytes, vals.size());
+    EXPECT_GT(instr.transient_bytes, 0);
+    EXPECT_GE(instr.scan_seconds, 0);
+    EXPECT_GE(instr.sort_seconds, 0);
+
+    auto out2 = tatami_layered::read_layered_sparse_from_matrix_market_text_buffer(reinterpret_cast<const unsigned char*>(contents.data()), contents.size(), opt);
+    EXPECT_EQ(instr.num_nonzero, vals.size() * 2);
+    EXPECT_EQ(instr.bytes_read, contents.size() * 4);
+    tatami_test::test_simple_row_access(*out2, *out);
+
+    // Same results without instrumentation.
+    opt.instrumentation = NULL;
+    auto out3 = tatami_layered::read_layered_sparse_from_matrix_market_text_file(path.c_str(), opt);
+    tatami_test::test_simple_row_access(*out3, *out);
+}
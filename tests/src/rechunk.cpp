@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/rechunk.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+class RechunkTest : public ::testing::TestWithParam<std::tuple<int, int> > {
+protected:
+    inline static size_t NR = 60, NC = 333;
+    inline static std::shared_ptr<tatami::NumericMatrix> ref;
+
+    static void SetUpTestSuite() {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        std::vector<double> full(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+        ref.reset(new tatami::DenseRowMatrix<double, int>(NR, NC, std::move(full)));
+    }
+
+    template<typename OutColumnIndex_, typename ColumnIndex_>
+    static void compare(const tatami_layered::LayeredSparseMatrix<double, int, ColumnIndex_>& mat, int chunk_size) {
+        tatami_layered::RechunkOptions ropt;
+        ropt.chunk_size = chunk_size;
+        ropt.num_threads = 2;
+        auto rechunked = tatami_layered::rechunk<OutColumnIndex_>(mat, ropt);
+        EXPECT_EQ(rechunked->get_chunk_size(), chunk_size);
+        tatami_test::test_simple_row_access(*rechunked, *ref);
+        tatami_test::test_simple_column_access(*rechunked, *ref);
+
+        // Same layers as a direct conversion with the new chunk size.
+        tatami_layered::ConvertToLayeredSparseOptions copt;
+        copt.chunk_size = chunk_size;
+        auto direct = tatami_layered::convert_to_layered_sparse<double, int, OutColumnIndex_>(*ref, copt);
+        ASSERT_EQ(direct->num_chunks(), rechunked->num_chunks());
+        for (int c = 0; c < direct->num_chunks(); ++c) {
+            EXPECT_EQ(*(direct->get_chunks()[c].codes), *(rechunked->get_chunks()[c].codes));
+        }
+    }
+};
+
+TEST_P(RechunkTest, Basic) {
+    auto param = GetParam();
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = std::get<0>(param);
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(*ref, copt);
+
+    const int new_chunk_size = std::get<1>(param);
+    compare<std::uint16_t>(*mat, new_chunk_size);
+    compare<std::uint32_t>(*mat, new_chunk_size);
+    if (new_chunk_size <= 256) {
+        compare<std::uint8_t>(*mat, new_chunk_size);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Rechunk,
+    RechunkTest,
+    ::testing::Combine(
+        ::testing::Values(10, 37, 100), // original chunk size
+        ::testing::Values(7, 20, 37, 256, 1000) // new chunk size
+    )
+);
+
+TEST_F(RechunkTest, Sharing) {
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 50;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(*ref, copt);
+
+    tatami_layered::RechunkOptions ropt;
+    ropt.chunk_size = 50;
+    auto rechunked = tatami_layered::rechunk<std::uint16_t>(*mat, ropt);
+    for (int c = 0; c < mat->num_chunks(); ++c) {
+        EXPECT_EQ(mat->get_chunks()[c].storage, rechunked->get_chunks()[c].storage);
+    }
+
+    // Chunk size is capped by the column index type.
+    ropt.chunk_size = 1000;
+    auto capped = tatami_layered::rechunk<std::uint8_t>(*mat, ropt);
+    EXPECT_EQ(capped->get_chunk_size(), 256);
+    tatami_test::test_simple_row_access(*capped, *ref);
+}
+
+TEST_F(RechunkTest, Transformed) {
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(*ref, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_layered::FusedTransform transform;
+    transform.column_factors.resize(NC);
+    for (size_t c = 0; c < NC; ++c) {
+        transform.column_factors[c] = 1.0 / (c + 1);
+    }
+    transform.log1p = true;
+    auto fused = mat->fuse_transform(transform);
+
+    tatami_layered::RechunkOptions ropt;
+    ropt.chunk_size = 17;
+    auto rechunked = tatami_layered::rechunk<std::uint8_t>(*fused, ropt);
+    ASSERT_TRUE(rechunked->get_fused_transform() != NULL);
+    tatami_test::test_simple_row_access(*rechunked, *fused);
+    tatami_test::test_simple_column_access(*rechunked, *fused);
+}
+
+TEST(Rechunk, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 50;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, copt);
+    copt.chunk_size = 100;
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, copt);
+
+    // Rows with escapes stay escaped in the merged chunks.
+    tatami_layered::RechunkOptions ropt;
+    ropt.chunk_size = 100;
+    ropt.outliers = true;
+    auto rechunked = tatami_layered::rechunk<std::uint8_t>(*mat, ropt);
+    tatami_test::test_simple_row_access(*rechunked, ref);
+    tatami_test::test_simple_column_access(*rechunked, ref);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(rechunked->get_chunks()[c].codes), *(direct->get_chunks()[c].codes));
+    }
+    EXPECT_GT(rechunked->get_chunks()[0].storee8.num_rows, 0);
+
+    ropt.outliers = false;
+    auto decoded = tatami_layered::rechunk<std::uint8_t>(*mat, ropt);
+    tatami_test::test_simple_row_access(*decoded, ref);
+    EXPECT_EQ(decoded->get_chunks()[0].storee8.num_rows, 0);
+}
+
+TEST(Rechunk, Empty) {
+    tatami::DenseRowMatrix<double, int> empty(10, 0, std::vector<double>());
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(empty, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_layered::RechunkOptions ropt;
+    ropt.chunk_size = 5;
+    auto rechunked = tatami_layered::rechunk<std::uint8_t>(*mat, ropt);
+    EXPECT_EQ(rechunked->nrow(), 10);
+    EXPECT_EQ(rechunked->ncol(), 0);
+    EXPECT_EQ(rechunked->num_chunks(), 1);
+
+    ropt.chunk_size = 0;
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::rechunk<std::uint8_t>(*mat, ropt);
+    }, "positive");
+}
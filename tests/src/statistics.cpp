@@ -0,0 +1,283 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/statistics.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+#include <cmath>
+#include <limits>
+
+class StatisticsTest : public ::testing::TestWithParam<std::tuple<int, int> > {
+protected:
+    static std::vector<double> create_dense(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        std::vector<double> full(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+        return full;
+    }
+
+    static void compare(const std::vector<double>& observed, const std::vector<double>& expected) {
+        ASSERT_EQ(observed.size(), expected.size());
+        for (size_t i = 0; i < observed.size(); ++i) {
+            if (std::isnan(expected[i])) {
+                EXPECT_TRUE(std::isnan(observed[i]));
+            } else {
+                EXPECT_NEAR(observed[i], expected[i], std::abs(expected[i]) * 1e-8 + 1e-8);
+            }
+        }
+    }
+
+    static void reference(const std::vector<double>& full, size_t NR, size_t NC, bool row, std::vector<double>& sums, std::vector<double>& vars, std::vector<std::size_t>& nnz) {
+        size_t dim = (row ? NR : NC), other = (row ? NC : NR);
+        sums.clear();
+        vars.clear();
+        nnz.clear();
+        for (size_t i = 0; i < dim; ++i) {
+            std::vector<double> current(other);
+            for (size_t j = 0; j < other; ++j) {
+                current[j] = (row ? full[i * NC + j] : full[j * NC + i]);
+            }
+
+            double s = 0;
+            int n = 0;
+            for (auto x : current) {
+                s += x;
+                n += (x != 0);
+            }
+            sums.push_back(s);
+            nnz.push_back(n);
+
+            if (other < 2) {
+                vars.push_back(std::numeric_limits<double>::quiet_NaN());
+            } else {
+                double m = s / other, v = 0;
+                for (auto x : current) {
+                    v += (x - m) * (x - m);
+                }
+                vars.push_back(v / (other - 1));
+            }
+        }
+    }
+};
+
+TEST_P(StatisticsTest, Basic) {
+    auto param = GetParam();
+    size_t NR = 150, NC = std::get<0>(param);
+    auto full = create_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 40;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::StatisticsOptions opt;
+    opt.num_threads = std::get<1>(param);
+
+    std::vector<double> sums, vars;
+    std::vector<std::size_t> nnz;
+
+    reference(full, NR, NC, true, sums, vars, nnz);
+    compare(tatami_layered::row_sums(*mat, opt), sums);
+    auto means = sums;
+    for (auto& m : means) {
+        m /= NC;
+    }
+    compare(tatami_layered::row_means(*mat, opt), means);
+    compare(tatami_layered::row_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::row_nnz(*mat, opt), nnz);
+
+    reference(full, NR, NC, false, sums, vars, nnz);
+    compare(tatami_layered::column_sums(*mat, opt), sums);
+    means = sums;
+    for (auto& m : means) {
+        m /= NR;
+    }
+    compare(tatami_layered::column_means(*mat, opt), means);
+    compare(tatami_layered::column_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::column_nnz(*mat, opt), nnz);
+}
+
+TEST_P(StatisticsTest, FloatingPoint) {
+    auto param = GetParam();
+    size_t NR = 150, NC = std::get<0>(param);
+    auto full = create_dense(NR, NC);
+    size_t counter = 0;
+    for (auto& x : full) {
+        if (x) {
+            ++counter;
+            if (counter % 3 == 0) {
+                x *= -0.37;
+            } else if (counter % 5 == 0) {
+                x += 0.5;
+            }
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 40;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::StatisticsOptions opt;
+    opt.num_threads = std::get<1>(param);
+
+    std::vector<double> sums, vars;
+    std::vector<std::size_t> nnz;
+
+    reference(full, NR, NC, true, sums, vars, nnz);
+    compare(tatami_layered::row_sums(*mat, opt), sums);
+    compare(tatami_layered::row_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::row_nnz(*mat, opt), nnz);
+
+    reference(full, NR, NC, false, sums, vars, nnz);
+    compare(tatami_layered::column_sums(*mat, opt), sums);
+    compare(tatami_layered::column_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::column_nnz(*mat, opt), nnz);
+}
+
+TEST_P(StatisticsTest, SignedInteger) {
+    auto param = GetParam();
+    size_t NR = 150, NC = std::get<0>(param);
+    auto full = create_dense(NR, NC);
+    size_t counter = 0;
+    for (auto& x : full) {
+        if (x) {
+            ++counter;
+            if (counter % 3 == 0) {
+                x = -x;
+            }
+        }
+    }
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 40;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::StatisticsOptions opt;
+    opt.num_threads = std::get<1>(param);
+
+    std::vector<double> sums, vars;
+    std::vector<std::size_t> nnz;
+
+    reference(full, NR, NC, true, sums, vars, nnz);
+    compare(tatami_layered::row_sums(*mat, opt), sums);
+    compare(tatami_layered::row_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::row_nnz(*mat, opt), nnz);
+
+    reference(full, NR, NC, false, sums, vars, nnz);
+    compare(tatami_layered::column_sums(*mat, opt), sums);
+    compare(tatami_layered::column_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::column_nnz(*mat, opt), nnz);
+}
+
+TEST_P(StatisticsTest, Dictionary) {
+    auto param = GetParam();
+    size_t NR = 30, NC = std::get<0>(param);
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.dictionary = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::StatisticsOptions opt;
+    opt.num_threads = std::get<1>(param);
+
+    std::vector<double> sums, vars;
+    std::vector<std::size_t> nnz;
+
+    reference(full, NR, NC, true, sums, vars, nnz);
+    compare(tatami_layered::row_sums(*mat, opt), sums);
+    compare(tatami_layered::row_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::row_nnz(*mat, opt), nnz);
+
+    reference(full, NR, NC, false, sums, vars, nnz);
+    compare(tatami_layered::column_sums(*mat, opt), sums);
+    compare(tatami_layered::column_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::column_nnz(*mat, opt), nnz);
+}
+
+TEST_P(StatisticsTest, Outliers) {
+    auto param = GetParam();
+    size_t NR = 30, NC = std::get<0>(param);
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    tatami_layered::StatisticsOptions opt;
+    opt.num_threads = std::get<1>(param);
+
+    std::vector<double> sums, vars;
+    std::vector<std::size_t> nnz;
+
+    reference(full, NR, NC, true, sums, vars, nnz);
+    compare(tatami_layered::row_sums(*mat, opt), sums);
+    compare(tatami_layered::row_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::row_nnz(*mat, opt), nnz);
+
+    reference(full, NR, NC, false, sums, vars, nnz);
+    compare(tatami_layered::column_sums(*mat, opt), sums);
+    compare(tatami_layered::column_variances(*mat, opt), vars);
+    EXPECT_EQ(tatami_layered::column_nnz(*mat, opt), nnz);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Statistics,
+    StatisticsTest,
+    ::testing::Combine(
+        ::testing::Values(5, 40, 101), // number of columns
+        ::testing::Values(1, 3) // number of threads
+    )
+);
+
+TEST(Statistics, ExplicitZeros) {
+    // Explicit zeros in the Matrix Market files should not count as non-zeros.
+    std::vector<double> full { 0, 1, 0, 2, 0, 0 };
+    tatami::DenseRowMatrix<double, int> ref(2, 3, full);
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, tatami_layered::ConvertToLayeredSparseOptions());
+
+    tatami_layered::StatisticsOptions opt;
+    EXPECT_EQ(tatami_layered::row_nnz(*mat, opt), std::vector<std::size_t>({ 1, 1 }));
+    EXPECT_EQ(tatami_layered::column_nnz(*mat, opt), std::vector<std::size_t>({ 1, 1, 0 }));
+    EXPECT_EQ(tatami_layered::row_sums(*mat, opt), std::vector<double>({ 1, 2 }));
+
+    // Empty matrices are handled gracefully.
+    tatami::DenseRowMatrix<double, int> empty(0, 5, std::vector<double>());
+    auto emat = tatami_layered::convert_to_layered_sparse(empty, tatami_layered::ConvertToLayeredSparseOptions());
+    EXPECT_TRUE(tatami_layered::row_sums(*emat, opt).empty());
+    auto csums = tatami_layered::column_sums(*emat, opt);
+    EXPECT_EQ(csums, std::vector<double>(5));
+    auto cvars = tatami_layered::column_variances(*emat, opt);
+    EXPECT_EQ(cvars.size(), 5);
+    EXPECT_TRUE(std::isnan(cvars.front()));
+}
+
+TEST(Statistics, Fused) {
+    std::vector<double> full { 0, 1, 0, 2, 0, 0 };
+    tatami::DenseRowMatrix<double, int> ref(2, 3, full);
+    auto mat = tatami_layered::convert_to_layered_sparse(ref, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_layered::FusedTransform transform;
+    transform.log1p = true;
+    auto fused = mat->fuse_transform(transform);
+
+    tatami_layered::StatisticsOptions opt;
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::row_sums(*fused, opt);
+    }, "fused");
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::column_variances(*fused, opt);
+    }, "fused");
+}
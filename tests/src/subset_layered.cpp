@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <numeric>
+#include <algorithm>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/subset_layered.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+class SubsetLayeredTest : public ::testing::TestWithParam<std::tuple<int, int> > {
+protected:
+    inline static size_t NR = 90, NC = 130;
+    inline static std::vector<double> full;
+    inline static std::shared_ptr<tatami_layered::LayeredSparseMatrix<double, int, std::uint16_t> > mat;
+
+    static void SetUpTestSuite() {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        full.resize(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+
+        tatami_layered::ConvertToLayeredSparseOptions copt;
+        copt.chunk_size = 25;
+        mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(tatami::DenseRowMatrix<double, int>(NR, NC, full), copt);
+    }
+
+    // 0 = all, 1 = sorted, 2 = unsorted with duplicates, 3 = contiguous block.
+    static std::vector<int> create_subset(int mode, int extent, int seed) {
+        std::vector<int> output;
+        std::mt19937_64 rng(seed);
+        if (mode == 1) {
+            for (int i = 0; i < extent; ++i) {
+                if (rng() % 3 == 0) {
+                    output.push_back(i);
+                }
+            }
+        } else if (mode == 2) {
+            for (int i = 0; i < extent / 2; ++i) {
+                output.push_back(rng() % extent);
+            }
+        } else if (mode == 3) {
+            output.resize(extent / 3);
+            std::iota(output.begin(), output.end(), extent / 4);
+        }
+        return output;
+    }
+
+    static tatami::DenseRowMatrix<double, int> create_reference(const std::vector<int>* rows, const std::vector<int>* cols) {
+        std::vector<int> all_rows(NR), all_cols(NC);
+        std::iota(all_rows.begin(), all_rows.end(), 0);
+        std::iota(all_cols.begin(), all_cols.end(), 0);
+        const auto& rsub = (rows ? *rows : all_rows);
+        const auto& csub = (cols ? *cols : all_cols);
+
+        std::vector<double> output;
+        output.reserve(rsub.size() * csub.size());
+        for (auto r : rsub) {
+            for (auto c : csub) {
+                output.push_back(full[r * NC + c]);
+            }
+        }
+        return tatami::DenseRowMatrix<double, int>(rsub.size(), csub.size(), std::move(output));
+    }
+};
+
+TEST_P(SubsetLayeredTest, Basic) {
+    auto param = GetParam();
+    auto rsub = create_subset(std::get<0>(param), NR, 1000 + std::get<0>(param));
+    auto csub = create_subset(std::get<1>(param), NC, 2000 + std::get<1>(param));
+    const std::vector<int>* rptr = (std::get<0>(param) ? &rsub : NULL);
+    const std::vector<int>* cptr = (std::get<1>(param) ? &csub : NULL);
+
+    tatami_layered::SubsetLayeredOptions sopt;
+    sopt.num_threads = 3;
+    auto subsetted = tatami_layered::subset_layered(*mat, rptr, cptr, sopt);
+    auto ref = create_reference(rptr, cptr);
+    EXPECT_EQ(subsetted->get_chunk_size(), 25);
+    tatami_test::test_simple_row_access(*subsetted, ref);
+    tatami_test::test_simple_column_access(*subsetted, ref);
+
+    // Layers should be the same as a direct conversion, i.e., categories are re-assigned.
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 25;
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint16_t>(ref, copt);
+    ASSERT_EQ(direct->num_chunks(), subsetted->num_chunks());
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(direct->get_chunks()[c].codes), *(subsetted->get_chunks()[c].codes));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    SubsetLayered,
+    SubsetLayeredTest,
+    ::testing::Combine(
+        ::testing::Values(0, 1, 2, 3), // row subset
+        ::testing::Values(0, 1, 2, 3)  // column subset
+    )
+);
+
+TEST_F(SubsetLayeredTest, Empty) {
+    std::vector<int> empty;
+    auto subsetted = tatami_layered::subset_layered(*mat, &empty, static_cast<const std::vector<int>*>(NULL), tatami_layered::SubsetLayeredOptions());
+    EXPECT_EQ(subsetted->nrow(), 0);
+    EXPECT_EQ(subsetted->ncol(), NC);
+
+    subsetted = tatami_layered::subset_layered(*mat, static_cast<const std::vector<int>*>(NULL), &empty, tatami_layered::SubsetLayeredOptions());
+    EXPECT_EQ(subsetted->nrow(), NR);
+    EXPECT_EQ(subsetted->ncol(), 0);
+    EXPECT_EQ(subsetted->num_chunks(), 1);
+}
+
+TEST_F(SubsetLayeredTest, Transformed) {
+    tatami_layered::FusedTransform transform;
+    transform.row_factors.resize(NR);
+    std::iota(transform.row_factors.begin(), transform.row_factors.end(), 1);
+    transform.column_factors.resize(NC);
+    std::iota(transform.column_factors.begin(), transform.column_factors.end(), 0.5);
+    transform.log1p = true;
+    auto fused = mat->fuse_transform(transform);
+
+    auto rsub = create_subset(2, NR, 10);
+    auto csub = create_subset(2, NC, 20);
+    auto subsetted = tatami_layered::subset_layered(*fused, &rsub, &csub, tatami_layered::SubsetLayeredOptions());
+
+    std::vector<double> expected(rsub.size() * csub.size());
+    for (size_t i = 0; i < rsub.size(); ++i) {
+        for (size_t j = 0; j < csub.size(); ++j) {
+            expected[i * csub.size() + j] = transform.apply(rsub[i], csub[j], full[rsub[i] * NC + csub[j]]);
+        }
+    }
+    tatami::DenseRowMatrix<double, int> tref(rsub.size(), csub.size(), std::move(expected));
+    tatami_test::test_simple_row_access(*subsetted, tref);
+    tatami_test::test_simple_column_access(*subsetted, tref);
+}
+
+TEST_F(SubsetLayeredTest, Errors) {
+    std::vector<int> bad { 0, static_cast<int>(NR) };
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::subset_layered(*mat, &bad, static_cast<const std::vector<int>*>(NULL), tatami_layered::SubsetLayeredOptions());
+    }, "number of rows");
+
+    std::vector<int> bad2 { -1 };
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::subset_layered(*mat, static_cast<const std::vector<int>*>(NULL), &bad2, tatami_layered::SubsetLayeredOptions());
+    }, "number of columns");
+}
+
+TEST(SubsetLayered, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    // Reversing the columns, so that the escapes also need to be sorted.
+    std::vector<int> cols(NC);
+    std::iota(cols.rbegin(), cols.rend(), 0);
+    std::vector<double> subfull;
+    subfull.reserve(NR * NC);
+    for (size_t r = 0; r < NR; ++r) {
+        for (auto c : cols) {
+            subfull.push_back(full[r * NC + c]);
+        }
+    }
+    tatami::DenseRowMatrix<double, int> expected(NR, NC, std::move(subfull));
+
+    tatami_layered::SubsetLayeredOptions sopt;
+    sopt.outliers = true;
+    auto sub = tatami_layered::subset_layered(*mat, static_cast<const std::vector<int>*>(NULL), &cols, sopt);
+    tatami_test::test_simple_row_access(*sub, expected);
+    tatami_test::test_simple_column_access(*sub, expected);
+    auto direct = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(expected, copt);
+    for (int c = 0; c < direct->num_chunks(); ++c) {
+        EXPECT_EQ(*(sub->get_chunks()[c].codes), *(direct->get_chunks()[c].codes));
+    }
+    EXPECT_GT(sub->get_chunks()[0].storee8.num_rows, 0);
+
+    sopt.outliers = false;
+    auto decoded = tatami_layered::subset_layered(*mat, static_cast<const std::vector<int>*>(NULL), &cols, sopt);
+    tatami_test::test_simple_row_access(*decoded, expected);
+    EXPECT_EQ(decoded->get_chunks()[0].storee8.num_rows, 0);
+}
+
+TEST(SubsetLayered, UnsignedIndex) {
+    std::vector<double> full(200);
+    for (std::size_t i = 0; i < full.size(); ++i) {
+        full[i] = (i % 3 ? 0 : i);
+    }
+    tatami::DenseRowMatrix<double, unsigned> ref(10, 20, full);
+    auto mat = tatami_layered::convert_to_layered_sparse<double, unsigned, std::uint8_t>(ref, tatami_layered::ConvertToLayeredSparseOptions());
+
+    std::vector<unsigned> rows { 7, 1 }, cols { 3, 19, 0 };
+    auto sub = tatami_layered::subset_layered(*mat, &rows, &cols, tatami_layered::SubsetLayeredOptions());
+    std::vector<double> subfull;
+    for (auto r : rows) {
+        for (auto c : cols) {
+            subfull.push_back(full[r * 20 + c]);
+        }
+    }
+    tatami::DenseRowMatrix<double, unsigned> expected(rows.size(), cols.size(), std::move(subfull));
+    tatami_test::test_simple_row_access(*sub, expected);
+
+    std::vector<unsigned> bad { 20 };
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::subset_layered(*mat, static_cast<const std::vector<unsigned>*>(NULL), &bad, tatami_layered::SubsetLayeredOptions());
+    }, "number of columns");
+}
@@ -0,0 +1,80 @@
+#ifndef TEST_ORACULAR_ACCESS_H
+#define TEST_ORACULAR_ACCESS_H
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <random>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <utility>
+
+#include "tatami/tatami.hpp"
+
+// Compares oracular extraction of 'mat' in a shuffled order (with some repeats) against myopic extraction from 'ref'.
+// This is done for full, block and indexed extraction, in both dense and sparse form.
+inline void test_oracular_access(const tatami::Matrix<double, int>& mat, const tatami::Matrix<double, int>& ref, const bool row, const unsigned seed) {
+    const int NR = ref.nrow(), NC = ref.ncol();
+    const int primary = (row ? NR : NC);
+    const int secondary = (row ? NC : NR);
+
+    std::mt19937_64 rng(seed);
+    std::vector<int> order(primary);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    for (int i = 0; i < primary; i += 3) {
+        order.push_back(order[i]);
+    }
+    auto oracle = std::make_shared<tatami::FixedVectorOracle<int> >(order);
+
+    const int block_start = secondary / 5;
+    const int block_length = secondary / 2;
+    auto indices = std::make_shared<std::vector<int> >();
+    for (int i = 1; i < secondary; i += 3) {
+        indices->push_back(i);
+    }
+
+    std::vector<double> expected(secondary), observed(secondary), vbuffer(secondary);
+    std::vector<int> ibuffer(secondary);
+
+    auto compare_dense = [&](auto ext, auto rext, int extent) -> void {
+        for (auto i : order) {
+            auto rptr = rext->fetch(i, expected.data());
+            auto optr = ext->fetch(observed.data());
+            ASSERT_TRUE(std::equal(rptr, rptr + extent, optr)) << "mismatch at " << i;
+        }
+    };
+
+    compare_dense(mat.dense(row, oracle, tatami::Options()), ref.dense(row, tatami::Options()), secondary);
+    compare_dense(mat.dense(row, oracle, block_start, block_length, tatami::Options()), ref.dense(row, block_start, block_length, tatami::Options()), block_length);
+    compare_dense(mat.dense(row, oracle, indices, tatami::Options()), ref.dense(row, indices, tatami::Options()), indices->size());
+
+    // The reference may contain explicit zeros, which are not stored in the layered matrix.
+    auto compare_sparse = [&](auto ext, auto rext) -> void {
+        std::vector<double> rvbuffer(secondary);
+        std::vector<int> ribuffer(secondary);
+        std::vector<std::pair<int, double> > expected_entries, observed_entries;
+        for (auto i : order) {
+            auto rrange = rext->fetch(i, rvbuffer.data(), ribuffer.data());
+            auto orange = ext->fetch(vbuffer.data(), ibuffer.data());
+            expected_entries.clear();
+            for (int k = 0; k < rrange.number; ++k) {
+                if (rrange.value[k]) {
+                    expected_entries.emplace_back(rrange.index[k], rrange.value[k]);
+                }
+            }
+            observed_entries.clear();
+            for (int k = 0; k < orange.number; ++k) {
+                observed_entries.emplace_back(orange.index[k], orange.value[k]);
+            }
+            ASSERT_EQ(expected_entries, observed_entries) << "mismatch at " << i;
+        }
+    };
+
+    compare_sparse(mat.sparse(row, oracle, tatami::Options()), ref.sparse(row, tatami::Options()));
+    compare_sparse(mat.sparse(row, oracle, block_start, block_length, tatami::Options()), ref.sparse(row, block_start, block_length, tatami::Options()));
+    compare_sparse(mat.sparse(row, oracle, indices, tatami::Options()), ref.sparse(row, indices, tatami::Options()));
+}
+
+#endif
@@ -2,24 +2,209 @@
 #include "tatami_test/tatami_test.hpp"
 #include "tatami_layered/utils.hpp"
 
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
 TEST(Utils, Categorize) {
     EXPECT_EQ(tatami_layered::categorize(100), tatami_layered::Category::U8);
     EXPECT_EQ(tatami_layered::categorize(1000), tatami_layered::Category::U16);
     EXPECT_EQ(tatami_layered::categorize(100000), tatami_layered::Category::U32);
+    EXPECT_EQ(tatami_layered::categorize(10000000000ull), tatami_layered::Category::U64);
+    EXPECT_EQ(tatami_layered::categorize(std::numeric_limits<std::uint64_t>::max()), tatami_layered::Category::U64);
 
-    tatami_test::throws_error([]() -> void {
-        tatami_layered::categorize(-1);
-    }, "negative");
+    EXPECT_EQ(tatami_layered::categorize(10.0), tatami_layered::Category::U8);
+    EXPECT_EQ(tatami_layered::categorize(4294967295.0), tatami_layered::Category::U32);
+    EXPECT_EQ(tatami_layered::categorize(1e10), tatami_layered::Category::U64);
 
-    tatami_test::throws_error([]() -> void {
-        tatami_layered::categorize(10000000000ull);
-    }, "outside of the range");
+    // Negative integers go to the signed layers.
+    EXPECT_EQ(tatami_layered::categorize(-1), tatami_layered::Category::I8);
+    EXPECT_EQ(tatami_layered::categorize(-128), tatami_layered::Category::I8);
+    EXPECT_EQ(tatami_layered::categorize(-129), tatami_layered::Category::I16);
+    EXPECT_EQ(tatami_layered::categorize(-100000), tatami_layered::Category::I32);
+    EXPECT_EQ(tatami_layered::categorize(-100000.0), tatami_layered::Category::I32);
+    EXPECT_EQ(tatami_layered::categorize(std::numeric_limits<std::int32_t>::min()), tatami_layered::Category::I32);
 
-    EXPECT_EQ(tatami_layered::categorize(10.0), tatami_layered::Category::U8);
+    // Non-integer and out-of-range values go to the floating-point layers.
+    EXPECT_EQ(tatami_layered::categorize(-10000000001ll), tatami_layered::Category::F64);
+    EXPECT_EQ(tatami_layered::categorize(-10000000001.0), tatami_layered::Category::F64);
+    EXPECT_EQ(tatami_layered::categorize(-0.5), tatami_layered::Category::F16);
+    EXPECT_EQ(tatami_layered::categorize(0.5), tatami_layered::Category::F16);
+    EXPECT_EQ(tatami_layered::categorize(0.1f), tatami_layered::Category::F32);
+    EXPECT_EQ(tatami_layered::categorize(0.1), tatami_layered::Category::F64);
+    EXPECT_EQ(tatami_layered::categorize(1e20), tatami_layered::Category::F64);
+    EXPECT_EQ(tatami_layered::categorize(1e300), tatami_layered::Category::F64);
+    EXPECT_EQ(tatami_layered::categorize(std::numeric_limits<double>::infinity()), tatami_layered::Category::F16);
+    EXPECT_EQ(tatami_layered::categorize(std::numeric_limits<double>::quiet_NaN()), tatami_layered::Category::F16);
 
-    tatami_test::throws_error([]() -> void {
-        tatami_layered::categorize(1e10);
-    }, "outside of the range");
+    // Tolerance allows for narrower types.
+    EXPECT_EQ(tatami_layered::categorize(0.1, 1e-7), tatami_layered::Category::F32);
+    EXPECT_EQ(tatami_layered::categorize(0.1, 1e-3), tatami_layered::Category::F16);
+    EXPECT_EQ(tatami_layered::categorize(1e20, 1e-3), tatami_layered::Category::F32); // too large for half precision.
+    EXPECT_EQ(tatami_layered::categorize(1e300, 1), tatami_layered::Category::F64);
+    EXPECT_EQ(tatami_layered::categorize(100.5, 1e-3), tatami_layered::Category::F16);
+    EXPECT_EQ(tatami_layered::categorize(100.5), tatami_layered::Category::F16); // exactly representable.
+    EXPECT_EQ(tatami_layered::categorize(2.5, 1e-3), tatami_layered::Category::F16);
+    EXPECT_EQ(tatami_layered::categorize(100, 1e-3), tatami_layered::Category::U8); // integers are always exact.
+}
+
+TEST(Utils, MergeCategories) {
+    using tatami_layered::Category;
+    auto merged = [](auto left, auto right) -> Category {
+        return tatami_layered::merge_categories(tatami_layered::summarize(left), tatami_layered::summarize(right)).category();
+    };
+
+    EXPECT_EQ(merged(5, 100000), Category::U32);
+    EXPECT_EQ(merged(0.1f, 0.5), Category::F32);
+    EXPECT_EQ(merged(5, 0.5), Category::F16);
+    EXPECT_EQ(merged(200, 0.5), Category::F16);
+    EXPECT_EQ(merged(2048, 0.5), Category::F16);
+    EXPECT_EQ(merged(2049, 0.5), Category::F32);
+    EXPECT_EQ(merged(0.1f, 100000), Category::F32);
+    EXPECT_EQ(merged(0.1f, 20000000), Category::F64);
+    EXPECT_EQ(merged(0.1, 5), Category::F64);
+
+    // Mixing non-negative and negative integers uses the smallest signed type that holds both.
+    EXPECT_EQ(merged(-5, 5), Category::I8);
+    EXPECT_EQ(merged(-5, 127), Category::I8);
+    EXPECT_EQ(merged(-5, 128), Category::I16);
+    EXPECT_EQ(merged(-200, 5), Category::I16);
+    EXPECT_EQ(merged(-5, 40000), Category::I32);
+    EXPECT_EQ(merged(-100000, -1), Category::I32);
+    EXPECT_EQ(merged(-5, 3000000000u), Category::F64);
+    EXPECT_EQ(merged(-5, 10000000000ull), Category::F64);
+    EXPECT_EQ(merged(-1, 0.5), Category::F16);
+    EXPECT_EQ(merged(-200, 0.5), Category::F16);
+    EXPECT_EQ(merged(-100000, 0.5), Category::F32);
+
+    // The range is remembered across merges.
+    auto big = tatami_layered::merge_categories(tatami_layered::summarize(5), tatami_layered::summarize(200));
+    EXPECT_EQ(big.category(), Category::U8);
+    EXPECT_EQ(tatami_layered::merge_categories(big, tatami_layered::summarize(-1)).category(), Category::I16);
+    auto small = tatami_layered::merge_categories(tatami_layered::summarize(100), tatami_layered::summarize(120));
+    EXPECT_EQ(tatami_layered::merge_categories(tatami_layered::summarize(-1), small).category(), Category::I8);
+    auto wide = tatami_layered::merge_categories(tatami_layered::summarize(1000), tatami_layered::summarize(200));
+    EXPECT_EQ(tatami_layered::merge_categories(wide, tatami_layered::summarize(-1)).category(), Category::I16);
+}
+
+TEST(Utils, MergeCategoriesOrder) {
+    using tatami_layered::Category;
+
+    // The category should not depend on the order in which values are added or summaries are merged.
+    std::vector<double> values { -5, 200, 0.5 };
+    std::sort(values.begin(), values.end());
+    do {
+        tatami_layered::RowCategory row;
+        for (auto v : values) {
+            tatami_layered::add_to_category(row, v);
+        }
+        EXPECT_EQ(row.category(), Category::F16);
+
+        auto left = tatami_layered::merge_categories(tatami_layered::summarize(values[0]), tatami_layered::summarize(values[1]));
+        EXPECT_EQ(tatami_layered::merge_categories(left, tatami_layered::summarize(values[2])).category(), Category::F16);
+        auto right = tatami_layered::merge_categories(tatami_layered::summarize(values[1]), tatami_layered::summarize(values[2]));
+        EXPECT_EQ(tatami_layered::merge_categories(tatami_layered::summarize(values[0]), right).category(), Category::F16);
+    } while (std::next_permutation(values.begin(), values.end()));
+
+    tatami_layered::RowCategory row;
+    for (auto v : { 3000.0, -5.0, 0.5 }) {
+        tatami_layered::add_to_category(row, v);
+    }
+    EXPECT_EQ(row.category(), Category::F32);
+}
+
+TEST(Utils, ChunkSummary) {
+    using tatami_layered::Category;
+
+    // Extras are only allocated once a negative or non-integer value is added.
+    tatami_layered::ChunkSummary summary;
+    summary.resize(3);
+    summary.add(0, 5);
+    summary.add(1, 70000.0);
+    std::vector<std::uint32_t> run { 0, 300, 2, 0 };
+    EXPECT_EQ(summary.add_run(2, run.data(), static_cast<int>(run.size()), 0), 2);
+    EXPECT_TRUE(summary.extras.empty());
+    EXPECT_EQ(summary.bytes(), 3);
+    EXPECT_EQ(summary.category(0), Category::U8);
+    EXPECT_EQ(summary.category(1), Category::U32);
+    EXPECT_EQ(summary.category(2), Category::U16);
+
+    summary.add(0, -1);
+    EXPECT_EQ(summary.extras.size(), 3);
+    EXPECT_EQ(summary.category(0), Category::I8);
+    EXPECT_EQ(summary.category(1), Category::U32);
+
+    // Merging gives the same result as adding all values to one summary.
+    tatami_layered::ChunkSummary other;
+    other.resize(3);
+    other.add(1, 0.5);
+    other.add(2, 100);
+    summary.merge(other);
+    EXPECT_EQ(summary.category(0), Category::I8);
+    EXPECT_EQ(summary.category(1), Category::F32);
+    EXPECT_EQ(summary.category(2), Category::U16);
+
+    // Row-parallel summaries only copy the extras of the chunks that need them.
+    std::vector<tatami_layered::ChunkSummary> shared(2);
+    for (auto& x : shared) {
+        x.resize(4);
+    }
+    std::mutex lock;
+    tatami_layered::RowRangeSummaries first(shared, 0, 2), second(shared, 2, 2);
+    first.add(0, 1, 1000);
+    second.add(0, 3, -200);
+    second.add(1, 2, 0.5);
+    first.finish(lock);
+    second.finish(lock);
+    EXPECT_EQ(shared[0].extras.size(), 4);
+    EXPECT_EQ(shared[1].extras.size(), 4);
+    EXPECT_EQ(shared[0].category(0), Category::U8);
+    EXPECT_EQ(shared[0].category(1), Category::U16);
+    EXPECT_EQ(shared[0].category(3), Category::I16);
+    EXPECT_EQ(shared[1].category(2), Category::F16);
+    EXPECT_EQ(shared[1].category(3), Category::U8);
+}
+
+TEST(Utils, Float16) {
+    auto roundtrip = [](float x) -> float {
+        return tatami_layered::Float16(x);
+    };
+
+    // Exactly representable values.
+    for (float x : { 0.0f, 1.0f, -2.5f, 0.125f, 1024.0f, 65504.0f, -65504.0f, 6.103515625e-05f /* smallest normal */, 5.9604644775390625e-08f /* smallest subnormal */ }) {
+        EXPECT_EQ(roundtrip(x), x);
+    }
+    EXPECT_EQ(tatami_layered::Float16(1.0f).bits, 0x3c00);
+    EXPECT_EQ(tatami_layered::Float16(-2.0f).bits, 0xc000);
+    EXPECT_EQ(tatami_layered::Float16(65504.0f).bits, 0x7bff);
+    EXPECT_EQ(tatami_layered::Float16(5.9604644775390625e-08f).bits, 0x0001);
+    EXPECT_TRUE(std::signbit(roundtrip(-0.0f)));
+
+    // Rounding to nearest, with ties to even.
+    EXPECT_EQ(roundtrip(1.0f + 1.0f / 2048), 1.0f);
+    EXPECT_EQ(roundtrip(1.0f + 3.0f / 2048), 1.0f + 2.0f / 1024);
+    EXPECT_EQ(roundtrip(1.0f + 1.5f / 2048), 1.0f + 1.0f / 1024);
+    EXPECT_EQ(roundtrip(2.9802322387695312e-08f), 0.0f); // half of the smallest subnormal.
+    EXPECT_EQ(roundtrip(3.0e-08f), 5.9604644775390625e-08f);
+    EXPECT_EQ(roundtrip(1.0e-10f), 0.0f);
+
+    for (int i = 1; i < 1000; ++i) {
+        const float x = i * 0.37f;
+        EXPECT_LE(std::abs(roundtrip(x) - x), x / 2048);
+    }
+
+    // Overflow and special values.
+    EXPECT_EQ(roundtrip(65519.0f), 65504.0f);
+    EXPECT_EQ(roundtrip(65520.0f), std::numeric_limits<float>::infinity());
+    EXPECT_EQ(roundtrip(1e10f), std::numeric_limits<float>::infinity());
+    EXPECT_EQ(roundtrip(-std::numeric_limits<float>::infinity()), -std::numeric_limits<float>::infinity());
+    EXPECT_TRUE(std::isnan(roundtrip(std::numeric_limits<float>::quiet_NaN())));
 }
 
 TEST(Utils, CheckChunkSize) {
@@ -57,3 +242,178 @@ TEST(Utils, CheckChunkSize) {
         tatami_layered::check_chunk_size<int, std::uint16_t>(0);
     }, "should be positive");
 }
+
+TEST(Utils, LayerArena) {
+    std::size_t offset = 0;
+    auto first = tatami_layered::LayerArena::reserve<std::uint16_t>(offset, 7);
+    EXPECT_EQ(first, 0);
+    auto second = tatami_layered::LayerArena::reserve<std::size_t>(offset, 3);
+    EXPECT_EQ(second, tatami_layered::LayerArena::default_alignment);
+    auto third = tatami_layered::LayerArena::reserve<std::uint8_t>(offset, 0);
+    EXPECT_EQ(third, 2 * tatami_layered::LayerArena::default_alignment);
+    EXPECT_EQ(offset, third);
+
+    tatami_layered::LayerArena arena(offset, false);
+    EXPECT_EQ(arena.size(), offset);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(arena.get<std::uint16_t>(first)) % tatami_layered::LayerArena::default_alignment, 0);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(arena.get<std::size_t>(second)) % tatami_layered::LayerArena::default_alignment, 0);
+
+    // Huge pages only kick in for sufficiently large allocations.
+    tatami_layered::LayerArena huge(5000000, true);
+    EXPECT_GE(huge.size(), 5000000);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(huge.get<unsigned char>(0)) % huge.alignment(), 0);
+
+    tatami_layered::LayerArena empty(0, true);
+    EXPECT_EQ(empty.size(), 0);
+}
+
+TEST(Utils, RowCode) {
+    EXPECT_EQ(sizeof(tatami_layered::RowCode), 4);
+
+    auto code = tatami_layered::pack_row_code(tatami_layered::Category::E8, 12345);
+    EXPECT_EQ(tatami_layered::row_code_category(code), tatami_layered::Category::E8);
+    EXPECT_EQ(tatami_layered::row_code_position(code), 12345);
+
+    const auto last = tatami_layered::max_row_code_rows - 1;
+    code = tatami_layered::pack_row_code(tatami_layered::Category::U8, last);
+    EXPECT_EQ(tatami_layered::row_code_category(code), tatami_layered::Category::U8);
+    EXPECT_EQ(tatami_layered::row_code_position(code), last);
+}
+
+TEST(Utils, OutlierCounts) {
+    using tatami_layered::Category;
+
+    // Outliers are only counted if requested, and only allocated once a row has any.
+    tatami_layered::ChunkSummary summary;
+    summary.resize(3);
+    summary.add(0, 1000);
+    EXPECT_TRUE(summary.outliers.empty());
+
+    summary.count_outliers = true;
+    summary.add(1, 254);
+    EXPECT_TRUE(summary.outliers.empty());
+    summary.add(1, 255.0);
+    std::vector<std::uint32_t> run(100, 1);
+    run[10] = 300;
+    run[20] = 70000;
+    EXPECT_EQ(summary.add_run(2, run.data(), static_cast<int>(run.size()), 0), 100);
+    EXPECT_EQ(summary.num_outliers(0), 0);
+    EXPECT_EQ(summary.num_outliers(1), 1);
+    EXPECT_EQ(summary.num_outliers(2), 2);
+    EXPECT_EQ(summary.bytes(), 3 + 3 * sizeof(tatami_layered::OutlierCount));
+
+    // A 32-bit row with 2 outliers among 100 values is smaller with escapes, unlike a row with a single value.
+    EXPECT_EQ(tatami_layered::choose_category<std::uint16_t>(summary, 2, 100), Category::E8);
+    EXPECT_EQ(tatami_layered::choose_category<std::uint16_t>(summary, 2, 2), Category::U32);
+    EXPECT_EQ(tatami_layered::choose_category<std::uint16_t>(summary, 1, 100), Category::U8); // 255 still fits in the 8-bit layer.
+
+    // Counts are merged and saturate.
+    tatami_layered::ChunkSummary other;
+    other.resize(3);
+    other.count_outliers = true;
+    for (int i = 0; i < 3; ++i) {
+        other.add(2, 1000);
+    }
+    summary.merge(other);
+    EXPECT_EQ(summary.num_outliers(2), 5);
+
+    std::vector<std::uint16_t> many(70000, 300);
+    summary.add_run(0, many.data(), static_cast<int>(many.size()), 0);
+    EXPECT_EQ(summary.num_outliers(0), tatami_layered::max_outlier_count);
+    EXPECT_EQ(tatami_layered::choose_category<std::uint32_t>(summary, 0, 1000000), Category::U16);
+
+    // Row-parallel summaries copy their counts over.
+    std::vector<tatami_layered::ChunkSummary> shared(1);
+    shared[0].resize(4);
+    shared[0].count_outliers = true;
+    std::mutex lock;
+    tatami_layered::RowRangeSummaries first(shared, 0, 2), second(shared, 2, 2);
+    first.add(0, 1, 1000);
+    second.add(0, 3, 500.0);
+    second.add(0, 3, 600);
+    first.finish(lock);
+    second.finish(lock);
+    EXPECT_EQ(shared[0].num_outliers(0), 0);
+    EXPECT_EQ(shared[0].num_outliers(1), 1);
+    EXPECT_EQ(shared[0].num_outliers(3), 2);
+}
+
+TEST(Utils, EscapedValues) {
+    std::vector<std::uint8_t> code { 1, 255, 2, 255, 255, 3 };
+    std::vector<std::uint16_t> index { 0, 5, 7, 10, 12, 20 };
+    std::vector<std::uint16_t> escape_index { 5, 10, 12 };
+    std::vector<std::uint64_t> escape_value { 1000, 2000, 3000 };
+    std::vector<std::uint64_t> expected { 1, 1000, 2, 2000, 3000, 3 };
+
+    auto make = [&]() -> tatami_layered::EscapedValues<std::uint16_t> {
+        return tatami_layered::EscapedValues<std::uint16_t>{ code.data(), index.data(), escape_index.data(), escape_value.data(), escape_value.size(), escape_value.size() };
+    };
+
+    // Forward access.
+    auto values = make();
+    for (size_t i = 0; i < code.size(); ++i) {
+        EXPECT_EQ(values[i], expected[i]);
+    }
+
+    // Out-of-order access falls back to a binary search.
+    auto values2 = make();
+    for (size_t i = code.size(); i > 0; --i) {
+        EXPECT_EQ(values2[i - 1], expected[i - 1]);
+    }
+
+    // Offsetting and incrementing.
+    auto values3 = make() + 3;
+    EXPECT_EQ(*values3, 2000);
+    ++values3;
+    EXPECT_EQ(*values3, 3000);
+    EXPECT_EQ(values3[1], 3);
+}
+
+TEST(Utils, ChunkCache) {
+    std::atomic<int> calls(0);
+    std::atomic<bool> fail(true);
+    auto loader = [&](std::size_t c) -> tatami_layered::LayeredChunk<int, std::uint8_t> {
+        if (c == 2 && fail.exchange(false)) {
+            throw std::runtime_error("failed to load chunk");
+        }
+        ++calls;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // so that the other threads request the chunk while it is being loaded.
+        return tatami_layered::LayeredChunk<int, std::uint8_t>();
+    };
+    tatami_layered::ChunkCache<int, std::uint8_t, decltype(loader)> cache(loader, std::vector<std::size_t>(3, 100), 1000);
+
+    // Concurrent misses on the same chunk only load it once.
+    std::vector<std::shared_ptr<const tatami_layered::LayeredChunk<int, std::uint8_t> > > results(4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() -> void {
+            results[t] = cache.get(1);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(calls, 1);
+    for (const auto& r : results) {
+        EXPECT_EQ(r, results.front());
+    }
+    EXPECT_EQ(cache.cached_bytes(), 100);
+
+    // Failed loads are not cached, so the next request tries again.
+    tatami_test::throws_error([&]() -> void {
+        cache.get(2);
+    }, "failed to load");
+    EXPECT_EQ(cache.cached_bytes(), 100);
+    cache.get(2);
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(cache.cached_bytes(), 200);
+
+    // Prefetched chunks are taken from the background thread, or loaded directly if they are requested before the thread gets to them.
+    tatami_layered::CachedChunks<int, std::uint8_t, decltype(cache)> source(&cache);
+    source.prefetch(0);
+    EXPECT_EQ(&(source.get(0)), cache.get(0).get());
+    source.prefetch(1);
+    source.prefetch(2);
+    EXPECT_EQ(&(source.get(2)), cache.get(2).get());
+    EXPECT_EQ(calls, 3);
+}
@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+
+#include "tatami/tatami.hpp"
+#include "tatami_test/tatami_test.hpp"
+#include "tatami_layered/convert_to_layered_sparse.hpp"
+#include "tatami_layered/visit.hpp"
+
+#include "mock_layered_sparse_data.h"
+
+#include <type_traits>
+
+class VisitTest : public ::testing::TestWithParam<int> {
+protected:
+    static std::vector<double> create_dense(size_t NR, size_t NC) {
+        std::vector<size_t> rows, cols;
+        std::vector<int> vals;
+        mock_layered_sparse_data(NR, NC, rows, cols, vals);
+        std::vector<double> full(NR * NC);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            full[rows[i] * NC + cols[i]] = vals[i];
+        }
+        return full;
+    }
+
+    template<typename Int_>
+    static int category_of() {
+        if constexpr(std::is_same<Int_, std::uint8_t>::value) {
+            return 0;
+        } else if constexpr(std::is_same<Int_, std::uint16_t>::value) {
+            return 1;
+        } else if constexpr(std::is_same<Int_, std::uint32_t>::value) {
+            return 2;
+        } else if constexpr(std::is_same<Int_, std::uint64_t>::value) {
+            return 3;
+        } else if constexpr(std::is_same<Int_, tatami_layered::Float16>::value) {
+            return 4;
+        } else if constexpr(std::is_same<Int_, float>::value) {
+            return 5;
+        } else if constexpr(std::is_same<Int_, double>::value) {
+            return 6;
+        } else if constexpr(std::is_same<Int_, std::int8_t>::value) {
+            return 7;
+        } else if constexpr(std::is_same<Int_, std::int16_t>::value) {
+            return 8;
+        } else {
+            static_assert(std::is_same<Int_, std::int32_t>::value);
+            return 9;
+        }
+    }
+};
+
+TEST_P(VisitTest, Row) {
+    size_t NR = 100, NC = GetParam();
+    auto full = create_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 32;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    std::vector<int> used(tatami_layered::num_categories);
+    for (size_t r = 0; r < NR; ++r) {
+        std::vector<double> observed(NC);
+        int last_start = -1;
+        int visits = 0;
+        tatami_layered::visit_row(*mat, static_cast<int>(r), [&](int column_start, const auto& span) -> void {
+            typedef std::remove_cv_t<std::remove_reference_t<decltype(*(span.value))> > Int;
+            ++used[category_of<Int>()];
+            EXPECT_GT(column_start, last_start);
+            last_start = column_start;
+            ++visits;
+            for (size_t i = 0; i < span.number; ++i) {
+                observed[column_start + span.index[i]] = span.value[i];
+            }
+        });
+        EXPECT_EQ(visits, mat->num_chunks());
+        EXPECT_EQ(observed, std::vector<double>(full.begin() + r * NC, full.begin() + (r + 1) * NC));
+    }
+
+    // The mock data should use every layer except for the 64-bit layer.
+    EXPECT_GT(used[0], 0);
+    EXPECT_GT(used[1], 0);
+    EXPECT_GT(used[2], 0);
+    for (size_t i = 3; i < used.size(); ++i) {
+        EXPECT_EQ(used[i], 0);
+    }
+}
+
+TEST_P(VisitTest, Chunk) {
+    size_t NR = 100, NC = GetParam();
+    auto full = create_dense(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 32;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    std::vector<double> observed(NR * NC);
+    for (int c = 0; c < mat->num_chunks(); ++c) {
+        const int column_start = c * mat->get_chunk_size();
+        int last_row = -1;
+        tatami_layered::visit_chunk(*mat, c, [&](int r, const auto& span) -> void {
+            EXPECT_EQ(r, last_row + 1);
+            last_row = r;
+            for (size_t i = 0; i < span.number; ++i) {
+                EXPECT_LT(span.index[i], mat->chunk_extent(c));
+                observed[r * NC + column_start + span.index[i]] = span.value[i];
+            }
+        });
+        EXPECT_EQ(last_row, static_cast<int>(NR) - 1);
+    }
+    EXPECT_EQ(observed, full);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Visit,
+    VisitTest,
+    ::testing::Values(20, 64, 151) // number of columns
+);
+
+TEST(Visit, Dictionary) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_dictionary_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.dictionary = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    std::vector<double> observed(NR * NC);
+    int num_dictionary = 0;
+    for (size_t r = 0; r < NR; ++r) {
+        tatami_layered::visit_row(*mat, static_cast<int>(r), [&](int column_start, const auto& span) -> void {
+            if constexpr(std::is_same<std::remove_cv_t<std::remove_reference_t<decltype(span)> >, tatami_layered::DictionarySpan<std::uint8_t> >::value) {
+                ++num_dictionary;
+                EXPECT_LE(span.table_size, 4);
+                for (size_t i = 0; i < span.number; ++i) {
+                    EXPECT_LT(span.code[i], span.table_size);
+                    EXPECT_EQ(span.value[i], span.table[span.code[i]]);
+                }
+            }
+            for (size_t i = 0; i < span.number; ++i) {
+                observed[r * NC + column_start + span.index[i]] = span.value[i];
+            }
+        });
+    }
+    EXPECT_EQ(observed, full);
+    EXPECT_EQ(num_dictionary, 15 * 3); // only the last chunk is too narrow.
+}
+
+TEST(Visit, Outliers) {
+    size_t NR = 30, NC = 200;
+    auto full = mock_outlier_data(NR, NC);
+    tatami::DenseRowMatrix<double, int> ref(NR, NC, full);
+
+    tatami_layered::ConvertToLayeredSparseOptions copt;
+    copt.chunk_size = 64;
+    copt.outliers = true;
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, copt);
+
+    std::vector<double> observed(NR * NC);
+    int num_escaped = 0;
+    for (size_t r = 0; r < NR; ++r) {
+        tatami_layered::visit_row(*mat, static_cast<int>(r), [&](int column_start, const auto& span) -> void {
+            if constexpr(std::is_same<std::remove_cv_t<std::remove_reference_t<decltype(span)> >, tatami_layered::EscapedSpan<std::uint8_t> >::value) {
+                ++num_escaped;
+                EXPECT_GT(span.num_escapes, 0);
+                size_t e = 0;
+                for (size_t i = 0; i < span.number; ++i) {
+                    if (span.code[i] == 255) {
+                        ASSERT_LT(e, span.num_escapes);
+                        EXPECT_EQ(span.escape_index[e], span.index[i]);
+                        EXPECT_EQ(span.value[i], span.escape_value[e]);
+                        ++e;
+                    } else {
+                        EXPECT_EQ(span.value[i], span.code[i]);
+                    }
+                }
+                EXPECT_EQ(e, span.num_escapes);
+            }
+            for (size_t i = 0; i < span.number; ++i) {
+                observed[r * NC + column_start + span.index[i]] = span.value[i];
+            }
+        });
+    }
+    EXPECT_EQ(observed, full);
+    EXPECT_EQ(num_escaped, 18 + 12 + 12); // row 4 (modulo 5) only has an outlier in the first chunk.
+}
+
+TEST(Visit, Errors) {
+    tatami::DenseRowMatrix<double, int> ref(10, 20, std::vector<double>(200, 1));
+    auto mat = tatami_layered::convert_to_layered_sparse<double, int, std::uint8_t>(ref, tatami_layered::ConvertToLayeredSparseOptions());
+    tatami_layered::FusedTransform transform;
+    transform.log1p = true;
+    auto fused = mat->fuse_transform(std::move(transform));
+
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::visit_row(*fused, 0, [&](int, const auto&) -> void {});
+    }, "fused transformation");
+    tatami_test::throws_error([&]() -> void {
+        tatami_layered::visit_chunk(*fused, 0, [&](int, const auto&) -> void {});
+    }, "fused transformation");
+}